@@ -6,12 +6,27 @@
  * Small auxiliary functions.
  */
 #define _XOPEN_SOURCE 700
+#define _GNU_SOURCE		// sched_getcpu()
 
 #include "core.h"
 #include <time.h>
 #include <mpi.h>
 #include <stdarg.h>
+#include <stddef.h>
 #include <math.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <unistd.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+/******************************************************************************
+ * DEFINING GLOBAL VARIABLES
+ *****************************************************************************/
+
+MPI_Comm simComm = MPI_COMM_WORLD;	// See core.h
 
 /******************************************************************************
  * LOCAL FUNCTION DECLARATIONS
@@ -84,6 +99,888 @@ void tMsg(long long int nanoSec, const char *string){
 
 }
 
+/******************************************************************************
+ * MEMORY ACCOUNTING FUNCTIONS
+ *****************************************************************************/
+
+// Stored in front of every block from memAlloc(). The union keeps the memory
+// returned to the user aligned as malloc() would.
+typedef union{
+	struct{
+		memTag tag;
+		size_t size;
+	} info;
+	max_align_t align;
+} MemHeader;
+
+static size_t memCurrent[MEM_NTAGS+1];	// Last element is total
+static size_t memPeak[MEM_NTAGS+1];
+
+static const char *memTagName[MEM_NTAGS+1] = {
+	"population", "grid", "migrants", "multigrid", "spectral", "object", "collision", "telemetry",
+	"total"
+};
+
+static void memCount(memTag tag, long int size){
+
+	memCurrent[tag] += size;
+	memCurrent[MEM_NTAGS] += size;
+
+	if(memCurrent[tag]>memPeak[tag]) memPeak[tag] = memCurrent[tag];
+	if(memCurrent[MEM_NTAGS]>memPeak[MEM_NTAGS])
+		memPeak[MEM_NTAGS] = memCurrent[MEM_NTAGS];
+}
+
+// Formats a number of bytes in a sensible unit (like tMsg() for time)
+static void memFormat(char *str, double bytes){
+
+	if(bytes >= 1<<30)		sprintf(str, "%7.2fGiB", bytes/(1<<30));
+	else if(bytes >= 1<<20)	sprintf(str, "%7.2fMiB", bytes/(1<<20));
+	else if(bytes >= 1<<10)	sprintf(str, "%7.2fkiB", bytes/(1<<10));
+	else					sprintf(str, "%7.0fB  ", bytes);
+}
+
+void *memAlloc(memTag tag, size_t size){
+
+	MemHeader *header = malloc(sizeof(*header)+size);
+	if(header==NULL) msg(ERROR|ALL, "failed to allocate %zu bytes for %s",
+							size, memTagName[tag]);
+
+	header->info.tag = tag;
+	header->info.size = size;
+	memCount(tag, size);
+
+	return header+1;
+}
+
+void memFree(void *ptr){
+
+	if(ptr==NULL) return;
+
+	MemHeader *header = (MemHeader *)ptr-1;
+	memCount(header->info.tag, -(long int)header->info.size);
+	free(header);
+}
+
+void memAdd(memTag tag, long int size){
+	memCount(tag, size);
+}
+
+size_t memGetCurrent(memTag tag){
+	return memCurrent[tag];
+}
+
+size_t memGetPeak(memTag tag){
+	return memPeak[tag];
+}
+
+void memMsg(const char *string){
+
+	int mpiRank, mpiSize;
+	MPI_Comm_rank(simComm,&mpiRank);
+	MPI_Comm_size(simComm,&mpiSize);
+
+	double current[MEM_NTAGS+1], peak[MEM_NTAGS+1];
+	double currentSum[MEM_NTAGS+1], peakSum[MEM_NTAGS+1];
+	struct { double val; int rank; } peakLocal[MEM_NTAGS+1], peakMax[MEM_NTAGS+1];
+
+	for(int t=0;t<=MEM_NTAGS;t++){
+		current[t] = memCurrent[t];
+		peak[t] = memPeak[t];
+		peakLocal[t].val = memPeak[t];
+		peakLocal[t].rank = mpiRank;
+	}
+
+	MPI_Reduce(current,currentSum,MEM_NTAGS+1,MPI_DOUBLE,MPI_SUM,0,simComm);
+	MPI_Reduce(peak,peakSum,MEM_NTAGS+1,MPI_DOUBLE,MPI_SUM,0,simComm);
+	MPI_Reduce(peakLocal,peakMax,MEM_NTAGS+1,MPI_DOUBLE_INT,MPI_MAXLOC,0,simComm);
+
+	double *currentAll = NULL, *peakAll = NULL;
+	if(mpiRank==0){
+		currentAll = malloc(mpiSize*sizeof(*currentAll));
+		peakAll = malloc(mpiSize*sizeof(*peakAll));
+	}
+	MPI_Gather(&current[MEM_NTAGS],1,MPI_DOUBLE,currentAll,1,MPI_DOUBLE,0,simComm);
+	MPI_Gather(&peak[MEM_NTAGS],1,MPI_DOUBLE,peakAll,1,MPI_DOUBLE,0,simComm);
+
+	if(mpiRank==0){
+
+		char a[16], b[16], c[16];
+
+		msg(STATUS, "Memory %s (sum of all nodes, largest node):", string);
+		for(int t=0;t<=MEM_NTAGS;t++){
+			memFormat(a, currentSum[t]);
+			memFormat(b, peakSum[t]);
+			memFormat(c, peakMax[t].val);
+			msg(STATUS, "  %-10s current %s, peak %s, peak %s on node %i",
+				memTagName[t], a, b, c, peakMax[t].rank);
+		}
+		for(int r=0;r<mpiSize;r++){
+			memFormat(a, currentAll[r]);
+			memFormat(b, peakAll[r]);
+			msg(STATUS, "  node %-5i current %s, peak %s", r, a, b);
+		}
+
+		free(currentAll);
+		free(peakAll);
+	}
+}
+
+/******************************************************************************
+ * TELEMETRY FUNCTIONS
+ *****************************************************************************/
+
+static const char *telPhaseName[TEL_NPHASES] = {
+	"move", "migrate", "distr", "solve", "efield", "acc", "output"
+};
+
+// Bounds of the array length used by telStream()
+#define TEL_STREAM_MIN (1<<18)
+#define TEL_STREAM_MAX (1<<22)
+
+// Measures memory bandwidth by the STREAM triad kernel a=b+s*c. All MPI nodes
+// run simultaneously such that nodes sharing memory compete as they do in a
+// run. Returns the best of a few repetitions in bytes per second. Each array
+// is four times the last level cache, if known, such that it does not fit in
+// cache but does not take more memory than needed.
+static double telStream(void){
+
+	long int n = TEL_STREAM_MAX;
+#ifdef _SC_LEVEL3_CACHE_SIZE
+	long int cache = sysconf(_SC_LEVEL3_CACHE_SIZE);
+	if(cache<=0) cache = sysconf(_SC_LEVEL2_CACHE_SIZE);
+	if(cache>0) n = 4*cache/sizeof(double);
+#endif
+	if(n<TEL_STREAM_MIN) n = TEL_STREAM_MIN;
+	if(n>TEL_STREAM_MAX) n = TEL_STREAM_MAX;
+
+	double *a = memAlloc(MEM_TELEMETRY,n*sizeof(*a));
+	double *b = memAlloc(MEM_TELEMETRY,n*sizeof(*b));
+	double *c = memAlloc(MEM_TELEMETRY,n*sizeof(*c));
+
+	for(long int i=0;i<n;i++){
+		a[i] = 0;
+		b[i] = 1;
+		c[i] = 2;
+	}
+
+	double best = INFINITY;
+	for(int r=0;r<5;r++){
+		MPI_Barrier(simComm);
+		unsigned long long int start = getNanoSec();
+		for(long int i=0;i<n;i++) a[i] = b[i]+3.0*c[i];
+		double time = (getNanoSec()-start)/1e9;
+		if(time<best) best = time;
+	}
+
+	// Prevents the compiler from optimizing away the kernel
+	if(a[n/2]!=7.0) msg(WARNING|ALL,"STREAM triad gave wrong result");
+
+	memFree(a);
+	memFree(b);
+	memFree(c);
+
+	return 3*n*sizeof(double)/best;
+}
+
+Telemetry *telAlloc(const dictionary *ini){
+
+	Telemetry *tel = malloc(sizeof(*tel));
+
+	tel->interval = iniGetDouble(ini,"telemetry:interval");
+	tel->nTimeSteps = iniGetInt(ini,"time:nTimeSteps");
+	tel->fName = getFileName(ini,"telemetry.prom");
+	tel->nSteps = 0;
+	tel->nStepsLast = 0;
+	tel->nPushes = 0;
+	tel->start = getNanoSec();
+	tel->last = tel->start;
+
+	tel->phases = malloc(TEL_NPHASES*sizeof(*tel->phases));
+	tel->phasesLast = malloc(TEL_NPHASES*sizeof(*tel->phasesLast));
+	tel->costs = malloc(TEL_NPHASES*sizeof(*tel->costs));
+	for(int i=0;i<TEL_NPHASES;i++){
+		tel->phases[i] = tAlloc();
+		tel->phasesLast[i] = 0;
+		tel->costs[i].bytes = 0;
+		tel->costs[i].flops = 0;
+	}
+
+	tel->imbalanceInterval = iniGetInt(ini,"telemetry:imbalanceInterval");
+	tel->imbalanceSnapshot = iniGetInt(ini,"telemetry:imbalanceSnapshot");
+	tel->nStepsImbalance = 0;
+	tel->phasesImbalance = malloc(TEL_NPHASES*sizeof(*tel->phasesImbalance));
+	for(int i=0;i<TEL_NPHASES;i++) tel->phasesImbalance[i] = 0;
+
+	// Measured only once per process, since every member of an ensemble would
+	// otherwise spend time on it
+	static double bandwidth = 0;
+	if(bandwidth==0) bandwidth = telStream();
+	tel->bandwidth = bandwidth;
+
+	return tel;
+}
+
+void telFree(Telemetry *tel){
+
+	for(int i=0;i<TEL_NPHASES;i++) tFree(tel->phases[i]);
+	free(tel->phases);
+	free(tel->phasesLast);
+	free(tel->costs);
+	free(tel->phasesImbalance);
+	free(tel->fName);
+	free(tel);
+}
+
+static void telWrite(Telemetry *tel, const Population *pop){
+
+	int mpiRank;
+	MPI_Comm_rank(simComm,&mpiRank);
+
+	unsigned long long int now = getNanoSec();
+	double elapsed = (now-tel->last)/1e9;
+	double total = (now-tel->start)/1e9;
+	int nSteps = tel->nSteps-tel->nStepsLast;
+
+	// Time per step in each phase since last write
+	double phase[TEL_NPHASES], phaseMax[TEL_NPHASES], phaseSum[TEL_NPHASES];
+	for(int i=0;i<TEL_NPHASES;i++){
+		phase[i] = (tel->phases[i]->total-tel->phasesLast[i])/(1e9*nSteps);
+		tel->phasesLast[i] = tel->phases[i]->total;
+	}
+
+	long int nParticles = 0;
+	for(int s=0;s<pop->nSpecies;s++) nParticles += pop->iStop[s]-pop->iStart[s];
+
+	long int nPushes = tel->nPushes, nPushesSum;
+	long int nParticlesMin, nParticlesMax;
+	double mem = memGetCurrent(MEM_NTAGS), memSum, memMax;
+
+	MPI_Reduce(phase,phaseMax,TEL_NPHASES,MPI_DOUBLE,MPI_MAX,0,simComm);
+	MPI_Reduce(phase,phaseSum,TEL_NPHASES,MPI_DOUBLE,MPI_SUM,0,simComm);
+	MPI_Reduce(&nPushes,&nPushesSum,1,MPI_LONG,MPI_SUM,0,simComm);
+	MPI_Reduce(&nParticles,&nParticlesMin,1,MPI_LONG,MPI_MIN,0,simComm);
+	MPI_Reduce(&nParticles,&nParticlesMax,1,MPI_LONG,MPI_MAX,0,simComm);
+	MPI_Reduce(&mem,&memSum,1,MPI_DOUBLE,MPI_SUM,0,simComm);
+	MPI_Reduce(&mem,&memMax,1,MPI_DOUBLE,MPI_MAX,0,simComm);
+
+	tel->last = now;
+	tel->nStepsLast = tel->nSteps;
+	tel->nPushes = 0;
+
+	if(mpiRank!=0) return;
+
+	int mpiSize;
+	MPI_Comm_size(simComm,&mpiSize);
+
+	double stepsPerSec = nSteps/elapsed;
+	double eta = (tel->nTimeSteps-tel->nSteps)/stepsPerSec;
+
+	// Write to temporary file and rename to never expose a partial file
+	char *fTmpName = strCatAlloc(2,tel->fName,".tmp");
+	FILE *f = fopen(fTmpName,"w");
+	if(f==NULL){
+		msg(WARNING,"could not write telemetry to %s",fTmpName);
+		free(fTmpName);
+		return;
+	}
+
+	fprintf(f,"pinc_step %i\n",tel->nSteps);
+	fprintf(f,"pinc_steps_total %i\n",tel->nTimeSteps);
+	fprintf(f,"pinc_elapsed_seconds %.3f\n",total);
+	fprintf(f,"pinc_eta_seconds %.3f\n",eta);
+	fprintf(f,"pinc_steps_per_second %.6g\n",stepsPerSec);
+	fprintf(f,"pinc_pushes_per_second %.6g\n",nPushesSum/elapsed);
+	for(int i=0;i<TEL_NPHASES;i++){
+		fprintf(f,"pinc_phase_seconds_per_step{phase=\"%s\",stat=\"max\"} %.6g\n",
+				telPhaseName[i],phaseMax[i]);
+		fprintf(f,"pinc_phase_seconds_per_step{phase=\"%s\",stat=\"mean\"} %.6g\n",
+				telPhaseName[i],phaseSum[i]/mpiSize);
+	}
+	fprintf(f,"pinc_memory_bytes{stat=\"sum\"} %.0f\n",memSum);
+	fprintf(f,"pinc_memory_bytes{stat=\"max\"} %.0f\n",memMax);
+	fprintf(f,"pinc_particles_per_node{stat=\"min\"} %li\n",nParticlesMin);
+	fprintf(f,"pinc_particles_per_node{stat=\"max\"} %li\n",nParticlesMax);
+	fclose(f);
+
+	if(rename(fTmpName,tel->fName))
+		msg(WARNING,"could not write telemetry to %s",tel->fName);
+	free(fTmpName);
+
+	int etaSec = (int)eta;
+	msg(STATUS,"Time-step %i/%i, %.3g steps/s, %.3g pushes/s, ETA %i:%02i:%02i",
+		tel->nSteps,tel->nTimeSteps,stepsPerSec,nPushesSum/elapsed,
+		etaSec/3600,(etaSec/60)%60,etaSec%60);
+}
+
+void telStep(Telemetry *tel, const Population *pop){
+
+	tel->nSteps++;
+	for(int s=0;s<pop->nSpecies;s++) tel->nPushes += pop->iStop[s]-pop->iStart[s];
+
+	if(tel->interval<=0) return;
+
+	// Rank 0 decides such that all nodes agree on when to write
+	int write = 0;
+	int mpiRank;
+	MPI_Comm_rank(simComm,&mpiRank);
+	if(mpiRank==0){
+		double elapsed = (getNanoSec()-tel->last)/1e9;
+		write = elapsed>=tel->interval || tel->nSteps==tel->nTimeSteps;
+	}
+	cpBegin("telemetry");
+	MPI_Bcast(&write,1,MPI_INT,0,simComm);
+
+	if(write) telWrite(tel,pop);
+	cpEnd();
+}
+
+// Name of dataset (without statistic) of quantity i in the imbalance
+// diagnostics. The quantities are particles of each specie, emigrants,
+// immigrants and time per step in each phase.
+static void telImbalanceName(char *name, int i, int nSpecies){
+
+	if(i<nSpecies)				sprintf(name,"/imbalance/particles/specie %i",i);
+	else if(i==nSpecies)		sprintf(name,"/imbalance/emigrants");
+	else if(i==nSpecies+1)		sprintf(name,"/imbalance/immigrants");
+	else sprintf(name,"/imbalance/seconds per step/%s",telPhaseName[i-nSpecies-2]);
+}
+
+static const char *telImbalanceStat[] = {"min","max","mean","argmax"};
+
+void telCreateImbalanceDatasets(const Telemetry *tel, hid_t history,
+								const Population *pop, const MpiInfo *mpiInfo){
+
+	if(tel->imbalanceInterval<=0) return;
+
+	int nSpecies = pop->nSpecies;
+	char name[128], base[96];
+
+	for(int i=0;i<nSpecies+2+TEL_NPHASES;i++){
+		telImbalanceName(base,i,nSpecies);
+		for(int j=0;j<4;j++){
+			sprintf(name,"%s/%s",base,telImbalanceStat[j]);
+			xyCreateDataset(history,name);
+		}
+	}
+
+	if(tel->imbalanceSnapshot){
+		int nValues = nSpecies+2*mpiInfo->nNeighbors+TEL_NPHASES;
+		xyCreateNodesDataset(history,"/imbalance/nodes",nValues);
+	}
+}
+
+void telWriteImbalance(Telemetry *tel, hid_t history, const Population *pop,
+					   const MpiInfo *mpiInfo, double x){
+
+	if(tel->imbalanceInterval<=0) return;
+	if(++tel->nStepsImbalance%tel->imbalanceInterval) return;
+
+	int nSpecies = pop->nSpecies;
+	int nNeighbors = mpiInfo->nNeighbors;
+	int nQuantities = nSpecies+2+TEL_NPHASES;
+	long int *nEmigrants = mpiInfo->nEmigrants;
+	long int *nImmigrants = mpiInfo->nImmigrants;
+
+	// Per node values, with emigrants and immigrants per neighbor
+	int nValues = nSpecies+2*nNeighbors+TEL_NPHASES;
+	double *values = calloc(nValues,sizeof(*values));
+	double *particles = values;
+	double *emigrants = &values[nSpecies];
+	double *immigrants = &values[nSpecies+nNeighbors];
+	double *phases = &values[nSpecies+2*nNeighbors];
+
+	for(int s=0;s<nSpecies;s++){
+		particles[s] = pop->iStop[s]-pop->iStart[s];
+		for(int ne=0;ne<nNeighbors;ne++){
+			emigrants[ne] += nEmigrants[ne*nSpecies+s];
+			immigrants[ne] += nImmigrants[ne*nSpecies+s];
+		}
+	}
+
+	for(int i=0;i<TEL_NPHASES;i++){
+		unsigned long long int total = tel->phases[i]->total;
+		phases[i] = (total-tel->phasesImbalance[i])/(1e9*tel->imbalanceInterval);
+		tel->phasesImbalance[i] = total;
+	}
+
+	// Reduced quantities along with rank for MPI_MINLOC and MPI_MAXLOC
+	struct { double val; int rank; } *local, *min, *max;
+	local = malloc(nQuantities*sizeof(*local));
+	min = malloc(nQuantities*sizeof(*min));
+	max = malloc(nQuantities*sizeof(*max));
+	double *val = malloc(nQuantities*sizeof(*val));
+	double *sum = malloc(nQuantities*sizeof(*sum));
+
+	for(int i=0;i<nQuantities;i++){
+		local[i].val = 0;
+		local[i].rank = mpiInfo->mpiRank;
+	}
+	for(int s=0;s<nSpecies;s++) local[s].val = particles[s];
+	for(int ne=0;ne<nNeighbors;ne++){
+		local[nSpecies].val += emigrants[ne];
+		local[nSpecies+1].val += immigrants[ne];
+	}
+	for(int i=0;i<TEL_NPHASES;i++) local[nSpecies+2+i].val = phases[i];
+
+	cpBegin("imbalance");
+	MPI_Reduce(local,min,nQuantities,MPI_DOUBLE_INT,MPI_MINLOC,0,simComm);
+	MPI_Reduce(local,max,nQuantities,MPI_DOUBLE_INT,MPI_MAXLOC,0,simComm);
+	for(int i=0;i<nQuantities;i++) val[i] = local[i].val;
+	MPI_Reduce(val,sum,nQuantities,MPI_DOUBLE,MPI_SUM,0,simComm);
+	cpEnd();
+
+	// Already reduced, so xyWrite() shall not reduce again
+	char name[128], base[96];
+	for(int i=0;i<nQuantities;i++){
+		double stat[] = {min[i].val, max[i].val, sum[i]/mpiInfo->mpiSize,
+						 (double)max[i].rank};
+		telImbalanceName(base,i,nSpecies);
+		for(int j=0;j<4;j++){
+			sprintf(name,"%s/%s",base,telImbalanceStat[j]);
+			xyWrite(history,name,x,stat[j],MPI_OP_NULL);
+		}
+	}
+
+	if(tel->imbalanceSnapshot)
+		xyWriteNodes(history,"/imbalance/nodes",x,values,nValues);
+
+	free(local);
+	free(min);
+	free(max);
+	free(val);
+	free(sum);
+	free(values);
+}
+
+void telRooflineMsg(const Telemetry *tel){
+
+	int mpiRank, mpiSize;
+	MPI_Comm_rank(simComm,&mpiRank);
+	MPI_Comm_size(simComm,&mpiSize);
+
+	// Time, bytes and flops for each phase, followed by bandwidth
+	double local[3*TEL_NPHASES+1], sum[3*TEL_NPHASES+1];
+	for(int i=0;i<TEL_NPHASES;i++){
+		local[3*i]   = tel->phases[i]->total/1e9;
+		local[3*i+1] = tel->costs[i].bytes;
+		local[3*i+2] = tel->costs[i].flops;
+	}
+	local[3*TEL_NPHASES] = tel->bandwidth;
+
+	MPI_Reduce(local,sum,3*TEL_NPHASES+1,MPI_DOUBLE,MPI_SUM,0,simComm);
+
+	if(mpiRank!=0) return;
+
+	double bandwidth = sum[3*TEL_NPHASES]/mpiSize;
+
+	msg(STATUS, "Roofline (nominal work, mean of all nodes, STREAM triad %.3g GB/s):",
+		bandwidth/1e9);
+	for(int i=0;i<TEL_NPHASES;i++){
+
+		double time = sum[3*i], bytes = sum[3*i+1], flops = sum[3*i+2];
+		if(time==0 || bytes==0) continue;
+
+		msg(STATUS, "  %-8s %8.3g GB/s (%5.1f%% of STREAM), %8.3g GF/s, %6.3g flop/B",
+			telPhaseName[i], bytes/time/1e9, 100*bytes/time/bandwidth,
+			flops/time/1e9, flops/bytes);
+	}
+}
+
+/******************************************************************************
+ * THREADING FUNCTIONS
+ *****************************************************************************/
+
+// Length of each line in the binding report
+#define THR_LINE_LENGTH 256
+
+void thrInit(const dictionary *ini){
+
+	int nThreads = iniGetInt(ini,"parallel:nThreads");
+	if(nThreads<0) msg(ERROR,"parallel:nThreads must be non-negative");
+
+	int provided, mpiRank, mpiSize;
+	MPI_Query_thread(&provided);
+	MPI_Comm_rank(simComm,&mpiRank);
+	MPI_Comm_size(simComm,&mpiSize);
+
+#ifdef _OPENMP
+	if(nThreads>0) omp_set_num_threads(nThreads);
+	nThreads = omp_get_max_threads();
+	if(nThreads>1 && provided<MPI_THREAD_FUNNELED)
+		msg(WARNING,"MPI does not support MPI_THREAD_FUNNELED");
+
+	const char *bindName[] = {"false","true","master","close","spread"};
+	int bind = omp_get_proc_bind();
+#else
+	if(nThreads>1) msg(WARNING,"compiled without OpenMP, using 1 thread");
+	nThreads = 1;
+#endif
+
+	// CPU each thread runs on
+	int *cpu = malloc(nThreads*sizeof(*cpu));
+	#pragma omp parallel
+	{
+#ifdef _OPENMP
+		int t = omp_get_thread_num();
+#else
+		int t = 0;
+#endif
+#ifdef __linux__
+		cpu[t] = sched_getcpu();
+#else
+		cpu[t] = -1;
+#endif
+	}
+
+	char host[MPI_MAX_PROCESSOR_NAME];
+	int hostLength;
+	MPI_Get_processor_name(host,&hostLength);
+
+	char line[THR_LINE_LENGTH];
+	int pos = snprintf(line,THR_LINE_LENGTH,"  node %-5i on %s, CPUs",mpiRank,host);
+	for(int t=0;t<nThreads && pos<THR_LINE_LENGTH;t++)
+		pos += snprintf(&line[pos],THR_LINE_LENGTH-pos," %i",cpu[t]);
+
+	char *lines = NULL;
+	if(mpiRank==0) lines = malloc(mpiSize*THR_LINE_LENGTH);
+	MPI_Gather(line,THR_LINE_LENGTH,MPI_CHAR,lines,THR_LINE_LENGTH,MPI_CHAR,0,
+			   simComm);
+
+	if(mpiRank==0){
+#ifdef _OPENMP
+		msg(STATUS,"Using %i thread(s) per MPI node, OpenMP binding %s:",
+			nThreads,bindName[bind]);
+#else
+		msg(STATUS,"Using 1 thread per MPI node:");
+#endif
+		for(int r=0;r<mpiSize;r++) msg(STATUS,"%s",&lines[r*THR_LINE_LENGTH]);
+	}
+
+	free(lines);
+	free(cpu);
+}
+
+int thrCount(void){
+#ifdef _OPENMP
+	return omp_get_max_threads();
+#else
+	return 1;
+#endif
+}
+
+int thrNum(void){
+#ifdef _OPENMP
+	return omp_get_thread_num();
+#else
+	return 0;
+#endif
+}
+
+/******************************************************************************
+ * TASK SCHEDULING FUNCTIONS
+ *****************************************************************************/
+
+// Deques are spaced by a cache line to avoid false sharing between threads
+#define SCH_PAD 8
+
+// Chunks per thread aimed for, and least weight of a chunk
+#define SCH_CHUNKS 16
+#define SCH_MIN_GRAIN 512
+
+#define SCH_PACK(head,tail) ((unsigned long long int)(head)<<32 | (tail))
+
+Scheduler *schAlloc(void){
+
+	Scheduler *sch = malloc(sizeof(*sch));
+	sch->nThreads = thrCount();
+	sch->nTasks = 0;
+	sch->nTasksAlloc = 0;
+	sch->cumWeight = NULL;
+	sch->grain = SCH_MIN_GRAIN;
+	sch->deque = malloc(SCH_PAD*sch->nThreads*sizeof(*sch->deque));
+	for(int t=0;t<sch->nThreads;t++) atomic_init(&sch->deque[SCH_PAD*t],0);
+
+	return sch;
+}
+
+void schFree(Scheduler *sch){
+
+	free(sch->cumWeight);
+	free((void *)sch->deque);
+	free(sch);
+}
+
+// Makes room for nTasks tasks in sch->cumWeight (only grows)
+static void schReserve(Scheduler *sch, long int nTasks){
+
+	if(nTasks+1>sch->nTasksAlloc){
+		sch->nTasksAlloc = nTasks+1;
+		sch->cumWeight = realloc(sch->cumWeight,
+								 sch->nTasksAlloc*sizeof(*sch->cumWeight));
+	}
+}
+
+// Distributes the tasks already stored in sch->cumWeight among the deques
+static void schDistribute(Scheduler *sch, long int nTasks){
+
+	const long int *cumWeight = sch->cumWeight;
+	sch->nTasks = nTasks;
+
+	int nThreads = sch->nThreads;
+	long int total = cumWeight[nTasks]-cumWeight[0];
+	sch->grain = total/(nThreads*SCH_CHUNKS);
+	if(sch->grain<SCH_MIN_GRAIN) sch->grain = SCH_MIN_GRAIN;
+
+	// Contiguous ranges of tasks with roughly equal weight
+	long int head = 0;
+	for(int t=0;t<nThreads;t++){
+		long int target = cumWeight[0]+total*(t+1)/nThreads;
+		long int tail = head;
+		while(tail<nTasks && cumWeight[tail]<target) tail++;
+		if(t==nThreads-1) tail = nTasks;
+		atomic_store(&sch->deque[SCH_PAD*t],SCH_PACK(head,tail));
+		head = tail;
+	}
+}
+
+void schSubmit(Scheduler *sch, const long int *cumWeight, long int nTasks){
+
+	schReserve(sch,nTasks);
+	for(long int t=0;t<=nTasks;t++) sch->cumWeight[t] = cumWeight[t];
+	schDistribute(sch,nTasks);
+}
+
+void schSubmitRange(Scheduler *sch, long int start, long int stop){
+
+	long int nTasks = sch->nThreads*SCH_CHUNKS;
+	schReserve(sch,nTasks);
+	long int *cumWeight = sch->cumWeight;
+	for(long int t=0;t<=nTasks;t++) cumWeight[t] = start+(stop-start)*t/nTasks;
+	schDistribute(sch,nTasks);
+}
+
+// First task after a chunk starting at head (at most tail)
+static long int schChunkEnd(const Scheduler *sch, long int head, long int tail){
+
+	const long int *cumWeight = sch->cumWeight;
+	long int target = cumWeight[head]+sch->grain;
+
+	// Binary search for the first task with cumulative weight at target
+	long int lo = head+1, hi = tail;
+	while(lo<hi){
+		long int mid = lo+(hi-lo)/2;
+		if(cumWeight[mid]<target) lo = mid+1;
+		else hi = mid;
+	}
+	return lo;
+}
+
+// First task of a chunk ending at tail (at least head)
+static long int schChunkBegin(const Scheduler *sch, long int head, long int tail){
+
+	const long int *cumWeight = sch->cumWeight;
+	long int target = cumWeight[tail]-sch->grain;
+
+	// Binary search for the last task with cumulative weight at target
+	long int lo = head, hi = tail-1;
+	while(lo<hi){
+		long int mid = hi-(hi-lo)/2;
+		if(cumWeight[mid]>target) hi = mid-1;
+		else lo = mid;
+	}
+	return lo;
+}
+
+int schNext(Scheduler *sch, long int *start, long int *stop){
+
+	int nThreads = sch->nThreads;
+	int self = thrNum()%nThreads;
+
+	// Own deque first, then the others
+	for(int i=0;i<nThreads;i++){
+
+		int t = (self+i)%nThreads;
+		_Atomic unsigned long long int *deque = &sch->deque[SCH_PAD*t];
+		unsigned long long int range = atomic_load(deque);
+
+		while(1){
+			long int head = range>>32;
+			long int tail = range&0xffffffff;
+			if(head>=tail) break;
+
+			long int first, last;
+			unsigned long long int remaining;
+			if(t==self){
+				first = head;
+				last = schChunkEnd(sch,head,tail);
+				remaining = SCH_PACK(last,tail);
+			} else {
+				first = schChunkBegin(sch,head,tail);
+				last = tail;
+				remaining = SCH_PACK(head,first);
+			}
+
+			// On failure, range is updated and the chunk is recomputed
+			if(atomic_compare_exchange_weak(deque,&range,remaining)){
+				*start = sch->cumWeight[first];
+				*stop = sch->cumWeight[last];
+				return 1;
+			}
+		}
+	}
+
+	return 0;
+}
+
+/******************************************************************************
+ * RANDOM NUMBER FUNCTIONS
+ *****************************************************************************/
+
+// Constants of Philox4x32 (multipliers and Weyl sequence increments)
+#define RNG_M0 0xD2511F53u
+#define RNG_M1 0xCD9E8D57u
+#define RNG_W0 0x9E3779B9u
+#define RNG_W1 0xBB67AE85u
+
+#define RNG_CHUNK 256	// Items per call to rngBlock()
+#define RNG_BINOMIAL_EXACT 30.0	// Largest mean drawn exactly by rngBinomial()
+
+// Ten rounds of Philox4x32 applied to the counter (c0,c1,c2,c3) in place
+static inline void rngRounds(uint32_t *c0, uint32_t *c1, uint32_t *c2,
+							 uint32_t *c3, uint32_t k0, uint32_t k1){
+
+	uint32_t x0 = *c0, x1 = *c1, x2 = *c2, x3 = *c3;
+	for(int r=0;r<10;r++){
+		uint64_t p0 = (uint64_t)RNG_M0*x0;
+		uint64_t p1 = (uint64_t)RNG_M1*x2;
+		x0 = (uint32_t)(p1>>32)^x1^k0;
+		x1 = (uint32_t)p1;
+		x2 = (uint32_t)(p0>>32)^x3^k1;
+		x3 = (uint32_t)p0;
+		k0 += RNG_W0;
+		k1 += RNG_W1;
+	}
+	*c0 = x0; *c1 = x1; *c2 = x2; *c3 = x3;
+}
+
+// Uniform in (0,1) from 52 random bits
+static inline double rngToDouble(uint32_t lo, uint32_t hi){
+	uint64_t x = ((uint64_t)hi<<32)|lo;
+	return ((double)(x>>12)+0.5)*(1.0/4503599627370496.0);
+}
+
+void rngPhilox(const unsigned int counter[4], const unsigned int key[2],
+			   unsigned int result[4]){
+
+	uint32_t c0 = counter[0], c1 = counter[1], c2 = counter[2], c3 = counter[3];
+	rngRounds(&c0,&c1,&c2,&c3,key[0],key[1]);
+	result[0] = c0;
+	result[1] = c1;
+	result[2] = c2;
+	result[3] = c3;
+}
+
+void rngSet(Rng *rng, unsigned int seed, rngStream stream, int specie,
+			long int step){
+
+	rng->key[0] = seed;
+	rng->key[1] = ((unsigned int)stream<<16) | (unsigned int)specie;
+	rng->step = (unsigned int)step;
+}
+
+// Two uniform values for each of n items from block b of the counter. Kept
+// free of branches and scattered stores such that the loop is vectorized.
+static void rngBlock(const Rng *rng, const unsigned long long int *index,
+					 long int n, uint32_t b, double *u0, double *u1){
+
+	uint32_t k0 = rng->key[0], k1 = rng->key[1], step = rng->step;
+
+	#pragma omp simd
+	for(long int i=0;i<n;i++){
+		uint32_t c0 = (uint32_t)index[i], c1 = (uint32_t)(index[i]>>32);
+		uint32_t c2 = step, c3 = b;
+		rngRounds(&c0,&c1,&c2,&c3,k0,k1);
+		u0[i] = rngToDouble(c0,c1);
+		u1[i] = rngToDouble(c2,c3);
+	}
+}
+
+void rngUniform(const Rng *rng, const unsigned long long int *index,
+				long int nItems, int nValues, double *values){
+
+	double u0[RNG_CHUNK], u1[RNG_CHUNK];
+
+	for(long int i0=0;i0<nItems;i0+=RNG_CHUNK){
+		long int n = nItems-i0 < RNG_CHUNK ? nItems-i0 : RNG_CHUNK;
+		double *v = &values[i0*nValues];
+
+		for(int b=0;2*b<nValues;b++){
+			rngBlock(rng,&index[i0],n,b,u0,u1);
+			for(long int i=0;i<n;i++) v[i*nValues+2*b] = u0[i];
+			if(2*b+1<nValues)
+				for(long int i=0;i<n;i++) v[i*nValues+2*b+1] = u1[i];
+		}
+	}
+}
+
+void rngGaussian(const Rng *rng, const unsigned long long int *index,
+				 long int nItems, int nValues, double *values){
+
+	double u0[RNG_CHUNK], u1[RNG_CHUNK];
+
+	for(long int i0=0;i0<nItems;i0+=RNG_CHUNK){
+		long int n = nItems-i0 < RNG_CHUNK ? nItems-i0 : RNG_CHUNK;
+		double *v = &values[i0*nValues];
+
+		// Box-Muller transform, which unlike the ziggurat method has no
+		// branches
+		for(int b=0;2*b<nValues;b++){
+			rngBlock(rng,&index[i0],n,b,u0,u1);
+			for(long int i=0;i<n;i++){
+				double r = sqrt(-2.0*log(u0[i]));
+				u0[i] = r*cos(2.0*M_PI*u1[i]);
+				u1[i] = r*sin(2.0*M_PI*u1[i]);
+			}
+			for(long int i=0;i<n;i++) v[i*nValues+2*b] = u0[i];
+			if(2*b+1<nValues)
+				for(long int i=0;i<n;i++) v[i*nValues+2*b+1] = u1[i];
+		}
+	}
+}
+
+long int rngBinomial(const Rng *rng, unsigned long long int index, long int n,
+					 double p){
+
+	if(n<=0 || p<=0) return 0;
+	if(p>=1) return n;
+	if(p>0.5) return n-rngBinomial(rng,index,n,1-p);
+
+	double mean = n*p;
+
+	if(mean<RNG_BINOMIAL_EXACT){
+
+		// Inversion of the cumulative distribution
+		double u, f = pow(1-p,n), q = p/(1-p);
+		rngUniform(rng,&index,1,1,&u);
+		long int k = 0;
+		while(u>f && k<n){
+			u -= f;
+			f *= q*(n-k)/(k+1);
+			k++;
+		}
+		return k;
+	}
+
+	// Normal approximation with continuity correction
+	double g;
+	rngGaussian(rng,&index,1,1,&g);
+	long int k = (long int)floor(mean+sqrt(mean*(1-p))*g+0.5);
+	if(k<0) k = 0;
+	if(k>n) k = n;
+	return k;
+}
+
 /******************************************************************************
  * STRING FUNCTIONS
  *****************************************************************************/
@@ -399,7 +1296,7 @@ void alSet(long int *a, long int n, ...){
 void adPrintInner(double *a, long int inc, long int end, char *varName){
 
 	int rank;
-	MPI_Comm_rank(MPI_COMM_WORLD,&rank);
+	MPI_Comm_rank(simComm,&rank);
 
 	printf("PRINT(%i): %s(1:%li:%li) = \n  [",rank,varName,inc,end);
 	int i;
@@ -415,7 +1312,7 @@ void adPrintInner(double *a, long int inc, long int end, char *varName){
 void aiPrintInner(int *a, long int inc, long int end, char *varName){
 
 	int rank;
-	MPI_Comm_rank(MPI_COMM_WORLD,&rank);
+	MPI_Comm_rank(simComm,&rank);
 
 	printf("PRINT(%i): %s(1:%li:%li) = \n  [",rank,varName,inc,end);
 	int i;
@@ -429,7 +1326,7 @@ void aiPrintInner(int *a, long int inc, long int end, char *varName){
 void alPrintInner(long int *a, long int inc, long int end, char *varName){
 
 	int rank;
-	MPI_Comm_rank(MPI_COMM_WORLD,&rank);
+	MPI_Comm_rank(simComm,&rank);
 
 	printf("PRINT(%i): %s(1:%li:%li) = \n  [",rank,varName,inc,end);
 	int i;
@@ -13,6 +13,14 @@
  */
 ///@{
 
+/**
+ * @brief	Returns a monotonic time in nanoseconds
+ * @return	Nanoseconds since an arbitrary but fixed point in time
+ *
+ * Only differences between two calls are meaningful.
+ */
+unsigned long long int getNanoSec(void);
+
 /**
  * @brief	Allocates a Timer struct
  * @return	Pointer to Timer struct
@@ -77,6 +85,376 @@ void tMsg(long long int nanoSec, const char *string);
 
 ///@}
 
+/**
+ * @name Memory accounting functions
+ */
+///@{
+
+/**
+ * @brief	Allocates memory and accounts for it under a subsystem
+ * @param	tag		Subsystem the memory belongs to
+ * @param	size	Number of bytes to allocate
+ * @return	Pointer to allocated memory
+ * @see		memTag, memFree(), memMsg()
+ *
+ * Works as malloc() except that the number of bytes is added to the current
+ * and peak count of the subsystem 'tag'. Memory allocated with memAlloc() must
+ * be freed using memFree(), and memFree() may only be used on such memory.
+ */
+void *memAlloc(memTag tag, size_t size);
+
+/**
+ * @brief	Frees memory allocated with memAlloc()
+ * @param	ptr		Pointer to memory (NULL is allowed)
+ * @see		memAlloc()
+ */
+void memFree(void *ptr);
+
+/**
+ * @brief	Accounts for memory not allocated through memAlloc()
+ * @param	tag		Subsystem the memory belongs to
+ * @param	size	Number of bytes (negative when freed)
+ *
+ * For buffers which must be allocated with a library's own allocator, e.g.
+ * fftw_malloc().
+ */
+void memAdd(memTag tag, long int size);
+
+/**
+ * @brief	Current number of bytes allocated by this MPI node
+ * @param	tag		Subsystem, or MEM_NTAGS for the total of all subsystems
+ * @return	Number of bytes
+ */
+size_t memGetCurrent(memTag tag);
+
+/**
+ * @brief	Peak number of bytes allocated by this MPI node
+ * @param	tag		Subsystem, or MEM_NTAGS for the total of all subsystems
+ * @return	Number of bytes
+ *
+ * The total peak is the peak of the sum, not the sum of the peaks.
+ */
+size_t memGetPeak(memTag tag);
+
+/**
+ * @brief	Prints current and peak memory per subsystem and per MPI node
+ * @param	string	Message to prefix the report with (e.g. "at startup")
+ *
+ * Collective operation. For each subsystem the sum across all MPI nodes is
+ * printed along with the largest consumer, followed by the total of each MPI
+ * node.
+ */
+void memMsg(const char *string);
+
+///@}
+
+/**
+ * @name Telemetry functions
+ */
+///@{
+
+/**
+ * @brief	Allocates Telemetry
+ * @param	ini		Dictionary to input file
+ * @return	Pointer to Telemetry
+ * @see		Telemetry, telStep(), telFree()
+ *
+ * Writes to the file "telemetry.prom" (see getFileName()) every
+ * telemetry:interval seconds. The memory bandwidth is measured here, so this
+ * is a collective operation taking a fraction of a second.
+ */
+Telemetry *telAlloc(const dictionary *ini);
+
+/**
+ * @brief	Frees Telemetry
+ * @param	tel		Pointer to Telemetry
+ */
+void telFree(Telemetry *tel);
+
+/**
+ * @brief	Registers a completed time step
+ * @param	tel		Telemetry
+ * @param	pop		Population
+ *
+ * Collective operation. To be called once at the end of each time step. If
+ * more than telemetry:interval seconds have passed since the last write, or
+ * it is the last time step, statistics since the last write are gathered
+ * from all MPI nodes, written to file and summarized on one status line.
+ */
+void telStep(Telemetry *tel, const Population *pop);
+
+/**
+ * @brief	Creates datasets for load imbalance diagnostics
+ * @param	tel			Telemetry
+ * @param	history		.xy.h5-file identifier
+ * @param	pop			Population
+ * @param	mpiInfo		MpiInfo
+ * @see		telWriteImbalance()
+ *
+ * Does nothing if telemetry:imbalanceInterval is zero.
+ */
+void telCreateImbalanceDatasets(const Telemetry *tel, hid_t history,
+								const Population *pop, const MpiInfo *mpiInfo);
+
+/**
+ * @brief	Writes load imbalance between MPI nodes to history file
+ * @param	tel			Telemetry
+ * @param	history		.xy.h5-file identifier
+ * @param	pop			Population
+ * @param	mpiInfo		MpiInfo
+ * @param	x			x-value (e.g. time step)
+ *
+ * Collective operation. To be called once every time step after migration.
+ * Every telemetry:imbalanceInterval time steps the number of particles of
+ * each specie, the number of emigrants and immigrants, and the time per step
+ * spent in each phase since the last write are reduced across MPI nodes.
+ * Since every write extends all the datasets collectively, the shipped input
+ * files use an interval of 100 time steps.
+ * The minimum, maximum, mean and the rank of the maximum ("argmax") are
+ * appended to datasets such as:
+ *
+ * @code
+ *	/imbalance/particles/specie 0/max
+ *	/imbalance/emigrants/argmax
+ *	/imbalance/seconds per step/move/mean
+ * @endcode
+ *
+ * If telemetry:imbalanceSnapshot is non-zero, the values of every MPI node
+ * are stored in "/imbalance/nodes" as well (see xyWriteNodes()), with columns
+ * x, particles of each specie, emigrants to each neighbor, immigrants from
+ * each neighbor and time per step in each phase. The counts come from the
+ * most recent migration, and the neighbors are in the order of
+ * MpiInfo::nEmigrants. The datasets must be created beforehand using
+ * telCreateImbalanceDatasets().
+ */
+void telWriteImbalance(Telemetry *tel, hid_t history, const Population *pop,
+					   const MpiInfo *mpiInfo, double x);
+
+/**
+ * @brief	Prints achieved bandwidth and floating point rate of each phase
+ * @param	tel		Telemetry
+ * @see		Cost
+ *
+ * Collective operation. The nominal work in Telemetry::costs is divided by the
+ * time spent in each phase, and the achieved bandwidth is compared to the
+ * memory bandwidth measured by a STREAM triad in telAlloc(). Phases far below
+ * the measured bandwidth (and with a low flop per byte ratio) are the ones
+ * with most to gain from optimization. More than 100% means that some of the
+ * nominal traffic was served from cache. Phases without nominal work are not
+ * shown.
+ *
+ * The nominal work must be added by the caller using the cost functions of the
+ * kernels, e.g.:
+ *
+ * @code
+ *	tStart(tel->phases[TEL_MOVE]);
+ *	puMove(pop);
+ *	tStop(tel->phases[TEL_MOVE]);
+ *	puMoveCost(&tel->costs[TEL_MOVE], pop);
+ * @endcode
+ */
+void telRooflineMsg(const Telemetry *tel);
+
+///@}
+
+/**
+ * @name Threading functions
+ */
+///@{
+
+/**
+ * @brief	Sets the number of threads per MPI node and reports their binding
+ * @param	ini		Dictionary to input file
+ *
+ * Collective operation. PINC may run several OpenMP threads per MPI node, with
+ * only the master thread communicating (MPI_THREAD_FUNNELED). This sets the
+ * number of threads to parallel:nThreads, or leaves it to OpenMP (e.g. the
+ * environment variable OMP_NUM_THREADS) if it is zero. Then it prints which
+ * CPU each thread of each MPI node runs on, such that the binding can be
+ * verified. For instance, with Open MPI and 4 threads per MPI node:
+ *
+ * @code
+ *	OMP_PROC_BIND=close OMP_PLACES=cores mpirun --map-by slot:PE=4 ./pinc input.ini
+ * @endcode
+ *
+ * Threads only improve performance if they are bound to separate cores, and
+ * only in the kernels which are parallelized with OpenMP. Arrays of particles
+ * and grids are initialized by the same threads that later work on them, such
+ * that their memory is placed close to those threads on NUMA systems (first
+ * touch). Compile with an empty OMP variable in the makefile to disable
+ * OpenMP.
+ */
+void thrInit(const dictionary *ini);
+
+/**
+ * @brief	Number of threads used by parallel regions
+ * @return	Number of threads (1 if compiled without OpenMP)
+ */
+int thrCount(void);
+
+/**
+ * @brief	Number of the calling thread within a parallel region
+ * @return	Thread number (0 outside parallel regions or without OpenMP)
+ */
+int thrNum(void);
+
+///@}
+
+/**
+ * @name Task scheduling functions
+ */
+///@{
+
+/**
+ * @brief	Allocates a task scheduler for the threads of this MPI node
+ * @return	Scheduler
+ * @see		Scheduler, schFree()
+ *
+ * The number of threads is that of thrCount() at the time of the call.
+ */
+Scheduler *schAlloc(void);
+
+/**
+ * @brief	Frees a scheduler allocated by schAlloc()
+ * @param	sch		Scheduler
+ */
+void schFree(Scheduler *sch);
+
+/**
+ * @brief	Submits tasks to a scheduler
+ * @param	sch			Scheduler
+ * @param	cumWeight	Cumulative weight before each task (nTasks+1 elements)
+ * @param	nTasks		Number of tasks
+ * @see		schNext()
+ *
+ * Replaces any tasks remaining from before. Must be called outside of
+ * parallel regions, and the tasks are then executed by all threads of a
+ * parallel region calling schNext() until it returns 0. cumWeight is copied,
+ * and may start at any value. For instance, with pop->iStart[s]=0 and tiles
+ * of 3, 0 and 5 particles, cumWeight is {0,3,3,8}.
+ */
+void schSubmit(Scheduler *sch, const long int *cumWeight, long int nTasks);
+
+/**
+ * @brief	Submits a range of equally weighted work to a scheduler
+ * @param	sch		Scheduler
+ * @param	start	First item
+ * @param	stop	First item not included
+ *
+ * Splits the items from start to stop-1 (e.g. particles) into a number of
+ * tasks proportional to the number of threads, and submits them like
+ * schSubmit(). The weights are written directly into the buffer of the
+ * scheduler, so nothing is allocated once it is large enough.
+ */
+void schSubmitRange(Scheduler *sch, long int start, long int stop);
+
+/**
+ * @brief	Takes the next chunk of tasks to execute
+ * @param		sch		Scheduler
+ * @param[out]	start	Cumulative weight at the first task of the chunk
+ * @param[out]	stop	Cumulative weight after the last task of the chunk
+ * @return		1 if a chunk was taken, 0 if all tasks are taken
+ *
+ * Thread-safe and lock-free. The chunk is returned as a range of cumulative
+ * weight, which for tiles of particles sorted by tile is the range of particle
+ * indices. Example:
+ *
+ * @code
+ *	schSubmit(sch, &tiles->start[s*(tiles->nTiles+1)], tiles->nTiles);
+ *	#pragma omp parallel
+ *	{
+ *		long int iStart, iStop;
+ *		while(schNext(sch,&iStart,&iStop)){
+ *			for(long int i=iStart;i<iStop;i++) ...
+ *		}
+ *	}
+ * @endcode
+ *
+ * A thread first takes chunks from the front of its own deque, and then steals
+ * chunks from the back of the deques of other threads.
+ */
+int schNext(Scheduler *sch, long int *start, long int *stop);
+
+///@}
+
+/**
+ * @name Random number functions
+ */
+///@{
+
+/**
+ * @brief	Philox4x32-10 bijection
+ * @param		counter	Counter (4 elements)
+ * @param		key		Key (2 elements)
+ * @param[out]	result	Random bits (4 elements)
+ * @see		Rng
+ *
+ * The counter-based generator by Salmon et al., "Parallel random numbers: as
+ * easy as 1, 2, 3" (2011), underlying rngUniform() and rngGaussian().
+ */
+void rngPhilox(const unsigned int counter[4], const unsigned int key[2],
+			   unsigned int result[4]);
+
+/**
+ * @brief	Sets the key and time step of a random number generator
+ * @param[out]	rng		Random number generator
+ * @param		seed	Seed, e.g. population:seed
+ * @param		stream	What the numbers are drawn for
+ * @param		specie	Specie (0 if not applicable)
+ * @param		step	Time step (0 for initial conditions)
+ */
+void rngSet(Rng *rng, unsigned int seed, rngStream stream, int specie,
+			long int step);
+
+/**
+ * @brief	Draws uniformly distributed numbers for a batch of items
+ * @param		rng		Random number generator
+ * @param		index	Index of each item (nItems elements)
+ * @param		nItems	Number of items
+ * @param		nValues	Number of values per item
+ * @param[out]	values	Values in (0,1) (nItems*nValues elements)
+ * @see		Rng
+ *
+ * The values of item i are stored from values[i*nValues], e.g. nDims values
+ * per particle as in Population. They only depend on rng and index[i], so the
+ * function is thread-safe and the items may be split between threads and MPI
+ * nodes in any way. The loop over the batch is vectorized.
+ */
+void rngUniform(const Rng *rng, const unsigned long long int *index,
+				long int nItems, int nValues, double *values);
+
+/**
+ * @brief	Draws normally distributed numbers for a batch of items
+ * @param		rng		Random number generator
+ * @param		index	Index of each item (nItems elements)
+ * @param		nItems	Number of items
+ * @param		nValues	Number of values per item
+ * @param[out]	values	Values of zero mean and unit variance
+ * @see		rngUniform()
+ *
+ * Uses the Box-Muller transform, and is otherwise like rngUniform().
+ */
+void rngGaussian(const Rng *rng, const unsigned long long int *index,
+				 long int nItems, int nValues, double *values);
+
+/**
+ * @brief	Draws a binomially distributed number for one item
+ * @param		rng		Random number generator
+ * @param		index	Index of the item
+ * @param		n		Number of trials
+ * @param		p		Probability of success in each trial
+ * @return		Number of successes (0 to n)
+ * @see		rngUniform()
+ *
+ * Exact (by inversion) when the smaller of n*p and n*(1-p) is below 30, and
+ * otherwise the normal approximation. Used e.g. to split a number of
+ * particles between subdomains.
+ */
+long int rngBinomial(const Rng *rng, unsigned long long int index, long int n,
+					 double p);
+
+///@}
+
 /**
  * @brief Concatenates strings
  * @param	n	Number of strings to concatenate
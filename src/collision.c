@@ -0,0 +1,616 @@
+/**
+ * @file		collision.c
+ * @brief		Monte Carlo collisions with neutrals and between particles.
+ *
+ * See collision.h.
+ */
+
+#define _XOPEN_SOURCE 700
+
+#include "core.h"
+#include "collision.h"
+#include <string.h>
+
+/******************************************************************************
+ * DECLARING LOCAL FUNCTIONS
+ *****************************************************************************/
+
+static void colReadCrossSections(const char *fName, long int *nRows,
+								 double **energy, double **sigma);
+static const long int *colIndexCells(Collider *col, const Population *pop,
+									 const Grid *grid);
+static inline void colScatter(double *v1, double *v2, double frac1,
+							  double frac2, double coeff, double gauss,
+							  double uniform);
+
+// Number of particles per block of a specie
+#define COL_BLOCK 4096
+
+// Number of candidates to draw random numbers for at a time
+#define COL_BATCH 64
+
+// Index of the random numbers of a candidate are its subdomain shifted by
+// COL_SUBDOMAIN_SHIFT, plus its block shifted by COL_BLOCK_SHIFT, plus the
+// number of the candidate in the block. The skip to the candidate is drawn
+// from this index, and the uniform and Gaussian values of the collision from
+// COL_UNIFORM_INDEX and COL_GAUSS_INDEX added to it. A block never draws more
+// than COL_BLOCK+COL_BATCH skips, such that all indices are different.
+#define COL_SUBDOMAIN_SHIFT 40
+#define COL_BLOCK_SHIFT 13
+#define COL_UNIFORM_INDEX (1ULL<<62)
+#define COL_GAUSS_INDEX (1ULL<<63)
+
+// Index of the random numbers of Coulomb collisions are the subdomain shifted
+// by COL_SUBDOMAIN_SHIFT, plus the cell shifted by COL_CELL_SHIFT, plus the
+// number of the particle (when shuffling) or pair in the cell. Thus, a cell
+// may hold at most COL_CELL_MAX particles of a specie.
+#define COL_CELL_SHIFT 14
+#define COL_CELL_MAX (1L<<(COL_CELL_SHIFT-1))
+
+/******************************************************************************
+ * DEFINING GLOBAL FUNCTIONS
+ *****************************************************************************/
+
+Collider *colAlloc(const dictionary *ini, const Units *units,
+				   const MpiInfo *mpiInfo){
+
+	// Read from ini
+	int nDims = iniGetInt(ini,"grid:nDims");
+	int nSpecies = iniGetInt(ini,"population:nSpecies");
+	double *mass = iniGetDoubleArr(ini,"population:mass",nSpecies);
+	char **processes = iniGetStrArr(ini,"collisions:processes",nSpecies);
+	char **crossSections = iniGetStrArr(ini,"collisions:crossSections",nSpecies);
+	double density = iniGetDouble(ini,"collisions:neutralDensity");
+	double neutralMass = iniGetDouble(ini,"collisions:neutralMass");
+	double neutralThermal = iniGetDouble(ini,"collisions:neutralThermalVelocity");
+	int tableSize = iniGetInt(ini,"collisions:tableSize");
+	int coulombInterval = iniGetInt(ini,"collisions:coulombInterval");
+	double coulombLog = iniGetDouble(ini,"collisions:coulombLog");
+	double *charge = iniGetDoubleArr(ini,"population:charge",nSpecies);
+	unsigned int seed = (unsigned int)iniGetInt(ini,"population:seed");
+
+	if(tableSize<2) msg(ERROR,"collisions:tableSize must be at least 2");
+	if(coulombInterval<0) msg(ERROR,"collisions:coulombInterval must be non-negative");
+	if(coulombInterval && nDims!=3) msg(ERROR,"collisions only supported in 3D");
+
+	Collider *col = malloc(sizeof(*col));
+	col->nSpecies = nSpecies;
+	col->tableSize = tableSize;
+	col->neutralThermal = neutralThermal;
+	col->seed = seed;
+	col->nCandidates = 0;
+	col->process = malloc(nSpecies*sizeof(*col->process));
+	col->table = malloc(nSpecies*tableSize*sizeof(*col->table));
+	col->gMax = malloc(nSpecies*sizeof(*col->gMax));
+	col->nuMax = malloc(nSpecies*sizeof(*col->nuMax));
+	col->massRatio = malloc(nSpecies*sizeof(*col->massRatio));
+	col->coulombInterval = coulombInterval;
+	col->coulombLog = coulombLog;
+	col->charge = malloc(nSpecies*sizeof(*col->charge));
+	col->mass = malloc(nSpecies*sizeof(*col->mass));
+	col->weight = malloc(nSpecies*sizeof(*col->weight));
+	col->nCells = 0;
+	col->cellStart = NULL;
+	col->cellStop = NULL;
+	col->index = NULL;
+	col->count = NULL;
+	col->nPairs = 0;
+
+	col->subdomain = 0;
+	for(int d=0;d<nDims;d++)
+		col->subdomain += mpiInfo->subdomain[d]*mpiInfo->nSubdomainsProd[d];
+
+	for(int s=0;s<nSpecies;s++){
+
+		double *table = &col->table[s*tableSize];
+		for(int j=0;j<tableSize;j++) table[j] = 0;
+		col->gMax[s] = 1;
+		col->nuMax[s] = 0;
+		col->massRatio[s] = 0;
+
+		// Physical particles
+		col->weight[s] = units->weights[s];
+		col->charge[s] = charge[s]/units->weights[s];
+		col->mass[s] = mass[s]/units->weights[s];
+
+		if(!strcmp(processes[s],"NONE")) col->process[s] = COL_NONE;
+		else if(!strcmp(processes[s],"ELASTIC")) col->process[s] = COL_ELASTIC;
+		else if(!strcmp(processes[s],"EXCHANGE")) col->process[s] = COL_EXCHANGE;
+		else msg(ERROR,"%s invalid value for collisions:processes",processes[s]);
+
+		if(col->process[s]==COL_NONE || density==0) continue;
+		if(nDims!=3) msg(ERROR,"collisions only supported in 3D");
+
+		// Reduced mass
+		double m = col->mass[s];
+		double mu = m*neutralMass/(m+neutralMass);
+		col->massRatio[s] = neutralMass/(m+neutralMass);
+
+		long int nRows;
+		double *energy, *sigma;
+		colReadCrossSections(crossSections[s],&nRows,&energy,&sigma);
+
+		// Normalize
+		double area = pow(units->length,2);
+		for(long int r=0;r<nRows;r++){
+			energy[r] *= elementaryCharge/units->energy;
+			sigma[r] /= area;
+		}
+
+		double gMax = sqrt(2*energy[nRows-1]/mu);
+		if(gMax==0) msg(ERROR,"%s must extend beyond zero energy",crossSections[s]);
+		col->gMax[s] = gMax;
+
+		long int r = 0;
+		for(int j=0;j<tableSize;j++){
+			double g = gMax*j/(tableSize-1);
+			double e = 0.5*mu*g*g;
+			while(r<nRows-1 && energy[r+1]<e) r++;
+			double sig = sigma[r];
+			if(r<nRows-1 && e>energy[r])
+				sig += (e-energy[r])*(sigma[r+1]-sigma[r])/(energy[r+1]-energy[r]);
+			table[j] = density*sig*g;
+			if(table[j]>col->nuMax[s]) col->nuMax[s] = table[j];
+		}
+
+		double p = 1-exp(-col->nuMax[s]);
+		if(p>0.1) msg(WARNING,"probability of collisions of specie %i is %.2f per "
+						"time step (should be below 0.1)",s,p);
+
+		free(energy);
+		free(sigma);
+	}
+
+	free(mass);
+	free(charge);
+	freeStrArr(processes);
+	freeStrArr(crossSections);
+
+	return col;
+}
+
+void colFree(Collider *col){
+
+	free(col->process);
+	free(col->table);
+	free(col->gMax);
+	free(col->nuMax);
+	free(col->massRatio);
+	free(col->charge);
+	free(col->mass);
+	free(col->weight);
+	free(col->cellStart);
+	free(col->cellStop);
+	memFree(col->index);
+	memFree(col->count);
+	free(col);
+}
+
+void colCollide(Collider *col, Population *pop, int n){
+
+	int tableSize = col->tableSize;
+	double thermal = col->neutralThermal;
+	long int nCandidates = 0;
+
+	for(int s=0;s<col->nSpecies;s++){
+
+		colProcess process = col->process[s];
+		double nuMax = col->nuMax[s];
+		if(process==COL_NONE || nuMax==0) continue;
+
+		const double *table = &col->table[s*tableSize];
+		double dg = col->gMax[s]/(tableSize-1);
+		double massRatio = col->massRatio[s];
+
+		Rng rng;
+		rngSet(&rng,col->seed,RNG_COLLISION,s,n);
+
+		long int iStart = pop->iStart[s];
+		long int nParticles = pop->iStop[s]-iStart;
+		long int nBlocks = (nParticles+COL_BLOCK-1)/COL_BLOCK;
+		double *vel = pop->vel;
+
+		#pragma omp parallel reduction(+:nCandidates)
+		{
+			unsigned long long int index[COL_BATCH];
+			long int candidate[COL_BATCH];
+			double skip[COL_BATCH];
+			double uniform[3*COL_BATCH];
+			double gauss[3*COL_BATCH];
+
+			#pragma omp for schedule(static)
+			for(long int b=0;b<nBlocks;b++){
+
+				long int i0 = iStart+b*COL_BLOCK;
+				long int nBlock = iStart+nParticles-i0;
+				if(nBlock>COL_BLOCK) nBlock = COL_BLOCK;
+
+				unsigned long long int base =
+					((unsigned long long int)col->subdomain<<COL_SUBDOMAIN_SHIFT)
+					+ ((unsigned long long int)b<<COL_BLOCK_SHIFT);
+
+				// The gaps between candidates are geometrically distributed
+				long int pos = -1;
+				for(long int k=0;pos<nBlock;k+=COL_BATCH){
+
+					for(int j=0;j<COL_BATCH;j++) index[j] = base+k+j;
+					rngUniform(&rng,index,COL_BATCH,1,skip);
+
+					int nBatch = 0;
+					for(int j=0;j<COL_BATCH && pos<nBlock;j++){
+						double gap = -log(skip[j])/nuMax;
+						pos = gap<nBlock ? pos+1+(long int)gap : nBlock;
+						if(pos<nBlock){
+							index[nBatch] = base+k+j;
+							candidate[nBatch++] = i0+pos;
+						}
+					}
+
+					for(int j=0;j<nBatch;j++) index[j] += COL_UNIFORM_INDEX;
+					rngUniform(&rng,index,nBatch,3,uniform);
+					for(int j=0;j<nBatch;j++) index[j] += COL_GAUSS_INDEX-COL_UNIFORM_INDEX;
+					rngGaussian(&rng,index,nBatch,3,gauss);
+					nCandidates += nBatch;
+
+					for(int j=0;j<nBatch;j++){
+
+						double *v = &vel[3*candidate[j]];
+						double *u = &uniform[3*j];
+
+						double vn[3], rel[3];
+						for(int d=0;d<3;d++){
+							vn[d] = thermal*gauss[3*j+d];
+							rel[d] = v[d]-vn[d];
+						}
+						double g = sqrt(rel[0]*rel[0]+rel[1]*rel[1]+rel[2]*rel[2]);
+
+						double x = g/dg, nu = table[tableSize-1];
+						if(x<tableSize-1){
+							int t = (int)x;
+							nu = table[t]+(x-t)*(table[t+1]-table[t]);
+						}
+
+						// Null collision
+						if(u[0]*nuMax>=nu) continue;
+
+						if(process==COL_EXCHANGE){
+							for(int d=0;d<3;d++) v[d] = vn[d];
+						} else {
+							double cosTheta = 2*u[1]-1;
+							double sinTheta = sqrt(1-cosTheta*cosTheta);
+							double phi = 2*M_PI*u[2];
+							double r = massRatio*g;
+							v[0] += r*sinTheta*cos(phi)-massRatio*rel[0];
+							v[1] += r*sinTheta*sin(phi)-massRatio*rel[1];
+							v[2] += r*cosTheta-massRatio*rel[2];
+						}
+					}
+				}
+			}
+		}
+	}
+
+	col->nCandidates = nCandidates;
+}
+
+void colCoulomb(Collider *col, Population *pop, const Grid *grid, int n){
+
+	col->nPairs = 0;
+	int interval = col->coulombInterval;
+	if(!interval || n%interval) return;
+
+	int nSpecies = col->nSpecies;
+	const long int *index = colIndexCells(col,pop,grid);
+	long int nCells = col->nCells;
+	double *vel = pop->vel;
+	long int nPairs = 0;
+
+	for(int a=0;a<nSpecies;a++){
+		for(int b=a;b<nSpecies;b++){
+
+			double qa = col->charge[a], qb = col->charge[b];
+			double ma = col->mass[a], mb = col->mass[b];
+			if(qa==0 || qb==0) continue;
+
+			// Variance of tan(theta/2) is coeff*n/u^3 (Takizuka and Abe)
+			double mu = ma*mb/(ma+mb);
+			double coeff = qa*qa*qb*qb*col->coulombLog*interval/(8*M_PI*mu*mu);
+			double fracA = mb/(ma+mb), fracB = ma/(ma+mb);
+
+			Rng rng;
+			rngSet(&rng,col->seed,RNG_COLLISION,nSpecies*(a+1)+b,n);
+
+			#pragma omp parallel reduction(+:nPairs)
+			{
+				long int nBuffer = 0;
+				long int *pa = NULL, *pb = NULL;
+				unsigned long long int *rIndex = NULL;
+				double *uniform = NULL, *gauss = NULL;
+
+				#pragma omp for schedule(dynamic,64)
+				for(long int c=0;c<nCells;c++){
+
+					long int startA = col->cellStart[a*nCells+c];
+					long int startB = col->cellStart[b*nCells+c];
+					long int na = col->cellStop[a*nCells+c]-startA;
+					long int nb = col->cellStop[b*nCells+c]-startB;
+					if(a==b ? na<2 : na<1 || nb<1) continue;
+
+					if(na+nb>nBuffer){
+						nBuffer = na+nb;
+						pa = realloc(pa,nBuffer*sizeof(*pa));
+						pb = realloc(pb,nBuffer*sizeof(*pb));
+						rIndex = realloc(rIndex,nBuffer*sizeof(*rIndex));
+						uniform = realloc(uniform,nBuffer*sizeof(*uniform));
+						gauss = realloc(gauss,nBuffer*sizeof(*gauss));
+					}
+
+					unsigned long long int base =
+						((unsigned long long int)col->subdomain<<COL_SUBDOMAIN_SHIFT)
+						+ ((unsigned long long int)c<<COL_CELL_SHIFT);
+
+					// Shuffle the particles of both species
+					long int nShuffle = a==b ? na : na+nb;
+					for(long int i=0;i<nShuffle;i++) rIndex[i] = base+i;
+					rngUniform(&rng,rIndex,nShuffle,1,uniform);
+					for(long int i=0;i<na;i++) pa[i] = index ? index[startA+i] : startA+i;
+					for(long int i=0;i<nb;i++) pb[i] = index ? index[startB+i] : startB+i;
+					for(long int i=na-1;i>0;i--){
+						long int j = (long int)(uniform[i]*(i+1));
+						long int t = pa[i]; pa[i] = pa[j]; pa[j] = t;
+					}
+					if(a!=b){
+						for(long int i=nb-1;i>0;i--){
+							long int j = (long int)(uniform[na+i]*(i+1));
+							long int t = pb[i]; pb[i] = pb[j]; pb[j] = t;
+						}
+					}
+
+					// Number of pairs, of which three are among the first three
+					// particles if their number is odd
+					long int np = a==b ? (na%2 ? (na-3)/2+3 : na/2) : (na>nb ? na : nb);
+
+					for(long int p=0;p<np;p++) rIndex[p] = base+p+COL_UNIFORM_INDEX;
+					rngUniform(&rng,rIndex,np,1,uniform);
+					for(long int p=0;p<np;p++) rIndex[p] += COL_GAUSS_INDEX-COL_UNIFORM_INDEX;
+					rngGaussian(&rng,rIndex,np,1,gauss);
+					nPairs += np;
+
+					if(a==b){
+
+						// Densities of physical particles, since cells have unit volume
+						double cn = coeff*na*col->weight[a];
+						long int p = 0, i0 = 0;
+						if(na%2){
+							for(int k=0;k<3;k++,p++)
+								colScatter(&vel[3*pa[k]],&vel[3*pa[(k+1)%3]],fracA,fracB,
+										   0.5*cn,gauss[p],uniform[p]);
+							i0 = 3;
+						}
+						for(long int i=i0;i<na;i+=2,p++)
+							colScatter(&vel[3*pa[i]],&vel[3*pa[i+1]],fracA,fracB,
+									   cn,gauss[p],uniform[p]);
+
+					} else {
+
+						double densA = na*col->weight[a], densB = nb*col->weight[b];
+						double cn = coeff*(densA<densB ? densA : densB);
+						for(long int p=0;p<np;p++)
+							colScatter(&vel[3*pa[p%na]],&vel[3*pb[p%nb]],fracA,fracB,
+									   cn,gauss[p],uniform[p]);
+					}
+				}
+
+				free(pa);
+				free(pb);
+				free(rIndex);
+				free(uniform);
+				free(gauss);
+			}
+		}
+	}
+
+	col->nPairs = nPairs;
+}
+
+void colCollideCost(Cost *cost, const Collider *col){
+
+	// Reading and writing velocities, and scattering
+	cost->bytes += col->nCandidates*6*sizeof(double);
+	cost->flops += col->nCandidates*40;
+}
+
+void colCoulombCost(Cost *cost, const Collider *col){
+
+	// Reading and writing the velocities of both particles, and scattering
+	cost->bytes += col->nPairs*12*sizeof(double);
+	cost->flops += col->nPairs*60;
+}
+
+/******************************************************************************
+ * DEFINING LOCAL FUNCTIONS
+ *****************************************************************************/
+
+// Sets the particles of each specie and cell, and returns the index (NULL if
+// the particles are sorted by cell already).
+static const long int *colIndexCells(Collider *col, const Population *pop,
+									 const Grid *grid){
+
+	int nSpecies = col->nSpecies;
+	int nDims = pop->nDims;
+	const int *size = &grid->size[1];
+	const long int *sizeProd = &grid->sizeProd[1];
+	long int nCells = grid->sizeProd[grid->rank]/grid->size[0];
+	int nThreads = thrCount();
+
+	// The cells change with the size of the subdomain (see gRebalance())
+	if(nCells!=col->nCells){
+		col->nCells = nCells;
+		col->cellStart = realloc(col->cellStart,nSpecies*nCells*sizeof(*col->cellStart));
+		col->cellStop = realloc(col->cellStop,nSpecies*nCells*sizeof(*col->cellStop));
+		memFree(col->count);
+		col->count = memAlloc(MEM_COLLISION,nThreads*nCells*sizeof(*col->count));
+	}
+
+	long int *cellStart = col->cellStart;
+	long int *cellStop = col->cellStop;
+	long int nMax = 0;
+
+	const Tiles *tiles = pop->tiles;
+	if(tiles && pop->sorted && tiles->tileSize==1 && tiles->nTiles==nCells){
+
+		// Each tile is a cell
+		for(int s=0;s<nSpecies;s++){
+			const long int *start = &tiles->start[s*(nCells+1)];
+			for(long int c=0;c<nCells;c++){
+				long int t = tiles->order[c];
+				cellStart[s*nCells+c] = start[t];
+				cellStop[s*nCells+c] = start[t+1];
+				if(start[t+1]-start[t]>nMax) nMax = start[t+1]-start[t];
+			}
+		}
+
+		if(nMax>COL_CELL_MAX)
+			msg(ERROR|ALL,"%li particles of a specie in a cell, but at most %li "
+						  "supported by Coulomb collisions",nMax,COL_CELL_MAX);
+		return NULL;
+	}
+
+	if(col->index==NULL)
+		col->index = memAlloc(MEM_COLLISION,pop->iStart[nSpecies]*sizeof(*col->index));
+
+	long int *index = col->index;
+	long int *count = col->count;
+	const double *pos = pop->pos;
+
+	for(int s=0;s<nSpecies;s++){
+
+		long int iStart = pop->iStart[s];
+		long int iStop = pop->iStop[s];
+
+		for(long int m=0;m<nThreads*nCells;m++) count[m] = 0;
+
+		// Counting sort like in pSortTiles()
+		#pragma omp parallel
+		{
+			long int *threadCount = &count[thrNum()*nCells];
+
+			#pragma omp for schedule(static)
+			for(long int i=iStart;i<iStop;i++){
+				long int c = 0;
+				for(int d=0;d<nDims;d++){
+					int j = (int)pos[i*nDims+d];
+					if(j>=size[d]) j = size[d]-1;
+					c += j*sizeProd[d];
+				}
+				threadCount[c]++;
+			}
+
+			#pragma omp single
+			{
+				long int offset = 0;
+				for(long int c=0;c<nCells;c++){
+					cellStart[s*nCells+c] = iStart+offset;
+					for(int t=0;t<nThreads;t++){
+						long int k = count[t*nCells+c];
+						count[t*nCells+c] = iStart+offset;
+						offset += k;
+					}
+					cellStop[s*nCells+c] = iStart+offset;
+					long int nCell = cellStop[s*nCells+c]-cellStart[s*nCells+c];
+					if(nCell>nMax) nMax = nCell;
+				}
+			}
+
+			#pragma omp for schedule(static)
+			for(long int i=iStart;i<iStop;i++){
+				long int c = 0;
+				for(int d=0;d<nDims;d++){
+					int j = (int)pos[i*nDims+d];
+					if(j>=size[d]) j = size[d]-1;
+					c += j*sizeProd[d];
+				}
+				index[threadCount[c]++] = i;
+			}
+		}
+	}
+
+	if(nMax>COL_CELL_MAX)
+		msg(ERROR|ALL,"%li particles of a specie in a cell, but at most %li "
+					  "supported by Coulomb collisions",nMax,COL_CELL_MAX);
+
+	return index;
+}
+
+// Scatters a pair of particles by a random angle in the center-of-mass frame,
+// where the variance of tan(theta/2) is coeff/u^3 for relative speed u.
+// frac1 and frac2 are the mass of the other particle over the sum of masses.
+static inline void colScatter(double *v1, double *v2, double frac1,
+							  double frac2, double coeff, double gauss,
+							  double uniform){
+
+	double ux = v1[0]-v2[0], uy = v1[1]-v2[1], uz = v1[2]-v2[2];
+	double uPerp2 = ux*ux+uy*uy;
+	double u = sqrt(uPerp2+uz*uz);
+	if(u==0) return;
+
+	double delta = gauss*sqrt(coeff/(u*u*u));
+	double sinTheta = 2*delta/(1+delta*delta);
+	double oneMinusCos = 2*delta*delta/(1+delta*delta);
+	double phi = 2*M_PI*uniform;
+	double cosPhi = cos(phi), sinPhi = sin(phi);
+
+	double dux, duy, duz;
+	if(uPerp2>0){
+		double uPerp = sqrt(uPerp2);
+		dux = (ux*uz*sinTheta*cosPhi-uy*u*sinTheta*sinPhi)/uPerp-ux*oneMinusCos;
+		duy = (uy*uz*sinTheta*cosPhi+ux*u*sinTheta*sinPhi)/uPerp-uy*oneMinusCos;
+		duz = -uPerp*sinTheta*cosPhi-uz*oneMinusCos;
+	} else {
+		dux = u*sinTheta*cosPhi;
+		duy = u*sinTheta*sinPhi;
+		duz = -u*oneMinusCos;
+	}
+
+	v1[0] += frac1*dux;
+	v1[1] += frac1*duy;
+	v1[2] += frac1*duz;
+	v2[0] -= frac2*dux;
+	v2[1] -= frac2*duy;
+	v2[2] -= frac2*duz;
+}
+
+// Reads the rows of two numbers in a file, skipping other lines
+static void colReadCrossSections(const char *fName, long int *nRows,
+								 double **energy, double **sigma){
+
+	FILE *file = fopen(fName,"r");
+	if(!file) msg(ERROR,"could not open %s",fName);
+
+	long int nAlloc = 64;
+	long int n = 0;
+	double *e = malloc(nAlloc*sizeof(*e));
+	double *sig = malloc(nAlloc*sizeof(*sig));
+
+	char line[256];
+	while(fgets(line,sizeof(line),file)){
+		double a, b;
+		if(sscanf(line,"%lf %lf",&a,&b)!=2) continue;
+		if(n==nAlloc){
+			nAlloc *= 2;
+			e = realloc(e,nAlloc*sizeof(*e));
+			sig = realloc(sig,nAlloc*sizeof(*sig));
+		}
+		if(n>0 && a<=e[n-1]) msg(ERROR,"energies in %s not increasing",fName);
+		e[n] = a;
+		sig[n] = b;
+		n++;
+	}
+	fclose(file);
+
+	if(n==0) msg(ERROR,"no cross sections in %s",fName);
+
+	*nRows = n;
+	*energy = e;
+	*sigma = sig;
+}
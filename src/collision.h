@@ -0,0 +1,167 @@
+/**
+ * @file		collision.h
+ * @brief		Monte Carlo collisions with neutrals and between particles.
+ *
+ * Particles collide with a uniform background of neutrals with the density,
+ * mass and thermal velocity given in the collisions section of the input
+ * file. The collision frequency of a particle, nu(g)=n*sigma(g)*g, depends on
+ * its speed g relative to the neutral it collides with. Rather than testing
+ * every particle every time step, the null-collision method is used: the
+ * probability of colliding with the largest collision frequency nuMax is the
+ * same for all particles, so the candidates for collisions can be selected by
+ * skipping a geometrically distributed number of particles at a time. Only the
+ * candidates draw a neutral velocity and evaluate the tabulated cross section,
+ * and collide with the probability nu(g)/nuMax. The rest are null collisions.
+ *
+ * The process of each specie is given by collisions:processes:
+ *
+ * - NONE:		No collisions.
+ * - ELASTIC:	Isotropic scattering in the center-of-mass frame.
+ * - EXCHANGE:	Charge exchange, i.e. the particle gets the neutral's velocity.
+ *
+ * The cross section of each specie is read from the file in
+ * collisions:crossSections with two columns: the kinetic energy in the
+ * center-of-mass frame in eV (in increasing order), and the cross section in
+ * m^2. Lines not starting with a number are skipped. The cross section is
+ * linearly interpolated, and taken as constant below the first energy. Above
+ * the last energy, the collision frequency is taken as constant.
+ *
+ * Particles also collide with each other by Coulomb collisions every
+ * collisions:coulombInterval time steps (0 disables) using the binary
+ * collision model of Takizuka and Abe, J. Comput. Phys. 25, 205 (1977). See
+ * colCoulomb().
+ *
+ * Only supported in 3D.
+ */
+
+#ifndef COLLISION_H
+#define COLLISION_H
+
+/**
+ * @brief Processes of collisions with neutrals
+ * @see Collider
+ */
+typedef enum{
+	COL_NONE,		///< No collisions
+	COL_ELASTIC,	///< Isotropic elastic scattering
+	COL_EXCHANGE	///< Charge exchange
+} colProcess;
+
+/**
+ * @brief Collisions of all species with the neutrals and each other
+ *
+ * The collision frequency of specie s is tabulated for tableSize equally
+ * spaced relative speeds from 0 to gMax[s], with one row per specie, and is
+ * in units of collisions per time step.
+ *
+ * The particles of specie s in cell c are index[i] for i from
+ * cellStart[s*nCells+c] to cellStop[s*nCells+c]-1, where the cells are
+ * numbered like the nodes of the grid. index is NULL when the Population is
+ * itself sorted by cell.
+ */
+typedef struct{
+	int nSpecies;			///< Number of species
+	colProcess *process;	///< Process of each specie
+	int tableSize;			///< Number of elements per table
+	double *table;			///< Collision frequency versus relative speed
+	double *gMax;			///< Relative speed of last table entry of each specie
+	double *nuMax;			///< Largest collision frequency of each specie
+	double *massRatio;		///< Mass of neutral over mass of neutral and particle
+	double neutralThermal;	///< Thermal velocity of neutrals
+	unsigned int seed;		///< Seed of random numbers (population:seed)
+	int subdomain;			///< Linear index of this MPI node's subdomain
+	long int nCandidates;	///< Candidates for collisions in last call to colCollide()
+	int coulombInterval;	///< Time steps between Coulomb collisions (0 disables)
+	double coulombLog;		///< Coulomb logarithm
+	double *charge;			///< Charge of a physical particle of each specie
+	double *mass;			///< Mass of a physical particle of each specie
+	double *weight;			///< Physical particles per simulation particle
+	long int nCells;		///< Number of cells in cellStart and cellStop
+	long int *cellStart;	///< First particle of each specie and cell in index
+	long int *cellStop;		///< First particle not of each specie and cell in index
+	long int *index;		///< Particles sorted by cell (nAlloc elements)
+	long int *count;		///< Particles per cell and thread when sorting
+	long int nPairs;		///< Colliding pairs in last call to colCoulomb()
+} Collider;
+
+/**
+ * @brief	Allocates a Collider and tabulates the collision frequencies
+ * @param	ini		Input file
+ * @param	units	Units
+ * @param	mpiInfo	MpiInfo
+ * @return	Pointer to Collider
+ *
+ * Must be called after uNormalize(). Warns if the probability of a candidate
+ * collision exceeds 0.1 per time step, since the particles can then only
+ * collide once per time step. Remember to free using colFree().
+ */
+Collider *colAlloc(const dictionary *ini, const Units *units,
+				   const MpiInfo *mpiInfo);
+
+/**
+ * @brief	Frees a Collider
+ * @param	col		Collider
+ */
+void colFree(Collider *col);
+
+/**
+ * @brief	Collides particles with neutrals for one time step
+ * @param			col		Collider
+ * @param[in,out]	pop		Population
+ * @param			n		Time step
+ *
+ * The particles of each specie are split into fixed blocks, which are
+ * distributed among the threads. Within a block, the random numbers of the
+ * candidates are drawn in batches from the RNG_COLLISION stream (see Rng),
+ * such that they do not depend on the number of threads.
+ *
+ * Call right after the accelerator, such that the velocities are at the same
+ * time as in the accelerator.
+ */
+void colCollide(Collider *col, Population *pop, int n);
+
+/**
+ * @brief	Coulomb collisions between the particles for one time step
+ * @param			col		Collider
+ * @param[in,out]	pop		Population (in local frame)
+ * @param			grid	Grid spanning the subdomain (e.g. rho)
+ * @param			n		Time step
+ *
+ * Does nothing unless n is a multiple of collisions:coulombInterval. Otherwise
+ * the particles in each cell are paired randomly for each pair of charged
+ * species, and each pair is scattered in its center-of-mass frame by an angle
+ * with a variance given by the densities in the cell and the time since the
+ * last call. Particles of the same specie are paired among themselves, with
+ * the first three colliding with each other at half the rate if their number
+ * is odd. For different species, each particle of the more numerous specie is
+ * paired with one of the other, which may thus collide several times. This
+ * conserves momentum and energy exactly for equal weights.
+ *
+ * The particles of each cell are found through an index, which is built by
+ * a counting sort over the positions. If pop is sorted by tiles of one cell
+ * (population:tileSize=1, see pSortTiles()), the tiles are used instead. The
+ * cells are distributed among the threads, and the random numbers of a cell
+ * are drawn from the RNG_COLLISION stream with the cell as index, such that
+ * they do not depend on the number of threads.
+ */
+void colCoulomb(Collider *col, Population *pop, const Grid *grid, int n);
+
+/**
+ * @brief	Adds the nominal work of the last call to colCollide() to cost
+ * @param[in,out]	cost	Cost
+ * @param			col		Collider
+ * @see		Cost
+ */
+void colCollideCost(Cost *cost, const Collider *col);
+
+/**
+ * @brief	Adds the nominal work of the last call to colCoulomb() to cost
+ * @param[in,out]	cost	Cost
+ * @param			col		Collider
+ * @see		Cost
+ *
+ * Counts only the work of the pairs, and not of building the index.
+ */
+void colCoulombCost(Cost *cost, const Collider *col);
+
+#endif // COLLISION_H
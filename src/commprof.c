@@ -0,0 +1,348 @@
+/**
+ * @file		commprof.c
+ * @brief		MPI communication profiler.
+ *
+ * Wrappers around MPI functions using the MPI profiling interface (PMPI). See
+ * commprof.h.
+ */
+
+#include "core.h"
+#include <stdarg.h>
+#include <string.h>
+
+#ifdef COMMPROF
+
+/******************************************************************************
+ * LOCAL VARIABLES AND FUNCTIONS
+ *****************************************************************************/
+
+typedef struct{
+	char label[CP_LABEL_LENGTH];	///< Category label
+	long int nCalls;				///< Number of calls
+	double bytes;					///< Bytes sent
+	double time;					///< Seconds spent inside MPI
+	double timeMax;					///< Largest time on any node (cpMsg() only)
+} CpRecord;
+
+static CpRecord *records = NULL;	// First record is "other"
+static int nRecords = 0;
+static int current = 0;				// Record currently counted to
+static double *peerBytes = NULL;	// Bytes sent to each rank in simComm
+
+// Record to count to. Allocated lazily since MPI may not be initialized yet.
+static CpRecord *cpCurrent(void){
+
+	if(records==NULL){
+		records = malloc(sizeof(*records));
+		strcpy(records[0].label,"other");
+		records[0].nCalls = 0;
+		records[0].bytes = 0;
+		records[0].time = 0;
+		nRecords = 1;
+		current = 0;
+	}
+
+	return &records[current];
+}
+
+static void cpCount(int count, MPI_Datatype type, int peer,
+					MPI_Comm comm, unsigned long long int start){
+
+	CpRecord *record = cpCurrent();
+
+	int typeSize = 0;
+	if(count>0) PMPI_Type_size(type,&typeSize);
+	double bytes = (double)count*typeSize;
+
+	record->nCalls++;
+	record->bytes += bytes;
+	record->time += (getNanoSec()-start)/1e9;
+
+	// The matrix uses ranks in simComm
+	if(peer<0 || bytes==0) return;
+	if(comm!=simComm){
+		MPI_Group group, simGroup;
+		PMPI_Comm_group(comm,&group);
+		PMPI_Comm_group(simComm,&simGroup);
+		int simPeer;
+		PMPI_Group_translate_ranks(group,1,&peer,simGroup,&simPeer);
+		PMPI_Group_free(&group);
+		PMPI_Group_free(&simGroup);
+		if(simPeer==MPI_UNDEFINED) return;
+		peer = simPeer;
+	}
+
+	// simComm is never larger than MPI_COMM_WORLD
+	if(peerBytes==NULL){
+		int worldSize;
+		PMPI_Comm_size(MPI_COMM_WORLD,&worldSize);
+		peerBytes = calloc(worldSize,sizeof(*peerBytes));
+	}
+	peerBytes[peer] += bytes;
+}
+
+static int cpCompareTime(const void *a, const void *b){
+
+	double ta = ((const CpRecord *)a)->time;
+	double tb = ((const CpRecord *)b)->time;
+	return (ta<tb) - (ta>tb);
+}
+
+/******************************************************************************
+ * DEFINING GLOBAL FUNCTIONS
+ *****************************************************************************/
+
+void cpBegin(const char *format, ...){
+
+	char label[CP_LABEL_LENGTH];
+	va_list args;
+	va_start(args,format);
+	vsnprintf(label,CP_LABEL_LENGTH,format,args);
+	va_end(args);
+
+	cpCurrent();
+
+	for(current=0;current<nRecords;current++){
+		if(!strcmp(records[current].label,label)) return;
+	}
+
+	records = realloc(records,(nRecords+1)*sizeof(*records));
+	strcpy(records[nRecords].label,label);
+	records[nRecords].nCalls = 0;
+	records[nRecords].bytes = 0;
+	records[nRecords].time = 0;
+	current = nRecords++;
+}
+
+void cpEnd(void){
+	current = 0;
+}
+
+void cpMsg(void){
+
+	cpCurrent();
+
+	int mpiRank, mpiSize, worldSize;
+	PMPI_Comm_rank(simComm,&mpiRank);
+	PMPI_Comm_size(simComm,&mpiSize);
+	PMPI_Comm_size(MPI_COMM_WORLD,&worldSize);
+
+	if(peerBytes==NULL) peerBytes = calloc(worldSize,sizeof(*peerBytes));
+
+	// Gather all records to rank 0. Categories may differ between nodes.
+	int *nBytes = NULL, *displs = NULL;
+	CpRecord *all = NULL;
+	int nLocalBytes = nRecords*sizeof(*records);
+
+	if(mpiRank==0){
+		nBytes = malloc(mpiSize*sizeof(*nBytes));
+		displs = malloc(mpiSize*sizeof(*displs));
+	}
+	PMPI_Gather(&nLocalBytes,1,MPI_INT,nBytes,1,MPI_INT,0,simComm);
+
+	int nAll = 0;
+	if(mpiRank==0){
+		int total = 0;
+		for(int r=0;r<mpiSize;r++){
+			displs[r] = total;
+			total += nBytes[r];
+		}
+		all = malloc(total);
+		nAll = total/sizeof(*all);
+	}
+	PMPI_Gatherv(records,nLocalBytes,MPI_BYTE,all,nBytes,displs,MPI_BYTE,0,
+				 simComm);
+
+	double *matrix = NULL;
+	if(mpiRank==0) matrix = malloc(mpiSize*mpiSize*sizeof(*matrix));
+	PMPI_Gather(peerBytes,mpiSize,MPI_DOUBLE,matrix,mpiSize,MPI_DOUBLE,0,
+				simComm);
+
+	if(mpiRank==0){
+
+		// Merge records with equal labels
+		int nMerged = 0;
+		CpRecord *merged = malloc(nAll*sizeof(*merged));
+		for(int i=0;i<nAll;i++){
+			int j;
+			for(j=0;j<nMerged;j++){
+				if(!strcmp(merged[j].label,all[i].label)) break;
+			}
+			if(j==nMerged){
+				merged[nMerged] = all[i];
+				merged[nMerged].timeMax = all[i].time;
+				nMerged++;
+			} else {
+				merged[j].nCalls += all[i].nCalls;
+				merged[j].bytes += all[i].bytes;
+				merged[j].time += all[i].time;
+				if(all[i].time>merged[j].timeMax) merged[j].timeMax = all[i].time;
+			}
+		}
+		qsort(merged,nMerged,sizeof(*merged),cpCompareTime);
+
+		msg(STATUS, "MPI communication (sum of all nodes, largest node):");
+		msg(STATUS, "  %-36s %10s %12s %10s %10s", "category", "calls", "MiB",
+			"time [s]", "max [s]");
+		for(int i=0;i<nMerged;i++){
+			if(merged[i].nCalls==0) continue;
+			msg(STATUS, "  %-36s %10li %12.3f %10.4f %10.4f", merged[i].label,
+				merged[i].nCalls, merged[i].bytes/(1<<20), merged[i].time,
+				merged[i].timeMax);
+		}
+
+		msg(STATUS, "MiB sent from node (row) to node (column):");
+		char *line = malloc(16*(mpiSize+1));
+		for(int r=0;r<mpiSize;r++){
+			char *pos = line;
+			pos += sprintf(pos,"  %6i:",r);
+			for(int c=0;c<mpiSize;c++){
+				pos += sprintf(pos," %10.3f",matrix[r*mpiSize+c]/(1<<20));
+			}
+			msg(STATUS, "%s", line);
+		}
+
+		free(line);
+		free(merged);
+		free(matrix);
+		free(all);
+		free(nBytes);
+		free(displs);
+	}
+
+	// Start over, such that each simulation in an ensemble is reported alone
+	for(int i=0;i<nRecords;i++){
+		records[i].nCalls = 0;
+		records[i].bytes = 0;
+		records[i].time = 0;
+	}
+	for(int r=0;r<worldSize;r++) peerBytes[r] = 0;
+}
+
+/******************************************************************************
+ * MPI WRAPPERS
+ *****************************************************************************/
+
+int MPI_Send(const void *buf, int count, MPI_Datatype datatype, int dest,
+			 int tag, MPI_Comm comm){
+
+	unsigned long long int start = getNanoSec();
+	int err = PMPI_Send(buf,count,datatype,dest,tag,comm);
+	cpCount(count,datatype,dest,comm,start);
+	return err;
+}
+
+int MPI_Recv(void *buf, int count, MPI_Datatype datatype, int source, int tag,
+			 MPI_Comm comm, MPI_Status *status){
+
+	unsigned long long int start = getNanoSec();
+	int err = PMPI_Recv(buf,count,datatype,source,tag,comm,status);
+	cpCount(0,datatype,-1,comm,start);
+	return err;
+}
+
+int MPI_Isend(const void *buf, int count, MPI_Datatype datatype, int dest,
+			  int tag, MPI_Comm comm, MPI_Request *request){
+
+	unsigned long long int start = getNanoSec();
+	int err = PMPI_Isend(buf,count,datatype,dest,tag,comm,request);
+	cpCount(count,datatype,dest,comm,start);
+	return err;
+}
+
+int MPI_Irecv(void *buf, int count, MPI_Datatype datatype, int source,
+			  int tag, MPI_Comm comm, MPI_Request *request){
+
+	unsigned long long int start = getNanoSec();
+	int err = PMPI_Irecv(buf,count,datatype,source,tag,comm,request);
+	cpCount(0,datatype,-1,comm,start);
+	return err;
+}
+
+int MPI_Sendrecv(const void *sendbuf, int sendcount, MPI_Datatype sendtype,
+				 int dest, int sendtag, void *recvbuf, int recvcount,
+				 MPI_Datatype recvtype, int source, int recvtag,
+				 MPI_Comm comm, MPI_Status *status){
+
+	unsigned long long int start = getNanoSec();
+	int err = PMPI_Sendrecv(sendbuf,sendcount,sendtype,dest,sendtag,
+							recvbuf,recvcount,recvtype,source,recvtag,
+							comm,status);
+	cpCount(sendcount,sendtype,dest,comm,start);
+	return err;
+}
+
+int MPI_Wait(MPI_Request *request, MPI_Status *status){
+
+	unsigned long long int start = getNanoSec();
+	int err = PMPI_Wait(request,status);
+	cpCount(0,MPI_BYTE,-1,MPI_COMM_WORLD,start);
+	return err;
+}
+
+int MPI_Waitall(int count, MPI_Request requests[], MPI_Status statuses[]){
+
+	unsigned long long int start = getNanoSec();
+	int err = PMPI_Waitall(count,requests,statuses);
+	cpCount(0,MPI_BYTE,-1,MPI_COMM_WORLD,start);
+	return err;
+}
+
+int MPI_Barrier(MPI_Comm comm){
+
+	unsigned long long int start = getNanoSec();
+	int err = PMPI_Barrier(comm);
+	cpCount(0,MPI_BYTE,-1,comm,start);
+	return err;
+}
+
+int MPI_Bcast(void *buffer, int count, MPI_Datatype datatype, int root,
+			  MPI_Comm comm){
+
+	unsigned long long int start = getNanoSec();
+	int err = PMPI_Bcast(buffer,count,datatype,root,comm);
+	cpCount(count,datatype,-1,comm,start);
+	return err;
+}
+
+int MPI_Reduce(const void *sendbuf, void *recvbuf, int count,
+			   MPI_Datatype datatype, MPI_Op op, int root, MPI_Comm comm){
+
+	unsigned long long int start = getNanoSec();
+	int err = PMPI_Reduce(sendbuf,recvbuf,count,datatype,op,root,comm);
+	cpCount(count,datatype,root,comm,start);
+	return err;
+}
+
+int MPI_Allreduce(const void *sendbuf, void *recvbuf, int count,
+				  MPI_Datatype datatype, MPI_Op op, MPI_Comm comm){
+
+	unsigned long long int start = getNanoSec();
+	int err = PMPI_Allreduce(sendbuf,recvbuf,count,datatype,op,comm);
+	cpCount(count,datatype,-1,comm,start);
+	return err;
+}
+
+int MPI_Gather(const void *sendbuf, int sendcount, MPI_Datatype sendtype,
+			   void *recvbuf, int recvcount, MPI_Datatype recvtype, int root,
+			   MPI_Comm comm){
+
+	unsigned long long int start = getNanoSec();
+	int err = PMPI_Gather(sendbuf,sendcount,sendtype,recvbuf,recvcount,recvtype,
+						  root,comm);
+	cpCount(sendcount,sendtype,root,comm,start);
+	return err;
+}
+
+int MPI_Allgather(const void *sendbuf, int sendcount, MPI_Datatype sendtype,
+				  void *recvbuf, int recvcount, MPI_Datatype recvtype,
+				  MPI_Comm comm){
+
+	unsigned long long int start = getNanoSec();
+	int err = PMPI_Allgather(sendbuf,sendcount,sendtype,recvbuf,recvcount,
+							 recvtype,comm);
+	cpCount(sendcount,sendtype,-1,comm,start);
+	return err;
+}
+
+#endif // COMMPROF
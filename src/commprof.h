@@ -0,0 +1,81 @@
+/**
+ * @file		commprof.h
+ * @brief		MPI communication profiler.
+ *
+ * Core module wrapping the MPI calls used by PINC through the MPI profiling
+ * interface (PMPI). When compiled in, every call to the wrapped functions is
+ * counted along with the bytes sent and the time spent inside MPI (including
+ * waiting). The statistics are kept per call site category, which the caller
+ * labels using cpBegin() and cpEnd(). Calls outside of a labelled region are
+ * counted as "other", which makes unexpected communication easy to spot.
+ *
+ * The profiler is optional and only compiled in if COMMPROF is defined, e.g.:
+ *
+ * @code
+ *	make CADD=-DCOMMPROF
+ * @endcode
+ *
+ * Otherwise, cpBegin(), cpEnd() and cpMsg() do nothing. The wrapped functions
+ * are MPI_Send(), MPI_Recv(), MPI_Isend(), MPI_Irecv(), MPI_Sendrecv(),
+ * MPI_Wait(), MPI_Waitall(), MPI_Barrier(), MPI_Bcast(), MPI_Reduce(),
+ * MPI_Allreduce(), MPI_Gather() and MPI_Allgather(). Since the wrappers
+ * replace the MPI functions in the whole executable, calls made by libraries
+ * such as HDF5 are also counted.
+ */
+
+#ifndef COMMPROF_H
+#define COMMPROF_H
+
+#ifdef COMMPROF
+
+/**
+ * @brief	Starts a labelled region of MPI calls
+ * @param	format	printf-like format specifier for the label
+ * @param	...		printf-like arguments
+ * @see		cpEnd()
+ *
+ * All wrapped MPI calls until the next call to cpEnd() are counted under the
+ * given label. Regions can not be nested. Example:
+ *
+ * @code
+ *	cpBegin("halo d%i", d);
+ *	MPI_Sendrecv(...);
+ *	cpEnd();
+ * @endcode
+ *
+ * The label is truncated to CP_LABEL_LENGTH-1 characters.
+ */
+void cpBegin(const char *format, ...);
+
+/**
+ * @brief	Ends a labelled region of MPI calls
+ * @see		cpBegin()
+ */
+void cpEnd(void);
+
+/**
+ * @brief	Prints communication statistics
+ *
+ * Collective operation. Prints a table of calls, bytes and time spent in MPI
+ * for each category (summed over MPI nodes, along with the largest time on
+ * any node), sorted by time. Then it prints the matrix of bytes sent from each
+ * MPI node (rows) to each MPI node (columns) by point-to-point calls and
+ * rooted collectives. Calls made by cpMsg() itself are not counted. Only the
+ * MPI nodes in simComm are included, and the statistics are reset afterwards.
+ */
+void cpMsg(void);
+
+#else
+
+#define cpBegin(...)
+#define cpEnd()
+#define cpMsg()
+
+#endif // COMMPROF
+
+/**
+ * @brief Maximum length of category labels (including terminating null)
+ */
+#define CP_LABEL_LENGTH 64
+
+#endif // COMMPROF_H
@@ -24,6 +24,147 @@
 /******************************************************************************
  * DEFINING CORE DATATYPES (used by several modules)
  *****************************************************************************/
+/**
+ * @brief Pool of tasks shared dynamically among the threads of an MPI node
+ * @see schAlloc(), schSubmit(), schNext()
+ *
+ * Each task has a weight, e.g. the number of particles in a tile, and the
+ * tasks are stored by their cumulative weight. When submitted, the tasks are
+ * split into contiguous ranges of roughly equal weight, one for each thread.
+ * This is the deque of the thread. A thread takes chunks of tasks from the
+ * front of its own deque, and when it is empty, steals chunks from the back of
+ * the others. The head and tail of each deque are packed into one word which
+ * is only changed by atomic compare-and-swap, so no locks are needed.
+ *
+ * The size of a chunk is chosen such that its weight is at least 'grain',
+ * which is large enough to make the overhead of taking it negligible, but
+ * small enough to let the threads finish at roughly the same time.
+ */
+typedef struct{
+	int nThreads;				///< Number of threads
+	long int nTasks;			///< Number of tasks submitted
+	long int nTasksAlloc;		///< Number of tasks allocated for
+	long int *cumWeight;		///< Cumulative weight before each task (nTasks+1 elements)
+	long int grain;				///< Least weight of a chunk of tasks
+	_Atomic unsigned long long int *deque;	///< Packed head and tail of the deques
+} Scheduler;
+
+/**
+ * @brief Division of a subdomain into tiles for sorting particles
+ * @see pSortTiles(), Population
+ *
+ * The subdomain is divided into tiles of tileSize cells along each dimension.
+ * The tiles are colored such that no two tiles of the same color are
+ * neighbors (2^nDims colors), and they are numbered color by color, starting
+ * with all tiles of color 0. Particles sorted by tile are thereby also sorted
+ * by color, and since particles in tiles of the same color never weigh to the
+ * same node, charge can be assigned from all tiles of one color concurrently.
+ *
+ * The particles of specie s in tile t are those from start[s*(nTiles+1)+t]
+ * to start[s*(nTiles+1)+t+1]-1.
+ */
+typedef struct{
+	int tileSize;			///< Number of cells per tile along each dimension
+	int nDims;				///< Number of dimensions
+	int *size;				///< Number of tiles along each dimension (nDims elements)
+	long int *sizeProd;		///< Cumulative product of size (nDims+1 elements)
+	long int nTiles;		///< Total number of tiles
+	long int *order;		///< Number of tile at row-major index (nTiles elements)
+	int nColors;			///< Number of colors (2^nDims)
+	long int *colorStart;	///< First tile of color c (nColors+1 elements)
+	long int *start;		///< First particle of each tile (nSpecies*(nTiles+1) elements)
+	long int *count;		///< Particles per tile and thread when sorting
+	double *buffer;			///< Position, velocity and weight of a specie when sorting
+} Tiles;
+
+/**
+ * @brief Purposes random numbers are drawn for
+ * @see Rng
+ *
+ * Each purpose has its own stream, such that e.g. adding velocities does not
+ * change the positions drawn.
+ */
+typedef enum{
+	RNG_POS,		///< Particle positions
+	RNG_VEL,		///< Particle velocities
+	RNG_COLLISION,	///< Collisions
+	RNG_INJECTION,	///< Injection of particles
+	RNG_BOUNDARY	///< Reflection of particles at boundaries
+} rngStream;
+
+/**
+ * @brief Counter-based random number generator
+ * @see rngSet(), rngUniform(), rngGaussian()
+ *
+ * Random numbers are computed by the Philox4x32-10 bijection of a counter,
+ * encrypted by a key. The key is the seed, stream and specie, and the counter
+ * is the time step and the index of an item, e.g. a particle or a cell. Thus,
+ * the numbers drawn for an item do not depend on which MPI node or thread
+ * draws them, nor on what has been drawn before. The struct is small and is
+ * meant to be declared on the stack.
+ */
+typedef struct{
+	unsigned int key[2];	///< Seed and stream/specie
+	unsigned int step;		///< Time step
+} Rng;
+
+/**
+ * @brief What happens to particles crossing an edge of the global domain
+ * @see Population
+ */
+typedef enum{
+	PBND_PERIODIC,		///< Reenter at the opposite edge
+	PBND_ABSORBING,		///< Removed
+	PBND_SPECULAR,		///< Reflected like by a mirror
+	PBND_DIFFUSE		///< Reemitted with a half-Maxwellian velocity
+} pBndType;
+
+/**
+ * @brief How the external fields vary in space
+ * @see External
+ */
+typedef enum{
+	EXT_CONSTANT,		///< Uniform
+	EXT_LINEAR,			///< Scaled by 1+k.x
+	EXT_COSINE			///< Scaled by cos(k.x)
+} extProfile;
+
+/**
+ * @brief External electric and magnetic fields acting on a population
+ * @see puAllocExternal()
+ *
+ * The fields given by fields:EExt and fields:BExt are not stored on a grid,
+ * but are added by the accelerators and Boris methods particle by particle.
+ * Both are scaled by the same profile f(x), where x is the position of the
+ * particle in the global reference frame, and k is fields:extWaveVector. For
+ * EXT_CONSTANT f is one, and the only cost is adding the per-specie constant
+ * acc to the velocity increment.
+ *
+ * acc[3*s+d] is the velocity increment of specie s during one time step due
+ * to the unscaled EExt, and T and S are the corresponding rotation parameters
+ * of the Boris methods due to BExt (named t and s in Birdsall & Langdon).
+ * They are precomputed for a time step of length dtFactor (see
+ * puExternalStep()). Where f is not one, the Boris methods scale T by f and
+ * recompute S for each particle.
+ *
+ * offset points to MpiInfo::offset, which follows the subdomain when load
+ * balancing moves it.
+ */
+typedef struct{
+	int nSpecies;			///< Number of species
+	int nDims;				///< Number of dimensions
+	extProfile profile;		///< Variation in space
+	double *k;				///< Wave vector or relative gradient (nDims elements)
+	const int *offset;		///< Offset of subdomain from global frame (nDims elements)
+	double *EExt;			///< External E-field (3 elements)
+	double *BExt;			///< External B-field (3 elements)
+	double *chargeOverMass;	///< Charge over mass (nSpecies elements)
+	double dtFactor;		///< Length of time step acc, T and S are computed for
+	double *acc;			///< Velocity increment by EExt (3*nSpecies elements, NULL if EExt is zero)
+	double *T;				///< Boris rotation parameter t (3*nSpecies elements)
+	double *S;				///< Boris rotation parameter s (3*nSpecies elements)
+} External;
+
 /**
  * @brief Contains a population of particles.
  *
@@ -55,6 +196,12 @@
  * (1,2,3) in the grid. Particles are usually specified in local frame but may
  * temporarily be expressed in global frame. See MpiInfo.
  *
+ * Each particle has nVelDims velocity components, stored like the positions
+ * with vel[i*nVelDims+d]. Usually nVelDims equals nDims, but a 2D grid may
+ * have nVelDims=3 (population:nVelDims), in which case the third component
+ * is normal to the grid (2D3V). It is then only changed by the magnetic field
+ * in the Boris methods, and is ignored when moving the particles.
+ *
  * kinEnergy and potEnergy stores the kinetic and potential energy of the
  * particles if an energy-computing function is utilized (see e.g. puAcc3D1KE
  * and gPotEnergy). Some energy-computing functions may be able to compute the
@@ -67,10 +214,48 @@
  *
  * If a population h5 output file is created, the handler to this file is
  * stored in h5.
+ *
+ * nPeak[s] is the largest number of particles of specie s this subdomain has
+ * held so far (i.e. the high-water mark of iStop[s]-iStart[s]). Comparing it
+ * to the allocated iStart[s+1]-iStart[s] tells how well population:nAlloc is
+ * sized. See puMemMsg().
+ *
+ * bnd tells what happens to particles crossing each edge of the global domain
+ * (in the order of grid:boundaries), and is applied when extracting emigrants
+ * (see puExtractEmigrantsND()). Diffusely reflected particles get the thermal
+ * velocity of their specie, drawn using seed and bndStep, which counts the
+ * calls to puExtractEmigrants*() such that each call draws new velocities. The
+ * number of particles and the kinetic energy absorbed by this subdomain since
+ * the last call to pWriteEnergy() is accumulated in absorbed and
+ * absorbedEnergy.
+ *
+ * The particle kernels are parallelized among the threads of an MPI node by
+ * the scheduler sch. If population:tileSize is non-zero, the particles can be
+ * sorted by spatial tiles using pSortTiles(), in which case the tiles are the
+ * tasks of the scheduler. 'sorted' tells whether the particles are still
+ * sorted, and is reset by any function moving particles in space or memory.
+ *
+ * If population:deltaF is set, the particles are markers of the deviation
+ * from a uniform Maxwellian background with the thermal velocity thermal[s]
+ * and the drift velocity drift[s] along each dimension, and weight[i] is the
+ * fraction of particle i which is this deviation. The weights move along with
+ * the particles, are deposited instead of the charge by the puDistr*()
+ * kernels and evolve in the puAcc*() kernels. Since the background is
+ * neutral, rho is then only the perturbed charge density. Absorbed particles
+ * count by their weights in absorbed and absorbedEnergy. Otherwise, weight
+ * and drift are NULL.
+ *
+ * fluid[s] is set if specie s is a fluid rather than particles, which is the
+ * case for the electrons (specie 0) with methods:poisson=mgBoltzSolver. No
+ * particles are allocated for, loaded into or injected into a fluid specie.
+ *
+ * ext holds the external fields applied by the particle kernels, and is NULL
+ * if there are none. It is not allocated by pAlloc(), see puAllocExternal().
  */
 typedef struct{
 	double *pos;		///< Position
 	double *vel;		///< Velocity
+	double *weight;		///< Delta-f weight (NULL if disabled)
 	long int *iStart;	///< First index of specie s (nSpecies+1 elements)
 	long int *iStop;	///< First index not of specie s (nSpecies elements)
 	double *charge;		///< Charge (nSpecies elements)
@@ -79,7 +264,21 @@ typedef struct{
 	double *potEnergy;	///< Potential energy (nSpecies+1 elements)
 	int nSpecies;		///< Number of species
 	int nDims;			///< Number of dimensions (usually 3)
+	int nVelDims;		///< Number of velocity components (nDims or 3)
 	hid_t h5;			///< HDF5 file handler
+	long int *nPeak;	///< Peak number of particles of specie s (nSpecies elements)
+	Scheduler *sch;		///< Scheduler of particle kernels
+	Tiles *tiles;		///< Tiles for sorting particles (NULL if disabled)
+	int sorted;			///< Whether particles are sorted by tile
+	pBndType *bnd;		///< Boundary at each edge (2*nDims elements)
+	double *thermal;	///< Thermal velocity (nSpecies elements)
+	double *drift;		///< Drift velocity of delta-f background (NULL if disabled)
+	unsigned int seed;	///< Seed of random numbers
+	unsigned int bndStep;	///< Step of random numbers of boundaries
+	double *absorbed;	///< Number of particles absorbed (nSpecies elements)
+	double *absorbedEnergy;	///< Kinetic energy absorbed (nSpecies elements)
+	int *fluid;			///< Whether specie s is a fluid (nSpecies elements)
+	External *ext;		///< External fields (NULL if none)
 } Population;
 
 /**
@@ -99,11 +298,17 @@ typedef struct{
  * reference frame. Adding/subtracting this to a position converts to/from the
  * global reference frame. See toLocalFrame(), toGlobalFrame().
  *
- * posToSubdomain is a factor which can be used to determine which subdomain a
- * globally specified position belongs to, e.g. for 1D:
+ * The subdomains form a rectilinear partition, i.e. the boundaries between
+ * subdomains are planes through the whole domain, but they need not be equally
+ * spaced. 'edges' holds the global position of the boundaries along each
+ * dimension, such that subdomain J along dimension d spans from edges[d][J] to
+ * edges[d][J+1], and edges[d][nSubdomains[d]] is the global size. Initially
+ * all subdomains have size grid:trueSize, but gRebalance() may move the edges.
+ * A globally specified position belongs to this subdomain along dimension d
+ * if:
  *
  * @code
- *	int J = (int)(posToNode[0]*pos[0]);
+ *	edges[d][subdomain[d]] <= pos[d] && pos[d] < edges[d][subdomain[d]+1]
  * @endcode
  */
 typedef struct{
@@ -114,7 +319,7 @@ typedef struct{
 	int *nSubdomains;			///< Number of MPI nodes (nDims elements)
 	int *nSubdomainsProd;		///< Cumulative product of nSubdomains (nDims+1 elements)
 	int *offset;				///< Offset from global reference frame (nDims elements)
-	double *posToSubdomain;		///< Factor for converting position to subdomain (nDims elements)
+	int **edges;				///< Global position of subdomain boundaries (nDims arrays of nSubdomains[d]+1 elements)
 
 	int nSpecies;				///< Number of species
 	int nNeighbors;				///< Number of neighbors (3^nDims-1) TBD: Omit if it's faster to recompute each time
@@ -125,6 +330,9 @@ typedef struct{
 	long int *nEmigrantsAlloc;	///< Number of migrants allocated for to each neighbor (nNeighbor elements)
 	long int *nImmigrants;		///< Number of immigrants of each specie from each neighbour (nSpecies*nNeighbor elements)
 	long int nImmigrantsAlloc;
+	long int *nEmigrantsPeak;	///< Peak number of emigrants to each neighbor (nNeighbor elements)
+	long int nImmigrantsPeak;	///< Peak number of doubles received in immigrants
+	int migrantSize;			///< Doubles per migrant (position, velocity and delta-f weight)
 	double **emigrants;			///< Buffer to house emigrants
 	double **emigrantsDummy;	///< YAY
 	double *immigrants;			///< Buffer to house immigrants
@@ -445,6 +653,92 @@ typedef struct{
 // void tic();
 // void toc();
 
+/**
+ * @brief Subsystems which memory is accounted for
+ * @see memAlloc(), memFree(), memMsg()
+ *
+ * Every allocation made through memAlloc() is tagged with one of these such
+ * that the current and peak number of bytes can be reported per subsystem.
+ */
+typedef enum{
+	MEM_POPULATION,	///< Particle positions and velocities
+	MEM_GRID,		///< Grid values and slice buffers
+	MEM_MIGRANTS,	///< Emigrant and immigrant buffers
+	MEM_MULTIGRID,	///< Multigrid sub-grids and work arrays
+	MEM_SPECTRAL,	///< Spectral solver arrays
+	MEM_OBJECT,		///< Object identifiers, surfaces and distance field
+	MEM_COLLISION,	///< Index of particles by cell for Coulomb collisions
+	MEM_TELEMETRY,	///< Arrays of the bandwidth measurement
+	MEM_NTAGS		///< Number of tags. Means "all tags" to memGetCurrent() etc.
+} memTag;
+
+/**
+ * @brief Phases of a time step timed by Telemetry
+ * @see Telemetry
+ */
+typedef enum{
+	TEL_MOVE,		///< Moving particles
+	TEL_MIGRATE,	///< Extracting and migrating particles
+	TEL_DISTR,		///< Distributing charge
+	TEL_SOLVE,		///< Solving for the potential
+	TEL_EFIELD,		///< Computing the E-field
+	TEL_ACC,		///< Accelerating particles
+	TEL_OUTPUT,		///< Diagnostics and writing to file
+	TEL_NPHASES		///< Number of phases
+} telPhase;
+
+/**
+ * @brief Nominal work done by a kernel
+ * @see Telemetry, telRooflineMsg()
+ *
+ * Counts the bytes a kernel must move to or from memory and the floating
+ * point operations it must perform, as derived from the algorithm rather than
+ * measured. Each kernel has a cost function adding the nominal work of one call
+ * (e.g. puDistrND1Cost() for puDistr3D1()). Divided by the time spent, this
+ * gives the achieved bandwidth and floating point rate of the kernel.
+ */
+typedef struct{
+	double bytes;		///< Bytes moved
+	double flops;		///< Floating point operations
+} Cost;
+
+/**
+ * @brief Live telemetry of a running simulation
+ * @see telAlloc(), telStep(), telFree()
+ *
+ * Keeps track of the progress of a run and periodically writes a small file
+ * in Prometheus text format with throughput, time per phase, ETA, memory and
+ * particles per MPI node. The phases are timed by the caller using the timers
+ * in 'phases':
+ *
+ * @code
+ *	tStart(tel->phases[TEL_MOVE]);
+ *	puMove(pop);
+ *	tStop(tel->phases[TEL_MOVE]);
+ * @endcode
+ *
+ * The same timers are used for the load imbalance diagnostics written to the
+ * history file by telWriteImbalance().
+ */
+typedef struct{
+	char *fName;				///< File to write telemetry to
+	double interval;			///< Seconds between each write (0 disables)
+	int nTimeSteps;				///< Total number of time steps in run
+	int nSteps;					///< Number of time steps completed
+	int nStepsLast;				///< Number of time steps completed at last write
+	long int nPushes;			///< Particle pushes since last write (this node)
+	unsigned long long int start;	///< Time of telAlloc()
+	unsigned long long int last;	///< Time of last write
+	Timer **phases;				///< Time spent in each phase (TEL_NPHASES elements)
+	unsigned long long int *phasesLast;	///< Phase totals at last write
+	Cost *costs;				///< Nominal work in each phase (TEL_NPHASES elements)
+	double bandwidth;			///< Memory bandwidth measured by telAlloc() [B/s]
+	int imbalanceInterval;		///< Time steps between each imbalance write (0 disables)
+	int imbalanceSnapshot;		///< Whether to write the values of every node as well
+	int nStepsImbalance;		///< Number of calls to telWriteImbalance()
+	unsigned long long int *phasesImbalance;	///< Phase totals at last imbalance write
+} Telemetry;
+
 
 /**
  * @brief Defines different types of messages
@@ -463,6 +757,20 @@ typedef enum{
  */
 typedef void (*funPtr)();
 
+/******************************************************************************
+ * DECLARING CORE VARIABLES
+ *****************************************************************************/
+
+/**
+ * @brief Communicator of all MPI nodes in the simulation
+ *
+ * Used instead of MPI_COMM_WORLD for all communication within a simulation,
+ * such that several simulations can run side by side in one MPI job (see
+ * ensemble mode in main.c). Equals MPI_COMM_WORLD except in ensemble mode.
+ * Defined in aux.c.
+ */
+extern MPI_Comm simComm;
+
 
 /******************************************************************************
  * INCLUDING CORE MODULES
@@ -472,6 +780,7 @@ typedef void (*funPtr)();
 #include "grid.h"
 #include "io.h"
 #include "aux.h"
+#include "commprof.h"
 #include "units.h"
 
 #endif // CORE_H
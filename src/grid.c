@@ -26,6 +26,7 @@
  * @return	The N-dimensional index of this MPI node
  */
 static int *getSubdomain(const dictionary *ini);
+static void gSetH5Spaces(Grid *grid, const MpiInfo *mpiInfo);
 
 /**
  * @brief Gets, sends, recieves and sets a slice, using MPI
@@ -150,8 +151,8 @@ static int *getSubdomain(const dictionary *ini){
 
 	// Get MPI info
 	int mpiSize, mpiRank;
-	MPI_Comm_size(MPI_COMM_WORLD,&mpiSize);
-	MPI_Comm_rank(MPI_COMM_WORLD,&mpiRank);
+	MPI_Comm_size(simComm,&mpiSize);
+	MPI_Comm_rank(simComm,&mpiRank);
 
 	// Get ini info
 	int nDims = iniGetInt(ini,"grid:nDims");
@@ -235,31 +236,30 @@ static void gExpandInner(	const double **in, double **out,
 	double *scalarVal = scalar->val;
 	double *fieldVal = field->val;
 
- 	// Scalar indices
-	long int sNext, sPrev;
-	long int f;
-	int fNext = fieldSizeProd[1];
-
 	long int start = alSum(&sizeProd[1], rank-1 );
 	long int end = sizeProd[rank]-start;
 
-
-	// Centered Finite difference
+	// Centered Finite difference. Indices are computed from g such that the
+	// iterations are independent.
 	for(int d = 1; d < rank; d++){
-		sNext = start + sizeProd[d];
-		sPrev = start - sizeProd[d];
-		f = start*fieldSizeProd[1] + (d-1);
-
+		long int step = sizeProd[d];
 
-		for(int g = start; g < end; g++){
-			fieldVal[f] = 0.5*(scalarVal[sNext] - scalarVal[sPrev]);
-			sNext++;
-			sPrev++;
-			f += fNext;
+		#pragma omp parallel for schedule(static)
+		for(long int g = start; g < end; g++){
+			long int f = g*fieldSizeProd[1] + (d-1);
+			fieldVal[f] = 0.5*(scalarVal[g+step] - scalarVal[g-step]);
 		}
 	}
 }
 
+void gFinDiff1stCost(Cost *cost, const Grid *scalar, const Grid *field){
+
+	// One pass per dimension reading scalar and writing one field component
+	int rank = scalar->rank;
+	long int nNodes = scalar->sizeProd[rank];
+	cost->bytes += (rank-1)*2*nNodes*sizeof(double);
+	cost->flops += (rank-1)*2*nNodes;
+}
 
 void gFinDiff2ndND(Grid *result, const Grid *object){
 
@@ -383,25 +383,31 @@ void gHaloOpDim(funPtr sliceOp, Grid *grid, const MpiInfo *mpiInfo, int d, opDir
 
 	MPI_Status 	status;
 
+	// Grids are told apart by kind and size (e.g. multigrid levels)
+	cpBegin("halo %s %li nodes d%i %s", size[0]==1 ? "scalar" : "vector",
+			sizeProd[rank]/size[0], d, dir==TOHALO ? "to" : "from");
+
 	// TBD: Ommitting this seems to yield race condition between consecutive
 	// calls to gHaloOpDim(). I'm not quite sure why so this should be
 	// investigated further.
-	MPI_Barrier(MPI_COMM_WORLD);
+	MPI_Barrier(simComm);
 
 	// Send and recieve upper (tag 1)
 	getSlice(sendSlice, grid, d, offsetUpperTake);
 	MPI_Sendrecv(sendSlice, nSlicePoints, MPI_DOUBLE, upperSubdomain, 1,
                  recvSlice, nSlicePoints, MPI_DOUBLE, lowerSubdomain, 1,
-                 MPI_COMM_WORLD, &status);
+                 simComm, &status);
 	sliceOp(recvSlice, grid, d, offsetLowerPlace);
 
 	// Send and recieve lower (tag 0)
 	getSlice(sendSlice, grid, d, offsetLowerTake);
 	MPI_Sendrecv(sendSlice, nSlicePoints, MPI_DOUBLE, lowerSubdomain, 0,
                  recvSlice, nSlicePoints, MPI_DOUBLE, upperSubdomain, 0,
-                 MPI_COMM_WORLD, &status);
+                 simComm, &status);
 	sliceOp(recvSlice, grid, d, offsetUpperPlace);
 
+	cpEnd();
+
 }
 
 
@@ -413,8 +419,8 @@ Grid *gAlloc(const dictionary *ini, int nValues){
 
 	// Get MPI info
 	int mpiSize, mpiRank;
-	MPI_Comm_size(MPI_COMM_WORLD,&mpiSize);
-	MPI_Comm_rank(MPI_COMM_WORLD,&mpiRank);
+	MPI_Comm_size(simComm,&mpiSize);
+	MPI_Comm_rank(simComm,&mpiRank);
 
 	// Load data from ini
 	int nDims = iniGetInt(ini, "grid:nDims");
@@ -460,10 +466,10 @@ Grid *gAlloc(const dictionary *ini, int nValues){
 	}
 
 	// Memory for values and a slice
-	double *val = malloc(sizeProd[rank]*sizeof(*val));
-	double *sendSlice = malloc(nSliceMax*sizeof(*sendSlice));
-	double *recvSlice = malloc(nSliceMax*sizeof(*recvSlice));
-	double *bndSlice = malloc(2*rank*nSliceMax*sizeof(*bndSlice));
+	double *val = memAlloc(MEM_GRID,sizeProd[rank]*sizeof(*val));
+	double *sendSlice = memAlloc(MEM_GRID,nSliceMax*sizeof(*sendSlice));
+	double *recvSlice = memAlloc(MEM_GRID,nSliceMax*sizeof(*recvSlice));
+	double *bndSlice = memAlloc(MEM_GRID,2*rank*nSliceMax*sizeof(*bndSlice));
 	// Maybe seek a different solution where it is only stored where needed
 
 	bndType *bnd = malloc(2*rank*sizeof(*bnd));
@@ -495,6 +501,9 @@ Grid *gAlloc(const dictionary *ini, int nValues){
 	grid->bndSlice = bndSlice;
 	grid->bnd = bnd;
 
+	// Zero by the threads working on it to place the pages near them
+	gZero(grid);
+
 	return grid;
 }
 
@@ -502,12 +511,14 @@ MpiInfo *gAllocMpi(const dictionary *ini){
 
 	// Get MPI info
 	int mpiSize, mpiRank;
-	MPI_Comm_size(MPI_COMM_WORLD,&mpiSize);
-	MPI_Comm_rank(MPI_COMM_WORLD,&mpiRank);
+	MPI_Comm_size(simComm,&mpiSize);
+	MPI_Comm_rank(simComm,&mpiRank);
 
 	// Load data from ini
 	int nDims = iniGetInt(ini, "grid:nDims");
 	int nSpecies = iniGetInt(ini, "population:nSpecies");
+	int nVelDims = iniGetInt(ini, "population:nVelDims");
+	int deltaF = iniGetInt(ini, "population:deltaF");
 	int *nSubdomains = iniGetIntArr(ini, "grid:nSubdomains", nDims);
 	int *nGhostLayers = iniGetIntArr(ini, "grid:nGhostLayers", 2*nDims);
 	int *trueSize = iniGetIntArr(ini, "grid:trueSize", nDims);
@@ -517,12 +528,13 @@ MpiInfo *gAllocMpi(const dictionary *ini){
 	//Position of the subdomain in the total domain
 	int *subdomain = getSubdomain(ini);
 	int *offset = malloc(nDims*sizeof(*offset));
-	double *posToSubdomain = malloc(nDims*sizeof(*posToSubdomain));
+	int **edges = malloc(nDims*sizeof(*edges));
 
+	// Equally sized subdomains to begin with
 	for(int d = 0; d < nDims; d++){
-		// offset[d] = subdomain[d]*trueSize[d];
-		offset[d] = subdomain[d]*trueSize[d]-nGhostLayers[d];
-		posToSubdomain[d] = (double)1/trueSize[d];
+		edges[d] = malloc((nSubdomains[d]+1)*sizeof(**edges));
+		for(int J=0;J<=nSubdomains[d];J++) edges[d][J] = J*trueSize[d];
+		offset[d] = edges[d][subdomain[d]]-nGhostLayers[d];
 	}
 
     MpiInfo *mpiInfo = malloc(sizeof(*mpiInfo));
@@ -531,12 +543,13 @@ MpiInfo *gAllocMpi(const dictionary *ini){
 	mpiInfo->nSubdomainsProd = nSubdomainsProd;
 	mpiInfo->offset = offset;
 	mpiInfo->nDims = nDims;
-	mpiInfo->posToSubdomain = posToSubdomain;
+	mpiInfo->edges = edges;
 	mpiInfo->mpiSize = mpiSize;
 	mpiInfo->mpiRank = mpiRank;
 
 	mpiInfo->nSpecies = nSpecies;
 	mpiInfo->nNeighbors = 0;	// Neighbourhood not created
+	mpiInfo->migrantSize = nDims+nVelDims+(deltaF!=0);
 
 	free(trueSize);
 
@@ -549,7 +562,8 @@ void gFreeMpi(MpiInfo *mpiInfo){
 	free(mpiInfo->nSubdomains);
 	free(mpiInfo->nSubdomainsProd);
 	free(mpiInfo->offset);
-	free(mpiInfo->posToSubdomain);
+	for(int d=0;d<mpiInfo->nDims;d++) free(mpiInfo->edges[d]);
+	free(mpiInfo->edges);
 	free(mpiInfo);
 
 }
@@ -560,14 +574,70 @@ void gFree(Grid *grid){
 	free(grid->trueSize);
 	free(grid->sizeProd);
 	free(grid->nGhostLayers);
-	free(grid->val);
-	free(grid->sendSlice);
-	free(grid->recvSlice);
+	memFree(grid->val);
+	memFree(grid->sendSlice);
+	memFree(grid->recvSlice);
+	memFree(grid->bndSlice);
 	free(grid->bnd);
 	free(grid);
 
 }
 
+void gResize(Grid *grid, const int *trueSize){
+
+	int rank = grid->rank;
+	int *size = grid->size;
+	int *nGhostLayers = grid->nGhostLayers;
+	long int *sizeProd = grid->sizeProd;
+
+	for(int d=1;d<rank;d++){
+		grid->trueSize[d] = trueSize[d-1];
+		size[d] = trueSize[d-1] + nGhostLayers[d] + nGhostLayers[d+rank];
+	}
+	ailCumProd(size,sizeProd,rank);
+
+	long int nSliceMax = 0;
+	for(int d=0;d<rank;d++){
+		long int nSlice = 1;
+		for(int dd=0;dd<rank;dd++){
+			if(dd!=d) nSlice *= size[dd];
+		}
+		if(nSlice>nSliceMax) nSliceMax = nSlice;
+	}
+
+	memFree(grid->val);
+	memFree(grid->sendSlice);
+	memFree(grid->recvSlice);
+	memFree(grid->bndSlice);
+	grid->val = memAlloc(MEM_GRID,sizeProd[rank]*sizeof(*grid->val));
+	grid->sendSlice = memAlloc(MEM_GRID,nSliceMax*sizeof(*grid->sendSlice));
+	grid->recvSlice = memAlloc(MEM_GRID,nSliceMax*sizeof(*grid->recvSlice));
+	grid->bndSlice = memAlloc(MEM_GRID,2*rank*nSliceMax*sizeof(*grid->bndSlice));
+	gZero(grid);
+
+}
+
+void gFitToSubdomain(Grid *grid, const MpiInfo *mpiInfo){
+
+	int nDims = mpiInfo->nDims;
+	int *subdomain = mpiInfo->subdomain;
+	int **edges = mpiInfo->edges;
+
+	int *trueSize = malloc(nDims*sizeof(*trueSize));
+	for(int d=0;d<nDims;d++)
+		trueSize[d] = edges[d][subdomain[d]+1]-edges[d][subdomain[d]];
+
+	gResize(grid,trueSize);
+	free(trueSize);
+
+	if(grid->h5){
+		H5Sclose(grid->h5MemSpace);
+		H5Sclose(grid->h5FileSpace);
+		gSetH5Spaces(grid,mpiInfo);
+	}
+
+}
+
 int *gGetGlobalSize(const dictionary *ini){
 
 	int nDims = iniGetInt(ini,"grid:nDims");
@@ -668,13 +738,22 @@ void gMul(Grid *grid, double num){
 
 	int rank = grid->rank;
 	long int nElements = grid->sizeProd[rank];
+	#pragma omp parallel for schedule(static)
 	for(long int p=0;p<nElements;p++) grid->val[p] *= num;
 }
 
+void gMulCost(Cost *cost, const Grid *grid){
+
+	long int nElements = grid->sizeProd[grid->rank];
+	cost->bytes += 2*nElements*sizeof(double);
+	cost->flops += nElements;
+}
+
 void gAdd(Grid *grid, double num){
 
 	int rank = grid->rank;
 	long int nElements = grid->sizeProd[rank];
+	#pragma omp parallel for schedule(static)
 	for(long int p=0;p<nElements;p++) grid->val[p] += num;
 }
 
@@ -682,6 +761,7 @@ void gSub(Grid *grid, double num){
 
 	int rank = grid->rank;
 	long int nElements = grid->sizeProd[rank];
+	#pragma omp parallel for schedule(static)
 	for(long int p=0;p<nElements;p++) grid->val[p] -= num;
 }
 
@@ -690,6 +770,7 @@ void gSquare(Grid *grid){
 	int rank = grid->rank;
 	long int nElements = grid->sizeProd[rank];
 	double *val = grid->val;
+	#pragma omp parallel for schedule(static)
 	for(long int g=0;g<nElements;g++) val[g] = val[g]*val[g];
 
 }
@@ -699,6 +780,7 @@ void gZero(Grid *grid){
 
 	int rank = grid->rank;
 	long int nElements = grid->sizeProd[rank];
+	#pragma omp parallel for schedule(static)
 	for(long int p=0;p<nElements;p++) grid->val[p] = 0;
 }
 
@@ -732,18 +814,19 @@ void gNeutralizeGrid(Grid *grid, const MpiInfo *mpiInfo){
 	int *trueSize = grid->trueSize;
 	int *nGhostLayers = grid->nGhostLayers;
 	int rank = grid->rank;
-	int mpiSize = mpiInfo->mpiSize;
-
 
-
-	double myCharge = gNeutralizeGridInner(&val,&nGhostLayers[rank-1],
+	// Subdomains may have different sizes so the volume is summed as well
+	double my[2], tot[2];
+	my[0] = gNeutralizeGridInner(&val,&nGhostLayers[rank-1],
 					&nGhostLayers[2*rank-1],&trueSize[rank-1],&sizeProd[rank-1]);
-	double totCharge = 0;
+	my[1] = (double)aiProd(&trueSize[1],rank-1);
 
-	MPI_Barrier(MPI_COMM_WORLD);
-	MPI_Allreduce(&myCharge, &totCharge, 1, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+	cpBegin("neutralization");
+	MPI_Barrier(simComm);
+	MPI_Allreduce(my, tot, 2, MPI_DOUBLE, MPI_SUM, simComm);
+	cpEnd();
 
-	double avgCharge = totCharge/((double)aiProd(&trueSize[1] , rank-1)*mpiSize);
+	double avgCharge = tot[0]/tot[1];
 
 	gSub(grid, avgCharge);
 
@@ -786,6 +869,7 @@ void gAddTo(Grid *result, Grid *addition){
 	double *resultVal = result->val;
 	double *addVal = addition->val;
 
+	#pragma omp parallel for schedule(static)
 	for(long int g = 0; g < sizeProd[rank]; g++)	resultVal[g] += addVal[g];
 
 }
@@ -797,6 +881,7 @@ void gSubFrom(Grid *result, const Grid *subtraction){
 	double *resultVal = result->val;
 	double *subVal = subtraction->val;
 
+	#pragma omp parallel for schedule(static)
 	for(long int g = 0; g < sizeProd[rank]; g++)	resultVal[g] -= subVal[g];
 
 }
@@ -849,12 +934,19 @@ double gSumTruegrid(const Grid *grid){
 long int gTotTruesize(const Grid *grid, const MpiInfo *mpiInfo){
 
 	int *nSubdomains = mpiInfo->nSubdomains;
+	int *subdomain = mpiInfo->subdomain;
+	int **edges = mpiInfo->edges;
 	int *trueSize = grid->trueSize;
 	int rank = grid->rank;
 
 	long int totTruesize = 1;
 
-	for(int r = 1; r < rank; r++) 	totTruesize *= nSubdomains[r-1]*trueSize[r];
+	// The grid may be coarser than the subdomain (e.g. multigrid levels)
+	for(int r = 1; r < rank; r++){
+		int d = r-1;
+		int width = edges[d][subdomain[d]+1]-edges[d][subdomain[d]];
+		totTruesize *= edges[d][nSubdomains[d]]/(width/trueSize[r]);
+	}
 
 	return totTruesize;
 }
@@ -863,7 +955,9 @@ void gAssertNeutralGrid(const Grid *rho, const MpiInfo *mpiInfo){
 
 	double sum = gSumTruegrid(rho);
 	double totSum = 1.;
-	MPI_Allreduce(&sum, &totSum, 1, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+	cpBegin("neutrality assertion");
+	MPI_Allreduce(&sum, &totSum, 1, MPI_DOUBLE, MPI_SUM, simComm);
+	cpEnd();
 
 	if( totSum < -0.001 || totSum > 0.001) msg(ERROR, "Total charge is %f", totSum);
 }
@@ -993,8 +1087,6 @@ void gBnd(Grid *grid, const MpiInfo *mpiInfo){
 
 	int rank = grid->rank;
 	bndType *bnd = grid->bnd;
-	int *subdomain = mpiInfo->subdomain;
-	int *nSubdomains = mpiInfo->nSubdomains;
 
 	//If periodic neutralize phi
 	int periodic = 0;
@@ -1003,6 +1095,18 @@ void gBnd(Grid *grid, const MpiInfo *mpiInfo){
 	}
 	if(periodic)	gPeriodic(grid, mpiInfo);
 
+	gBndEdges(grid, mpiInfo);
+
+	return;
+}
+
+void gBndEdges(Grid *grid, const MpiInfo *mpiInfo){
+
+	int rank = grid->rank;
+	bndType *bnd = grid->bnd;
+	int *subdomain = mpiInfo->subdomain;
+	int *nSubdomains = mpiInfo->nSubdomains;
+
 	//Lower edge
 	for(int d = 1; d < rank; d++){
 		if(subdomain[d-1] == 0){
@@ -1032,6 +1136,7 @@ void gCreateNeighborhood(const dictionary *ini, MpiInfo *mpiInfo, Grid *grid){
 
 	int nDims = mpiInfo->nDims;
 	int nSpecies = mpiInfo->nSpecies;
+	int migrantSize = mpiInfo->migrantSize;
 	int *size = grid->size;
 
 	// COMPUTE SIMPLE VARIABLES
@@ -1087,8 +1192,8 @@ void gCreateNeighborhood(const dictionary *ini, MpiInfo *mpiInfo, Grid *grid){
 	double **emigrantsDummy = malloc(nNeighbors*sizeof(**emigrantsDummy));
 	for(int i=0;i<nNeighbors;i++)
 		if(i!=neighborhoodCenter){
-			migrants[i] = malloc(nEmigrantsAlloc[i]*sizeof(*migrants));
-			emigrants[i] = malloc(2*nDims*nEmigrantsAlloc[i]*sizeof(*emigrants));
+			migrants[i] = memAlloc(MEM_MIGRANTS,nEmigrantsAlloc[i]*sizeof(**migrants));
+			emigrants[i] = memAlloc(MEM_MIGRANTS,migrantSize*nEmigrantsAlloc[i]*sizeof(**emigrants));
 		}
 
 	double *thresholds = iniGetDoubleArr(ini,"grid:thresholds",2*nDims);
@@ -1103,8 +1208,11 @@ void gCreateNeighborhood(const dictionary *ini, MpiInfo *mpiInfo, Grid *grid){
 	long int *nEmigrants = malloc(nNeighbors*nSpecies*sizeof(*nEmigrants));
 	long int *nImmigrants = malloc(nNeighbors*nSpecies*sizeof(*nImmigrants));
 
-	long int nImmigrantsAlloc = 2*nDims*alMax(nEmigrantsAlloc,nNeighbors);
-	double *immigrants = malloc(nImmigrantsAlloc*sizeof(*immigrants));
+	long int nImmigrantsAlloc = migrantSize*alMax(nEmigrantsAlloc,nNeighbors);
+	double *immigrants = memAlloc(MEM_MIGRANTS,nImmigrantsAlloc*sizeof(*immigrants));
+
+	long int *nEmigrantsPeak = malloc(nNeighbors*sizeof(*nEmigrantsPeak));
+	alSetAll(nEmigrantsPeak,nNeighbors,0);
 
 	MPI_Request *send = malloc(nNeighbors*sizeof(*send));
 	MPI_Request *recv = malloc(nNeighbors*sizeof(*recv));
@@ -1125,6 +1233,8 @@ void gCreateNeighborhood(const dictionary *ini, MpiInfo *mpiInfo, Grid *grid){
 	mpiInfo->nImmigrants = nImmigrants;
 	mpiInfo->nEmigrantsAlloc = nEmigrantsAlloc;
 	mpiInfo->nImmigrantsAlloc = nImmigrantsAlloc;
+	mpiInfo->nEmigrantsPeak = nEmigrantsPeak;
+	mpiInfo->nImmigrantsPeak = 0;
 	mpiInfo->thresholds = thresholds;
 	mpiInfo->immigrants = immigrants;
 	mpiInfo->neighborhoodCenter = neighborhoodCenter;
@@ -1137,8 +1247,8 @@ void gDestroyNeighborhood(MpiInfo *mpiInfo){
 	double **emigrants = mpiInfo->emigrants;
 	for(int neigh=0;neigh<mpiInfo->nNeighbors;neigh++){
 		if(neigh!=mpiInfo->neighborhoodCenter){
-			free(migrants[neigh]);
-			free(emigrants[neigh]);
+			memFree(migrants[neigh]);
+			memFree(emigrants[neigh]);
 		}
 	}
 	free(migrants);
@@ -1147,19 +1257,123 @@ void gDestroyNeighborhood(MpiInfo *mpiInfo){
 	free(mpiInfo->emigrantsDummy);
 	mpiInfo->nNeighbors = 0;
 	free(mpiInfo->nEmigrantsAlloc);
+	free(mpiInfo->nEmigrantsPeak);
 	free(mpiInfo->thresholds);
-	free(mpiInfo->immigrants);
+	memFree(mpiInfo->immigrants);
+	free(mpiInfo->nEmigrants);
 	free(mpiInfo->nImmigrants);
 	free(mpiInfo->send);
 	free(mpiInfo->recv);
 }
 
+/*****************************************************************************
+ *		LOAD BALANCING
+ ****************************************************************************/
+
+int gRebalance(MpiInfo *mpiInfo, double cost, int granularity){
+
+	int nDims = mpiInfo->nDims;
+	int *nSubdomains = mpiInfo->nSubdomains;
+	int *subdomain = mpiInfo->subdomain;
+	int *offset = mpiInfo->offset;
+	double *thresholds = mpiInfo->thresholds;
+	int **edges = mpiInfo->edges;
+
+	const double tolerance = 0.05;	// Accepted imbalance (max/mean-1)
+	const double relaxation = 0.5;	// Fraction of the way to move the edges
+
+	cpBegin("rebalancing");
+
+	double costMax, costSum;
+	MPI_Allreduce(&cost,&costMax,1,MPI_DOUBLE,MPI_MAX,simComm);
+	MPI_Allreduce(&cost,&costSum,1,MPI_DOUBLE,MPI_SUM,simComm);
+
+	if(costSum<=0 || costMax*mpiInfo->mpiSize/costSum < 1+tolerance){
+		cpEnd();
+		return 0;
+	}
+
+	int changed = 0;
+	for(int d=0;d<nDims;d++){
+
+		int nJ = nSubdomains[d];
+		if(nJ==1) continue;
+
+		int J = subdomain[d];
+		int *old = edges[d];
+		int L = old[nJ];
+
+		// Cost per node along d, summed over all subdomains. Each subdomain
+		// contributes its cost uniformly over the nodes it spans.
+		double *density = calloc(L,sizeof(*density));
+		double *cumulative = malloc((L+1)*sizeof(*cumulative));
+		for(int j=old[J];j<old[J+1];j++) density[j] = cost/(old[J+1]-old[J]);
+		MPI_Allreduce(MPI_IN_PLACE,density,L,MPI_DOUBLE,MPI_SUM,simComm);
+
+		cumulative[0] = 0;
+		for(int j=0;j<L;j++) cumulative[j+1] = cumulative[j]+density[j];
+
+		// Place the inner edges at equal amounts of cumulative cost. Each edge
+		// is kept between its old neighbors such that particles move at most
+		// one subdomain, and no subdomain gets narrower than 'granularity'.
+		int *newEdges = malloc((nJ+1)*sizeof(*newEdges));
+		newEdges[0] = 0;
+		newEdges[nJ] = L;
+		int j = 0;
+		for(int e=1;e<nJ;e++){
+
+			double target = cumulative[L]*e/nJ;
+			while(j<L-1 && cumulative[j+1]<target) j++;
+			double pos = j;
+			if(density[j]>0) pos += (target-cumulative[j])/density[j];
+
+			// Move at least one step unless the target is closest to old edge
+			int step = (int)round(relaxation*(pos-old[e])/granularity);
+			if(step==0 && (int)round((pos-old[e])/granularity)!=0)
+				step = pos>old[e] ? 1 : -1;
+			int edge = granularity*(int)round((double)old[e]/granularity);
+			edge += step*granularity;
+
+			// The limits are rounded inwards to multiples of 'granularity'
+			int lower = old[e-1];
+			if(newEdges[e-1]+granularity>lower) lower = newEdges[e-1]+granularity;
+			lower = granularity*((lower+granularity-1)/granularity);
+			int upper = old[e+1];
+			if(L-(nJ-e)*granularity<upper) upper = L-(nJ-e)*granularity;
+			upper = granularity*(upper/granularity);
+
+			if(edge<lower) edge = lower;
+			if(edge>upper) edge = upper;
+			if(lower>upper) edge = old[e];
+			newEdges[e] = edge;
+		}
+
+		offset[d] += newEdges[J]-old[J];
+		thresholds[nDims+d] += (newEdges[J+1]-newEdges[J])-(old[J+1]-old[J]);
+
+		for(int e=0;e<=nJ;e++){
+			if(newEdges[e]!=old[e]) changed = 1;
+			old[e] = newEdges[e];
+		}
+
+		free(newEdges);
+		free(density);
+		free(cumulative);
+	}
+
+	cpEnd();
+
+	return changed;
+}
+
 /******************************************************************************
  * H5 FUNCTIONS
  *****************************************************************************/
 
 void gWriteH5(const Grid *grid, const MpiInfo *mpiInfo, double n){
 
+	cpBegin("hdf5 grid");
+
 	hid_t fileSpace = grid->h5FileSpace;
 	hid_t memSpace = grid->h5MemSpace;
 	hid_t file = grid->h5;
@@ -1177,6 +1391,8 @@ void gWriteH5(const Grid *grid, const MpiInfo *mpiInfo, double n){
 
 	H5Dclose(dataset);
 	H5Pclose(pList);
+
+	cpEnd();
 }
 
 void gReadH5(Grid *grid, const MpiInfo *mpiInfo, double n){
@@ -1207,8 +1423,11 @@ void gCloseH5(Grid *grid){
 	H5Fclose(grid->h5);
 }
 
-void gOpenH5(const dictionary *ini, Grid *grid, const MpiInfo *mpiInfo,
-			 const Units *units, double denorm, const char *fName){
+/*
+ * Hyperslabs selecting the true grid in memory and this subdomain's part of
+ * the file. The subdomains need not be equally sized (see MpiInfo).
+ */
+static void gSetH5Spaces(Grid *grid, const MpiInfo *mpiInfo){
 
 	int rank = grid->rank;
 	int nDims = rank-1;
@@ -1217,37 +1436,24 @@ void gOpenH5(const dictionary *ini, Grid *grid, const MpiInfo *mpiInfo,
 	int	*nGhostLayers = grid->nGhostLayers;
 	int *nSubdomains = mpiInfo->nSubdomains;
 	int *subdomain = mpiInfo->subdomain;
-
-	/*
-	 * CREATE FILE
-	 */
-
-	hid_t file = openH5File(ini,fName,"grid");
-
-	/*
-	 * CREATE ATTRIBUTES
-	 */
-
-	setH5Attr(file,"Axis denormalization factor",&units->length,1);
-	setH5Attr(file,"Quantity denormalization factor",&denorm,1);
-
-	/*
-	 * HDF5 HYPERSLAB DEFINITION
-	 */
+	int **edges = mpiInfo->edges;
 
 	hsize_t *fileDims 	= malloc(rank*sizeof(*fileDims));
 	hsize_t *memDims 	= malloc(rank*sizeof(*memDims));
 	hsize_t *memOffset 	= malloc(rank*sizeof(*memOffset));
 	hsize_t *fileOffset = malloc(rank*sizeof(*fileOffset));
 
-	for(int d=0;d<rank;d++){
+	for(int d=0;d<nDims;d++){
 		// HDF5 indices needs to be reversed compared to ours due to non-C ordering.
-		memDims[d]		= (hsize_t)size[rank-d-1];
-		memOffset[d]	= (hsize_t)nGhostLayers[rank-d-1];
-		fileDims[d]		= (hsize_t)trueSize[rank-d-1]*nSubdomains[rank-d-2];
-		fileOffset[d]	= (hsize_t)trueSize[rank-d-1]*subdomain[rank-d-2];
+		int dd = rank-d-2;
+		memDims[d]		= (hsize_t)size[dd+1];
+		memOffset[d]	= (hsize_t)nGhostLayers[dd+1];
+		fileDims[d]		= (hsize_t)edges[dd][nSubdomains[dd]];
+		fileOffset[d]	= (hsize_t)edges[dd][subdomain[dd]];
 	}
 
+	memDims[rank-1] = (hsize_t)size[0];
+	memOffset[rank-1] = (hsize_t)nGhostLayers[0];
 	fileDims[rank-1] = (hsize_t)trueSize[0];
 	fileOffset[rank-1] = (hsize_t)0.;
 
@@ -1263,9 +1469,32 @@ void gOpenH5(const dictionary *ini, Grid *grid, const MpiInfo *mpiInfo,
 	free(memOffset);
 	free(fileOffset);
 
-	grid->h5 = file;
 	grid->h5MemSpace = memSpace;
 	grid->h5FileSpace = fileSpace;
+}
+
+void gOpenH5(const dictionary *ini, Grid *grid, const MpiInfo *mpiInfo,
+			 const Units *units, double denorm, const char *fName){
+
+	/*
+	 * CREATE FILE
+	 */
+
+	hid_t file = openH5File(ini,fName,"grid");
+
+	/*
+	 * CREATE ATTRIBUTES
+	 */
+
+	setH5Attr(file,"Axis denormalization factor",&units->length,1);
+	setH5Attr(file,"Quantity denormalization factor",&denorm,1);
+
+	/*
+	 * HDF5 HYPERSLAB DEFINITION
+	 */
+
+	gSetH5Spaces(grid,mpiInfo);
+	grid->h5 = file;
 
 }
 
@@ -48,6 +48,33 @@ Grid *gAlloc(const dictionary *ini, int nValues);
  */
 void gFree(Grid *grid);
 
+/**
+ * @brief Changes the number of true grid points of a grid
+ * @param	grid		Grid
+ * @param	trueSize	New number of true grid points (nDims elements)
+ * @return	void
+ *
+ * The values, slice buffers and boundary slices are reallocated. The values
+ * are set to zero while the contents of the slices are undefined afterwards.
+ * Ghost layers and boundary types are kept.
+ * The HDF5 hyperslabs are not updated (see gFitToSubdomain()).
+ */
+void gResize(Grid *grid, const int *trueSize);
+
+/**
+ * @brief Resizes a grid to span this MPI node's subdomain
+ * @param	grid		Grid
+ * @param	mpiInfo		MpiInfo
+ * @return	void
+ * @see		gRebalance()
+ *
+ * Uses gResize() to give the grid the size of the subdomain according to
+ * MpiInfo::edges, and updates the HDF5 hyperslabs if the grid has an open
+ * .grid.h5-file. Values are not preserved but set to zero. Boundary slices
+ * must be set again using gSetBndSlices() if used.
+ */
+void gFitToSubdomain(Grid *grid, const MpiInfo *mpiInfo);
+
 /**
  * @brief Set boundary slices
  * @param   grid    Grid
@@ -274,6 +301,14 @@ void gCopy(const Grid *original, Grid *copy);
  */
 void gMul(Grid *grid, double num);
 
+/**
+ * @brief Adds the nominal work of gMul() to cost
+ * @param[in,out]	cost	Cost
+ * @param			grid	Grid
+ * @see Cost
+ */
+void gMulCost(Cost *cost, const Grid *grid);
+
 /**
  * @brief Add all values in grid by a number
  * @param	grid	Grid
@@ -315,6 +350,15 @@ long int gTotTruesize(const Grid *grid, const MpiInfo *mpiInfo);
 
 void gFinDiff1st(const Grid *scalar, Grid *field);
 
+/**
+ * @brief Adds the nominal work of gFinDiff1st() to cost
+ * @param[in,out]	cost	Cost
+ * @param			scalar	Value to do the finite differencing on
+ * @param			field	Field returned after derivating
+ * @see Cost
+ */
+void gFinDiff1stCost(Cost *cost, const Grid *scalar, const Grid *field);
+
 /**
  * @brief Performs a 2nd order central space finite difference on a grid
  * @param 	rho 	Value to do the finite differencing on
@@ -401,6 +445,16 @@ void gAssertNeutralGrid(const Grid *rho, const MpiInfo *mpiInfo);
  */
 void gBnd(Grid *grid, const MpiInfo *mpiInfo);
 
+/**
+ * @brief Applies Dirichlet and Neumann boundary conditions to edge
+ * @param 	grid		Grid to apply boundary conditions to
+ * @param	mpiInfo		Info about subdomain
+ *
+ * Like gBnd() but does not neutralize periodic grids. Used when the mean of
+ * the grid is fixed by the equation itself, e.g. by a linear term.
+ */
+void gBndEdges(Grid *grid, const MpiInfo *mpiInfo);
+
 /**
  * @brief	Assign particles artificial positions suitable for debugging
  * @param			ini				Input file dictionary
@@ -504,6 +558,45 @@ void gCreateNeighborhood(const dictionary *ini, MpiInfo *mpiInfo, Grid *grid);
  */
 void gDestroyNeighborhood(MpiInfo *mpiInfo);
 
+/**
+ * @brief Moves subdomain boundaries to even out the load between MPI nodes
+ * @param[in,out]	mpiInfo		MpiInfo
+ * @param			cost		Measured cost of this subdomain (e.g. seconds)
+ * @param			granularity	Subdomain sizes are kept multiples of this
+ * @return			1 if any boundary moved, 0 otherwise
+ *
+ * Collective operation. The subdomains are kept as a rectilinear partition
+ * (see MpiInfo), where the boundaries along each dimension are moved towards
+ * the positions where the cost, summed over the slabs of subdomains and
+ * assumed evenly distributed within each subdomain, is equally shared. Nothing
+ * is done unless the largest cost exceeds the mean by more than 5%.
+ *
+ * To avoid oscillations the boundaries are moved only halfway towards their
+ * target, and never past the old position of the neighboring boundaries. The
+ * latter ensures that particles migrate at most one subdomain. The edges are
+ * placed at multiples of 'granularity' (use mgGranularity() for the multigrid
+ * solver), such that all but the last subdomain along each dimension have
+ * sizes that are multiples of it. The migration thresholds and offsets in 'mpiInfo' are updated, but
+ * not particles or grids. The recommended procedure is:
+ *
+ * @code
+ *	pToGlobalFrame(pop, mpiInfo);
+ *	int changed = gRebalance(mpiInfo, cost, granularity);
+ *	pToLocalFrame(pop, mpiInfo);
+ *	if(changed){
+ *		puReserveEmigrants(pop, mpiInfo);
+ *		extractEmigrants(pop, mpiInfo);
+ *		puMigrate(pop, mpiInfo, rho);
+ *		gFitToSubdomain(rho, mpiInfo);
+ *		// ... other grids, and reallocate solver
+ *	}
+ * @endcode
+ *
+ * Grid quantities must be recomputed afterwards. The population must be
+ * allocated large enough to take the extra particles.
+ */
+int gRebalance(MpiInfo *mpiInfo, double cost, int granularity);
+
 /**
  * @brief Computes potential energy
  * @param		rho		Charge density
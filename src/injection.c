@@ -0,0 +1,343 @@
+/**
+ * @file		injection.c
+ * @brief		Particle injection through the edges of the domain.
+ *
+ * See injection.h.
+ */
+
+#define _XOPEN_SOURCE 700
+
+#include "core.h"
+#include "injection.h"
+#include <string.h>
+
+/******************************************************************************
+ * DECLARING LOCAL FUNCTIONS
+ *****************************************************************************/
+
+static void injTabulate(double drift, double thermal, int tableSize,
+						double *table);
+
+// Number of particles to draw random numbers for at a time
+#define INJ_BATCH 256
+
+// Resolution of the distribution integrated by injTabulate() per table entry
+#define INJ_RESOLUTION 16
+
+// Index of the random numbers of a cell on a face are its global index on the
+// face times 2*nDims plus the face number, shifted by INJ_CELL_SHIFT, plus the
+// particle number. The number of particles to inject is drawn from
+// INJ_COUNT_INDEX and the Gaussian velocities from INJ_GAUSS_INDEX added to
+// this, such that all indices are different.
+#define INJ_CELL_SHIFT 24
+#define INJ_COUNT_INDEX (1ULL<<23)
+#define INJ_GAUSS_INDEX (1ULL<<63)
+
+/******************************************************************************
+ * DEFINING GLOBAL FUNCTIONS
+ *****************************************************************************/
+
+Injector *injAlloc(const dictionary *ini, const Population *pop,
+				   const MpiInfo *mpiInfo){
+
+	// Read from ini
+	int nDims = iniGetInt(ini,"grid:nDims");
+	int nSpecies = iniGetInt(ini,"population:nSpecies");
+	long int *nParticles = iniGetLongIntArr(ini,"population:nParticles",nSpecies);
+	double *drift = iniGetDoubleArr(ini,"population:drift",nSpecies);
+	double *thermal = iniGetDoubleArr(ini,"population:thermalVelocity",nSpecies);
+	char **faces = iniGetStrArr(ini,"injection:faces",2*nDims);
+	char **boundaries = iniGetStrArr(ini,"grid:boundaries",2*nDims);
+	int tableSize = iniGetInt(ini,"injection:tableSize");
+	unsigned int seed = (unsigned int)iniGetInt(ini,"population:seed");
+
+	if(tableSize<2) msg(ERROR,"injection:tableSize must be at least 2");
+
+	// Read from mpiInfo
+	int *subdomain = mpiInfo->subdomain;
+	int *nSubdomains = mpiInfo->nSubdomains;
+	int **edges = mpiInfo->edges;
+	int *offset = mpiInfo->offset;
+
+	long int volume = 1;
+	for(int d=0;d<nDims;d++) volume *= edges[d][nSubdomains[d]];
+
+	Injector *inj = malloc(sizeof(*inj));
+	inj->nDims = nDims;
+	inj->nSpecies = nSpecies;
+	inj->tableSize = tableSize;
+	inj->drift = drift;
+	inj->thermal = thermal;
+	inj->seed = seed;
+	inj->lower = malloc(nDims*sizeof(*inj->lower));
+	inj->size = malloc(nDims*sizeof(*inj->size));
+	inj->face = malloc(2*nDims*sizeof(*inj->face));
+	inj->facePos = malloc(2*nDims*sizeof(*inj->facePos));
+	inj->origin = malloc(nDims*sizeof(*inj->origin));
+	inj->globalSize = malloc(nDims*sizeof(*inj->globalSize));
+
+	for(int d=0;d<nDims;d++){
+		inj->origin[d] = edges[d][subdomain[d]];
+		inj->globalSize[d] = edges[d][nSubdomains[d]];
+		inj->lower[d] = edges[d][subdomain[d]]-offset[d];
+		inj->size[d] = edges[d][subdomain[d]+1]-edges[d][subdomain[d]];
+	}
+
+	// Faces of the global domain belonging to this subdomain
+	int nFaces = 0;
+	for(int f=0;f<2*nDims;f++){
+
+		int d = f%nDims;
+		int upper = f>=nDims;
+
+		if(!strcmp(faces[f],"NONE")) continue;
+		if(strcmp(faces[f],"MAXWELL"))
+			msg(ERROR,"%s invalid value for injection:faces",faces[f]);
+		if(!strcmp(boundaries[f],"PERIODIC"))
+			msg(ERROR,"can't inject through face %i since its grid:boundaries "
+					  "is PERIODIC",f);
+
+		if(subdomain[d]!=(upper ? nSubdomains[d]-1 : 0)) continue;
+
+		inj->face[nFaces] = f;
+		inj->facePos[nFaces] = inj->lower[d] + (upper ? inj->size[d] : 0);
+		nFaces++;
+	}
+	inj->nFaces = nFaces;
+
+	// Indices of the cells on all faces must fit above INJ_CELL_SHIFT
+	if(2*nDims*(unsigned long long int)volume>=(1ULL<<(63-INJ_CELL_SHIFT)))
+		msg(ERROR,"the domain is too large for injection");
+
+	inj->table = malloc(nSpecies*nFaces*tableSize*sizeof(*inj->table));
+	inj->rate = malloc(nSpecies*nFaces*sizeof(*inj->rate));
+
+	for(int s=0;s<nSpecies;s++){
+		for(int i=0;i<nFaces;i++){
+
+			int f = inj->face[i];
+
+			// Drift into the domain
+			double u = f<nDims ? drift[s] : -drift[s];
+
+			// A fluid specie is not particles (see Population::fluid)
+			double density = pop->fluid[s] ? 0 : (double)nParticles[s]/volume;
+			inj->rate[s*nFaces+i] = density*injFlux(u,thermal[s]);
+			if(inj->rate[s*nFaces+i]>=INJ_COUNT_INDEX/2)
+				msg(ERROR,"too many particles of specie %i injected per cell",s);
+			injTabulate(u,thermal[s],tableSize,
+						&inj->table[(s*nFaces+i)*tableSize]);
+		}
+	}
+
+	free(nParticles);
+	freeStrArr(faces);
+	freeStrArr(boundaries);
+
+	return inj;
+}
+
+void injFree(Injector *inj){
+
+	free(inj->face);
+	free(inj->facePos);
+	free(inj->table);
+	free(inj->rate);
+	free(inj->drift);
+	free(inj->thermal);
+	free(inj->lower);
+	free(inj->size);
+	free(inj->origin);
+	free(inj->globalSize);
+	free(inj);
+}
+
+void injInject(const Injector *inj, Population *pop, int n){
+
+	int nDims = inj->nDims;
+	int nVelDims = pop->nVelDims;
+	int nFaces = inj->nFaces;
+	int tableSize = inj->tableSize;
+
+	for(int s=0;s<inj->nSpecies;s++){
+
+		Rng rng;
+		rngSet(&rng,inj->seed,RNG_INJECTION,s,n);
+
+		for(int i=0;i<nFaces;i++){
+
+			int f = inj->face[i];
+			int d = f%nDims;
+			double sign = f<nDims ? 1 : -1;
+			double facePos = inj->facePos[i];
+			const double *table = &inj->table[(s*nFaces+i)*tableSize];
+			double drift = inj->drift[s];
+			double thermal = inj->thermal[s];
+
+			// Cells of the face belonging to this subdomain
+			long int nCells = 1;
+			for(int dd=0;dd<nDims;dd++) if(dd!=d) nCells *= (long int)inj->size[dd];
+
+			// Index of each cell from its global position on the face
+			unsigned long long int *base = malloc(nCells*sizeof(*base));
+			long int *first = malloc((nCells+1)*sizeof(*first));
+			double *u = malloc(nCells*sizeof(*u));
+			for(long int c=0;c<nCells;c++){
+				unsigned long long int global = 0, stride = 1;
+				long int rest = c;
+				for(int dd=0;dd<nDims;dd++){
+					if(dd==d) continue;
+					long int size = (long int)inj->size[dd];
+					global += (inj->origin[dd]+rest%size)*stride;
+					stride *= inj->globalSize[dd];
+					rest /= size;
+				}
+				base[c] = ((global*2*nDims+f)<<INJ_CELL_SHIFT) + INJ_COUNT_INDEX;
+			}
+
+			// Random rounding of the mean number of particles of each cell
+			double rate = inj->rate[s*nFaces+i];
+			rngUniform(&rng,base,nCells,1,u);
+			for(long int c=0;c<nCells;c++) base[c] -= INJ_COUNT_INDEX;
+			first[0] = 0;
+			for(long int c=0;c<nCells;c++)
+				first[c+1] = first[c] + (long int)rate + (u[c]<rate-(long int)rate);
+			long int nNew = first[nCells];
+
+			long int iStart = pop->iStop[s];
+			if(iStart+nNew>pop->iStart[s+1])
+				msg(ERROR|ALL,	"allocated only %li particles of specie %i per node but "
+							"%li needed after injection", pop->iStart[s+1]-pop->iStart[s],
+							s, iStart+nNew-pop->iStart[s]);
+
+			#pragma omp parallel
+			{
+				// Speed and time since crossing, then position in the cell
+				int nUniform = nDims+1;
+				unsigned long long int index[INJ_BATCH];
+				double *uniform = malloc(INJ_BATCH*nUniform*sizeof(*uniform));
+				double *gauss = malloc(INJ_BATCH*nVelDims*sizeof(*gauss));
+				double *corner = malloc(nDims*sizeof(*corner));
+
+				#pragma omp for schedule(static)
+				for(long int c=0;c<nCells;c++){
+
+					long int rest = c;
+					for(int dd=0;dd<nDims;dd++){
+						if(dd==d) continue;
+						long int size = (long int)inj->size[dd];
+						corner[dd] = inj->lower[dd]+rest%size;
+						rest /= size;
+					}
+
+					long int nCell = first[c+1]-first[c];
+					for(long int k0=0;k0<nCell;k0+=INJ_BATCH){
+
+						long int nBatch = nCell-k0;
+						if(nBatch>INJ_BATCH) nBatch = INJ_BATCH;
+
+						for(long int k=0;k<nBatch;k++) index[k] = base[c]+k0+k;
+						rngUniform(&rng,index,nBatch,nUniform,uniform);
+						for(long int k=0;k<nBatch;k++) index[k] += INJ_GAUSS_INDEX;
+						rngGaussian(&rng,index,nBatch,nVelDims,gauss);
+
+						for(long int k=0;k<nBatch;k++){
+
+							long int p = iStart+first[c]+k0+k;
+							double *r = &uniform[k*nUniform];
+							double *g = &gauss[k*nVelDims];
+							double *pos = &pop->pos[p*nDims];
+							double *vel = &pop->vel[p*nVelDims];
+
+							double x = r[0]*(tableSize-1);
+							int j = (int)x;
+							if(j>tableSize-2) j = tableSize-2;
+							double speed = table[j]+(x-j)*(table[j+1]-table[j]);
+
+							for(int dd=0;dd<nDims;dd++){
+								if(dd==d){
+									vel[dd] = sign*speed;
+									pos[dd] = facePos;
+								} else {
+									vel[dd] = drift+thermal*g[dd];
+									pos[dd] = corner[dd]+r[2+dd-(dd>d)];
+								}
+								pos[dd] += r[1]*vel[dd];
+							}
+							for(int dd=nDims;dd<nVelDims;dd++) vel[dd] = drift+thermal*g[dd];
+
+							// Particles at an upper face belong to the next subdomain
+							if(sign<0 && pos[d]>=facePos) pos[d] = nextafter(facePos,0);
+
+							// Injected particles are part of the unperturbed background
+							if(pop->weight) pop->weight[p] = 0;
+						}
+					}
+				}
+
+				free(uniform);
+				free(gauss);
+				free(corner);
+			}
+
+			pop->iStop[s] += nNew;
+			free(base);
+			free(first);
+			free(u);
+		}
+	}
+
+	if(nFaces) pop->sorted = 0;
+}
+
+double injFlux(double drift, double thermal){
+
+	if(thermal==0) return drift>0 ? drift : 0;
+
+	double a = drift/(sqrt(2)*thermal);
+	return thermal/sqrt(2*M_PI)*exp(-a*a) + 0.5*drift*(1+erf(a));
+}
+
+/******************************************************************************
+ * DEFINING LOCAL FUNCTIONS
+ *****************************************************************************/
+
+// Inverse CDF of v*exp(-(v-drift)^2/(2*thermal^2)) for v>0 at tableSize
+// equally spaced probabilities from 0 to 1.
+static void injTabulate(double drift, double thermal, int tableSize,
+						double *table){
+
+	// Cold (or fully outflowing) species enter with the drift, if at all
+	if(thermal==0 || injFlux(drift,thermal)==0){
+		for(int j=0;j<tableSize;j++) table[j] = drift>0 ? drift : 0;
+		return;
+	}
+
+	// Integrate the distribution by the trapezoidal rule
+	int nPoints = INJ_RESOLUTION*tableSize;
+	double vMax = (drift>0 ? drift : 0) + 8*thermal;
+	double dv = vMax/(nPoints-1);
+	double *cdf = malloc(nPoints*sizeof(*cdf));
+
+	double fLast = 0;
+	cdf[0] = 0;
+	for(int p=1;p<nPoints;p++){
+		double v = p*dv;
+		double a = (v-drift)/thermal;
+		double f = v*exp(-0.5*a*a);
+		cdf[p] = cdf[p-1]+0.5*(f+fLast)*dv;
+		fLast = f;
+	}
+
+	// Invert by linear interpolation
+	int p = 0;
+	for(int j=0;j<tableSize;j++){
+		double c = cdf[nPoints-1]*j/(tableSize-1);
+		while(p<nPoints-2 && cdf[p+1]<c) p++;
+		double w = cdf[p+1]>cdf[p] ? (c-cdf[p])/(cdf[p+1]-cdf[p]) : 0;
+		if(w>1) w = 1;
+		table[j] = (p+w)*dv;
+	}
+
+	free(cdf);
+}
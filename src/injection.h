@@ -0,0 +1,99 @@
+/**
+ * @file		injection.h
+ * @brief		Particle injection through the edges of the domain.
+ *
+ * Particles enter the domain through the faces selected by injection:faces as
+ * if the plasma outside was an infinite, drifting Maxwellian with the density
+ * and temperature of the initial population. The velocity normal to a face is
+ * then distributed as the flux-Maxwellian v*f(v), which is sampled by
+ * interpolation in an inverse cumulative distribution tabulated by injAlloc().
+ * This keeps the cost negligible compared to the pusher even at high
+ * injection rates.
+ *
+ * Injection is meant to be used along with non-periodic particle boundaries,
+ * and faces whose grid:boundaries is PERIODIC are rejected. Faces are numbered
+ * like grid:boundaries, i.e. the lower faces along each dimension first, and
+ * then the upper faces.
+ */
+
+#ifndef INJECTION_H
+#define INJECTION_H
+
+/**
+ * @brief Injection through the faces of this MPI node's subdomain
+ *
+ * Only faces which are both selected in injection:faces and part of the edge
+ * of the global domain are stored. The tables are stored with one row of
+ * tableSize elements per specie and face, with the specie as the slowest
+ * varying index, and likewise for rate. The rate is per cell of the face,
+ * since particles are drawn cell by cell (see injInject()).
+ */
+typedef struct{
+	int nDims;				///< Number of dimensions
+	int nSpecies;			///< Number of species
+	int nFaces;				///< Number of faces injected through on this node
+	int *face;				///< Face number (nFaces elements)
+	double *facePos;		///< Position of face in local frame (nFaces elements)
+	int tableSize;			///< Number of elements per table
+	double *table;			///< Inverse CDF of the speed normal to the face
+	double *rate;			///< Mean number of particles per cell and time step
+	double *drift;			///< Drift velocity of each specie
+	double *thermal;		///< Thermal velocity of each specie
+	double *lower;			///< Lower corner of subdomain in local frame (nDims elements)
+	double *size;			///< Size of subdomain (nDims elements)
+	unsigned int seed;		///< Seed of random numbers (population:seed)
+	int *origin;			///< Global index of the lower corner of subdomain (nDims elements)
+	int *globalSize;		///< Number of cells in the global domain (nDims elements)
+} Injector;
+
+/**
+ * @brief	Allocates an Injector and tabulates the velocity distributions
+ * @param	ini		Input file
+ * @param	pop		Population
+ * @param	mpiInfo	MpiInfo
+ * @return	Pointer to Injector
+ *
+ * The density of each specie is population:nParticles divided by the global
+ * volume, and the velocity distribution is given by population:drift and
+ * population:thermalVelocity. A fluid specie is not injected (see
+ * Population::fluid). Remember to free using injFree().
+ */
+Injector *injAlloc(const dictionary *ini, const Population *pop,
+				   const MpiInfo *mpiInfo);
+
+/**
+ * @brief	Frees an Injector
+ * @param	inj		Injector
+ */
+void injFree(Injector *inj);
+
+/**
+ * @brief	Injects particles for one time step
+ * @param			inj		Injector
+ * @param[in,out]	pop		Population
+ * @param			n		Time step
+ *
+ * Appends the new particles of each specie after the existing ones. Each new
+ * particle has crossed the face a random fraction of the time step ago, and
+ * is moved that fraction of its velocity (partial push) from a uniformly
+ * distributed point on the face. The random numbers are drawn from the
+ * RNG_INJECTION stream (see Rng) with indices given by the global cell of the
+ * face they enter through, so the particles depend neither on the number of
+ * threads nor on how the domain is split into subdomains.
+ *
+ * Call after puMove() and before migration, since the partial push may move
+ * particles into neighboring subdomains.
+ */
+void injInject(const Injector *inj, Population *pop, int n);
+
+/**
+ * @brief	Mean flux of a drifting Maxwellian through a surface
+ * @param	drift	Drift velocity along the normal of the surface
+ * @param	thermal	Thermal velocity
+ * @return	Number of particles per unit density, area and time
+ *
+ * Only particles moving along the normal are counted.
+ */
+double injFlux(double drift, double thermal);
+
+#endif // INJECTION_H
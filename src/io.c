@@ -87,14 +87,6 @@ static char** listToStrArr(const char* list);
  */
 static int listGetNElements(const char* list);
 
-/**
- * @brief Asserts that key exists in ini-file and emits ERROR if not.
- * @param	ini		ini-file dictionary
- * @param	key		Key to check existence of
- * @return			void
- */
-void iniAssertExistence(const dictionary *ini, const char* key);
-
 /**
  * @brief Expands/repeats a string array
  * @param	strArr		String array to expand
@@ -197,7 +189,7 @@ void msg(msgKind kind, const char* restrict format,...){
 	// Parse and assemble message
 	int rank;
 	char msg[bufferSize], buffer[bufferSize];
-	MPI_Comm_rank(MPI_COMM_WORLD,&rank);
+	MPI_Comm_rank(simComm,&rank);
 	vsnprintf(msg,bufferSize,format,args);
 	if((kind&ALL)){
 		snprintf(buffer,bufferSize,"%s (%i): %s",prefix,rank,msg);
@@ -314,6 +306,18 @@ void iniClose(dictionary *ini){
 	iniparser_freedict(ini);
 }
 
+dictionary* iniCopy(const dictionary *ini){
+
+	dictionary *copy = dictionary_new(0);
+
+	// Sections are stored as keys without value
+	for(int i=0;i<ini->size;i++){
+		if(ini->key[i]!=NULL) dictionary_set(copy,ini->key[i],ini->val[i]);
+	}
+
+	return copy;
+}
+
 void iniAssertExistence(const dictionary *ini, const char* key){
 
 	if(!iniparser_find_entry((dictionary*)ini,key)){
@@ -563,9 +567,8 @@ void iniApplySuffix(dictionary *ini, const char *key,
  * DEFINING HDF5 FUNCTIONS (expanding HDF5 API)
  *****************************************************************************/
 
-hid_t openH5File(const dictionary *ini, const char *fName, const char *fSubExt){
+char *getFileName(const dictionary *ini, const char *fName){
 
-	// Determine filename
 	char *fPrefix = iniGetStr(ini,"files:output");
 
 	// Add separator if filename prefix (not just folder) is specified
@@ -574,16 +577,28 @@ hid_t openH5File(const dictionary *ini, const char *fName, const char *fSubExt){
 	if(strcmp(fPrefix,".")==0) sep[0]='/';
 	else if(strlen(fPrefix)>0 && lastchar!='/') sep[0]='_';
 
-	char *fTotName = strCatAlloc(6,fPrefix,sep,fName,".",fSubExt,".h5");
-
-	// Enable MPI-I/O access
-	hid_t pList = H5Pcreate(H5P_FILE_ACCESS);
-	H5Pset_fapl_mpio(pList,MPI_COMM_WORLD,MPI_INFO_NULL);
+	char *fTotName = strCatAlloc(3,fPrefix,sep,fName);
 
 	// Make sure parent folder exist
 	if(makePath(fTotName))
 		msg(ERROR,"Could not open or create folder for '%s'.",fTotName);
 
+	free(fPrefix);
+
+	return fTotName;
+}
+
+hid_t openH5File(const dictionary *ini, const char *fName, const char *fSubExt){
+
+	// Determine filename
+	char *fBaseName = strCatAlloc(4,fName,".",fSubExt,".h5");
+	char *fTotName = getFileName(ini,fBaseName);
+	free(fBaseName);
+
+	// Enable MPI-I/O access
+	hid_t pList = H5Pcreate(H5P_FILE_ACCESS);
+	H5Pset_fapl_mpio(pList,simComm,MPI_INFO_NULL);
+
 	hid_t file;	// h5 file handle
 
 	// Open or create file (if it doesn't exist)
@@ -596,7 +611,6 @@ hid_t openH5File(const dictionary *ini, const char *fName, const char *fSubExt){
 	}
 
 	H5Pclose(pList);
-	free(fPrefix);
 	free(fTotName);
 
 	return file;
@@ -666,7 +680,7 @@ hid_t xyOpenH5(const dictionary *ini, const char *fName){
 void xyCreateDataset(hid_t h5, const char *name){
 
 	int mpiRank;
-	MPI_Comm_rank(MPI_COMM_WORLD,&mpiRank);
+	MPI_Comm_rank(simComm,&mpiRank);
 
 	createH5Group(h5,name);	// Creates parent groups
 
@@ -691,12 +705,14 @@ void xyCreateDataset(hid_t h5, const char *name){
 }
 void xyWrite(hid_t h5, const char* name, double x, double y, MPI_Op op){
 
+	cpBegin("history %s", name);
+
 	int mpiRank;
-	MPI_Comm_rank(MPI_COMM_WORLD,&mpiRank);
+	MPI_Comm_rank(simComm,&mpiRank);
 
 	// Reduce data across nodes
-	double yReduced;
-	MPI_Reduce(&y,&yReduced,1,MPI_DOUBLE,op,0,MPI_COMM_WORLD);
+	double yReduced = y;
+	if(op!=MPI_OP_NULL) MPI_Reduce(&y,&yReduced,1,MPI_DOUBLE,op,0,simComm);
 
 	// Load dataset
 	hid_t dataset = H5Dopen(h5,name,H5P_DEFAULT);
@@ -731,6 +747,84 @@ void xyWrite(hid_t h5, const char* name, double x, double y, MPI_Op op){
 	H5Sclose(fileSpace);
 	H5Dclose(dataset);
 
+	cpEnd();
+}
+
+void xyCreateNodesDataset(hid_t h5, const char *name, int nValues){
+
+	int mpiSize;
+	MPI_Comm_size(simComm,&mpiSize);
+
+	createH5Group(h5,name);	// Creates parent groups
+
+	const int arrSize=3;
+
+	// One row of x and values per MPI node for each write
+	hsize_t chunkDims[] = {1,mpiSize,nValues+1};
+	hid_t pList = H5Pcreate(H5P_DATASET_CREATE);
+	H5Pset_chunk(pList, arrSize, chunkDims);
+
+	hsize_t fileDims[] = {0,mpiSize,nValues+1};
+	hsize_t fileDimsMax[] = {H5S_UNLIMITED,mpiSize,nValues+1};
+	hid_t fileSpace = H5Screate_simple(arrSize,fileDims,fileDimsMax);
+
+	hid_t dataset = H5Dcreate(h5,name,H5T_IEEE_F64LE,fileSpace,H5P_DEFAULT,pList,H5P_DEFAULT);
+
+	H5Pclose(pList);
+	H5Sclose(fileSpace);
+	H5Dclose(dataset);
+
+}
+
+void xyWriteNodes(hid_t h5, const char *name, double x, const double *values,
+				  int nValues){
+
+	cpBegin("history %s", name);
+
+	int mpiRank, mpiSize;
+	MPI_Comm_rank(simComm,&mpiRank);
+	MPI_Comm_size(simComm,&mpiSize);
+
+	// Gather rows of x and values to rank 0
+	int nCols = nValues+1;
+	double *row = malloc(nCols*sizeof(*row));
+	double *rows = NULL;
+	if(mpiRank==0) rows = malloc(mpiSize*nCols*sizeof(*rows));
+
+	row[0] = x;
+	for(int i=0;i<nValues;i++) row[i+1] = values[i];
+	MPI_Gather(row,nCols,MPI_DOUBLE,rows,nCols,MPI_DOUBLE,0,simComm);
+
+	hid_t dataset = H5Dopen(h5,name,H5P_DEFAULT);
+
+	// Extend dataspace in file by one block (must be done on all MPI nodes)
+	const int arrSize=3;
+	hid_t fileSpace = H5Dget_space(dataset);
+	hsize_t fileDims[arrSize];
+	H5Sget_simple_extent_dims(fileSpace,fileDims,NULL);
+	fileDims[0]++;
+	H5Dset_extent(dataset,fileDims);
+
+	H5Sclose(fileSpace);
+	fileSpace = H5Dget_space(dataset);
+
+	if(mpiRank==0){
+		hsize_t offset[] = {fileDims[0]-1,0,0};
+		hsize_t memDims[] = {1,mpiSize,nCols};
+		H5Sselect_hyperslab(fileSpace,H5S_SELECT_SET,offset,NULL,memDims,NULL);
+
+		hid_t memSpace = H5Screate_simple(arrSize,memDims,NULL);
+		H5Dwrite(dataset, H5T_NATIVE_DOUBLE, memSpace, fileSpace, H5P_DEFAULT, rows);
+		H5Sclose(memSpace);
+	}
+
+	H5Sclose(fileSpace);
+	H5Dclose(dataset);
+
+	free(row);
+	free(rows);
+
+	cpEnd();
 }
 
 void xyCloseH5(hid_t h5){
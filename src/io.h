@@ -224,6 +224,16 @@ dictionary* iniOpen(int argc, char *argv[]);
 ///@brief Close dictionary
 void iniClose(dictionary *ini);
 
+/**
+ * @brief Copy dictionary
+ * @param	ini		Dictionary to copy
+ * @return	Allocated copy of ini
+ *
+ * Useful to override settings for one run without affecting the next, e.g.
+ * in ensemble mode. Close the copy using iniClose() after use.
+ */
+dictionary* iniCopy(const dictionary *ini);
+
 ///@brief Get integer
 int iniGetInt(const dictionary* ini, const char *key);
 ///@brief Get long int
@@ -275,6 +285,14 @@ char** iniGetStrArr(const dictionary *ini, const char *key, int nElements);
 ///@brief Get the number of elements in an array/comma-separated list
 int iniGetNElements(const dictionary* ini, const char* key);
 
+/**
+ * @brief Asserts that key exists in ini-file and emits ERROR if not.
+ * @param	ini		ini-file dictionary
+ * @param	key		Key to check existence of
+ * @return			void
+ */
+void iniAssertExistence(const dictionary *ini, const char* key);
+
 /**
  * @brief Apply multiplicator to entries in ini-file with suffix.
  * @param[in,out]	ini			Dictionary to search
@@ -344,6 +362,18 @@ void freeStrArr(char** strArr);
  */
 hid_t openH5File(const dictionary* ini, const char *fName, const char *fSubExt);
 
+/**
+ * @brief Determines the path of an output file
+ * @param	ini		Dictionary to input file
+ * @param	fName	File name including extension (e.g. "telemetry.prom")
+ * @return	Path to file
+ *
+ * Prepends files:output to the file name following the same conventions as
+ * openH5File(), and creates parent directories unless they already exists.
+ * Remember to free() the returned string.
+ */
+char *getFileName(const dictionary *ini, const char *fName);
+
 /**
  * @brief Sets array of double as attributes in h5-file
  * @param	h5		.h5-file identifier
@@ -409,7 +439,9 @@ void xyCloseH5(hid_t h5);
  * In parallel executions, the y value is reduced across all MPI nodes using the
  * specified MPI reduction operation, for instance MPI_SUM to sum the y-value of
  * all MPI nodes before writing to file. If the x value differs amongst the
- * nodes, the x-value of rank 0 is simply used.
+ * nodes, the x-value of rank 0 is simply used. Likewise, the y-value of rank 0
+ * is used without any reduction if op is MPI_OP_NULL, which is useful for
+ * values already reduced by the caller.
  *
  * The dataset must be created beforehand by calling xyCreateDataset() and the
  * file is created by xyOpenH5(). Remember to close the H5 file using
@@ -445,6 +477,34 @@ void xyWrite(hid_t h5, const char* name, double x, double y, MPI_Op op);
  */
 void xyCreateDataset(hid_t h5, const char *name);
 
+/**
+ * @brief Creates a dataset in a .xy.h5 file for values from each MPI node
+ * @param	h5		Identifier to .h5-file to create dataset in
+ * @param	name	Dataset name
+ * @param	nValues	Number of values per MPI node
+ * @return			void
+ * @see		xyWriteNodes()
+ */
+void xyCreateNodesDataset(hid_t h5, const char *name, int nValues);
+
+/**
+ * @brief Writes values from each MPI node to a dataset in an H5-file
+ * @param	h5		.h5-file identifier
+ * @param	name	Dataset name
+ * @param	x		x-value
+ * @param	values	Values of this MPI node (nValues elements)
+ * @param	nValues	Number of values per MPI node
+ * @return	void
+ *
+ * Collective operation. Rather than reducing across MPI nodes like xyWrite(),
+ * the values of all nodes are stored. The dataset has dimensions
+ * (writes, MPI nodes, nValues+1), where the first column is the x-value. It
+ * must be created beforehand using xyCreateNodesDataset() with the same
+ * nValues.
+ */
+void xyWriteNodes(hid_t h5, const char *name, double x, const double *values,
+				  int nValues);
+
 /**
  * @brief Writes grid structs to a parsefile
  * @param ini 		dictionary of the input file
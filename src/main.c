@@ -12,24 +12,34 @@
 #include "multigrid.h"
 #include "spectral.h"
 #include "object.h"
+#include "injection.h"
+#include "collision.h"
+#include <string.h>
+#include <strings.h>
 
 void regular(dictionary *ini);
 funPtr regular_set(dictionary *ini){ return regular; }
 
+void ensemble(dictionary *ini);
+funPtr ensemble_set(dictionary *ini){ return ensemble; }
+
 int main(int argc, char *argv[]){
 
 	/*
 	 * INITIALIZE PINC
 	 */
-	MPI_Init(&argc,&argv);
+	int provided;	// Only the master thread communicates
+	MPI_Init_thread(&argc,&argv,MPI_THREAD_FUNNELED,&provided);
 	dictionary *ini = iniOpen(argc,argv); // No printing before this
 	msg(STATUS, "PINC %s started.", VERSION);    // Needs MPI
+	thrInit(ini);
 	MPI_Barrier(MPI_COMM_WORLD);
 
 	/*
 	 * CHOOSE PINC RUN MODE
 	 */
 	void (*run)() = select(ini,"methods:mode",	regular_set,
+												ensemble_set,
 												mgMode_set,
 												mgModeErrorScaling_set,
 												sMode_set);
@@ -54,13 +64,20 @@ void regular(dictionary *ini){
 	void (*acc)()   			= select(ini,	"methods:acc",
 												puAcc3D1_set,
 												puAcc3D1KE_set,
+												puAcc2D1_set,
+												puAcc2D1KE_set,
 												puAccND1_set,
 												puAccND1KE_set,
 												puAccND0_set,
-												puAccND0KE_set);
+												puAccND0KE_set,
+												puBoris3D1_set,
+												puBoris3D1KE_set,
+												puBoris2D1_set,
+												puBoris2D1KE_set);
 
 	void (*distr)() 			= select(ini,	"methods:distr",
 												puDistr3D1_set,
+												puDistr2D1_set,
 												puDistrND1_set,
 												puDistrND0_set);
 
@@ -70,13 +87,49 @@ void regular(dictionary *ini){
 
 	void (*solverInterface)()	= select(ini,	"methods:poisson",
 												mgSolver_set,
+												mgBoltzSolver_set,
 												sSolver_set);
 
+	void (*accCost)()			= select(ini,	"methods:acc",
+												puAcc3D1_cost,
+												puAcc3D1KE_cost,
+												puAcc2D1_cost,
+												puAcc2D1KE_cost,
+												puAccND1_cost,
+												puAccND1KE_cost,
+												puAccND0_cost,
+												puAccND0KE_cost,
+												puBoris3D1_cost,
+												puBoris3D1KE_cost,
+												puBoris2D1_cost,
+												puBoris2D1KE_cost);
+
+	void (*distrCost)()			= select(ini,	"methods:distr",
+												puDistr3D1_cost,
+												puDistr2D1_cost,
+												puDistrND1_cost,
+												puDistrND0_cost);
+
+	void (*extractEmigrantsCost)() = select(ini,	"methods:migrate",
+												puExtractEmigrants3D_cost,
+												puExtractEmigrantsND_cost);
+
+	void (*solveCost)()			= select(ini,	"methods:poisson",
+												mgSolver_cost,
+												mgBoltzSolver_cost,
+												sSolver_cost);
+
 	void (*solve)() = NULL;
 	void *(*solverAlloc)() = NULL;
 	void (*solverFree)() = NULL;
 	solverInterface(&solve, &solverAlloc, &solverFree);
 
+	// Electrons (specie 0) are a Boltzmann fluid rather than particles (see
+	// Population::fluid)
+	char *poisson = iniGetStr(ini, "methods:poisson");
+	int boltzmann = !strcmp(poisson, "mgBoltzSolver");
+	free(poisson);
+
 	/*
 	 * INITIALIZE PINC VARIABLES
 	 */
@@ -85,11 +138,22 @@ void regular(dictionary *ini){
 
 	MpiInfo *mpiInfo = gAllocMpi(ini);
 	Population *pop = pAlloc(ini);
+	pop->ext = puAllocExternal(ini, mpiInfo);
 	Grid *E   = gAlloc(ini, VECTOR);
 	Grid *rho = gAlloc(ini, SCALAR);
 	Grid *phi = gAlloc(ini, SCALAR);
 	void *solver = solverAlloc(ini, rho, phi);
-	// Object *obj = oAlloc(ini);
+	Injector *inj = injAlloc(ini, pop, mpiInfo);
+	Collider *col = colAlloc(ini, units, mpiInfo);
+
+	// Objects absorbing particles (optional)
+	char *objFile = iniGetStr(ini, "objects:file");
+	char *objMeshes = iniGetStr(ini, "objects:meshes");
+	int useFile = strcmp(objFile, "NONE");
+	int useMeshes = strcmp(objMeshes, "NONE");
+	if(useFile && useMeshes) msg(ERROR, "specify either objects:file or objects:meshes");
+	Object *obj = useFile || useMeshes ? oAlloc(ini) : NULL;
+	if(obj && boltzmann) msg(ERROR, "objects are not supported with mgBoltzSolver");
 
 	// Creating a neighbourhood in the rho to handle migrants
 	gCreateNeighborhood(ini, mpiInfo, rho);
@@ -97,11 +161,6 @@ void regular(dictionary *ini){
 	// Setting Boundary slices
 	gSetBndSlices(phi, mpiInfo);
 
-	// Random number seeds
-	gsl_rng *rngSync = gsl_rng_alloc(gsl_rng_mt19937);
-	gsl_rng *rng = gsl_rng_alloc(gsl_rng_mt19937);
-	gsl_rng_set(rng,mpiInfo->mpiRank+1); // Seed needs to be >=1
-
 	/*
 	 * PREPARE FILES FOR WRITING
 	 */
@@ -109,11 +168,16 @@ void regular(dictionary *ini){
 	gOpenH5(ini, rho, mpiInfo, units, units->chargeDensity, "rho");
 	gOpenH5(ini, phi, mpiInfo, units, units->potential, "phi");
 	gOpenH5(ini, E,   mpiInfo, units, units->eField, "E");
-  // oOpenH5(ini, obj, mpiInfo, units, 1, "test");
-  // oReadH5(obj, mpiInfo);
+	if(useFile){
+		oOpenH5(ini, obj, mpiInfo, units, 1, objFile);
+		oReadH5(obj, mpiInfo);
+	}
+	if(useMeshes) oVoxelize(ini, obj, mpiInfo);
+	if(obj) oComputeCapacitance(obj, ini, units, solve, solver, rho, phi, mpiInfo);
 
 	hid_t history = xyOpenH5(ini,"history");
 	pCreateEnergyDatasets(history,pop);
+	if(obj) oCreateChargeDatasets(history,obj);
 
 	// Add more time series to history if you want
 	// xyCreateDataset(history,"/group/group/dataset");
@@ -123,10 +187,31 @@ void regular(dictionary *ini){
 	 */
 
 	// Initalize particles
-	// pPosUniform(ini, pop, mpiInfo, rngSync);
-	pPosLattice(ini, pop, mpiInfo);
-	pVelZero(pop);
-	// pVelMaxwell(ini, pop, rng);
+	char *profile = iniGetStr(ini, "population:profile");
+	if(strcmp(profile, "NONE")){
+		Grid *density = gAlloc(ini, SCALAR);
+		gOpenH5(ini, density, mpiInfo, units, 1, profile);
+		gReadH5(density, mpiInfo, 0);
+		gCloseH5(density);
+		pPosProfile(ini, pop, mpiInfo, density);
+		gFree(density);
+	} else {
+		char *positions = iniGetStr(ini, "population:positions");
+		if(!strcmp(positions, "LATTICE")) pPosLattice(ini, pop, mpiInfo);
+		else if(!strcmp(positions, "UNIFORM")) pPosUniform(ini, pop, mpiInfo);
+		else if(!strcmp(positions, "QUIET")) pPosQuiet(ini, pop, mpiInfo);
+		else msg(ERROR, "population:positions=%s is invalid", positions);
+		free(positions);
+	}
+	free(profile);
+	char *velocities = iniGetStr(ini, "population:velocities");
+	if(pop->weight && !strcmp(velocities, "ZERO"))
+		msg(ERROR, "population:deltaF needs MAXWELL or QUIET velocities");
+	if(!strcmp(velocities, "ZERO")) pVelZero(pop);
+	else if(!strcmp(velocities, "MAXWELL")) pVelMaxwell(ini, pop, mpiInfo);
+	else if(!strcmp(velocities, "QUIET")) pVelQuiet(ini, pop);
+	else msg(ERROR, "population:velocities=%s is invalid", velocities);
+	free(velocities);
 	double maxVel = iniGetDouble(ini,"population:maxVel");
 
 	// Perturb particles
@@ -136,6 +221,7 @@ void regular(dictionary *ini){
 	extractEmigrants(pop, mpiInfo);
 
 	puMigrate(pop, mpiInfo, rho);
+	pSortTiles(pop, rho);
 
 	/*
 	 * INITIALIZATION (E.g. half-step)
@@ -147,6 +233,7 @@ void regular(dictionary *ini){
 
 	// Get initial E-field
 	solve(solver, rho, phi, mpiInfo);
+	if(obj) oApplyCapacitance(obj, solve, solver, rho, phi, mpiInfo);
 	gFinDiff1st(phi, E);
 	gHaloOp(setSlice, E, mpiInfo, TOHALO);
 	gMul(E, -1.);
@@ -154,22 +241,35 @@ void regular(dictionary *ini){
 
 	// Advance velocities half a step
 	gMul(E, 0.5);
+	puExternalStep(pop->ext, 0.5);
 	acc(pop, E);
 	gMul(E, 2.0);
+	puExternalStep(pop->ext, 1.0);
+
+	memMsg("at startup");
 
 	/*
 	 * TIME LOOP
 	 */
 
 	Timer *t = tAlloc(mpiInfo->mpiRank);
+	Telemetry *tel = telAlloc(ini);
+	telCreateImbalanceDatasets(tel, history, pop, mpiInfo);
+	Timer **phases = tel->phases;
+	Cost *costs = tel->costs;
 
 	// n should start at 1 since that's the timestep we have after the first
 	// iteration (i.e. when storing H5-files).
 	int nTimeSteps = iniGetInt(ini,"time:nTimeSteps");
+
+	// Load balancing uses the time spent in purely local particle phases
+	int rebalanceInterval = iniGetInt(ini,"grid:rebalanceInterval");
+	int granularity = mgGranularity(ini);
+	unsigned long long int particleTimeLast = 0;
+
 	for(int n = 1; n <= nTimeSteps; n++){
 
-		msg(STATUS,"Computing time-step %i",n);
-		MPI_Barrier(MPI_COMM_WORLD);	// Temporary, shouldn't be necessary
+		MPI_Barrier(simComm);	// Temporary, shouldn't be necessary
 
 		// Check that no particle moves beyond a cell (mostly for debugging)
 		pVelAssertMax(pop,maxVel);
@@ -177,19 +277,30 @@ void regular(dictionary *ini){
 		tStart(t);
 
 		// Move particles
-		puMove(pop);
-		// oRayTrace(pop, obj);
+		tStart(phases[TEL_MOVE]);
+		if(obj) oMove(pop, obj);
+		else puMove(pop);
+		injInject(inj, pop, n);
+		tStop(phases[TEL_MOVE]);
+		puMoveCost(&costs[TEL_MOVE], pop);
 
 		// Migrate particles (periodic boundaries)
+		tStart(phases[TEL_MIGRATE]);
+		extractEmigrantsCost(&costs[TEL_MIGRATE], pop);
 		extractEmigrants(pop, mpiInfo);
 		puMigrate(pop, mpiInfo, rho);
+		pSortTiles(pop, rho);
+		tStop(phases[TEL_MIGRATE]);
 
 		// Check that no particle resides out-of-bounds (just for debugging)
 		pPosAssertInLocalFrame(pop, rho);
 
 		// Compute charge density
+		tStart(phases[TEL_DISTR]);
 		distr(pop, rho);
 		gHaloOp(addSlice, rho, mpiInfo, FROMHALO);
+		tStop(phases[TEL_DISTR]);
+		distrCost(&costs[TEL_DISTR], pop, rho);
 
 		// gAssertNeutralGrid(rho, mpiInfo);
 
@@ -199,26 +310,43 @@ void regular(dictionary *ini){
 		// mgSolve(solver, rho, phi, mpiInfo);
 		// sSolve(solver, rho, phi, mpiInfo);
 
+		tStart(phases[TEL_SOLVE]);
 		solve(solver, rho, phi, mpiInfo);
+		if(obj) oApplyCapacitance(obj, solve, solver, rho, phi, mpiInfo);
 
 		gHaloOp(setSlice, phi, mpiInfo, TOHALO); // Needed by sSolve but not mgSolve
+		tStop(phases[TEL_SOLVE]);
+		solveCost(&costs[TEL_SOLVE], solver, rho, phi, mpiInfo);
 
-		gAssertNeutralGrid(phi, mpiInfo);
+		if(!boltzmann) gAssertNeutralGrid(phi, mpiInfo);
 
 		// Compute E-field
+		tStart(phases[TEL_EFIELD]);
 		gFinDiff1st(phi, E);
 		gHaloOp(setSlice, E, mpiInfo, TOHALO);
 		gMul(E, -1.);
+		tStop(phases[TEL_EFIELD]);
+		gFinDiff1stCost(&costs[TEL_EFIELD], phi, E);
+		gMulCost(&costs[TEL_EFIELD], E);
 
 		gAssertNeutralGrid(E, mpiInfo);
-		// Apply external E
-		// gAddTo(Ext);
+		// External fields are applied by acc (see External)
 
-		// Accelerate particle and compute kinetic energy for step n
+		// Accelerate particle and compute kinetic energy for step n, then
+		// collide with neutrals and each other
+		tStart(phases[TEL_ACC]);
 		acc(pop, E);
+		colCollide(col, pop, n);
+		colCoulomb(col, pop, rho, n);
+		tStop(phases[TEL_ACC]);
+		accCost(&costs[TEL_ACC], pop, E);
+		colCollideCost(&costs[TEL_ACC], col);
+		colCoulombCost(&costs[TEL_ACC], col);
 
 		tStop(t);
 
+		tStart(phases[TEL_OUTPUT]);
+
 		// Sum energy for all species
 		pSumKinEnergy(pop);
 
@@ -234,14 +362,63 @@ void regular(dictionary *ini){
 		// gWriteH5(phi, mpiInfo, (double) n);
 		// pWriteH5(pop, mpiInfo, (double) n, (double)n+0.5);
 		pWriteEnergy(history,pop,(double)n);
-
+		if(obj) oWriteCharge(history,obj,(double)n);
+		telWriteImbalance(tel, history, pop, mpiInfo, (double)n);
+
+		tStop(phases[TEL_OUTPUT]);
+
+		telStep(tel, pop);
+
+		if(rebalanceInterval && n%rebalanceInterval==0){
+
+			unsigned long long int particleTime = phases[TEL_MOVE]->total
+												+ phases[TEL_ACC]->total;
+			double cost = (particleTime-particleTimeLast)/1e9;
+			particleTimeLast = particleTime;
+
+			pToGlobalFrame(pop, mpiInfo);
+			int changed = gRebalance(mpiInfo, cost, granularity);
+			pToLocalFrame(pop, mpiInfo);
+
+			if(changed){
+				msg(STATUS, "Subdomain boundaries moved at time step %i", n);
+				puReserveEmigrants(pop, mpiInfo);
+				extractEmigrants(pop, mpiInfo);
+				puMigrate(pop, mpiInfo, rho);
+
+				// Grid quantities are recomputed next time step
+				solverFree(solver);
+				gFitToSubdomain(rho, mpiInfo);
+				gFitToSubdomain(phi, mpiInfo);
+				gFitToSubdomain(E, mpiInfo);
+				solver = solverAlloc(ini, rho, phi);
+				gSetBndSlices(phi, mpiInfo);
+				injFree(inj);
+				inj = injAlloc(ini, pop, mpiInfo);
+				if(obj){
+					gFitToSubdomain(obj->domain, mpiInfo);
+					if(useFile) oReadH5(obj, mpiInfo);
+					else oVoxelize(ini, obj, mpiInfo);
+					oRedistributeCapacitance(obj, mpiInfo);
+				}
+				pSortTiles(pop, rho);
+			}
+		}
 	}
 
 	if(mpiInfo->mpiRank==0) tMsg(t->total, "Time spent: ");
 
+	cpBegin("reports");
+	memMsg("at exit");
+	puMemMsg(pop, mpiInfo);
+	telRooflineMsg(tel);
+	cpEnd();
+	cpMsg();
+
 	/*
 	 * FINALIZE PINC VARIABLES
 	 */
+	gDestroyNeighborhood(mpiInfo);
 	gFreeMpi(mpiInfo);
 
 	// Close h5 files
@@ -249,7 +426,7 @@ void regular(dictionary *ini){
 	gCloseH5(rho);
 	gCloseH5(phi);
 	gCloseH5(E);
-	// oCloseH5(obj);
+	if(useFile) oCloseH5(obj);
 	xyCloseH5(history);
 
 	// Free memory
@@ -259,11 +436,195 @@ void regular(dictionary *ini){
 	gFree(rho);
 	gFree(phi);
 	gFree(E);
+	puFreeExternal(pop->ext);
 	pFree(pop);
 	uFree(units);
-	// oFree(obj);
+	injFree(inj);
+	colFree(col);
+	if(obj) oFree(obj);
+	free(objFile);
+	free(objMeshes);
+
+	tFree(t);
+	telFree(tel);
+
+}
+
+/*
+ * Reads the sweep table on the master and broadcasts it to all MPI nodes.
+ */
+static char *ensReadTable(const dictionary *ini){
+
+	int rank;
+	MPI_Comm_rank(MPI_COMM_WORLD,&rank);
+
+	int length = 0;
+	char *text = NULL;
+
+	if(rank==0){
+		char *fName = iniGetStr(ini,"ensemble:sweep");
+		FILE *file = fopen(fName,"r");
+		if(file==NULL) msg(ERROR,"Failed to open %s.",fName);
+
+		fseek(file,0,SEEK_END);
+		length = (int)ftell(file);
+		rewind(file);
+
+		text = malloc(length+1);
+		length = (int)fread(text,1,length,file);
+		fclose(file);
+		free(fName);
+	}
+
+	MPI_Bcast(&length,1,MPI_INT,0,MPI_COMM_WORLD);
+	if(rank!=0) text = malloc(length+1);
+	MPI_Bcast(text,length,MPI_CHAR,0,MPI_COMM_WORLD);
+	text[length] = '\0';
+
+	return text;
+}
+
+/*
+ * Splits the sweep table into whitespace-separated words, ignoring comments
+ * and empty lines. Words containing whitespace are enclosed in double quotes.
+ * The first nKeys words are the keys, followed by nKeys values for each
+ * member. Returns the number of members.
+ */
+static int ensParseTable(char *text, char ***words, int *nKeys){
+
+	int nWords = 0, nAlloc = 16, nLines = 0, nLineWords = 0;
+	*words = malloc(nAlloc*sizeof(**words));
+	char **ends = malloc(nAlloc*sizeof(*ends));
+	*nKeys = 0;
+
+	char *c = text;
+	while(1){
+
+		// Skip whitespace and comments within the line
+		while(*c==' ' || *c=='\t' || *c=='\r') c++;
+		if(*c==';' || *c=='#') while(*c!='\n' && *c!='\0') c++;
+
+		if(*c=='\n' || *c=='\0'){
+			if(nLineWords>0){
+				if(nLines==0) *nKeys = nLineWords;
+				else if(nLineWords!=*nKeys)
+					msg(ERROR,"Member %i of the sweep table has %i values but "
+							  "there are %i keys.", nLines-1, nLineWords, *nKeys);
+				nLines++;
+				nLineWords = 0;
+			}
+			if(*c=='\0') break;
+			c++;
+			continue;
+		}
+
+		if(nWords==nAlloc){
+			nAlloc *= 2;
+			*words = realloc(*words,nAlloc*sizeof(**words));
+			ends = realloc(ends,nAlloc*sizeof(*ends));
+		}
+
+		if(*c=='"'){
+			(*words)[nWords] = ++c;
+			while(*c!='"' && *c!='\n' && *c!='\0') c++;
+			if(*c!='"') msg(ERROR,"Unterminated quote in the sweep table.");
+			ends[nWords++] = c++;
+		} else {
+			(*words)[nWords] = c;
+			while(*c!='\0' && !strchr(" \t\r\n;#",*c)) c++;
+			ends[nWords++] = c;
+		}
+		nLineWords++;
+	}
+
+	// Terminate words after scanning, since the terminators are significant
+	for(int w=0;w<nWords;w++) *ends[w] = '\0';
+	free(ends);
+
+	if(nLines==0) msg(ERROR,"The sweep table is empty.");
+
+	return nLines-1;
+}
+
+/*
+ * Runs many independent simulations (members) with regular(). The MPI nodes
+ * are split into groups of as many nodes as there are subdomains, and the
+ * members are distributed round-robin between the groups. Each member
+ * overrides the keys given in the ensemble:sweep table, e.g.:
+ *
+ *	time:nTimeSteps		population:nParticles	; Keys
+ *	1000				"64 pc"					; Member 0
+ *	2000				"128 pc"				; Member 1
+ *
+ * and writes its output with the prefix "member<n>" added to files:output.
+ */
+void ensemble(dictionary *ini){
+
+	int worldRank, worldSize;
+	MPI_Comm_rank(MPI_COMM_WORLD,&worldRank);
+	MPI_Comm_size(MPI_COMM_WORLD,&worldSize);
+
+	// Each member runs on as many MPI nodes as there are subdomains
+	int nDims = iniGetInt(ini,"grid:nDims");
+	int *nSubdomains = iniGetIntArr(ini,"grid:nSubdomains",nDims);
+	int nNodes = aiProd(nSubdomains,nDims);
+	free(nSubdomains);
+
+	if(worldSize%nNodes)
+		msg(ERROR,"The number of MPI nodes (%i) must be a multiple of the "
+				  "number of subdomains (%i) in ensemble mode.",
+				  worldSize, nNodes);
+
+	char *text = ensReadTable(ini);
+	char **words;
+	int nKeys;
+	int nMembers = ensParseTable(text,&words,&nKeys);
+
+	for(int k=0;k<nKeys;k++){
+		if(	!strcasecmp(words[k],"grid:nDims") ||
+			!strcasecmp(words[k],"grid:nSubdomains") ||
+			!strcasecmp(words[k],"methods:mode"))
+			msg(ERROR,"%s can not vary within an ensemble.",words[k]);
+		iniAssertExistence(ini,words[k]);
+	}
+
+	int nGroups = worldSize/nNodes;
+	int group = worldRank/nNodes;
+	msg(STATUS,"Running %i members on %i groups of %i MPI nodes.",
+		nMembers, nGroups, nNodes);
+	if(nGroups>nMembers)
+		msg(WARNING,"%i groups have no members to run.",nGroups-nMembers);
+
+	MPI_Comm_split(MPI_COMM_WORLD,group,worldRank,&simComm);
+
+	// Output is separated similarly to getFileName()
+	char *output = iniGetStr(ini,"files:output");
+	char *sep = "";
+	if(!strcmp(output,".")) sep = "/";
+	else if(strlen(output)>0 && output[strlen(output)-1]!='/') sep = "_";
+
+	for(int m=group;m<nMembers;m+=nGroups){
+
+		dictionary *member = iniCopy(ini);
+		for(int k=0;k<nKeys;k++){
+			iniSetStr(member,words[k],words[(m+1)*nKeys+k]);
+		}
+
+		char name[32];
+		sprintf(name,"member%i",m);
+		char *prefix = strCatAlloc(3,output,sep,name);
+		iniSetStr(member,"files:output",prefix);
+		free(prefix);
+
+		msg(STATUS,"Ensemble member %i of %i started.",m,nMembers);
+		regular(member);
+		iniClose(member);
+	}
 
-	gsl_rng_free(rngSync);
-	gsl_rng_free(rng);
+	MPI_Comm_free(&simComm);
+	simComm = MPI_COMM_WORLD;
 
+	free(output);
+	free(words);
+	free(text);
 }
@@ -171,10 +171,10 @@ Grid **mgAllocSubGrids(const dictionary *ini, Grid *grid,
 		ailCumProd(subSize, subSizeProd, rank);
 
 		//Alloc slice and val
-		double *val = malloc(subSizeProd[rank]*sizeof(*val));
-		double *sendSlice = malloc(nSliceMax*sizeof(*sendSlice));
-		double *recvSlice = malloc(nSliceMax*sizeof(*recvSlice));
-		double *bndSlice = malloc(2*rank*nSliceMax*sizeof(*bndSlice));
+		double *val = memAlloc(MEM_MULTIGRID,subSizeProd[rank]*sizeof(*val));
+		double *sendSlice = memAlloc(MEM_MULTIGRID,nSliceMax*sizeof(*sendSlice));
+		double *recvSlice = memAlloc(MEM_MULTIGRID,nSliceMax*sizeof(*recvSlice));
+		double *bndSlice = memAlloc(MEM_MULTIGRID,2*rank*nSliceMax*sizeof(*bndSlice));
 
 		//Ghost layer vector
 		int *subNGhostLayers = malloc(rank*2*sizeof(*subNGhostLayers));
@@ -198,6 +198,7 @@ Grid **mgAllocSubGrids(const dictionary *ini, Grid *grid,
 		grid->bndSlice = bndSlice;
 		grid->h5 = 0;
 		grid->bnd = subBnd;
+		gZero(grid);	// Memory may be reused, e.g. in ensemble mode
 
 		grids[q] = grid;
 	}
@@ -209,6 +210,36 @@ Grid **mgAllocSubGrids(const dictionary *ini, Grid *grid,
  *		Inline functions
  ************************************************/
 
+ // Linear term on a level (NULL for Poisson's equation). Only Poisson's
+ // equation needs neutralization of the source term with periodic boundaries.
+ inline static const Grid *mgDiagAt(const Multigrid *multigrid, int level){
+ 	return multigrid->diag ? multigrid->diag[level] : NULL;
+ }
+
+ // Scratch array of the Jacobi smoothers on a level (NULL if not used)
+ inline static double *mgWorkAt(const Multigrid *multigrid, int level){
+ 	return multigrid->work ? multigrid->work[level] : NULL;
+ }
+
+ // Boundary conditions of phi. The linear term fixes the mean of phi, so
+ // periodic grids are only neutralized for Poisson's equation.
+ inline static void mgBnd(Grid *phi, const Grid *diag, const MpiInfo *mpiInfo){
+ 	if(diag) gBndEdges(phi, mpiInfo);
+ 	else gBnd(phi, mpiInfo);
+ }
+
+ // Whether a smoother supports the linear term
+ inline static int mgHasDiag(void (*smoother)(Grid *phi, const Grid *rho,
+ 						const Grid *diag, double *work, const int nCycles, const MpiInfo *mpiInfo)){
+ 	return smoother == &mgGS3D || smoother == &mgJacob3D;
+ }
+
+ // Whether a smoother needs a scratch array (Multigrid::work)
+ inline static int mgHasWork(void (*smoother)(Grid *phi, const Grid *rho,
+ 						const Grid *diag, double *work, const int nCycles, const MpiInfo *mpiInfo)){
+ 	return smoother == &mgJacobND || smoother == &mgJacob1D || smoother == &mgJacob3D;
+ }
+
  inline static void loopRedBlack2D(double *rhoVal,double *phiVal,long int *sizeProd, int *trueSize, int kEdgeInc,
  				long int g){
 
@@ -294,6 +325,26 @@ Grid **mgAllocSubGrids(const dictionary *ini, Grid *grid,
  ************************************************/
 
 
+int mgGranularity(const dictionary *ini){
+
+	int nLevels = iniGetInt(ini, "multigrid:mgLevels");
+	const char *keys[] = {	"multigrid:preSmooth", "multigrid:postSmooth",
+							"multigrid:coarseSolver"};
+
+	int granularity = 1;
+	for(int l = 1; l < nLevels; l++) granularity *= 2;
+
+	int redBlack = 0;
+	for(int k = 0; k < 3; k++){
+		char *name = iniGetStr(ini, keys[k]);
+		if(!strncmp(name, "gaussSeidelRB", 13)) redBlack = 1;
+		free(name);
+	}
+	if(redBlack) granularity *= 2;
+
+	return granularity;
+}
+
 Multigrid *mgAlloc(const dictionary *ini, Grid *grid){
 
 	//Multigrid
@@ -314,17 +365,12 @@ Multigrid *mgAlloc(const dictionary *ini, Grid *grid){
 	if(!nMGCycles) msg(ERROR, "MG cycles is 0 \n");
 
 
-	// Sanity check (true grid points need to be a multiple of 2^(multigrid levels)
+	// Sanity check (true grid points need to be a multiple of the granularity)
+	int granularity = mgGranularity(ini);
 	for(int d = 0; d < nDims; d++){
-
-		// Computes 2^nLevels. pow() is for doubles.
-		int power = 1;
-		for(int i = 0; i<nLevels; i++) power *= 2;
-
-		if(trueSize[d+1] % (int) pow(2,nLevels)){
-			/* msg(ERROR, "The number of True Grid Points needs to be a multiple of 2^nLevels"); */
-			msg(STATUS, "2^nLevels=%d", power);
-			msg(ERROR, "All elements in grid:trueSize must be a multiple of 2^mgLevels=%d", power);
+		if(trueSize[d+1] % granularity){
+			msg(ERROR, "All elements in grid:trueSize must be a multiple of %d "
+					   "with mgLevels=%d and these smoothers", granularity, nLevels);
 		}
 	}
 
@@ -338,12 +384,25 @@ Multigrid *mgAlloc(const dictionary *ini, Grid *grid){
 	multigrid->nPreSmooth = nPreSmooth;
 	multigrid->nPostSmooth = nPostSmooth;
 	multigrid->nCoarseSolve = nCoarseSolve;
+	multigrid->nCyclesLast = 0;
     multigrid->grids = grids;
+	multigrid->diag = NULL;
+	multigrid->work = NULL;
 
     //Setting the algorithms to be used, pointer functions
 	mgSetSolver(ini, multigrid);
 	mgSetRestrictProlong(ini, multigrid);
 
+	// Scratch arrays follow the size of each level (also after gRebalance())
+	if(	mgHasWork(multigrid->preSmooth) || mgHasWork(multigrid->postSmooth) ||
+		mgHasWork(multigrid->coarseSolv)){
+		multigrid->work = malloc(nLevels*sizeof(*multigrid->work));
+		for(int q = 0; q < nLevels; q++){
+			long int size = grids[q]->sizeProd[grids[q]->rank];
+			multigrid->work[q] = memAlloc(MEM_MULTIGRID, size*sizeof(double));
+		}
+	}
+
   	return multigrid;
 
 }
@@ -356,6 +415,10 @@ void mgFree(Multigrid *multigrid){
 	for(int n = 1; n < nLevels; n++){
 		gFree(grids[n]);
 	}
+	if(multigrid->work){
+		for(int n = 0; n < nLevels; n++) memFree(multigrid->work[n]);
+		free(multigrid->work);
+	}
 	free(multigrid);
 
 	return;
@@ -366,6 +429,7 @@ MultigridSolver* mgAllocSolver(const dictionary *ini, Grid *rho, Grid *phi){
 	MultigridSolver *solver = (MultigridSolver *)malloc(sizeof(*solver));
 
 	Grid *res = gAlloc(ini, SCALAR);
+	gResize(res, &rho->trueSize[1]);	// Subdomain may differ from ini
 	Multigrid *mgRho = mgAlloc(ini, rho);
 	Multigrid *mgRes = mgAlloc(ini, res);
 	Multigrid *mgPhi = mgAlloc(ini, phi);
@@ -377,6 +441,10 @@ MultigridSolver* mgAllocSolver(const dictionary *ini, Grid *rho, Grid *phi){
 	solver->mgRes = mgRes;
 	solver->mgPhi = mgPhi;
 	solver->mgAlgo = mgAlgo;
+	solver->rhs = NULL;
+	solver->mgDiag = NULL;
+	solver->boltzCharge = 0;
+	solver->boltzTemp = 0;
 
 	return solver;
 }
@@ -387,6 +455,11 @@ void mgFreeSolver(MultigridSolver *solver){
 	mgFree(solver->mgPhi);
 	mgFree(solver->mgRes);
 	gFree(solver->res);
+	if(solver->mgDiag){
+		gFree(solver->mgDiag->grids[0]);
+		mgFree(solver->mgDiag);
+		gFree(solver->rhs);
+	}
 	free(solver);
 }
 void mgSolver(	void (**solve)(),
@@ -406,11 +479,206 @@ void mgSolve(const MultigridSolver *solver,
 	mgSolveRaw(solver->mgAlgo, solver->mgRho, solver->mgPhi, solver->mgRes, mpiInfo);
 }
 
+void mgSolveCost(Cost *cost, const MultigridSolver *solver, const Grid *rho,
+				 const Grid *phi, const MpiInfo *mpiInfo){
+
+	const Multigrid *mgRho = solver->mgRho;
+	int nLevels = mgRho->nLevels;
+	int nCycles = mgRho->nCyclesLast;
+	int nDims = rho->rank-1;
+	double stencil = 2*nDims+2;	// Flops per point of smoother or residual
+
+	double bytes = 0, flops = 0;
+	for(int l=0;l<nLevels;l++){
+
+		const Grid *grid = mgRho->grids[l];
+		long int nNodes = grid->sizeProd[grid->rank];
+
+		if(l==nLevels-1){
+			// Coarse solver (the only level if nLevels==1)
+			bytes += mgRho->nCoarseSolve*3*nNodes*sizeof(double);
+			flops += mgRho->nCoarseSolve*stencil*nNodes;
+			continue;
+		}
+
+		// Pre- and post-smoothing (read rho, read and write phi)
+		int nSmooth = mgRho->nPreSmooth+mgRho->nPostSmooth;
+		bytes += nSmooth*3*nNodes*sizeof(double);
+		flops += nSmooth*stencil*nNodes;
+
+		// Arrays passed when zeroing res (1), computing residual (3),
+		// restricting (1), prolonging (2) and subtracting correction (3)
+		bytes += (1+3+1+2+3)*nNodes*sizeof(double);
+		flops += (stencil+1+2+1)*nNodes;
+	}
+
+	// Residual computed for the convergence test after each cycle
+	if(nLevels>1){
+		long int nNodes = rho->sizeProd[rho->rank];
+		bytes += 3*nNodes*sizeof(double);
+		flops += (stencil+2)*nNodes;
+	}
+
+	cost->bytes += nCycles*bytes;
+	cost->flops += nCycles*flops;
+}
+
+funPtr mgSolver_cost(const dictionary *ini){
+	return mgSolveCost;
+}
+
+MultigridSolver* mgAllocBoltzSolver(const dictionary *ini, Grid *rho, Grid *phi){
+
+	int nSpecies = iniGetInt(ini, "population:nSpecies");
+	long int *nParticles = iniGetLongIntArr(ini, "population:nParticles", nSpecies);
+	double *charge = iniGetDoubleArr(ini, "population:charge", nSpecies);
+	double *mass = iniGetDoubleArr(ini, "population:mass", nSpecies);
+	double *thermal = iniGetDoubleArr(ini, "population:thermalVelocity", nSpecies);
+	long int volume = gGetGlobalVolume(ini);
+
+	if(thermal[0]==0)
+		msg(ERROR, "Boltzmann electrons (specie 0) need a non-zero thermal velocity");
+
+	// Newton iterations have another source term than rho
+	Grid *rhs = gAlloc(ini, SCALAR);
+	Grid *diag = gAlloc(ini, SCALAR);
+	gResize(rhs, &rho->trueSize[1]);
+	gResize(diag, &rho->trueSize[1]);
+
+	MultigridSolver *solver = mgAllocSolver(ini, rhs, phi);
+	solver->rhs = rhs;
+	solver->mgDiag = mgAlloc(ini, diag);
+	solver->mgRho->diag = solver->mgDiag->grids;
+
+	// Normalized, so q=charge[0] and kT=mass[0]*thermal[0]^2
+	solver->boltzCharge = charge[0]*nParticles[0]/volume;
+	solver->boltzTemp = mass[0]*pow(thermal[0],2)/charge[0];
+
+	Multigrid *mgRho = solver->mgRho;
+	if(	!mgHasDiag(mgRho->preSmooth) || !mgHasDiag(mgRho->postSmooth) ||
+		!mgHasDiag(mgRho->coarseSolv))
+		msg(ERROR, "mgBoltzSolver needs the 3D gaussSeidelRB or jacobian smoothers");
+
+	free(nParticles);
+	free(charge);
+	free(mass);
+	free(thermal);
+
+	return solver;
+}
+
+void mgBoltzSolver(	void (**solve)(),
+					MultigridSolver *(**solverAlloc)(),
+					void (**solverFree)()){
+
+	*solve=mgBoltzSolve;
+	*solverAlloc=mgAllocBoltzSolver;
+	*solverFree=mgFreeSolver;
+}
+funPtr mgBoltzSolver_set(const dictionary *ini){
+	return mgBoltzSolver;
+}
+
+void mgBoltzSolve(const MultigridSolver *solver,
+	const Grid *rho, const Grid *phi, const MpiInfo* mpiInfo){
+
+	Multigrid *mgRho = solver->mgRho;
+	Multigrid *mgPhi = solver->mgPhi;
+	Multigrid *mgRes = solver->mgRes;
+	Multigrid *mgDiag = solver->mgDiag;
+	funPtr mgAlgo = solver->mgAlgo;
+	int nLevels = mgRho->nLevels;
+	int bottom = nLevels-1;
+
+	Grid *rhs = solver->rhs;
+	Grid *diag = mgDiag->grids[0];
+	Grid *res = solver->res;
+	long int nNodes = rho->sizeProd[rho->rank];
+	double *rhoVal = rho->val;
+	double *phiVal = phi->val;
+	double *rhsVal = rhs->val;
+	double *diagVal = diag->val;
+	double rho0 = solver->boltzCharge;
+	double temp = solver->boltzTemp;
+
+	double tol = 1.E-10;
+	double barRes;
+
+	mgRho->nCyclesLast = 0;
+
+	while(1){
+
+		// Linearize the electron charge density about the present phi
+		for(long int g = 0; g < nNodes; g++){
+			double rhoE = rho0*exp(-phiVal[g]/temp);
+			diagVal[g] = rhoE/temp;
+			rhsVal[g] = rhoVal[g] + rhoE + diagVal[g]*phiVal[g];
+		}
+		gHaloOp(setSlice, rhs, mpiInfo, TOHALO);
+		gHaloOp(setSlice, diag, mpiInfo, TOHALO);
+
+		// The linearized residual equals the nonlinear residual at this phi
+		mgResidual(res, rhs, phi, diag, mpiInfo);
+		barRes = mgSumTrueSquared(res, mpiInfo);
+		barRes /= gTotTruesize(rhs, mpiInfo);
+		barRes = sqrt(barRes);
+		if(isnan(barRes)) msg(ERROR, "Newton iterations of mgBoltzSolve() diverged");
+		if(barRes < tol) break;
+
+		// The Laplacian of coarser levels is in units of their step size
+		for(int l = 0; l < bottom; l++){
+			mgRho->restrictor(mgDiag->grids[l], mgDiag->grids[l+1]);
+			gMul(mgDiag->grids[l+1], 4.);
+			gHaloOp(setSlice, mgDiag->grids[l+1], mpiInfo, TOHALO);
+		}
+
+		if(nLevels > 1){
+			mgAlgo(0, bottom, 0, mgRho, mgPhi, mgRes, mpiInfo);
+		} else {
+			mgRho->coarseSolv(mgPhi->grids[0], rhs, diag, mgWorkAt(mgRho, 0),
+							  mgRho->nCoarseSolve, mpiInfo);
+		}
+		mgRho->nCyclesLast++;
+	}
+}
+
+void mgBoltzSolveCost(Cost *cost, const MultigridSolver *solver, const Grid *rho,
+					  const Grid *phi, const MpiInfo *mpiInfo){
+
+	mgSolveCost(cost, solver, rho, phi, mpiInfo);
+
+	const Multigrid *mgDiag = solver->mgDiag;
+	int nLevels = mgDiag->nLevels;
+	int nCycles = solver->mgRho->nCyclesLast;
+
+	// Linearizing (read rho and phi, write rhs and diag) and restricting diag
+	long int nNodes = rho->sizeProd[rho->rank];
+	double bytes = 4*nNodes*sizeof(double);
+	double flops = 6*nNodes;
+	for(int l=1;l<nLevels;l++){
+		const Grid *grid = mgDiag->grids[l];
+		long int nCoarse = grid->sizeProd[grid->rank];
+		bytes += 2*nCoarse*sizeof(double);
+		flops += 8*nCoarse;
+	}
+
+	// The convergence test reads diag as well
+	bytes += nNodes*sizeof(double);
+	flops += 2*nNodes;
+
+	cost->bytes += (nCycles+1)*bytes;
+	cost->flops += (nCycles+1)*flops;
+}
+
+funPtr mgBoltzSolver_cost(const dictionary *ini){
+	return mgBoltzSolveCost;
+}
+
 /******************************************************
  *		Iterative Solvers
  *****************************************************/
 
-void mgJacobND(Grid *phi,const Grid *rho, const int nCycles, const  MpiInfo *mpiInfo){
+void mgJacobND(Grid *phi,const Grid *rho, const Grid *diag, double *work, const int nCycles, const  MpiInfo *mpiInfo){
 	// Warning not optimized
 	//Common variables
 	int rank = phi->rank;
@@ -421,8 +689,7 @@ void mgJacobND(Grid *phi,const Grid *rho, const int nCycles, const  MpiInfo *mpi
 	double *rhoVal = rho->val;
 
 	//Temporary value
-	static double *tempVal = NULL;
-	if(tempVal==NULL)tempVal = malloc(sizeProd[rank]*sizeof(*tempVal));
+	double *tempVal = work;
 
 	//Indexes for how to increase and domain of trueGrid
 	long int gStep;
@@ -443,23 +710,17 @@ void mgJacobND(Grid *phi,const Grid *rho, const int nCycles, const  MpiInfo *mpi
 
 		for(long int g = gStart; g < gEnd; g++) tempVal[g] += rhoVal[g];
 		adScale(tempVal, sizeProd[rank], coeff);
-		// for(long int g = gStart; g < gEnd; g++) phiVal[g] = tempVal[g];
-
-		phi->val = tempVal;
-        tempVal = phiVal;
+		for(long int g = gStart; g < gEnd; g++) phiVal[g] = tempVal[g];
 
 		gHaloOp(setSlice, phi, mpiInfo, TOHALO);
 		gBnd(phi, mpiInfo);
 
-		phiVal = phi->val;
-
-
 	}
 
 	return;
 }
 
-void mgJacob1D(Grid *phi,const Grid *rho, const int nCycles, const  MpiInfo *mpiInfo){
+void mgJacob1D(Grid *phi,const Grid *rho, const Grid *diag, double *work, const int nCycles, const  MpiInfo *mpiInfo){
 
 	//Seperate values
 	double *phiVal = phi->val;
@@ -469,8 +730,7 @@ void mgJacob1D(Grid *phi,const Grid *rho, const int nCycles, const  MpiInfo *mpi
 	long int *sizeProd = phi->sizeProd;
 
 	//Temporary value
-	static double *tempVal = NULL;
-	if(tempVal==NULL)tempVal = malloc(sizeProd[2]*sizeof(*tempVal));
+	double *tempVal = work;
 
 	double sum = 0.;
 
@@ -488,16 +748,13 @@ void mgJacob1D(Grid *phi,const Grid *rho, const int nCycles, const  MpiInfo *mpi
 		for(int g = 1; g < size[1]-1; g++) sum += tempVal[g];
 		if(sum > 1. || sum < -1.)	msg(WARNING, "totSum to high: %f", sum);
 
-		//Swap stuff
-		phi->val = tempVal;
-		tempVal = phiVal;
-		phiVal = phi->val;
+		for(long int g = 0; g < sizeProd[2]; g++) phiVal[g] = tempVal[g];
 
 	}
 
 }
 
-void mgJacob3D(Grid *phi,const Grid *rho, const int nCycles, const  MpiInfo *mpiInfo){
+void mgJacob3D(Grid *phi,const Grid *rho, const Grid *diag, double *work, const int nCycles, const  MpiInfo *mpiInfo){
 
 	//Common variables
 	int rank = phi->rank;
@@ -506,30 +763,34 @@ void mgJacob3D(Grid *phi,const Grid *rho, const int nCycles, const  MpiInfo *mpi
 	//Seperate values
 	double *phiVal = phi->val;
 	double *rhoVal = rho->val;
+	double *diagVal = diag ? diag->val : NULL;
 
 	//Temporary value
-	double *tempVal = malloc (sizeProd[rank]*sizeof(*tempVal));
+	double *tempVal = work;
 	double coeff = 1./6;
+	long int gStart = sizeProd[1] + sizeProd[2] + sizeProd[3];
+	long int gEnd = sizeProd[rank] - gStart;
 
 	for(int c = 0; c < nCycles; c++){
 		// Index of neighboring nodes
-		long int g =  sizeProd[1] + sizeProd[2] + sizeProd[3];
+		long int g = gStart;
 
-		long int gj = sizeProd[1];
-		long int gjj= -sizeProd[1];
-		long int gk = sizeProd[2];
-		long int gkk= -sizeProd[2];
-		long int gl = sizeProd[3];
-		long int gll= -sizeProd[3];
+		long int gj = g + sizeProd[1];
+		long int gjj= g - sizeProd[1];
+		long int gk = g + sizeProd[2];
+		long int gkk= g - sizeProd[2];
+		long int gl = g + sizeProd[3];
+		long int gll= g - sizeProd[3];
 
-		long int end = sizeProd[rank] - 2*g;
+		long int end = gEnd - gStart;
 
 		for(long int q = 0; q < end; q++){
-			tempVal[g] = coeff*(phiVal[gj] + phiVal[gjj] +
-								phiVal[gk] + phiVal[gkk] +
-								phiVal[gl] + phiVal[gll] +
-								+ rhoVal[g]);
+			double sum = phiVal[gj] + phiVal[gjj] +
+						 phiVal[gk] + phiVal[gkk] +
+						 phiVal[gl] + phiVal[gll] + rhoVal[g];
+			tempVal[g] = diagVal ? sum/(6.+diagVal[g]) : coeff*sum;
 
+			g++;
 			gj++;
 			gjj++;
 			gk++;
@@ -538,15 +799,13 @@ void mgJacob3D(Grid *phi,const Grid *rho, const int nCycles, const  MpiInfo *mpi
 			gll++;
 		}
 
-		for(long int q = 0; q < sizeProd[rank]; q++) phiVal[q] = tempVal[q];
+		for(long int q = gStart; q < gEnd; q++) phiVal[q] = tempVal[q];
 
 		gHaloOp(setSlice, phi, mpiInfo, TOHALO);
-		gBnd(phi, mpiInfo);
+		mgBnd(phi, diag, mpiInfo);
 
 	}
 
-	free(tempVal);
-
 	return;
 }
 
@@ -581,7 +840,7 @@ static void mgGSNDInner(double *phiVal, const double *rhoVal, double *coeff, lon
 	return;
 }
 
-void mgGSND(Grid *phi, const Grid *rho, int nCycles, const MpiInfo *mpiInfo){
+void mgGSND(Grid *phi, const Grid *rho, const Grid *diag, double *work, int nCycles, const MpiInfo *mpiInfo){
 	// Warning not optimized
 	//Common variables
 	int rank = phi->rank;
@@ -621,7 +880,7 @@ void mgGSND(Grid *phi, const Grid *rho, int nCycles, const MpiInfo *mpiInfo){
 }
 
 
-void mgGS2D(Grid *phi, const Grid *rho, int nCycles, const MpiInfo *mpiInfo){
+void mgGS2D(Grid *phi, const Grid *rho, const Grid *diag, double *work, int nCycles, const MpiInfo *mpiInfo){
 
 	//Common variables
 	int *trueSize = phi->trueSize;
@@ -680,7 +939,7 @@ void mgGS2D(Grid *phi, const Grid *rho, int nCycles, const MpiInfo *mpiInfo){
 }
 
 
-void mgGS3D(Grid *phi, const Grid *rho, int nCycles, const MpiInfo *mpiInfo){
+void mgGS3D(Grid *phi, const Grid *rho, const Grid *diag, double *work, int nCycles, const MpiInfo *mpiInfo){
 
 	//Common variables
 	int *trueSize = phi->trueSize;
@@ -692,6 +951,8 @@ void mgGS3D(Grid *phi, const Grid *rho, int nCycles, const MpiInfo *mpiInfo){
 	double *phiVal = phi->val;
 	double *rhoVal = rho->val;
 
+	double *diagVal = diag ? diag->val : NULL;
+
 	//Indexes
 	long int g;
 	int gj = sizeProd[1];
@@ -699,6 +960,7 @@ void mgGS3D(Grid *phi, const Grid *rho, int nCycles, const MpiInfo *mpiInfo){
 	int gl = sizeProd[3];
 
 	double coeff = 1./6.;
+	double sum;
 
 	for(int c = 0; c < nCycles; c++){
 
@@ -710,9 +972,10 @@ void mgGS3D(Grid *phi, const Grid *rho, int nCycles, const MpiInfo *mpiInfo){
 		for(int l = 0; l < trueSize[3];l++){
 			for(int k = 0; k < size[2]; k++){
 				for(int j = 0; j < size[1]; j+=2){
-					phiVal[g] = coeff*(	phiVal[g+gj] + phiVal[g-gj] +
-										phiVal[g+gk] + phiVal[g-gk] +
-										phiVal[g+gl] + phiVal[g-gl] + rhoVal[g]);
+					sum = 	phiVal[g+gj] + phiVal[g-gj] +
+							phiVal[g+gk] + phiVal[g-gk] +
+							phiVal[g+gl] + phiVal[g-gl] + rhoVal[g];
+					phiVal[g] = diagVal ? sum/(6.+diagVal[g]) : coeff*sum;
 					g	+=2;
 				}
 
@@ -730,7 +993,7 @@ void mgGS3D(Grid *phi, const Grid *rho, int nCycles, const MpiInfo *mpiInfo){
 		}
 
 		gHaloOp(setSlice, phi, mpiInfo, TOHALO);
-		gBnd(phi, mpiInfo);
+		mgBnd(phi, diag, mpiInfo);
 
 		/*********************
 		 *	Black pass
@@ -739,9 +1002,10 @@ void mgGS3D(Grid *phi, const Grid *rho, int nCycles, const MpiInfo *mpiInfo){
 		 for(int l = 0; l < trueSize[3];l++){
 		 	for(int k = 0; k < size[2]; k++){
 		 		for(int j = 0; j < size[1]; j+=2){
-		 			phiVal[g] = coeff*(	phiVal[g+gj] + phiVal[g-gj] +
-		 								phiVal[g+gk] + phiVal[g-gk] +
-		 								phiVal[g+gl] + phiVal[g-gl] + rhoVal[g]);
+		 			sum = 	phiVal[g+gj] + phiVal[g-gj] +
+		 					phiVal[g+gk] + phiVal[g-gk] +
+		 					phiVal[g+gl] + phiVal[g-gl] + rhoVal[g];
+		 			phiVal[g] = diagVal ? sum/(6.+diagVal[g]) : coeff*sum;
 
 		 			g	+=2;
 		 		}
@@ -759,7 +1023,7 @@ void mgGS3D(Grid *phi, const Grid *rho, int nCycles, const MpiInfo *mpiInfo){
 		 }
 
 		gHaloOp(setSlice, phi, mpiInfo, TOHALO);
-		gBnd(phi, mpiInfo);
+		mgBnd(phi, diag, mpiInfo);
 	}
 
 
@@ -768,7 +1032,7 @@ void mgGS3D(Grid *phi, const Grid *rho, int nCycles, const MpiInfo *mpiInfo){
 
 
 
-void mgGS3DNew(Grid *phi, const Grid *rho, int nCycles, const MpiInfo *mpiInfo){
+void mgGS3DNew(Grid *phi, const Grid *rho, const Grid *diag, double *work, int nCycles, const MpiInfo *mpiInfo){
 
 	//Common variables
 	int *trueSize = phi->trueSize;
@@ -1382,13 +1646,15 @@ void mgRestrictBnd(Multigrid *mgGrid){
  *			VARIOUS COMPUTATIONS (RESIDUAL)
  ******************************************************/
 
-void mgResidual(Grid *res, const Grid *rho, const Grid *phi,const MpiInfo *mpiInfo){
+void mgResidual(Grid *res, const Grid *rho, const Grid *phi, const Grid *diag,
+				const MpiInfo *mpiInfo){
 
 	//Load
 	long int *sizeProd = res->sizeProd;
 	int rank = res->rank;
 	double *resVal = res->val;
 	double *rhoVal = rho->val;
+	double *phiVal = phi->val;
 
 	//Should consider changing to function pointers
 	if(rank == 4){
@@ -1399,6 +1665,11 @@ void mgResidual(Grid *res, const Grid *rho, const Grid *phi,const MpiInfo *mpiIn
 
 	for (long int g = 0; g < sizeProd[rank]; g++) resVal[g] += rhoVal[g];
 
+	if(diag){
+		double *diagVal = diag->val;
+		for(long int g = 0; g < sizeProd[rank]; g++) resVal[g] -= diagVal[g]*phiVal[g];
+	}
+
 	return;
 }
 
@@ -1439,10 +1710,10 @@ double mgResMass3D(Grid *grid, MpiInfo *mpiInfo){
 		g+=lEdgeInc;
 	}
 
-	if(mpiRank != 0) MPI_Send(&mass, 1, MPI_DOUBLE, 0, mpiRank, MPI_COMM_WORLD);
+	if(mpiRank != 0) MPI_Send(&mass, 1, MPI_DOUBLE, 0, mpiRank, simComm);
 	if(mpiRank == 0){
 		for(int r = 1; r < mpiSize; r++){
-			MPI_Recv(&massRecv, 1, MPI_DOUBLE, r, r, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+			MPI_Recv(&massRecv, 1, MPI_DOUBLE, r, r, simComm, MPI_STATUS_IGNORE);
 			mass += massRecv;
 		}
 	}
@@ -1475,7 +1746,9 @@ double mgSumTrueSquared(Grid *error,const MpiInfo *mpiInfo){
 	double sum = gSumTruegrid(error);
 
 	//Reduce
-	MPI_Allreduce(MPI_IN_PLACE, &sum, 1, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+	cpBegin("multigrid residual norm");
+	MPI_Allreduce(MPI_IN_PLACE, &sum, 1, MPI_DOUBLE, MPI_SUM, simComm);
+	cpEnd();
 
 	return sum;
 }
@@ -1501,9 +1774,11 @@ void parseMGOptim(dictionary *ini, Multigrid *multigrid){
  	if(level == bottom){
  		gHaloOp(setSlice, mgPhi->grids[level], mpiInfo, TOHALO);
 		gHaloOp(setSlice, mgRho->grids[level], mpiInfo, TOHALO);
-		gNeutralizeGrid(mgRho->grids[level], mpiInfo);
- 		mgRho->coarseSolv(mgPhi->grids[level], mgRho->grids[level], mgRho->nCoarseSolve, mpiInfo);
-		gBnd(mgPhi->grids[level], mpiInfo);
+		if(!mgRho->diag) gNeutralizeGrid(mgRho->grids[level], mpiInfo);
+ 		mgRho->coarseSolv(mgPhi->grids[level], mgRho->grids[level],
+						  mgDiagAt(mgRho, level), mgWorkAt(mgRho, level),
+						  mgRho->nCoarseSolve, mpiInfo);
+		mgBnd(mgPhi->grids[level], mgDiagAt(mgRho, level), mpiInfo);
  		mgRho->prolongator(mgRes->grids[level-1], mgPhi->grids[level], mpiInfo);
 
  		return;
@@ -1516,14 +1791,16 @@ void parseMGOptim(dictionary *ini, Multigrid *multigrid){
  	Grid *phi = mgPhi->grids[level];
  	Grid *rho = mgRho->grids[level];
  	Grid *res = mgRes->grids[level];
+ 	const Grid *diag = mgDiagAt(mgRho, level);
+ 	double *work = mgWorkAt(mgRho, level);
 
  	//Boundary
  	gHaloOp(setSlice, rho, mpiInfo, TOHALO);
- 	gNeutralizeGrid(rho,mpiInfo);
+ 	if(!diag) gNeutralizeGrid(rho,mpiInfo);
 
  	//Prepare to go down
- 	mgRho->preSmooth(phi, rho, nPreSmooth, mpiInfo);
- 	mgResidual(res, rho, phi, mpiInfo);
+ 	mgRho->preSmooth(phi, rho, diag, work, nPreSmooth, mpiInfo);
+ 	mgResidual(res, rho, phi, diag, mpiInfo);
  	gHaloOp(setSlice, res, mpiInfo, TOHALO);
 
  	//Go down
@@ -1536,9 +1813,9 @@ void parseMGOptim(dictionary *ini, Multigrid *multigrid){
  	gAddTo( phi, res );
 
  	gHaloOp(setSlice, phi,mpiInfo, TOHALO);
- 	gBnd(phi,mpiInfo);
- 	mgRho->postSmooth(phi, rho, nPostSmooth, mpiInfo);
-	gBnd(phi, mpiInfo);
+ 	mgBnd(phi, diag, mpiInfo);
+ 	mgRho->postSmooth(phi, rho, diag, work, nPostSmooth, mpiInfo);
+	mgBnd(phi, diag, mpiInfo);
 
  	//Go up
  	if(level >top){
@@ -1571,11 +1848,11 @@ void mgVRegular(int level, int bottom, int top, Multigrid *mgRho, Multigrid *mgP
 	Grid *res;
 
 	//Solvers
-	void (*coarseSolv)(Grid *phi, const Grid *rho, const int nCycles,
+	void (*coarseSolv)(Grid *phi, const Grid *rho, const Grid *diag, double *work, const int nCycles,
 		const MpiInfo *mpiInfo) = mgRho->coarseSolv;
-	void (*postSmooth)(Grid *phi, const Grid *rho, const int nCycles,
+	void (*postSmooth)(Grid *phi, const Grid *rho, const Grid *diag, double *work, const int nCycles,
 		const MpiInfo *mpiInfo) = mgRho->postSmooth;
-	void (*preSmooth)(Grid *phi, const Grid *rho, const int nCycles,
+	void (*preSmooth)(Grid *phi, const Grid *rho, const Grid *diag, double *work, const int nCycles,
 		const MpiInfo *mpiInfo) = mgRho->preSmooth;
 
 	//Restriction/Prolongators
@@ -1592,17 +1869,18 @@ void mgVRegular(int level, int bottom, int top, Multigrid *mgRho, Multigrid *mgP
 
 		//Boundary
 		gHaloOp(setSlice, phi, mpiInfo, TOHALO);
-		gBnd(phi, mpiInfo);
-		gNeutralizeGrid(rho, mpiInfo);
+		mgBnd(phi, mgDiagAt(mgRho, current), mpiInfo);
+		if(!mgRho->diag) gNeutralizeGrid(rho, mpiInfo);
 
 
-		preSmooth(phi, rho, nPreSmooth, mpiInfo);
+		preSmooth(phi, rho, mgDiagAt(mgRho, current), mgWorkAt(mgRho, current),
+				  nPreSmooth, mpiInfo);
 
 		gHaloOp(setSlice, rho, mpiInfo, TOHALO);
-		gBnd(phi, mpiInfo);
+		mgBnd(phi, mgDiagAt(mgRho, current), mpiInfo);
 
 		gZero(res);
-		mgResidual(res, rho, phi, mpiInfo);
+		mgResidual(res, rho, phi, mgDiagAt(mgRho, current), mpiInfo);
 
 		gHaloOp(setSlice, res, mpiInfo, TOHALO);
 
@@ -1615,15 +1893,16 @@ void mgVRegular(int level, int bottom, int top, Multigrid *mgRho, Multigrid *mgP
 	/*****************************************************
 	 *	//OBS, ONLY NEEDED FOR PERIODIC (neutralize)
 	 *****************************************************/
-	gNeutralizeGrid(rho, mpiInfo);
+	if(!mgRho->diag) gNeutralizeGrid(rho, mpiInfo);
 
 	//Solve at coarsest
 	gHaloOp(setSlice, rho, mpiInfo, TOHALO);
-	coarseSolv(phi, rho, nCoarseSolv, mpiInfo);
+	coarseSolv(phi, rho, mgDiagAt(mgRho, bottom), mgWorkAt(mgRho, bottom),
+			   nCoarseSolv, mpiInfo);
 
 	//Send up
 	gHaloOp(setSlice, phi, mpiInfo, TOHALO);
-	gBnd(phi,mpiInfo);
+	mgBnd(phi, mgDiagAt(mgRho, bottom), mpiInfo);
 	prolongator(mgRes->grids[bottom-1], phi, mpiInfo);
 
 
@@ -1639,10 +1918,11 @@ void mgVRegular(int level, int bottom, int top, Multigrid *mgRho, Multigrid *mgP
 		gSubFrom( phi, res );
 
 		gHaloOp(setSlice, phi,mpiInfo, TOHALO);
-		gBnd(phi,mpiInfo);
+		mgBnd(phi, mgDiagAt(mgRho, current), mpiInfo);
 
-		postSmooth(phi, rho, nPostSmooth, mpiInfo);
-		gBnd(phi, mpiInfo);
+		postSmooth(phi, rho, mgDiagAt(mgRho, current), mgWorkAt(mgRho, current),
+				   nPostSmooth, mpiInfo);
+		mgBnd(phi, mgDiagAt(mgRho, current), mpiInfo);
 
 		if(current > top) prolongator(mgRes->grids[current-1], phi, mpiInfo);
 	}
@@ -1696,10 +1976,14 @@ void mgSolveRaw(funPtr mgAlgo, Multigrid *mgRho, Multigrid *mgPhi, Multigrid *mg
 	double tol = 1.E-10;
 	double barRes = 2.;
 
+	mgRho->nCyclesLast = 0;
+
 	if(nLevels >1){
 		while(barRes > tol){
 			mgAlgo(0, bottom, 0, mgRho, mgPhi, mgRes, mpiInfo);
-			mgResidual(mgRes->grids[0],mgRho->grids[0], mgPhi->grids[0], mpiInfo);
+			mgRho->nCyclesLast++;
+			mgResidual(mgRes->grids[0],mgRho->grids[0], mgPhi->grids[0],
+					   mgDiagAt(mgRho, 0), mpiInfo);
 			gHaloOp(setSlice, mgRes->grids[0],mpiInfo,TOHALO);
 			barRes = mgSumTrueSquared(mgRes->grids[0],mpiInfo);
 			barRes /= gTotTruesize(mgRho->grids[0],mpiInfo);
@@ -1716,9 +2000,10 @@ void mgSolveRaw(funPtr mgAlgo, Multigrid *mgRho, Multigrid *mgPhi, Multigrid *mg
 			Grid *phi = mgPhi->grids[0];
 			Grid *rho = mgRho->grids[0];
 			gHaloOp(setSlice, rho, mpiInfo, TOHALO);
-			gBnd(rho, mpiInfo);
-			mgRho->coarseSolv(phi, rho,
+			mgBnd(rho, mgDiagAt(mgRho, 0), mpiInfo);
+			mgRho->coarseSolv(phi, rho, mgDiagAt(mgRho, 0), mgWorkAt(mgRho, 0),
 								mgRho->nCoarseSolve, mpiInfo);
+			mgRho->nCyclesLast++;
 		}
 	}
 
@@ -1787,7 +2072,7 @@ void mgModeErrorScaling(dictionary *ini){
 	gHaloOp(setSlice, E, mpiInfo, TOHALO);
 	mgCompError(phi,sol,error);
 	mgCompError(E, solE, errorE);
-	mgResidual(res,rho, phi, mpiInfo);
+	mgResidual(res,rho, phi, NULL, mpiInfo);
 
 	/*********************************************************************
 	*			STORE GRIDS
@@ -1949,7 +2234,7 @@ void mgMode(dictionary *ini){
 		gBnd(phi, mpiInfo);
 		gFinDiff1st(phi, E);
 		mgCompError(phi,sol,error);
-		mgResidual(res,rho, phi, mpiInfo);
+		mgResidual(res,rho, phi, NULL, mpiInfo);
 
 
 		gOpenH5(ini, E, mpiInfo, units, 1.0, "E_0");
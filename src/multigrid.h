@@ -31,15 +31,18 @@
 	int nPreSmooth;					///<
 	int nPostSmooth;
 	int nCoarseSolve;
+	int nCyclesLast;				///< Cycles run by the last call to mgSolveRaw()
+	Grid **diag;					///< Linear term on each level (may be NULL)
+	double **work;					///< Scratch array of each level (NULL unless a Jacobi smoother is used)
 
     ///< Function pointer to a Coarse Grid Solver function
-    void (*coarseSolv)(	Grid *phi, const Grid *rho, const int nCycles,
+    void (*coarseSolv)(	Grid *phi, const Grid *rho, const Grid *diag, double *work, const int nCycles,
 						const MpiInfo *mpiInfo);
     ///< Function pointer to a Post Smooth function
-    void (*postSmooth)(	Grid *phi, const Grid *rho, const int nCycles,
+    void (*postSmooth)(	Grid *phi, const Grid *rho, const Grid *diag, double *work, const int nCycles,
 						const MpiInfo *mpiInfo);
     ///< Function pointer to a Pre Smooth function
-    void (*preSmooth)(	Grid *phi, const Grid *rho, const int nCycles,
+    void (*preSmooth)(	Grid *phi, const Grid *rho, const Grid *diag, double *work, const int nCycles,
 						const MpiInfo *mpiInfo);
     ///< Function pointer to restrictor
 	void (*restrictor)(const Grid *fine, Grid *coarse);
@@ -54,6 +57,10 @@ typedef struct {
     Multigrid *mgPhi;
     Multigrid *mgRes;
     funPtr mgAlgo;
+	Grid *rhs;				///< Right-hand side of Newton iterations (mgBoltzSolve())
+	Multigrid *mgDiag;		///< Linearized electron term (NULL unless mgBoltzSolve())
+	double boltzCharge;		///< Electron charge density where phi is zero
+	double boltzTemp;		///< Electron temperature in units of potential (kT/q)
 } MultigridSolver;
 
 /**
@@ -84,17 +91,99 @@ typedef struct {
  *
  *
  *	NB!The number of true grid points used in the finest grid needs to be a
- *  multiple nLevels*2, to make it possible to half the grid points down to
- *  the coarsest grid.
+ *  multiple of mgGranularity(), to make it possible to half the grid points
+ *  down to the coarsest grid.
  */
 
 Multigrid *mgAlloc(const dictionary *ini, Grid *grid);
 
+/**
+ * @brief Number of grid points the subdomain sizes must be a multiple of
+ * @param	ini		Input file
+ * @return	Granularity
+ *
+ * Halving the grid down to the coarsest of mgLevels levels requires sizes that
+ * are multiples of 2^(mgLevels-1). The red-black Gauss-Seidel smoothers also
+ * need an even number of grid points on the coarsest level, and doubles it.
+ * mgAlloc() checks this, and gRebalance() uses it to place the subdomain edges.
+ */
+int mgGranularity(const dictionary *ini);
+
 MultigridSolver* mgAllocSolver(const dictionary *ini, Grid *rho, Grid *phi);
 void mgFreeSolver(MultigridSolver *solver);
 void mgSolve(const MultigridSolver *solver,	const Grid *rho, const Grid *phi, const MpiInfo* mpiInfo);
 funPtr mgSolver_set(const dictionary *ini);
 
+/**
+ * @brief Adds the nominal work of the last call to mgSolve() to cost
+ * @param[in,out]	cost		Cost
+ * @param			solver		MultigridSolver
+ * @param			rho			Charge density
+ * @param			phi			Potential
+ * @param			mpiInfo		MpiInfo
+ * @see Cost, puMoveCost()
+ *
+ * Takes the same arguments as mgSolve(), preceded by 'cost'. Since mgSolve()
+ * runs until convergence, it must be called after mgSolve(). Each cycle is
+ * counted as a V-cycle, and stencil neighbours are assumed to be cached such
+ * that each grid point is read once per sweep. mgSolver_cost() selects it by
+ * the key methods:poisson.
+ */
+void mgSolveCost(Cost *cost, const MultigridSolver *solver, const Grid *rho,
+				 const Grid *phi, const MpiInfo *mpiInfo);
+funPtr mgSolver_cost(const dictionary *ini);
+
+/**
+ * @brief Solves Poisson's equation with Boltzmann electrons
+ * @param			solver		MultigridSolver from mgAllocBoltzSolver()
+ * @param			rho			Charge density of the ions
+ * @param[in,out]	phi			Potential
+ * @param			mpiInfo		MpiInfo
+ *
+ * Specie 0 is treated as a fluid in Boltzmann equilibrium rather than as
+ * particles, i.e. its charge density is
+ *
+ * \f[
+ *		\rho_e = \rho_0 \exp\left(-\frac{q\phi}{kT}\right)
+ * \f]
+ *
+ * where \f$\rho_0\f$ is the mean charge density given by population:nParticles
+ * and \f$kT\f$ is given by population:thermalVelocity. The nonlinear equation
+ * \f$\nabla^2\phi = -\rho-\rho_e(\phi)\f$ is solved by Newton iterations,
+ * each of which linearizes \f$\rho_e\f$ about the present phi and runs one
+ * multigrid cycle on
+ *
+ * \f[
+ *		\left(\nabla^2-\kappa^2\right)\phi = -\rho-\rho_e+\kappa^2\phi,
+ *		\quad \kappa^2 = -\frac{d\rho_e}{d\phi}
+ * \f]
+ *
+ * where the right-hand side is evaluated at the present phi. The diagonal term
+ * \f$\kappa^2\f$ is restricted to all levels and included by the smoothers.
+ * The iterations stop when the residual of the nonlinear equation is below
+ * the same tolerance as mgSolveRaw(). Since phi from the previous time step is
+ * the initial guess, few iterations are needed in a time loop.
+ *
+ * The particles of specie 0 must not be pushed or deposited to rho, which
+ * is taken care of in the regular run mode when methods:poisson=mgBoltzSolver.
+ * Only the 3D gaussSeidelRB and jacobian smoothers support the diagonal term.
+ */
+MultigridSolver* mgAllocBoltzSolver(const dictionary *ini, Grid *rho, Grid *phi);
+void mgBoltzSolve(const MultigridSolver *solver, const Grid *rho, const Grid *phi,
+				  const MpiInfo* mpiInfo);
+funPtr mgBoltzSolver_set(const dictionary *ini);
+
+/**
+ * @brief Adds the nominal work of the last call to mgBoltzSolve() to cost
+ * @see mgSolveCost()
+ *
+ * As mgSolveCost(), but also counts linearizing the electron charge density
+ * and restricting the diagonal term once per cycle.
+ */
+void mgBoltzSolveCost(Cost *cost, const MultigridSolver *solver, const Grid *rho,
+					  const Grid *phi, const MpiInfo *mpiInfo);
+funPtr mgBoltzSolver_cost(const dictionary *ini);
+
  /**
   * @brief Free multigrid struct, top gridQuantity needs to be freed seperately
   * @param 	multigrid
@@ -217,23 +306,32 @@ funPtr mgSolveRaw_set(dictionary *ini);
  *  through the grid trying to simplify the iteration through the grid.
  *
  */
-void mgGS3DNew(Grid *phi, const Grid *rho, const int nCycles,
+void mgGS3DNew(Grid *phi, const Grid *rho, const Grid *diag, double *work, const int nCycles,
                 const MpiInfo *mpiInfo);
 
 /**
  * @brief Gauss-Seidel Red and Black 3D
  * @param	rho		Source term
  * @param	phi		Solution term
+ * @param	diag	Linear term (NULL for Poisson's equation)
+ * @param	work	Scratch array of the size of phi (used by Jacobi smoothers)
  * @param	mpiInfo	Subdomain information
  * @return	phi
  *
+ *	Solves \f$(\nabla^2-\kappa^2)\phi=-\rho\f$, where \f$\kappa^2\f$ is
+ *  given per node by diag. The other smoothers ignore diag.
+ *
+ *	All smoothers share this signature. work is owned by the Multigrid level
+ *  (Multigrid::work) such that it follows the size of the grid when the
+ *  subdomains are rebalanced. The Gauss-Seidel smoothers ignore it.
+ *
  *	3D dimensional implementation of Gauss-Seidel RB, which does one sweep
  *  through the grid for each color, but has slightly more complicated behaviour
  *  on the edges, due to needing to skip the ghostlayers.
  *
  *	NB! Assumes 1 ghost layer, and even number of grid points.
  */
-void mgGS3D(Grid *phi, const Grid *rho, const int nCycles,
+void mgGS3D(Grid *phi, const Grid *rho, const Grid *diag, double *work, const int nCycles,
             const MpiInfo *mpiInfo);
 
 /**
@@ -248,11 +346,11 @@ void mgGS3D(Grid *phi, const Grid *rho, const int nCycles,
  *
  *	NB! Assumes 1 ghost layer, and even number of grid points.
  */
-void mgGS2D(Grid *phi, const Grid *rho, const int nCycles,
+void mgGS2D(Grid *phi, const Grid *rho, const Grid *diag, double *work, const int nCycles,
             const MpiInfo *mpiInfo);
 
 
-void mgGSND(Grid *phi, const Grid *rho, int nCycles, const MpiInfo *mpiInfo);
+void mgGSND(Grid *phi, const Grid *rho, const Grid *diag, double *work, int nCycles, const MpiInfo *mpiInfo);
 
 /**
  * @brief mgJacob method
@@ -262,15 +360,22 @@ void mgGSND(Grid *phi, const Grid *rho, int nCycles, const MpiInfo *mpiInfo);
  * @return	phi
  *
  * Non-optimized implementation of a mgJacob2D algorithm to solve poissons
- * equation.
+ * equation. The new iterate is stored in work before it is copied to phi.
  *
  *	NB! Assumes 1 ghost layer, and even number of grid points.
  */
-void mgJacobND(Grid *phi, const Grid *rho, const int nCycles,
+void mgJacobND(Grid *phi, const Grid *rho, const Grid *diag, double *work, const int nCycles,
                 const MpiInfo *mpiInfo);
-void mgJacob1D(Grid *phi, const Grid *rho, const int nCycles,
+void mgJacob1D(Grid *phi, const Grid *rho, const Grid *diag, double *work, const int nCycles,
                 const MpiInfo *mpiInfo);
-void mgJacob3D(Grid *phi, const Grid *rho, const int nCycles,
+
+/**
+ * @brief Jacobi 3D
+ * @see mgGS3D()
+ *
+ * Supports the linear term diag like mgGS3D().
+ */
+void mgJacob3D(Grid *phi, const Grid *rho, const Grid *diag, double *work, const int nCycles,
                 const MpiInfo *mpiInfo);
 
 
@@ -371,15 +476,17 @@ void mgRestrictBnd(Multigrid *mgGrid);
  * @param	res		Residual grid
  * @param	phi		Phi	grid
  * @param	rho		Rho grid
+ * @param	diag	Linear term (NULL for Poisson's equation)
  * @param	mpiInfo	Subdomain information
  * @return	res
  *
  *	Computes the residual on a grid level.
  *	\f[
- *		d_l = \nabla^2_l\phi_l - \rho_l
+ *		d_l = \nabla^2_l\phi_l - \kappa^2_l\phi_l + \rho_l
  *	\f]
  */
-void mgResidual(Grid *res, const Grid *rho, const Grid *phi,const MpiInfo *mpiInfo);
+void mgResidual(Grid *res, const Grid *rho, const Grid *phi, const Grid *diag,
+				const MpiInfo *mpiInfo);
 
 /**
  * @brief Returns mass of a grid
@@ -7,70 +7,724 @@
 
 #include "core.h"
 #include "object.h"
+#include <string.h>
 
 /******************************************************************************
  *  LOCAL FUNCTION DECLARATIONS
  *****************************************************************************/
 
 /**
- * @brief   Count the number of objects and fills the lookup tables.
+ * @brief   Reads a dataset from the .grid.h5-file into obj->domain.
  * @param	obj		Object
- * @param	ini		input settings
+ * @param	name	Name of dataset
  * @return	void
  */
-void oFillLookupTables(Object *obj, const MpiInfo *mpiInfo);
+static void oReadDataset(Object *obj, const char *name);
+
+/**
+ * @brief   Object identifier at a position along the last step of a particle.
+ * @param	obj		Object
+ * @param	pos		Position after the step
+ * @param	vel		Velocity
+ * @param	s		Fraction of the step back from pos
+ * @return	Identifier (0 outside objects)
+ */
+static int oIdAt(const Object *obj, const double *pos, const double *vel,
+                 double s);
+
+/**
+ * @brief   Signed distance at a position along the last step of a particle.
+ * @see     oIdAt(), oDistance()
+ */
+static double oDistanceAt(const Object *obj, const double *pos,
+                          const double *vel, double s);
+
+/**
+ * @brief   Reads the triangles of an ASCII .vtk- or .stl-file.
+ * @param	fName		File name
+ * @param	stepSize	Step size, to convert coordinates to cells
+ * @param	offset		Offset of subdomain, to convert to local frame
+ * @param	nTriangles	Number of triangles (output)
+ * @return	Corners of the triangles (9 elements per triangle)
+ */
+static double *oReadMesh(const char *fName, const double *stepSize,
+                         const int *offset, long int *nTriangles);
+
+/**
+ * @brief   Sets the nodes inside a closed triangle mesh in obj->domain.
+ * @param	obj			Object
+ * @param	triangles	Corners of the triangles in the local frame
+ * @param	nTriangles	Number of triangles
+ * @param	id			Object identifier to set
+ * @return	void
+ */
+static void oRasterize(Object *obj, const double *triangles,
+                       long int nTriangles, int id);
+
+static int oCompareDouble(const void *a, const void *b);
+
+static int oCompareLong(const void *a, const void *b);
+
+/**
+ * @brief   Inverts a matrix in-place by Gauss-Jordan elimination.
+ * @param	a		Row-major n*n matrix
+ * @param	n		Number of rows
+ * @return	void
+ */
+static void oInvert(double *a, int n);
+
+/**
+ * @brief   Inverts a matrix distributed by rows by Gauss-Jordan elimination.
+ * @param	rows	Row-major nRows*n elements, the rows of this MPI node
+ * @param	index	Index of each of those rows in the matrix
+ * @param	nRows	Number of rows on this MPI node
+ * @param	n		Number of rows in all
+ * @param	pivot	Index of the row used as pivot for each column (output)
+ * @param	mpiInfo	MpiInfo
+ * @return	void
+ *
+ * Rows are not swapped between MPI nodes. Instead, row pivot[m] holds row m
+ * of the inverse on return, with column pivot[k] stored at k.
+ */
+static void oInvertRows(double *rows, const int *index, int nRows, int n,
+                        int *pivot, const MpiInfo *mpiInfo);
+
+/**
+ * @brief   Sends rows of a matrix distributed by rows to the MPI nodes using them.
+ * @param	rows	Row-major nHave*n elements, the rows of this MPI node
+ * @param	have	Index of each of those rows in the matrix
+ * @param	nHave	Number of rows on this MPI node
+ * @param	want	Index of each row wanted by this MPI node
+ * @param	nWant	Number of rows wanted by this MPI node
+ * @param	n		Number of rows in all (and elements per row)
+ * @param	mpiInfo	MpiInfo
+ * @return	The wanted rows (nWant*n elements)
+ */
+static double *oRouteRows(const double *rows, const int *have, int nHave,
+                          const int *want, int nWant, int n,
+                          const MpiInfo *mpiInfo);
+
+/**
+ * @brief   Numbers the surface nodes of the conducting objects.
+ * @param	obj		Object
+ * @param	mpiInfo	MpiInfo
+ * @return	void
+ *
+ * Sets nCap, nCapLocal, capNode, capIndex, capOrder, capCounts, capDispls and
+ * capObject from lookupSurface and conductor (see Object).
+ */
+static void oNumberCapacitance(Object *obj, const MpiInfo *mpiInfo);
+
+/**
+ * @brief   Frees the capacitance matrix and related arrays.
+ * @param	obj		Object
+ * @return	void
+ */
+static void oFreeCapacitance(Object *obj);
+
+// Number of bisections in oCrossing() without a signed distance field
+#define O_CROSSING_BISECTIONS 10
+
+// Rays cast by oRasterize() are shifted off the nodes by these amounts (in
+// cells) along the y- and z-axes, such that they do not hit edges and corners
+// of meshes aligned with the grid.
+#define O_RAY_SHIFT_Y 1.1e-7
+#define O_RAY_SHIFT_Z 1.7e-7
 
 /******************************************************************************
  *  LOCAL FUNCTION DEFINITIONS
  *****************************************************************************/
 
-void oFillLookupTables(Object *obj, const MpiInfo *mpiInfo) {
+static void oReadDataset(Object *obj, const char *name){
     
-    int nObjects = 0;
-    for (int i=0; i<obj->domain->sizeProd[obj->domain->rank]; i++) {
-        if (obj->domain->val[i]>nObjects) {
-            nObjects = (int)(obj->domain->val[i]+0.5); // Note, this is not necessary
-                //the number of objects, but rather the identifier of the object with the highest number.
+    // Identical to gReadH5()
+    hid_t fileSpace = obj->domain->h5FileSpace;
+    hid_t memSpace = obj->domain->h5MemSpace;
+    hid_t file = obj->domain->h5;
+    double *val = obj->domain->val;
+    
+    hid_t pList = H5Pcreate(H5P_DATASET_XFER);
+    H5Pset_dxpl_mpio(pList, H5FD_MPIO_COLLECTIVE);
+    
+    hid_t dataset = H5Dopen(file,name,H5P_DEFAULT);
+    H5Dread(dataset, H5T_NATIVE_DOUBLE, memSpace, fileSpace, pList, val);
+    
+    H5Dclose(dataset);
+    H5Pclose(pList);
+}
+
+static double *oReadMesh(const char *fName, const double *stepSize,
+                         const int *offset, long int *nTriangles){
+    
+    FILE *file = fopen(fName, "r");
+    if(!file) msg(ERROR, "could not open %s", fName);
+    
+    const char *ext = strrchr(fName, '.');
+    int isVtk = ext && (!strcmp(ext,".vtk") || !strcmp(ext,".VTK"));
+    int isStl = ext && (!strcmp(ext,".stl") || !strcmp(ext,".STL"));
+    if(!isVtk && !isStl) msg(ERROR, "%s is neither a .vtk- nor an .stl-file", fName);
+    
+    long int nAlloc = 1024;
+    long int n = 0;
+    double *triangles = malloc(nAlloc*9*sizeof(*triangles));
+    char token[64];
+    
+    if(isStl){
+        
+        // Every three vertices form a facet
+        long int nVertices = 0;
+        while(fscanf(file, "%63s", token)==1){
+            if(strcmp(token, "vertex")) continue;
+            if(n==nAlloc){
+                nAlloc *= 2;
+                triangles = realloc(triangles, nAlloc*9*sizeof(*triangles));
+            }
+            double *corner = &triangles[9*n+3*(nVertices%3)];
+            if(fscanf(file, "%lf %lf %lf", &corner[0], &corner[1], &corner[2])!=3)
+                msg(ERROR, "invalid vertex in %s", fName);
+            if(++nVertices%3==0) n++;
         }
+        
+    } else {
+        
+        // Header, title and format
+        char line[256];
+        if(!fgets(line, sizeof(line), file) || !fgets(line, sizeof(line), file) ||
+           fscanf(file, "%63s", token)!=1 || strcmp(token, "ASCII"))
+            msg(ERROR, "%s is not an ASCII legacy VTK-file", fName);
+        
+        long int nPoints = 0;
+        double *points = NULL;
+        while(fscanf(file, "%63s", token)==1){
+            
+            if(!strcmp(token, "POINTS")){
+                if(fscanf(file, "%ld %63s", &nPoints, token)!=2)
+                    msg(ERROR, "invalid POINTS in %s", fName);
+                points = malloc(3*nPoints*sizeof(*points));
+                for(long int i=0; i<3*nPoints; i++)
+                    if(fscanf(file, "%lf", &points[i])!=1)
+                        msg(ERROR, "invalid POINTS in %s", fName);
+            }
+            
+            // Each cell is split into triangles sharing its first point
+            if(!strcmp(token, "POLYGONS") || !strcmp(token, "CELLS")){
+                long int nCells, size;
+                if(!points || fscanf(file, "%ld %ld", &nCells, &size)!=2)
+                    msg(ERROR, "invalid %s in %s", token, fName);
+                for(long int c=0; c<nCells; c++){
+                    long int nCorners, first = 0, prev = 0, next;
+                    if(fscanf(file, "%ld", &nCorners)!=1)
+                        msg(ERROR, "invalid cell in %s", fName);
+                    for(long int k=0; k<nCorners; k++){
+                        if(fscanf(file, "%ld", &next)!=1 || next<0 || next>=nPoints)
+                            msg(ERROR, "invalid cell in %s", fName);
+                        if(k==0) first = next;
+                        if(k>=2){
+                            if(n==nAlloc){
+                                nAlloc *= 2;
+                                triangles = realloc(triangles, nAlloc*9*sizeof(*triangles));
+                            }
+                            for(int d=0; d<3; d++){
+                                triangles[9*n+d]   = points[3*first+d];
+                                triangles[9*n+3+d] = points[3*prev+d];
+                                triangles[9*n+6+d] = points[3*next+d];
+                            }
+                            n++;
+                        }
+                        prev = next;
+                    }
+                }
+            }
+        }
+        free(points);
     }
-    // Make sure each process knows about the total number of objects.
-    MPI_Allreduce(MPI_IN_PLACE, &nObjects, 1, MPI_INT, MPI_MAX, MPI_COMM_WORLD);
     
-    // Initialise and compute the array storing the offsets of the objects in the lookup table.
-    long int *lookupInteriorOffset = malloc((nObjects+1)*sizeof(*lookupInteriorOffset));
-    for (long int i=0; i<nObjects+1; i++) {
-        lookupInteriorOffset[i] = 0;
+    fclose(file);
+    if(n==0) msg(ERROR, "no triangles found in %s", fName);
+    
+    for(long int i=0; i<9*n; i++){
+        int d = (int)(i%3);
+        triangles[i] = triangles[i]/stepSize[d]-offset[d];
     }
-   
-    for (long int i=0; i<obj->domain->sizeProd[obj->domain->rank]; i++) {
-        if (obj->domain->val[i]>0.5){
-            lookupInteriorOffset[(int)(obj->domain->val[i]+0.5)]++;
+    
+    *nTriangles = n;
+    return triangles;
+}
+
+static void oRasterize(Object *obj, const double *triangles,
+                       long int nTriangles, int id){
+    
+    Grid *domain = obj->domain;
+    int *size = domain->size;
+    int *nGhostLayers = domain->nGhostLayers;
+    long int *sizeProd = domain->sizeProd;
+    double *val = domain->val;
+    
+    // True nodes along each dimension
+    int lo[3], hi[3];
+    for(int d=0; d<3; d++){
+        lo[d] = nGhostLayers[d+1];
+        hi[d] = size[d+1]-nGhostLayers[d+5];
+    }
+    
+    // One ray along the x-axis per line of true nodes
+    int nY = hi[1]-lo[1];
+    long int nLines = (long int)nY*(hi[2]-lo[2]);
+    long int *lineOffset = calloc(nLines+1, sizeof(*lineOffset));
+    double *crossing = NULL;
+    
+    // Count the crossings of each ray, and then store them
+    for(int pass=0; pass<2; pass++){
+        
+        long int *count = calloc(nLines, sizeof(*count));
+        
+        for(long int t=0; t<nTriangles; t++){
+            
+            const double *x = &triangles[9*t];
+            const double *y = &triangles[9*t+1];
+            const double *z = &triangles[9*t+2];
+            
+            double det = (y[3]-y[0])*(z[6]-z[0])-(y[6]-y[0])*(z[3]-z[0]);
+            if(det==0) continue;
+            
+            double yMin = fmin(y[0],fmin(y[3],y[6]))-O_RAY_SHIFT_Y;
+            double yMax = fmax(y[0],fmax(y[3],y[6]))-O_RAY_SHIFT_Y;
+            double zMin = fmin(z[0],fmin(z[3],z[6]))-O_RAY_SHIFT_Z;
+            double zMax = fmax(z[0],fmax(z[3],z[6]))-O_RAY_SHIFT_Z;
+            int jStart = (int)fmax(ceil(yMin), lo[1]);
+            int jStop  = (int)fmin(floor(yMax), hi[1]-1);
+            int kStart = (int)fmax(ceil(zMin), lo[2]);
+            int kStop  = (int)fmin(floor(zMax), hi[2]-1);
+            
+            for(int k=kStart; k<=kStop; k++){
+                for(int j=jStart; j<=jStop; j++){
+                    
+                    // Barycentric coordinates in the yz-plane
+                    double py = j+O_RAY_SHIFT_Y;
+                    double pz = k+O_RAY_SHIFT_Z;
+                    double a = ((y[3]-py)*(z[6]-pz)-(y[6]-py)*(z[3]-pz))/det;
+                    double b = ((y[6]-py)*(z[0]-pz)-(y[0]-py)*(z[6]-pz))/det;
+                    double c = 1-a-b;
+                    if(a<0 || b<0 || c<0) continue;
+                    
+                    long int line = (j-lo[1])+(long int)(k-lo[2])*nY;
+                    if(pass) crossing[lineOffset[line]+count[line]] = a*x[0]+b*x[3]+c*x[6];
+                    count[line]++;
+                }
+            }
+        }
+        
+        if(!pass){
+            alCumSum(count, lineOffset, nLines);
+            crossing = malloc(lineOffset[nLines]*sizeof(*crossing));
         }
+        free(count);
     }
-    alCumSum(lookupInteriorOffset+1,lookupInteriorOffset,nObjects);
     
-    // Initialise and compute the lookup table.
-    long int *lookupInterior = malloc((lookupInteriorOffset[nObjects])*sizeof(*lookupInterior));
-    for (long int i=0; i<lookupInteriorOffset[nObjects]; i++) {
-        lookupInterior[i]=0;
+    // Nodes between every other pair of crossings are inside
+    int nOdd = 0;
+    #pragma omp parallel for schedule(dynamic,64) reduction(+:nOdd)
+    for(long int line=0; line<nLines; line++){
+        
+        double *c = &crossing[lineOffset[line]];
+        long int nCrossings = lineOffset[line+1]-lineOffset[line];
+        qsort(c, nCrossings, sizeof(*c), oCompareDouble);
+        if(nCrossings%2) nOdd++;
+        
+        int j = lo[1]+(int)(line%nY);
+        int k = lo[2]+(int)(line/nY);
+        long int base = j*sizeProd[2]+k*sizeProd[3];
+        
+        for(long int m=0; m+1<nCrossings; m+=2){
+            int iStart = (int)fmax(ceil(c[m]), lo[0]);
+            int iStop  = (int)fmin(floor(c[m+1]), hi[0]-1);
+            for(int i=iStart; i<=iStop; i++) val[base+i*sizeProd[1]] = id;
+        }
     }
-   
-    long int *index = malloc((nObjects)*sizeof(*index));
-    for (long int i=0; i<nObjects; i++) {
-        index[i]=lookupInteriorOffset[i];
+    
+    if(nOdd) msg(WARNING|ALL, "%i rays cross object %i an odd number of times. "
+                 "Is the mesh closed?", nOdd, id);
+    
+    free(lineOffset);
+    free(crossing);
+}
+
+static int oCompareDouble(const void *a, const void *b){
+    
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x>y)-(x<y);
+}
+
+static int oCompareLong(const void *a, const void *b){
+    
+    long int x = *(const long int *)a;
+    long int y = *(const long int *)b;
+    return (x>y)-(x<y);
+}
+
+static int oIdAt(const Object *obj, const double *pos, const double *vel,
+                 double s){
+    
+    int nDims = obj->domain->rank-1;
+    const long int *mul = &obj->maskSizeProd[1];
+    
+    long int j = 0;
+    for(int d=0; d<nDims; d++) j += (long int)(pos[d]-s*vel[d]+0.5)*mul[d];
+    
+    return obj->mask[j];
+}
+
+static double oDistanceAt(const Object *obj, const double *pos,
+                          const double *vel, double s){
+    
+    int nDims = obj->domain->rank-1;
+    const long int *mul = &obj->maskSizeProd[1];
+    const float *distance = obj->distance;
+    
+    long int j = 0;
+    for(int d=0; d<nDims; d++) j += (long int)(pos[d]-s*vel[d])*mul[d];
+    
+    // Multilinear interpolation between the 2^nDims surrounding nodes
+    double result = 0;
+    for(int corner=0; corner<(1<<nDims); corner++){
+        double weight = 1;
+        long int k = j;
+        for(int d=0; d<nDims; d++){
+            double x = pos[d]-s*vel[d];
+            double frac = x-(long int)x;
+            if(corner>>d & 1){
+                weight *= frac;
+                k += mul[d];
+            } else {
+                weight *= 1-frac;
+            }
+        }
+        result += weight*distance[k];
     }
-   
-    for (long int i=0; i<obj->domain->sizeProd[obj->domain->rank]; i++) {
-        if (obj->domain->val[i]>0.5){
-            lookupInterior[(index[(int)(obj->domain->val[i]+0.5)-1])] = i;
-            (index[(int)(obj->domain->val[i]+0.5)-1])++;
+    
+    return result;
+}
+
+static void oInvert(double *a, int n){
+    
+    int *perm = malloc(n*sizeof(*perm));
+    
+    for(int k=0; k<n; k++){
+        
+        // Partial pivoting
+        int p = k;
+        for(int i=k+1; i<n; i++) if(fabs(a[i*n+k])>fabs(a[p*n+k])) p = i;
+        if(a[p*n+k]==0) msg(ERROR,"singular capacitance matrix");
+        perm[k] = p;
+        if(p!=k){
+            for(int j=0; j<n; j++){
+                double temp = a[k*n+j];
+                a[k*n+j] = a[p*n+j];
+                a[p*n+j] = temp;
+            }
+        }
+        
+        double pivot = 1/a[k*n+k];
+        a[k*n+k] = 1;
+        for(int j=0; j<n; j++) a[k*n+j] *= pivot;
+        
+        for(int i=0; i<n; i++){
+            if(i==k) continue;
+            double factor = a[i*n+k];
+            a[i*n+k] = 0;
+            for(int j=0; j<n; j++) a[i*n+j] -= factor*a[k*n+j];
         }
     }
     
-    // Add to the obj Object.
-    obj->nObjects = nObjects;
-    obj->lookupInterior = lookupInterior;
-    obj->lookupInteriorOffset = lookupInteriorOffset;
+    // Undo row swaps as column swaps in reverse order
+    for(int k=n-1; k>=0; k--){
+        int p = perm[k];
+        if(p==k) continue;
+        for(int i=0; i<n; i++){
+            double temp = a[i*n+k];
+            a[i*n+k] = a[i*n+p];
+            a[i*n+p] = temp;
+        }
+    }
+    
+    free(perm);
+}
+
+static void oInvertRows(double *rows, const int *index, int nRows, int n,
+                        int *pivot, const MpiInfo *mpiInfo){
+    
+    int mpiSize = mpiInfo->mpiSize;
+    
+    // MPI node having each row
+    int *counts = malloc(mpiSize*sizeof(*counts));
+    int *displs = malloc((mpiSize+1)*sizeof(*displs));
+    int *indexAll = malloc(n*sizeof(*indexAll));
+    int *owner = malloc(n*sizeof(*owner));
+    MPI_Allgather(&nRows, 1, MPI_INT, counts, 1, MPI_INT, simComm);
+    aiCumSum(counts, displs, mpiSize);
+    MPI_Allgatherv(index, nRows, MPI_INT, indexAll, counts, displs, MPI_INT,
+                   simComm);
+    for(int r=0; r<mpiSize; r++)
+        for(int k=displs[r]; k<displs[r+1]; k++) owner[indexAll[k]] = r;
+    
+    char *used = calloc(nRows, sizeof(*used));
+    double *pivotRow = malloc(n*sizeof(*pivotRow));
+    
+    for(int k=0; k<n; k++){
+        
+        // Partial pivoting among the rows not used yet
+        struct { double value; int index; } best = {-1, -1}, bestAll;
+        int p = -1;
+        for(int i=0; i<nRows; i++){
+            double value = fabs(rows[(long int)i*n+k]);
+            if(!used[i] && value>best.value){
+                best.value = value;
+                best.index = index[i];
+                p = i;
+            }
+        }
+        MPI_Allreduce(&best, &bestAll, 1, MPI_DOUBLE_INT, MPI_MAXLOC, simComm);
+        if(bestAll.value<=0) msg(ERROR,"singular capacitance matrix");
+        pivot[k] = bestAll.index;
+        
+        if(bestAll.index==best.index){
+            double *row = &rows[(long int)p*n];
+            double factor = 1/row[k];
+            row[k] = 1;
+            for(int j=0; j<n; j++) row[j] *= factor;
+            for(int j=0; j<n; j++) pivotRow[j] = row[j];
+            used[p] = 1;
+        } else {
+            p = -1;
+        }
+        MPI_Bcast(pivotRow, n, MPI_DOUBLE, owner[bestAll.index], simComm);
+        
+        for(int i=0; i<nRows; i++){
+            if(i==p) continue;
+            double *row = &rows[(long int)i*n];
+            double factor = row[k];
+            row[k] = 0;
+            for(int j=0; j<n; j++) row[j] -= factor*pivotRow[j];
+        }
+    }
+    
+    free(counts);
+    free(displs);
+    free(indexAll);
+    free(owner);
+    free(used);
+    free(pivotRow);
+}
+
+static double *oRouteRows(const double *rows, const int *have, int nHave,
+                          const int *want, int nWant, int n,
+                          const MpiInfo *mpiInfo){
+    
+    int mpiSize = mpiInfo->mpiSize;
+    int mpiRank = mpiInfo->mpiRank;
+    
+    // Rows had and wanted by each MPI node
+    int *haveCounts = malloc(mpiSize*sizeof(*haveCounts));
+    int *haveDispls = malloc((mpiSize+1)*sizeof(*haveDispls));
+    int *haveAll = malloc(n*sizeof(*haveAll));
+    MPI_Allgather(&nHave, 1, MPI_INT, haveCounts, 1, MPI_INT, simComm);
+    aiCumSum(haveCounts, haveDispls, mpiSize);
+    MPI_Allgatherv(have, nHave, MPI_INT, haveAll, haveCounts, haveDispls,
+                   MPI_INT, simComm);
+    
+    int *wantCounts = malloc(mpiSize*sizeof(*wantCounts));
+    int *wantDispls = malloc((mpiSize+1)*sizeof(*wantDispls));
+    int *wantAll = malloc(n*sizeof(*wantAll));
+    MPI_Allgather(&nWant, 1, MPI_INT, wantCounts, 1, MPI_INT, simComm);
+    aiCumSum(wantCounts, wantDispls, mpiSize);
+    MPI_Allgatherv(want, nWant, MPI_INT, wantAll, wantCounts, wantDispls,
+                   MPI_INT, simComm);
+    
+    int *owner = malloc(n*sizeof(*owner));
+    int *position = malloc(n*sizeof(*position));
+    for(int r=0; r<mpiSize; r++)
+        for(int k=haveDispls[r]; k<haveDispls[r+1]; k++) owner[haveAll[k]] = r;
+    for(int i=0; i<nHave; i++) position[have[i]] = i;
+    
+    // Counted in rows, such that the counts fit in an int
+    int *sendCounts = calloc(mpiSize, sizeof(*sendCounts));
+    int *sendDispls = malloc((mpiSize+1)*sizeof(*sendDispls));
+    int *recvCounts = calloc(mpiSize, sizeof(*recvCounts));
+    int *recvDispls = malloc((mpiSize+1)*sizeof(*recvDispls));
+    for(int r=0; r<mpiSize; r++)
+        for(int k=wantDispls[r]; k<wantDispls[r+1]; k++)
+            if(owner[wantAll[k]]==mpiRank) sendCounts[r]++;
+    for(int i=0; i<nWant; i++) recvCounts[owner[want[i]]]++;
+    aiCumSum(sendCounts, sendDispls, mpiSize);
+    aiCumSum(recvCounts, recvDispls, mpiSize);
+    
+    double *send = malloc((long int)sendDispls[mpiSize]*n*sizeof(*send));
+    double *recv = malloc((long int)nWant*n*sizeof(*recv));
+    double *result = malloc((long int)nWant*n*sizeof(*result));
+    
+    long int s = 0;
+    for(int r=0; r<mpiSize; r++)
+        for(int k=wantDispls[r]; k<wantDispls[r+1]; k++)
+            if(owner[wantAll[k]]==mpiRank){
+                const double *row = &rows[(long int)position[wantAll[k]]*n];
+                for(int j=0; j<n; j++) send[s++] = row[j];
+            }
+    
+    MPI_Datatype rowType;
+    MPI_Type_contiguous(n, MPI_DOUBLE, &rowType);
+    MPI_Type_commit(&rowType);
+    MPI_Alltoallv(send, sendCounts, sendDispls, rowType,
+                  recv, recvCounts, recvDispls, rowType, simComm);
+    MPI_Type_free(&rowType);
+    
+    // Each MPI node sends the rows in the order they are wanted
+    for(int i=0; i<nWant; i++){
+        int k = recvDispls[owner[want[i]]]++;
+        for(int j=0; j<n; j++)
+            result[(long int)i*n+j] = recv[(long int)k*n+j];
+    }
+    
+    free(haveCounts);
+    free(haveDispls);
+    free(haveAll);
+    free(wantCounts);
+    free(wantDispls);
+    free(wantAll);
+    free(owner);
+    free(position);
+    free(sendCounts);
+    free(sendDispls);
+    free(recvCounts);
+    free(recvDispls);
+    free(send);
+    free(recv);
+    
+    return result;
+}
+
+static void oNumberCapacitance(Object *obj, const MpiInfo *mpiInfo){
+    
+    int nObjects = obj->nObjects;
+    int nDims = mpiInfo->nDims;
+    int mpiSize = mpiInfo->mpiSize;
+    int mpiRank = mpiInfo->mpiRank;
+    oConductor *conductor = obj->conductor;
+    long int *lookupSurface = obj->lookupSurface;
+    long int *lookupSurfaceOffset = obj->lookupSurfaceOffset;
+    Grid *domain = obj->domain;
+    
+    // Surface nodes of conducting objects on this MPI node
+    int nCapLocal = 0;
+    for(int o=0; o<nObjects; o++)
+        if(conductor[o]!=O_INSULATING)
+            nCapLocal += (int)(lookupSurfaceOffset[o+1]-lookupSurfaceOffset[o]);
+    
+    // Keyed by global node index and then object
+    long int *capNode = malloc(nCapLocal*sizeof(*capNode));
+    long int *key = malloc(nCapLocal*sizeof(*key));
+    int i = 0;
+    for(int o=0; o<nObjects; o++){
+        if(conductor[o]==O_INSULATING) continue;
+        for(long int k=lookupSurfaceOffset[o]; k<lookupSurfaceOffset[o+1]; k++){
+            long int node = lookupSurface[k];
+            long int global = 0, stride = 1;
+            for(int d=0; d<nDims; d++){
+                long int size = mpiInfo->edges[d][mpiInfo->nSubdomains[d]];
+                long int j = (node/domain->sizeProd[d+1])%domain->size[d+1];
+                global += ((j+mpiInfo->offset[d])%size)*stride;
+                stride *= size;
+            }
+            capNode[i] = node;
+            key[i] = global*nObjects+o;
+            i++;
+        }
+    }
+    
+    int *capCounts = malloc(mpiSize*sizeof(*capCounts));
+    int *capDispls = malloc((mpiSize+1)*sizeof(*capDispls));
+    MPI_Allgather(&nCapLocal, 1, MPI_INT, capCounts, 1, MPI_INT, simComm);
+    aiCumSum(capCounts, capDispls, mpiSize);
+    int nCap = capDispls[mpiSize];
+    
+    if(nCap==0){
+        free(capNode);
+        free(key);
+        free(capCounts);
+        free(capDispls);
+        obj->nCap = 0;
+        obj->nCapLocal = 0;
+        return;
+    }
+    
+    long int *keyAll = malloc(nCap*sizeof(*keyAll));
+    long int *keySorted = malloc(nCap*sizeof(*keySorted));
+    MPI_Allgatherv(key, nCapLocal, MPI_LONG, keyAll, capCounts, capDispls,
+                   MPI_LONG, simComm);
+    for(int j=0; j<nCap; j++) keySorted[j] = keyAll[j];
+    qsort(keySorted, nCap, sizeof(*keySorted), oCompareLong);
+    
+    int *capObject = malloc(nCap*sizeof(*capObject));
+    int *capOrder = malloc(nCap*sizeof(*capOrder));
+    int *capIndex = malloc(nCapLocal*sizeof(*capIndex));
+    for(int j=0; j<nCap; j++) capObject[j] = (int)(keySorted[j]%nObjects);
+    for(int k=0; k<nCap; k++){
+        long int *found = bsearch(&keyAll[k], keySorted, nCap,
+                                  sizeof(*keySorted), oCompareLong);
+        capOrder[k] = (int)(found-keySorted);
+    }
+    for(int i=0; i<nCapLocal; i++) capIndex[i] = capOrder[capDispls[mpiRank]+i];
+    
+    free(key);
+    free(keyAll);
+    free(keySorted);
+    
+    obj->nCap = nCap;
+    obj->nCapLocal = nCapLocal;
+    obj->capNode = capNode;
+    obj->capIndex = capIndex;
+    obj->capOrder = capOrder;
+    obj->capCounts = capCounts;
+    obj->capDispls = capDispls;
+    obj->capObject = capObject;
+}
+
+static void oFreeCapacitance(Object *obj){
+    
+    free(obj->conductor);
+    free(obj->bias);
+    free(obj->capNode);
+    free(obj->capIndex);
+    free(obj->capOrder);
+    free(obj->capCounts);
+    free(obj->capDispls);
+    free(obj->capObject);
+    free(obj->capMatrix);
+    free(obj->capRowSum);
+    free(obj->capColSum);
+    free(obj->capTotal);
+    free(obj->capFloating);
+    free(obj->capPhi);
+    free(obj->capBuffer);
+    
+    obj->conductor = NULL;
+    obj->bias = NULL;
+    obj->capNode = NULL;
+    obj->capIndex = NULL;
+    obj->capOrder = NULL;
+    obj->capCounts = NULL;
+    obj->capDispls = NULL;
+    obj->capObject = NULL;
+    obj->capMatrix = NULL;
+    obj->capRowSum = NULL;
+    obj->capColSum = NULL;
+    obj->capTotal = NULL;
+    obj->capFloating = NULL;
+    obj->capPhi = NULL;
+    obj->capBuffer = NULL;
+    obj->nCap = 0;
+    obj->nCapLocal = 0;
+    obj->volume = 0;
 }
 
 
@@ -83,16 +737,38 @@ Object *oAlloc(const dictionary *ini){
     
     Grid *domain = gAlloc(ini, SCALAR);
     
-    long int *lookupInterior = NULL;
-    long int *lookupInteriorOffset = NULL;
     int nObjects = 0;
     
     Object *obj = malloc(sizeof(*obj));
     
     obj->domain = domain;
-    obj->lookupInterior = lookupInterior;
-    obj->lookupInteriorOffset = lookupInteriorOffset;
     obj->nObjects = nObjects;
+    obj->mask = NULL;
+    obj->maskSizeProd = NULL;
+    obj->distance = NULL;
+    obj->charge = NULL;
+    obj->chargeThread = NULL;
+    obj->chargeStride = 0;
+    obj->lookupSurface = NULL;
+    obj->lookupSurfaceOffset = NULL;
+    obj->conductor = NULL;
+    obj->bias = NULL;
+    obj->capNode = NULL;
+    obj->capIndex = NULL;
+    obj->capOrder = NULL;
+    obj->capCounts = NULL;
+    obj->capDispls = NULL;
+    obj->capObject = NULL;
+    obj->capMatrix = NULL;
+    obj->capRowSum = NULL;
+    obj->capColSum = NULL;
+    obj->capTotal = NULL;
+    obj->capFloating = NULL;
+    obj->capPhi = NULL;
+    obj->capBuffer = NULL;
+    obj->nCap = 0;
+    obj->nCapLocal = 0;
+    obj->volume = 0;
     
     return obj;
 }
@@ -101,8 +777,14 @@ void oFree(Object *obj){
     
     gFree(obj->domain);
     
-    free(obj->lookupInterior);
-    free(obj->lookupInteriorOffset);
+    memFree(obj->mask);
+    free(obj->maskSizeProd);
+    memFree(obj->distance);
+    memFree(obj->lookupSurface);
+    free(obj->lookupSurfaceOffset);
+    free(obj->charge);
+    free(obj->chargeThread);
+    oFreeCapacitance(obj);
     free(obj);
     
 }
@@ -115,35 +797,558 @@ void oCloseH5(Object *obj){
 void oOpenH5(const dictionary *ini, Object *obj, const MpiInfo *mpiInfo,
              const Units *units, double denorm, const char *fName){
    
-    gOpenH5(ini, obj->domain,   mpiInfo, units, denorm, "object");
+    gOpenH5(ini, obj->domain,   mpiInfo, units, denorm, fName);
 }
 
 void oReadH5(Object *obj, const MpiInfo *mpiInfo){
     
-    // Identical to gReadH5()
-    hid_t fileSpace = obj->domain->h5FileSpace;
-    hid_t memSpace = obj->domain->h5MemSpace;
-    hid_t file = obj->domain->h5;
-    double *val = obj->domain->val;
+    Grid *domain = obj->domain;
+    long int nNodes = domain->sizeProd[domain->rank];
     
-    hid_t pList = H5Pcreate(H5P_DATASET_XFER);
-    H5Pset_dxpl_mpio(pList, H5FD_MPIO_COLLECTIVE);
+    if(!domain->val) domain->val = memAlloc(MEM_GRID, nNodes*sizeof(*domain->val));
     
-    char name[64];
-    sprintf(name,"Object"); //Only line which is different from gReadH5().
+    oReadDataset(obj, "Object");
+    oMakeMask(obj, mpiInfo);
     
-    hid_t dataset = H5Dopen(file,name,H5P_DEFAULT);
-    H5Dread(dataset, H5T_NATIVE_DOUBLE, memSpace, fileSpace, pList, val);
+    memFree(obj->distance);
+    obj->distance = NULL;
+    if(H5Lexists(domain->h5, "Distance", H5P_DEFAULT)>0){
+        oReadDataset(obj, "Distance");
+        oMakeDistance(obj, mpiInfo);
+    }
     
-    H5Dclose(dataset);
-    H5Pclose(pList);
+    // Only the compact representation is kept
+    memFree(domain->val);
+    domain->val = NULL;
+}
+
+void oVoxelize(const dictionary *ini, Object *obj, const MpiInfo *mpiInfo){
+    
+    Grid *domain = obj->domain;
+    long int nNodes = domain->sizeProd[domain->rank];
+    
+    int nDims = iniGetInt(ini, "grid:nDims");
+    if(nDims!=3) msg(ERROR, "objects:meshes only supported in 3D");
+    
+    int nMeshes = iniGetNElements(ini, "objects:meshes");
+    char **meshes = iniGetStrArr(ini, "objects:meshes", nMeshes);
+    double *stepSize = iniGetDoubleArr(ini, "grid:stepSize", nDims);
     
-    //Count the number of objects and fills the lookup tables.
-    oFillLookupTables(obj,mpiInfo);
+    if(!domain->val) domain->val = memAlloc(MEM_GRID, nNodes*sizeof(*domain->val));
+    gZero(domain);
+    
+    // Later meshes take precedence where objects overlap
+    for(int o=0; o<nMeshes; o++){
+        long int nTriangles;
+        double *triangles = oReadMesh(meshes[o], stepSize, mpiInfo->offset, &nTriangles);
+        oRasterize(obj, triangles, nTriangles, o+1);
+        free(triangles);
+    }
+    
+    oMakeMask(obj, mpiInfo);
+    
+    memFree(obj->distance);
+    obj->distance = NULL;
+    memFree(domain->val);
+    domain->val = NULL;
+    
+    freeStrArr(meshes);
+    free(stepSize);
 }
 
 /******************************************************************************
  *  GLOBAL FUNCTION DEFINITIONS
  *****************************************************************************/
 
+void oMakeMask(Object *obj, const MpiInfo *mpiInfo){
+    
+    Grid *domain = obj->domain;
+    int rank = domain->rank;
+    int *size = domain->size;
+    int *nGhostLayers = domain->nGhostLayers;
+    long int *sizeProd = domain->sizeProd;
+    double *val = domain->val;
+    
+    // Objects in the ghost layers belong to the neighbors
+    gHaloOp(setSlice, domain, mpiInfo, TOHALO);
+    
+    // One extra node along each dimension (zero)
+    long int *maskSizeProd = malloc(rank*sizeof(*maskSizeProd));
+    maskSizeProd[0] = 1;
+    maskSizeProd[1] = 1;
+    for(int d=2; d<rank; d++) maskSizeProd[d] = maskSizeProd[d-1]*(size[d-1]+1);
+    long int maskSize = maskSizeProd[rank-1]*(size[rank-1]+1);
+    
+    unsigned char *mask = memAlloc(MEM_OBJECT, maskSize*sizeof(*mask));
+    memset(mask, 0, maskSize*sizeof(*mask));
+    
+    // Single pass finding the identifiers and the surface nodes
+    long int nSurface = 0;
+    long int nSurfaceAlloc = 1024;
+    long int *surface = malloc(nSurfaceAlloc*sizeof(*surface));
+    int *coord = calloc(rank, sizeof(*coord));
+    int nObjects = 0;
+    
+    for(long int g=0; g<sizeProd[rank]; g++){
+        
+        int id = (int)(val[g]+0.5);
+        if(id>0){
+            
+            if(id>255) msg(ERROR,"at most 255 objects supported, found %i",id);
+            if(id>nObjects) nObjects = id;
+            
+            long int m = 0;
+            int isTrue = 1;
+            for(int d=1; d<rank; d++){
+                m += coord[d]*maskSizeProd[d];
+                if(coord[d]<nGhostLayers[d] || coord[d]>=size[d]-nGhostLayers[rank+d])
+                    isTrue = 0;
+            }
+            mask[m] = (unsigned char)id;
+            
+            // Nodes at the edge of domain have unknown neighbors
+            int isSurface = 0;
+            for(int d=1; d<rank && isTrue; d++){
+                if(coord[d]==0 || coord[d]==size[d]-1) isSurface = 1;
+                else if((int)(val[g-sizeProd[d]]+0.5)!=id) isSurface = 1;
+                else if((int)(val[g+sizeProd[d]]+0.5)!=id) isSurface = 1;
+            }
+            
+            if(isTrue && isSurface){
+                if(nSurface==nSurfaceAlloc){
+                    nSurfaceAlloc *= 2;
+                    surface = realloc(surface, nSurfaceAlloc*sizeof(*surface));
+                }
+                surface[nSurface++] = g;
+            }
+        }
+        
+        for(int d=1; d<rank && ++coord[d]==size[d]; d++) coord[d] = 0;
+    }
+    free(coord);
+    
+    // Make sure each process knows about the total number of objects.
+    MPI_Allreduce(MPI_IN_PLACE, &nObjects, 1, MPI_INT, MPI_MAX, simComm);
+    
+    // Group the surface nodes by object (counting sort)
+    long int *lookupSurfaceOffset = calloc(nObjects+1, sizeof(*lookupSurfaceOffset));
+    for(long int i=0; i<nSurface; i++) lookupSurfaceOffset[(int)(val[surface[i]]+0.5)]++;
+    alCumSum(lookupSurfaceOffset+1, lookupSurfaceOffset, nObjects);
+    
+    long int *lookupSurface = memAlloc(MEM_OBJECT, nSurface*sizeof(*lookupSurface));
+    long int *index = malloc(nObjects*sizeof(*index));
+    for(int o=0; o<nObjects; o++) index[o] = lookupSurfaceOffset[o];
+    for(long int i=0; i<nSurface; i++)
+        lookupSurface[index[(int)(val[surface[i]]+0.5)-1]++] = surface[i];
+    free(index);
+    free(surface);
+    
+    memFree(obj->mask);
+    free(obj->maskSizeProd);
+    memFree(obj->lookupSurface);
+    free(obj->lookupSurfaceOffset);
+    obj->nObjects = nObjects;
+    obj->mask = mask;
+    obj->maskSizeProd = maskSizeProd;
+    obj->lookupSurface = lookupSurface;
+    obj->lookupSurfaceOffset = lookupSurfaceOffset;
+    
+    // Collected charge is kept if the mask is remade, e.g. after load balancing
+    if(!obj->charge){
+        obj->chargeStride = 8*((nObjects+7)/8);
+        obj->charge = calloc(nObjects,sizeof(*obj->charge));
+        obj->chargeThread = calloc(thrCount()*obj->chargeStride,sizeof(*obj->chargeThread));
+    }
+}
+
+void oMakeDistance(Object *obj, const MpiInfo *mpiInfo){
+    
+    Grid *domain = obj->domain;
+    int rank = domain->rank;
+    int *size = domain->size;
+    long int *sizeProd = domain->sizeProd;
+    long int *maskSizeProd = obj->maskSizeProd;
+    double *val = domain->val;
+    
+    gHaloOp(setSlice, domain, mpiInfo, TOHALO);
+    
+    // The extra layer of the mask gets the values of the layer before it
+    long int maskSize = maskSizeProd[rank-1]*(size[rank-1]+1);
+    float *distance = memAlloc(MEM_OBJECT, maskSize*sizeof(*distance));
+    int *coord = calloc(rank, sizeof(*coord));
+    
+    for(long int m=0; m<maskSize; m++){
+        
+        long int g = 0;
+        for(int d=1; d<rank; d++)
+            g += (coord[d]<size[d] ? coord[d] : size[d]-1)*sizeProd[d];
+        distance[m] = (float)val[g];
+        
+        for(int d=1; d<rank && ++coord[d]==size[d]+1; d++) coord[d] = 0;
+    }
+    free(coord);
+    
+    memFree(obj->distance);
+    obj->distance = distance;
+}
 
+double oDistance(const Object *obj, const double *pos){
+    
+    return oDistanceAt(obj, pos, pos, 0);
+}
+
+double oCrossing(const Object *obj, const double *pos, const double *vel){
+    
+    // Linear interpolation between the distances before and after the step
+    if(obj->distance){
+        double before = oDistanceAt(obj, pos, vel, 1);
+        double after = oDistanceAt(obj, pos, vel, 0);
+        if(before<=0) return 0;
+        if(after>=0) return 1;
+        return before/(before-after);
+    }
+    
+    // Bisection between a point outside and a point inside an object
+    double outside = 1, inside = 0;
+    for(int i=0; i<O_CROSSING_BISECTIONS; i++){
+        double s = 0.5*(outside+inside);
+        if(oIdAt(obj, pos, vel, s)) inside = s;
+        else outside = s;
+    }
+    
+    return 1-0.5*(outside+inside);
+}
+
+void oMove(Population *pop, Object *obj){
+    
+    int nSpecies = pop->nSpecies;
+    int nDims = pop->nDims;
+    int nVelDims = pop->nVelDims;
+    double *pos = pop->pos;
+    double *vel = pop->vel;
+    const unsigned char *mask = obj->mask;
+    const long int *mul = &obj->maskSizeProd[1];
+    double *chargeThread = obj->chargeThread;
+    int stride = obj->chargeStride;
+    
+    for(int s=0; s<nSpecies; s++){
+        
+        double charge = pop->charge[s];
+        
+        // Moving streams through the particles, so tiles are of no use
+        schSubmitRange(pop->sch,pop->iStart[s],pop->iStop[s]);
+        
+        #pragma omp parallel
+        {
+            double *collected = &chargeThread[thrNum()*stride];
+            
+            long int iStart, iStop;
+            while(schNext(pop->sch,&iStart,&iStop)){
+                for(long int i=iStart; i<iStop; i++){
+                    
+                    long int p = i*nDims;
+                    long int j = 0;
+                    for(int d=0; d<nDims; d++){
+                        pos[p+d] += vel[i*nVelDims+d];
+                        j += (long int)(pos[p+d]+0.5)*mul[d];
+                    }
+                    
+                    int o = mask[j];
+                    if(o){
+                        collected[o-1] += charge;
+                        pos[p] = P_REMOVED;
+                    }
+                }
+            }
+        }
+    }
+    
+    // Sum over threads
+    int nThreads = thrCount();
+    for(int t=0; t<nThreads; t++){
+        for(int o=0; o<obj->nObjects; o++){
+            obj->charge[o] += chargeThread[t*stride+o];
+            chargeThread[t*stride+o] = 0;
+        }
+    }
+    
+    pop->sorted = 0;
+}
+
+void oComputeCapacitance(Object *obj, const dictionary *ini, const Units *units,
+                         funPtr solve, void *solver, Grid *rho, Grid *phi,
+                         const MpiInfo *mpiInfo){
+    
+    int nObjects = obj->nObjects;
+    
+    // Arrays from a previous call, e.g. before load balancing
+    oFreeCapacitance(obj);
+    
+    // Type of each object
+    char **biasStr = iniGetStrArr(ini, "objects:bias", nObjects);
+    oConductor *conductor = malloc(nObjects*sizeof(*conductor));
+    double *bias = malloc(nObjects*sizeof(*bias));
+    for(int o=0; o<nObjects; o++){
+        bias[o] = 0;
+        if(!strcmp(biasStr[o],"NONE")){
+            conductor[o] = O_INSULATING;
+        } else if(!strcmp(biasStr[o],"FLOAT")){
+            conductor[o] = O_FLOATING;
+        } else {
+            char *end;
+            conductor[o] = O_BIASED;
+            bias[o] = strtod(biasStr[o],&end)/units->potential;
+            if(end==biasStr[o] || *end!='\0')
+                msg(ERROR,"%s invalid value for objects:bias",biasStr[o]);
+        }
+    }
+    freeStrArr(biasStr);
+    obj->conductor = conductor;
+    obj->bias = bias;
+    
+    oNumberCapacitance(obj, mpiInfo);
+    int nCap = obj->nCap;
+    int nCapLocal = obj->nCapLocal;
+    long int *capNode = obj->capNode;
+    int *capIndex = obj->capIndex;
+    int *capObject = obj->capObject;
+    
+    if(nCap==0) return;
+    
+    // A periodic potential requires a neutral charge density
+    int rank = rho->rank;
+    int periodic = 1;
+    for(int r=0; r<2*rank; r++)
+        if(r%rank && rho->bnd[r]!=PERIODIC) periodic = 0;
+    long int volume = periodic ? gTotTruesize(rho,mpiInfo) : 0;
+    long int nNodes = rho->sizeProd[rank];
+    
+    // Surface node on this MPI node of each number, if any
+    int *local = malloc(nCap*sizeof(*local));
+    for(int j=0; j<nCap; j++) local[j] = -1;
+    for(int i=0; i<nCapLocal; i++) local[capIndex[i]] = i;
+    
+    // Potential at the surface nodes of this MPI node due to a unit charge at
+    // each surface node, i.e., the rows of this MPI node
+    double *rows = malloc((long int)nCapLocal*nCap*sizeof(*rows));
+    for(int j=0; j<nCap; j++){
+        
+        gZero(rho);
+        gZero(phi);
+        if(volume) adSetAll(rho->val, nNodes, -1.0/volume);
+        if(local[j]>=0) rho->val[capNode[local[j]]] += 1;
+        
+        solve(solver, rho, phi, mpiInfo);
+        
+        for(int i=0; i<nCapLocal; i++)
+            rows[(long int)i*nCap+j] = phi->val[capNode[i]];
+    }
+    free(local);
+    
+    int *pivot = malloc(nCap*sizeof(*pivot));
+    int *pivotOf = malloc(nCap*sizeof(*pivotOf));
+    oInvertRows(rows, capIndex, nCapLocal, nCap, pivot, mpiInfo);
+    for(int k=0; k<nCap; k++) pivotOf[pivot[k]] = k;
+    
+    // Undo the column permutation, and send each row to the MPI node of its
+    // surface node
+    int *have = malloc(nCapLocal*sizeof(*have));
+    double *temp = malloc(nCap*sizeof(*temp));
+    for(int i=0; i<nCapLocal; i++){
+        double *row = &rows[(long int)i*nCap];
+        for(int j=0; j<nCap; j++) temp[j] = row[pivotOf[j]];
+        for(int j=0; j<nCap; j++) row[j] = temp[j];
+        have[i] = pivotOf[capIndex[i]];
+    }
+    double *capMatrix = oRouteRows(rows, have, nCapLocal, capIndex, nCapLocal,
+                                   nCap, mpiInfo);
+    free(rows);
+    free(have);
+    free(temp);
+    free(pivot);
+    free(pivotOf);
+    
+    // Sum the matrix over each object
+    double *capRowSum = calloc(nCapLocal*nObjects, sizeof(*capRowSum));
+    double *capColSum = calloc(nObjects*nCap, sizeof(*capColSum));
+    double *capTotal = calloc(nObjects*nObjects, sizeof(*capTotal));
+    
+    for(int i=0; i<nCapLocal; i++){
+        double *row = &capMatrix[(long int)i*nCap];
+        int o = capObject[capIndex[i]];
+        for(int j=0; j<nCap; j++){
+            capRowSum[i*nObjects+capObject[j]] += row[j];
+            capColSum[o*nCap+j] += row[j];
+        }
+    }
+    MPI_Allreduce(MPI_IN_PLACE, capColSum, nObjects*nCap, MPI_DOUBLE, MPI_SUM,
+                  simComm);
+    
+    for(int o=0; o<nObjects; o++)
+        for(int j=0; j<nCap; j++)
+            capTotal[o*nObjects+capObject[j]] += capColSum[o*nCap+j];
+    
+    // Inverse of the capacitance between floating objects
+    int nFloating = 0;
+    int *floating = malloc(nObjects*sizeof(*floating));
+    for(int o=0; o<nObjects; o++)
+        if(conductor[o]==O_FLOATING) floating[nFloating++] = o;
+    
+    double *sub = malloc(nFloating*nFloating*sizeof(*sub));
+    for(int a=0; a<nFloating; a++)
+        for(int b=0; b<nFloating; b++)
+            sub[a*nFloating+b] = capTotal[floating[a]*nObjects+floating[b]];
+    oInvert(sub, nFloating);
+    
+    double *capFloating = calloc(nObjects*nObjects, sizeof(*capFloating));
+    for(int a=0; a<nFloating; a++)
+        for(int b=0; b<nFloating; b++)
+            capFloating[floating[a]*nObjects+floating[b]] = sub[a*nFloating+b];
+    
+    free(sub);
+    free(floating);
+    
+    obj->capMatrix = capMatrix;
+    obj->capRowSum = capRowSum;
+    obj->capColSum = capColSum;
+    obj->capTotal = capTotal;
+    obj->capFloating = capFloating;
+    obj->capPhi = malloc(nCap*sizeof(*obj->capPhi));
+    obj->capBuffer = malloc(nCap*sizeof(*obj->capBuffer));
+    obj->volume = volume;
+    
+    gZero(rho);
+    gZero(phi);
+}
+
+void oRedistributeCapacitance(Object *obj, const MpiInfo *mpiInfo){
+    
+    int nCap = obj->nCap;
+    int nObjects = obj->nObjects;
+    
+    if(nCap==0) return;
+    
+    double *capMatrix = obj->capMatrix;
+    int *capIndex = obj->capIndex;
+    int nCapLocal = obj->nCapLocal;
+    
+    free(obj->capNode);
+    free(obj->capOrder);
+    free(obj->capCounts);
+    free(obj->capDispls);
+    free(obj->capObject);
+    free(obj->capRowSum);
+    
+    // The numbers do not depend on the subdomains, so only rows are moved
+    oNumberCapacitance(obj, mpiInfo);
+    if(obj->nCap!=nCap)
+        msg(ERROR,"load balancing changed the number of surface nodes of "
+                  "conducting objects from %i to %i", nCap, obj->nCap);
+    
+    obj->capMatrix = oRouteRows(capMatrix, capIndex, nCapLocal, obj->capIndex,
+                                obj->nCapLocal, nCap, mpiInfo);
+    free(capMatrix);
+    free(capIndex);
+    
+    nCapLocal = obj->nCapLocal;
+    double *capRowSum = calloc(nCapLocal*nObjects, sizeof(*capRowSum));
+    for(int i=0; i<nCapLocal; i++)
+        for(int j=0; j<nCap; j++)
+            capRowSum[i*nObjects+obj->capObject[j]] +=
+                obj->capMatrix[(long int)i*nCap+j];
+    obj->capRowSum = capRowSum;
+}
+
+void oApplyCapacitance(Object *obj, funPtr solve, void *solver, Grid *rho,
+                       Grid *phi, const MpiInfo *mpiInfo){
+    
+    int nCap = obj->nCap;
+    int nCapLocal = obj->nCapLocal;
+    int nObjects = obj->nObjects;
+    long int *capNode = obj->capNode;
+    double *capPhi = obj->capPhi;
+    double *capTotal = obj->capTotal;
+    double *capColSum = obj->capColSum;
+    oConductor *conductor = obj->conductor;
+    
+    if(nCap==0) return;
+    
+    // Potential at all surface nodes
+    double *capBuffer = obj->capBuffer;
+    int first = obj->capDispls[mpiInfo->mpiRank];
+    for(int i=0; i<nCapLocal; i++) capBuffer[first+i] = phi->val[capNode[i]];
+    MPI_Allgatherv(MPI_IN_PLACE, 0, MPI_DATATYPE_NULL, capBuffer, obj->capCounts,
+                   obj->capDispls, MPI_DOUBLE, simComm);
+    for(int k=0; k<nCap; k++) capPhi[obj->capOrder[k]] = capBuffer[k];
+    
+    double *charge = malloc(nObjects*sizeof(*charge));
+    MPI_Allreduce(obj->charge, charge, nObjects, MPI_DOUBLE, MPI_SUM, simComm);
+    
+    // Surface charge on each object cancelling the potential at its surface
+    double *induced = calloc(nObjects, sizeof(*induced));
+    for(int o=0; o<nObjects; o++)
+        for(int j=0; j<nCap; j++)
+            induced[o] += capColSum[o*nCap+j]*capPhi[j];
+    
+    // Potential of each object
+    double *potential = malloc(nObjects*sizeof(*potential));
+    double *rhs = malloc(nObjects*sizeof(*rhs));
+    for(int o=0; o<nObjects; o++){
+        potential[o] = conductor[o]==O_BIASED ? obj->bias[o] : 0;
+        rhs[o] = charge[o]+induced[o];
+    }
+    for(int o=0; o<nObjects; o++)
+        for(int p=0; p<nObjects; p++)
+            if(conductor[p]==O_BIASED) rhs[o] -= capTotal[o*nObjects+p]*potential[p];
+    for(int o=0; o<nObjects; o++)
+        if(conductor[o]==O_FLOATING)
+            for(int p=0; p<nObjects; p++)
+                potential[o] += obj->capFloating[o*nObjects+p]*rhs[p];
+    
+    // Add the surface charge on this MPI node
+    for(int i=0; i<nCapLocal; i++){
+        double sigma = 0;
+        for(int p=0; p<nObjects; p++)
+            sigma += potential[p]*obj->capRowSum[i*nObjects+p];
+        for(int j=0; j<nCap; j++)
+            sigma -= obj->capMatrix[(long int)i*nCap+j]*capPhi[j];
+        rho->val[capNode[i]] += sigma;
+    }
+    
+    // The total surface charge is known without communication
+    if(obj->volume){
+        double total = 0;
+        for(int o=0; o<nObjects; o++){
+            if(conductor[o]==O_INSULATING) continue;
+            total -= induced[o];
+            for(int p=0; p<nObjects; p++)
+                total += capTotal[o*nObjects+p]*potential[p];
+        }
+        adShift(rho->val, rho->sizeProd[rho->rank], -total/obj->volume);
+    }
+    
+    free(charge);
+    free(induced);
+    free(potential);
+    free(rhs);
+    
+    solve(solver, rho, phi, mpiInfo);
+}
+
+void oCreateChargeDatasets(hid_t xy, const Object *obj){
+    
+    char name[64];
+    for(int o=0; o<obj->nObjects; o++){
+        sprintf(name,"/object/charge/object %i",o+1);
+        xyCreateDataset(xy,name);
+    }
+}
+
+void oWriteCharge(hid_t xy, const Object *obj, double x){
+    
+    char name[64];
+    for(int o=0; o<obj->nObjects; o++){
+        sprintf(name,"/object/charge/object %i",o+1);
+        xyWrite(xy,name,x,obj->charge[o],MPI_SUM);
+    }
+}
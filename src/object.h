@@ -8,14 +8,86 @@
 #ifndef OBJECT_H
 #define OBJECT_H
 
+/**
+ * @brief Electrical properties of an object
+ */
+typedef enum{
+	O_INSULATING,	///< Potential not enforced
+	O_FLOATING,		///< Equipotential with the collected charge
+	O_BIASED		///< Equipotential at a given potential
+} oConductor;
+
 /**
  * @brief Represents an object
+ *
+ * Objects are read into domain, which holds the identifier of the object at
+ * each node (0 outside objects, and 1 to nObjects inside). domain->val is only
+ * kept while reading, and is NULL otherwise. The geometry is instead kept in
+ * mask, which holds the same identifiers as one byte per node, such that
+ * testing a particle against the objects costs one small load. A particle
+ * belongs to the node nearest to it. The mask has one more node along each
+ * dimension than domain, with zeros in the extra layer, such that any
+ * particle having moved less than one cell from a valid position has a node in
+ * the mask (see oMove()). The mask is indexed using maskSizeProd like a scalar
+ * Grid (maskSizeProd[0]=1).
+ *
+ * The surface of an object is the true nodes of the object having a neighbor
+ * outside of it. Their indices in domain are stored in lookupSurface, first
+ * those of object 1, then those of object 2, and so on, starting at
+ * lookupSurfaceOffset[0], lookupSurfaceOffset[1], etc. Only the surface is
+ * stored per node, such that the memory apart from mask scales with the
+ * surface area of the objects rather than their volume.
+ *
+ * distance is an optional signed distance field on the same nodes as mask,
+ * negative inside the objects. It is measured in cells and gives the
+ * position of the surface within a cell (see oDistance() and oCrossing()).
+ * It is NULL if not present in the input.
+ *
+ * charge is the charge collected by each object on this MPI node since it was
+ * allocated. Each thread accumulates its share in its own row of chargeThread,
+ * which has chargeStride elements per thread to avoid false sharing.
+ *
+ * Objects can be conducting (see oConductor), in which case the potential on
+ * the surface is enforced using the capacitance matrix method (see
+ * oComputeCapacitance()). The surface nodes of the conducting objects on all
+ * MPI nodes are numbered from 0 to nCap-1 by their global node index, and then
+ * by object, such that the numbers do not depend on the subdomains. capIndex
+ * holds the numbers of the nCapLocal surface nodes on this MPI node, in the
+ * order of lookupSurface. capOrder holds the numbers of all surface nodes
+ * ordered by MPI node instead, of which capCounts and capDispls tells how many
+ * belong to each MPI node, and the first of them. The capacitance matrix is
+ * distributed by rows, such that each MPI node only stores the nCapLocal rows
+ * of its own surface nodes. All cap-arrays are NULL if nCap is zero.
  */
 typedef struct{
 	Grid *domain;					///< Represents precense of objects
-	long int *lookupInterior;		///< Indices of the interior of the objects
-	long int *lookupInteriorOffset;	///< Offset in the above per object (nObjects+1 elements)
 	int nObjects;					///< Number of objects
+	unsigned char *mask;			///< Object identifier at each node
+	long int *maskSizeProd;			///< Multiples to index mask (nDims+1 elements)
+	float *distance;				///< Signed distance to the surface at each node
+	long int *lookupSurface;		///< Indices of the surface of the objects
+	long int *lookupSurfaceOffset;	///< Offset in the above per object (nObjects+1 elements)
+	double *charge;					///< Collected charge (nObjects elements)
+	double *chargeThread;			///< Collected charge per thread
+	int chargeStride;				///< Elements per thread in chargeThread
+	oConductor *conductor;			///< Type of each object (nObjects elements)
+	double *bias;					///< Potential of biased objects (nObjects elements)
+	int nCap;						///< Number of surface nodes of conducting objects
+	int nCapLocal;					///< Number of those on this MPI node
+	long int *capNode;				///< Index of each of those on this MPI node
+	int *capIndex;					///< Number of each of those on this MPI node
+	int *capOrder;					///< Number of each surface node ordered by MPI node (nCap elements)
+	int *capCounts;					///< Surface nodes per MPI node
+	int *capDispls;					///< First surface node of each MPI node
+	int *capObject;					///< Object of each surface node (nCap elements)
+	double *capMatrix;				///< Rows of the capacitance matrix (nCapLocal*nCap elements)
+	double *capRowSum;				///< Sum of each row per object (nCapLocal*nObjects elements)
+	double *capColSum;				///< Sum of each column per object (nObjects*nCap elements)
+	double *capTotal;				///< Capacitance between objects (nObjects*nObjects elements)
+	double *capFloating;			///< Inverse of capTotal among floating objects
+	double *capPhi;					///< Potential at the surface nodes (nCap elements)
+	double *capBuffer;				///< Potential at the surface nodes ordered by MPI node (nCap elements)
+	long int volume;				///< Global number of true nodes if periodic potential, otherwise 0
 } Object;
 
 /**
@@ -66,14 +138,193 @@ void oCloseH5(Object *obj);
  * @return	void
  * @see gReadH5()
  *
- * Reads the input objects and creates the various lookup tables needed.
+ * Reads the dataset "Object" with the identifiers of the objects and makes
+ * the mask and the surface lookup tables (see oMakeMask()). If the file also
+ * has a dataset "Distance", it is read as the signed distance field (see
+ * oMakeDistance()). obj->domain->val is freed afterwards.
  */
 void oReadH5(Object *obj, const MpiInfo *mpiInfo);
 
 /**
- * TO IMPLEMENT!
+ * @brief	Makes the objects from triangle meshes
+ * @param	ini		Input file
+ * @param	obj		Object
+ * @param	mpiInfo	MpiInfo
+ * @return	void
+ *
+ * Alternative to oReadH5() which reads the closed triangle meshes listed in
+ * objects:meshes, one per object, from ASCII legacy VTK-files (POLYGONS or
+ * CELLS) or ASCII STL-files. Their coordinates are in the same units as
+ * grid:stepSize, with the origin at the first node of the global grid. Only
+ * 3D is supported.
+ *
+ * Each MPI node only sets its own true nodes. For each line of nodes along
+ * the x-axis, a ray is intersected with the triangles covering it, and nodes
+ * between every other pair of crossings are inside. The rays are shifted
+ * slightly off the nodes to avoid hitting edges exactly. Where meshes overlap,
+ * the last one takes precedence. The mask and the surface lookup tables are
+ * then made like in oReadH5() (see oMakeMask()), but there is no distance
+ * field.
+ */
+void oVoxelize(const dictionary *ini, Object *obj, const MpiInfo *mpiInfo);
+
+/**
+ * @brief	Makes the mask and the surface lookup tables from obj->domain
+ * @param	obj             Object
+ * @param	mpiInfo			MpiInfo
+ * @return	void
+ *
+ * Called by oReadH5(), but must be called again if obj->domain is changed in
+ * other ways. The ghost layers of obj->domain are exchanged with the
+ * neighbors first, and it is then scanned once. At most 255 objects are
+ * supported.
+ */
+void oMakeMask(Object *obj, const MpiInfo *mpiInfo);
+
+/**
+ * @brief	Makes the signed distance field from obj->domain
+ * @param	obj             Object
+ * @param	mpiInfo			MpiInfo
+ * @return	void
+ *
+ * obj->domain must hold the signed distance to the nearest surface in cells,
+ * negative inside the objects. Like oMakeMask(), the ghost layers are
+ * exchanged first. Call after oMakeMask().
+ */
+void oMakeDistance(Object *obj, const MpiInfo *mpiInfo);
+
+/**
+ * @brief	Signed distance to the nearest surface
+ * @param	obj		Object
+ * @param	pos		Position in the local frame
+ * @return	Distance in cells, negative inside objects
+ *
+ * Interpolates obj->distance multilinearly. It must not be NULL.
+ */
+double oDistance(const Object *obj, const double *pos);
+
+/**
+ * @brief	Where a particle entered an object during its last step
+ * @param	obj		Object
+ * @param	pos		Position inside the object after the step
+ * @param	vel		Velocity (i.e. the step)
+ * @return	Fraction of the step from pos-vel to pos before the crossing
+ *
+ * Uses the signed distance field if present, which gives the crossing within
+ * the cell. Otherwise, the step is bisected using the mask, which only
+ * resolves the crossing to the nearest node.
+ */
+double oCrossing(const Object *obj, const double *pos, const double *vel);
+
+/**
+ * @brief	Moves particles and absorbs those entering objects
+ * @param	pop		Population
+ * @param	obj		Object
+ * @return	void
+ *
+ * Does the same as puMove(), and in the same pass looks up the node nearest to
+ * each particle in obj->mask. A particle inside an object has its charge added
+ * to obj->charge and is marked for removal by setting its position along the
+ * first dimension to P_REMOVED. It is removed when extracting emigrants (see
+ * puExtractEmigrantsND()), which already visits all particles.
+ *
+ * Particles must not move more than one cell per time step (see
+ * pVelAssertMax()).
+ */
+void oMove(Population *pop, Object *obj);
+
+/**
+ * @brief	Computes the capacitance matrix of the conducting objects
+ * @param	obj		Object
+ * @param	ini		Input file
+ * @param	units	Units
+ * @param	solve	Function solving Poisson's equation (see e.g. mgSolve())
+ * @param	solver	Solver used by solve
+ * @param	rho		Charge density (overwritten)
+ * @param	phi		Potential (overwritten)
+ * @param	mpiInfo	MpiInfo
+ * @return	void
+ *
+ * Whether each object is insulating, floating or biased is given by
+ * objects:bias as NONE, FLOAT or its potential in volts. The response of the
+ * solver to a unit charge on each surface node of a conducting object, taken
+ * at all such surface nodes, forms the matrix which is inverted to get the
+ * capacitance matrix. This takes one solve per surface node (nCap in all),
+ * so it is only done at startup. Each MPI node keeps the potential at its own
+ * surface nodes from the solves, and the matrix is inverted distributed by
+ * rows, such that no MPI node stores more than its nCapLocal rows. See
+ * oRedistributeCapacitance() for load balancing.
+ *
+ * If the potential is periodic, a neutralizing background is subtracted from
+ * the unit charge, since the solution is only defined for a neutral charge
+ * density. The potential of a biased object is then relative to the mean.
+ *
+ * Call after oReadH5().
+ */
+void oComputeCapacitance(Object *obj, const dictionary *ini, const Units *units,
+						 funPtr solve, void *solver, Grid *rho, Grid *phi,
+						 const MpiInfo *mpiInfo);
+
+/**
+ * @brief	Moves the capacitance matrix to new subdomains
+ * @param	obj		Object
+ * @param	mpiInfo	MpiInfo
+ * @return	void
+ *
+ * Call after moving the subdomain boundaries, and reading the objects into the
+ * new subdomain with oReadH5() or oVoxelize(). The capacitance matrix does not
+ * depend on the subdomains, so its rows are only sent to the MPI nodes now
+ * having their surface nodes.
+ *
+ * @see oComputeCapacitance(), gRebalance()
+ */
+void oRedistributeCapacitance(Object *obj, const MpiInfo *mpiInfo);
+
+/**
+ * @brief	Corrects the potential on the surface of the conducting objects
+ * @param	obj		Object
+ * @param	solve	Function solving Poisson's equation (see e.g. mgSolve())
+ * @param	solver	Solver used by solve
+ * @param	rho		Charge density
+ * @param	phi		Potential
+ * @param	mpiInfo	MpiInfo
+ * @return	void
+ *
+ * Call after solving for phi. Finds the surface charge on the conducting
+ * objects which makes the potential of biased objects equal to their bias, and
+ * the potential of floating objects constant with a total charge equal to what
+ * they have collected (see oMove()). The surface charge is added to rho, and
+ * phi is solved for again. Does nothing if there are no conducting objects.
+ *
+ * The potential at the surface nodes is the only quantity exchanged between
+ * all MPI nodes, apart from the collected charge of each object.
+ *
+ * @see oComputeCapacitance()
+ */
+void oApplyCapacitance(Object *obj, funPtr solve, void *solver, Grid *rho,
+					   Grid *phi, const MpiInfo *mpiInfo);
+
+/**
+ * @brief	Creates datasets for the collected charge in .xy.h5-file
+ * @param	xy		History file
+ * @param	obj		Object
+ * @return	void
+ *
+ * The datasets are /object/charge/object 1, /object/charge/object 2, and so on,
+ * like the identifiers in obj->domain.
+ */
+void oCreateChargeDatasets(hid_t xy, const Object *obj);
+
+/**
+ * @brief	Writes the charge collected by each object
+ * @param	xy		History file
+ * @param	obj		Object
+ * @param	x		Time step
+ * @return	void
+ * @see		oCreateChargeDatasets()
  *
+ * The charge is summed over all MPI nodes.
  */
-void oRayTrace(Population *pop, const Object *obj);
+void oWriteCharge(hid_t xy, const Object *obj, double x);
 
 #endif // OBJECT_H
@@ -11,12 +11,81 @@
 
 #include "core.h"
 #include <math.h>
+#include <string.h>
 #include <mpi.h>
-#include <gsl/gsl_rng.h>
-#include <gsl/gsl_randist.h>
 #include <hdf5.h>
 #include "iniparser.h"
 
+/******************************************************************************
+ * DECLARING LOCAL FUNCTIONS
+ *****************************************************************************/
+
+// Weight of a box of the bisection of the global grid summed over all MPI nodes
+typedef struct{
+	unsigned long long int id;	///< Box number (see pSplitHalf())
+	long long int weight;		///< Summed weight of its cells
+} PSplitKnown;
+
+// Splitting of particles between cells in pPosLocal(). The global grid is
+// bisected until every box is a cell, and the particles in each box are split
+// between its halves by a binomial distribution.
+typedef struct{
+	int nDims;					///< Number of dimensions
+	int *nSubdomains;			///< Subdomains along each dimension
+	int **edges;				///< Edges of the subdomains (see MpiInfo)
+	int *size;					///< Cells of the global grid along each dimension
+	int *lo;					///< Lower cell of this subdomain
+	int *hi;					///< Cell past the upper cell of this subdomain
+	long long int *sum;			///< Summed table of local weights (NULL if uniform)
+	long int *sumProd;			///< Cumulative product of the sizes of sum
+	PSplitKnown *known;			///< Weights summed over all MPI nodes, by id
+	long int nKnown;			///< Number of elements in known
+	int *leafCell;				///< Lower corner of each local cell with particles
+	long int *leafFirst;		///< Global number of its first particle
+	long int *leafN;			///< Number of particles in it
+	long int nLeaves;			///< Number of local cells with particles
+} PSplit;
+
+static Tiles *pAllocTiles(int tileSize, int nDims, long int nBuffer);
+static void pFreeTiles(Tiles *tiles);
+static void pSetTiles(Tiles *tiles, int nSpecies);
+static inline long int pTile(const Tiles *tiles, const double *pos);
+static void pPosLocal(const dictionary *ini, Population *pop,
+					  const MpiInfo *mpiInfo, const Grid *density);
+static void pSplitHalf(const PSplit *sp, const int *a, const int *b, int right,
+					   int *ca, int *cb);
+static long long int pSplitLocalSum(const PSplit *sp, const int *a, const int *b);
+static int pSplitStraddles(const PSplit *sp, const int *a, const int *b);
+static void pSplitKnown(PSplit *sp, unsigned long long int id,
+						const int *a, const int *b, long int *nAlloc);
+static int pSplitCompare(const void *x, const void *y);
+static long long int pSplitWeight(const PSplit *sp, unsigned long long int id,
+								  const int *a, const int *b);
+static void pSplitDescend(PSplit *sp, const Rng *rng, unsigned long long int id,
+						  const int *a, const int *b, long int n, long int g0,
+						  long long int w);
+static double pRadicalInverse(unsigned long long int k, int base);
+static double pInvNormalCdf(double p);
+
+// Bases of the radical inverses of pPosQuiet() and pVelQuiet()
+static const int pPrimes[] = {2,3,5,7,11,13};
+
+// Number of particles to draw random numbers for at a time
+#define P_RNG_BATCH 256
+
+// Positions drawn at random are multiples of 1/P_POS_RES, such that moving
+// between the global and local reference frames is exact for any domain size
+// below 2^21. This keeps pHashPos() independent of the subdomains.
+#define P_POS_RES 4294967296.0
+
+// Index of the random numbers splitting particles between cells, which must
+// not coincide with those of the particles in pPosLocal()
+#define P_SPLIT_INDEX (1ULL<<63)
+
+// Densities of profiles are rounded to multiples of their maximum divided by
+// P_PROFILE_RES, such that sums over any set of cells are exact
+#define P_PROFILE_RES 1048576.0
+
 /******************************************************************************
  * DEFINING GLOBAL FUNCTIONS
  *****************************************************************************/
@@ -25,15 +94,28 @@ Population *pAlloc(const dictionary *ini){
 
 	// Get MPI info
 	int size, rank;
-	MPI_Comm_size(MPI_COMM_WORLD,&size);
-	MPI_Comm_rank(MPI_COMM_WORLD,&rank);
+	MPI_Comm_size(simComm,&size);
+	MPI_Comm_rank(simComm,&rank);
 
 	// Load data
 	int nSpecies = iniGetInt(ini,"population:nSpecies");
 	int nDims = iniGetInt(ini,"grid:nDims");
+	int nVelDims = iniGetInt(ini,"population:nVelDims");
+	if(nVelDims!=nDims && nVelDims!=3)
+		msg(ERROR,"population:nVelDims must be grid:nDims or 3");
+	int tileSize = iniGetInt(ini,"population:tileSize");
+	if(tileSize<0) msg(ERROR,"population:tileSize must be non-negative");
+	int deltaF = iniGetInt(ini,"population:deltaF");
+
+	// Electrons are a Boltzmann fluid with mgBoltzSolver (see mgBoltzSolve())
+	char *poisson = iniGetStr(ini,"methods:poisson");
+	int *fluid = malloc(nSpecies*sizeof(*fluid));
+	for(int s=0;s<nSpecies;s++) fluid[s] = s==0 && !strcmp(poisson,"mgBoltzSolver");
+	free(poisson);
 
 	// Number of particles to allocate for (for all computing nodes)
 	long int *nAllocTotal = iniGetLongIntArr(ini,"population:nAlloc",nSpecies);
+	for(int s=0;s<nSpecies;s++) if(fluid[s]) nAllocTotal[s] = 0;
 
 	// Determine memory to allocate for this node
 	long int *nAlloc = malloc(nSpecies*sizeof(long int));
@@ -56,16 +138,68 @@ Population *pAlloc(const dictionary *ini){
 	free(nAllocTotal);
 
 	Population *pop = malloc(sizeof(Population));
-	pop->pos = malloc((long int)nDims*iStart[nSpecies]*sizeof(double));
-	pop->vel = malloc((long int)nDims*iStart[nSpecies]*sizeof(double));
+	pop->pos = memAlloc(MEM_POPULATION,(long int)nDims*iStart[nSpecies]*sizeof(double));
+	pop->vel = memAlloc(MEM_POPULATION,(long int)nVelDims*iStart[nSpecies]*sizeof(double));
+	pop->weight = deltaF ? memAlloc(MEM_POPULATION,iStart[nSpecies]*sizeof(double)) : NULL;
 	pop->nSpecies = nSpecies;
 	pop->nDims = nDims;
+	pop->nVelDims = nVelDims;
 	pop->iStart = iStart;
 	pop->iStop = iStop;
 	pop->kinEnergy = malloc((nSpecies+1)*sizeof(double));
 	pop->potEnergy = malloc((nSpecies+1)*sizeof(double));
 	pop->charge = iniGetDoubleArr(ini,"population:charge",nSpecies);
 	pop->mass = iniGetDoubleArr(ini,"population:mass",nSpecies);
+	pop->nPeak = malloc(nSpecies*sizeof(*pop->nPeak));
+	alSetAll(pop->nPeak,nSpecies,0);
+	pop->sch = schAlloc();
+	pop->sorted = 0;
+
+	char **boundaries = iniGetStrArr(ini,"population:boundaries",2*nDims);
+	pop->bnd = malloc(2*nDims*sizeof(*pop->bnd));
+	for(int b=0;b<2*nDims;b++){
+		if(		!strcmp(boundaries[b],"PERIODIC"))	pop->bnd[b] = PBND_PERIODIC;
+		else if(!strcmp(boundaries[b],"ABSORBING"))	pop->bnd[b] = PBND_ABSORBING;
+		else if(!strcmp(boundaries[b],"SPECULAR"))	pop->bnd[b] = PBND_SPECULAR;
+		else if(!strcmp(boundaries[b],"DIFFUSE"))	pop->bnd[b] = PBND_DIFFUSE;
+		else msg(ERROR,"%s invalid value for population:boundaries",boundaries[b]);
+	}
+	freeStrArr(boundaries);
+
+	pop->thermal = iniGetDoubleArr(ini,"population:thermalVelocity",nSpecies);
+	pop->drift = deltaF ? iniGetDoubleArr(ini,"population:drift",nSpecies) : NULL;
+	if(deltaF)
+		for(int s=0;s<nSpecies;s++)
+			if(pop->thermal[s]<=0)
+				msg(ERROR,"population:deltaF requires a positive population:thermalVelocity");
+	pop->seed = (unsigned int)iniGetInt(ini,"population:seed");
+	pop->bndStep = 0;
+	pop->absorbed = calloc(nSpecies,sizeof(*pop->absorbed));
+	pop->absorbedEnergy = calloc(nSpecies,sizeof(*pop->absorbedEnergy));
+	pop->fluid = fluid;
+	pop->ext = NULL;
+
+	long int nAllocMax = 0;
+	for(int s=0;s<nSpecies;s++)
+		if(iStart[s+1]-iStart[s]>nAllocMax) nAllocMax = iStart[s+1]-iStart[s];
+	int nValues = nDims+nVelDims+(deltaF!=0);
+	pop->tiles = tileSize ? pAllocTiles(tileSize,nDims,nValues*nAllocMax) : NULL;
+
+	// Zero each specie in parallel, such that its pages are first touched by,
+	// and spread over the memory of, all threads. This only approximates which
+	// thread later pushes which particle, since the scheduler hands out tasks
+	// dynamically and pSortTiles() moves the particles.
+	for(int s=0;s<nSpecies;s++){
+		double *pos = pop->pos;
+		double *vel = pop->vel;
+		double *weight = pop->weight;
+		#pragma omp parallel for schedule(static)
+		for(long int i=iStart[s];i<iStart[s+1];i++){
+			for(int d=0;d<nDims;d++) pos[i*nDims+d] = 0;
+			for(int d=0;d<nVelDims;d++) vel[i*nVelDims+d] = 0;
+			if(weight) weight[i] = 0;
+		}
+	}
 
 	return pop;
 
@@ -73,78 +207,105 @@ Population *pAlloc(const dictionary *ini){
 
 void pFree(Population *pop){
 
-	free(pop->pos);
-	free(pop->vel);
+	memFree(pop->pos);
+	memFree(pop->vel);
+	if(pop->weight) memFree(pop->weight);
 	free(pop->kinEnergy);
 	free(pop->potEnergy);
 	free(pop->iStart);
 	free(pop->iStop);
 	free(pop->charge);
 	free(pop->mass);
+	free(pop->nPeak);
+	free(pop->bnd);
+	free(pop->thermal);
+	free(pop->drift);
+	free(pop->absorbed);
+	free(pop->absorbedEnergy);
+	free(pop->fluid);
+	schFree(pop->sch);
+	if(pop->tiles) pFreeTiles(pop->tiles);
 	free(pop);
 
 }
 
-void pPosUniform(const dictionary *ini, Population *pop, const MpiInfo *mpiInfo, const gsl_rng *rng){
+void pPosUniform(const dictionary *ini, Population *pop, const MpiInfo *mpiInfo){
+
+	pPosLocal(ini,pop,mpiInfo,NULL);
+}
+
+void pPosProfile(const dictionary *ini, Population *pop, const MpiInfo *mpiInfo,
+				 const Grid *density){
+
+	pPosLocal(ini,pop,mpiInfo,density);
+}
+
+void pPosQuiet(const dictionary *ini, Population *pop, const MpiInfo *mpiInfo){
 
 	// Read from ini
 	int nSpecies = pop->nSpecies;
 	int nDims = pop->nDims;
 	long int *nParticles = iniGetLongIntArr(ini,"population:nParticles",nSpecies);
-	int *trueSize = iniGetIntArr(ini,"grid:trueSize",nDims);
 
 	// Read from mpiInfo
 	int *subdomain = mpiInfo->subdomain;
-	double *posToSubdomain = mpiInfo->posToSubdomain;
+	int *nSubdomains = mpiInfo->nSubdomains;
+	int *nSubdomainsProd = mpiInfo->nSubdomainsProd;
+	int **edges = mpiInfo->edges;
+	int *offset = mpiInfo->offset;
 
-	// Compute normalized length of global reference frame
-	int *L = gGetGlobalSize(ini);
+	int nAll = nSubdomainsProd[nDims];
+	int self = 0;
+	for(int d=0;d<nDims;d++) self += subdomain[d]*nSubdomainsProd[d];
+
+	// Volume of all subdomains before this one, and of this one
+	double volBefore = 0, volSelf = 0, volTotal = 0;
+	for(int j=0;j<nAll;j++){
+		double vol = 1;
+		for(int d=0;d<nDims;d++){
+			int J = (j/nSubdomainsProd[d])%nSubdomains[d];
+			vol *= edges[d][J+1]-edges[d][J];
+		}
+		if(j<self) volBefore += vol;
+		if(j==self) volSelf = vol;
+		volTotal += vol;
+	}
 
 	for(int s=0;s<nSpecies;s++){
 
-		// Start on first particle of this specie
-		long int iStart = pop->iStart[s];
-		long int iStop = iStart;
-		double *pos = &pop->pos[iStart*nDims];
+		if(pop->fluid[s]) continue;
 
-		// Iterate through all particles to be generated. Same seed on all MPI
-		// nodes ensure same particles are generated everywhere.
-		for(long int i=0;i<nParticles[s];i++){
+		// Rounding the cumulative share makes the total exact
+		long int nLocal = (long int)floor(nParticles[s]*(volBefore+volSelf)/volTotal)
+						- (long int)floor(nParticles[s]*volBefore/volTotal);
+		if(self==nAll-1)
+			nLocal = nParticles[s]-(long int)floor(nParticles[s]*volBefore/volTotal);
 
-			// Generate position for particle i
-			for(int d=0;d<nDims;d++) pos[d] = L[d]*gsl_rng_uniform_pos(rng);
+		long int iStart = pop->iStart[s];
+		long int allocated = pop->iStart[s+1]-iStart;
+		if(nLocal>allocated)
+			msg(ERROR|ALL,	"allocated only %li particles of specie %i per node but "
+						"%li generated", allocated, s, nLocal);
 
-			// Count the number of dimensions where the particle resides in
-			// the range of this node
-			int correctRange = 0;
-			for(int d=0;d<nDims;d++)
-				correctRange += (subdomain[d] == (int)(posToSubdomain[d]*pos[d]));
+		// Hammersley set: evenly spaced along the first dimension, and
+		// radical inverses in bases 2, 3, ... along the others
+		#pragma omp parallel for schedule(static)
+		for(long int k=0;k<nLocal;k++){
 
-			// Iterate only if particle resides in this sub-domain.
-			if(correctRange==nDims){
-				pos += nDims;
-				iStop++;
+			double *pos = &pop->pos[(iStart+k)*nDims];
+			for(int d=0;d<nDims;d++){
+				int size = edges[d][subdomain[d]+1]-edges[d][subdomain[d]];
+				double u = d ? pRadicalInverse(k,pPrimes[d-1]) : (k+0.5)/nLocal;
+				double frac = floor(u*size*P_POS_RES)/P_POS_RES;
+				pos[d] = edges[d][subdomain[d]]-offset[d] + frac;
 			}
-
 		}
 
-		if(iStop>pop->iStart[s+1]){
-			int allocated = pop->iStart[s+1]-iStart;
-			int generated = iStop-iStart;
-			msg(ERROR,	"allocated only %i particles of specie %i per node but"
-			 			"%i generated", allocated, s, generated);
-		}
-
-		pop->iStop[s]=iStop;
-
+		pop->iStop[s] = iStart+nLocal;
+		pop->sorted = 0;
 	}
 
-	pToLocalFrame(pop,mpiInfo);
-
-	free(L);
 	free(nParticles);
-	free(trueSize);
-
 }
 
 void pPosLattice(const dictionary *ini, Population *pop, const MpiInfo *mpiInfo){
@@ -157,7 +318,7 @@ void pPosLattice(const dictionary *ini, Population *pop, const MpiInfo *mpiInfo)
 
 	// Read from mpiInfo
 	int *subdomain = mpiInfo->subdomain;
-	double *posToSubdomain = mpiInfo->posToSubdomain;
+	int **edges = mpiInfo->edges;
 
 	// Compute normalized length of global reference frame
 	int *L = gGetGlobalSize(ini);
@@ -165,6 +326,8 @@ void pPosLattice(const dictionary *ini, Population *pop, const MpiInfo *mpiInfo)
 
 	for(int s=0;s<nSpecies;s++){
 
+		if(pop->fluid[s]) continue;
+
 		// Particle-particle distance in lattice
 		double l = pow(V/(double)nParticles[s],1.0/nDims);
 
@@ -188,7 +351,8 @@ void pPosLattice(const dictionary *ini, Population *pop, const MpiInfo *mpiInfo)
 			// the range of this node
 			int correctRange = 0;
 			for(int d=0;d<nDims;d++)
-				correctRange += (subdomain[d] == (int)(posToSubdomain[d]*pos[d]));
+				correctRange += (pos[d] >= edges[d][subdomain[d]] &&
+								 pos[d] <  edges[d][subdomain[d]+1]);
 
 			// Iterate only if particle resides in this sub-domain.
 			if(correctRange==nDims){
@@ -206,6 +370,7 @@ void pPosLattice(const dictionary *ini, Population *pop, const MpiInfo *mpiInfo)
 		}
 
 		pop->iStop[s]=iStop;
+		pop->sorted = 0;
 
 	}
 
@@ -238,10 +403,18 @@ void pPosPerturb(const dictionary *ini, Population *pop, const MpiInfo *mpiInfo)
 		long int iStop = pop->iStop[s];
 		for(long int i=iStart;i<iStop;i++){
 
+			// Ratio of unperturbed to perturbed density at the particle
+			double ratio = 1;
 			for(int d=0;d<nDims;d++){
-				double theta = 2.0*M_PI*mode[s*nDims+d]*pos[i*nDims+d]/L[d];
+				double k = 2.0*M_PI*mode[s*nDims+d]/L[d];
+				double theta = k*pos[i*nDims+d];
 				pos[i*nDims+d] += amplitude[s*nDims+d]*cos(theta);
+				ratio *= 1-amplitude[s*nDims+d]*k*sin(theta);
 			}
+
+			// The particles now sample the perturbed distribution, of which
+			// the background is the fraction ratio
+			if(pop->weight) pop->weight[i] = 1-ratio;
 		}
 	}
 
@@ -259,8 +432,8 @@ void pPosDebug(const dictionary *ini, Population *pop){
 	long int *nParticles = iniGetLongIntArr(ini,"population:nParticles",nSpecies);
 
 	int mpiRank, mpiSize;
-	MPI_Comm_rank(MPI_COMM_WORLD,&mpiRank);
-	MPI_Comm_size(MPI_COMM_WORLD,&mpiSize);
+	MPI_Comm_rank(simComm,&mpiRank);
+	MPI_Comm_size(simComm,&mpiSize);
 
 	for(int s=0;s<nSpecies;s++){
 		nParticles[s] /= mpiSize;
@@ -274,8 +447,10 @@ void pPosDebug(const dictionary *ini, Population *pop){
 			1,1,0,1,1,0,1,1,0,1,1,0,1,1,0,1,1,0,1,1,0,1,1,0,1,1,0);
 
 	for(int s=0;s<nSpecies;s++){
+		if(pop->fluid[s]) continue;
 		long int iStart = pop->iStart[s];
 		pop->iStop[s] = iStart + nParticles[s];
+		pop->sorted = 0;
 		double *pos = &pop->pos[iStart*nDims];
 
 		for(long int i=0;i<nParticles[s];i++){
@@ -322,7 +497,7 @@ void pVelAssertMax(const Population *pop, double max){
 	double *vel = pop->vel;
 
 	int nSpecies = pop->nSpecies;
-	int nDims = pop->nDims;
+	int nVelDims = pop->nVelDims;
 
 	for(int s=0; s<nSpecies; s++){
 
@@ -330,25 +505,28 @@ void pVelAssertMax(const Population *pop, double max){
 		long int iStop  = pop->iStop[s];
 		for(int i=iStart; i<iStop; i++){
 
-			for(int d=0;d<nDims;d++){
+			for(int d=0;d<nVelDims;d++){
 
-				if(vel[i*nDims+d]>max){
+				if(vel[i*nVelDims+d]>max){
 					msg(ERROR,	"Particle i=%li (of specie %i) travels too"
 					 			"fast in dimension %i: %f>%f",
-								i, s, d, vel[i*nDims+d], max);
+								i, s, d, vel[i*nVelDims+d], max);
 				}
 			}
 		}
 	}
 }
 
-void pVelMaxwell(const dictionary *ini, Population *pop, const gsl_rng *rng){
+void pVelMaxwell(const dictionary *ini, Population *pop, const MpiInfo *mpiInfo){
 
 	int nSpecies = pop->nSpecies;
 	double *velDrift = iniGetDoubleArr(ini,"population:drift",nSpecies);
 	double *velThermal = iniGetDoubleArr(ini,"population:thermalVelocity",nSpecies);
+	unsigned int seed = (unsigned int)iniGetInt(ini,"population:seed");
 
 	int nDims = pop->nDims;
+	int nVelDims = pop->nVelDims;
+	int *offset = mpiInfo->offset;
 
 	for(int s=0;s<nSpecies;s++){
 
@@ -356,22 +534,66 @@ void pVelMaxwell(const dictionary *ini, Population *pop, const gsl_rng *rng){
 		long int iStop = pop->iStop[s];
 
 		double velTh = velThermal[s];
+		double drift = velDrift[s];
+		Rng rng;
+		rngSet(&rng,seed,RNG_VEL,s,0);
+
+		#pragma omp parallel for schedule(static)
+		for(long int i0=iStart;i0<iStop;i0+=P_RNG_BATCH){
+
+			long int nBatch = iStop-i0;
+			if(nBatch>P_RNG_BATCH) nBatch = P_RNG_BATCH;
+
+			// Particles are identified by their global position
+			unsigned long long int index[P_RNG_BATCH];
+			for(long int k=0;k<nBatch;k++)
+				index[k] = pHashPos(&pop->pos[(i0+k)*nDims],offset,nDims);
+
+			double *vel = &pop->vel[i0*nVelDims];
+			rngGaussian(&rng,index,nBatch,nVelDims,vel);
+			for(long int j=0;j<nBatch*nVelDims;j++) vel[j] = drift + velTh*vel[j];
+		}
+	}
+	free(velDrift);
+	free(velThermal);
+}
+
+void pVelQuiet(const dictionary *ini, Population *pop){
+
+	int nSpecies = pop->nSpecies;
+	int nDims = pop->nDims;
+	int nVelDims = pop->nVelDims;
+	double *velDrift = iniGetDoubleArr(ini,"population:drift",nSpecies);
+	double *velThermal = iniGetDoubleArr(ini,"population:thermalVelocity",nSpecies);
+
+	for(int s=0;s<nSpecies;s++){
+
+		long int iStart = pop->iStart[s];
+		long int iStop = pop->iStop[s];
+		double velTh = velThermal[s];
+		double drift = velDrift[s];
 
+		// Pairs of particles get opposite thermal velocities. The bases of
+		// the radical inverses follow those used by pPosQuiet().
+		#pragma omp parallel for schedule(static)
 		for(long int i=iStart;i<iStop;i++){
 
-			double *vel = &pop->vel[i*nDims];
-			for(int d=0;d<nDims;d++){
-				vel[d] = velDrift[s] + gsl_ran_gaussian_ziggurat(rng,velTh);
+			long int m = (i-iStart)/2;
+			double sign = (i-iStart)%2 ? -1 : 1;
+			for(int d=0;d<nVelDims;d++){
+				double u = pRadicalInverse(m+1,pPrimes[nDims-1+d]);
+				pop->vel[i*nVelDims+d] = drift + sign*velTh*pInvNormalCdf(u);
 			}
 		}
 	}
+
 	free(velDrift);
 	free(velThermal);
 }
 
 void pVelSet(Population *pop, const double *vel){
 
-	int nDims = pop->nDims;
+	int nVelDims = pop->nVelDims;
 	int nSpecies = pop->nSpecies;
 
 	for(int s=0;s<nSpecies;s++){
@@ -380,8 +602,8 @@ void pVelSet(Population *pop, const double *vel){
 		long int iStop = pop->iStop[s];
 
 		for(long int i=iStart;i<iStop;i++){
-			for(int d=0;d<nDims;d++){
-				pop->vel[i*nDims+d] = vel[d];
+			for(int d=0;d<nVelDims;d++){
+				pop->vel[i*nVelDims+d] = vel[d];
 			}
 		}
 	}
@@ -389,7 +611,7 @@ void pVelSet(Population *pop, const double *vel){
 
 void pVelZero(Population *pop){
 
-	int nDims = pop->nDims;
+	int nVelDims = pop->nVelDims;
 	int nSpecies = pop->nSpecies;
 
 	for(int s=0;s<nSpecies;s++){
@@ -398,8 +620,8 @@ void pVelZero(Population *pop){
 		long int iStop = pop->iStop[s];
 
 		for(long int i=iStart;i<iStop;i++){
-			for(int d=0;d<nDims;d++){
-				pop->vel[i*nDims+d] = 0;
+			for(int d=0;d<nVelDims;d++){
+				pop->vel[i*nVelDims+d] = 0;
 			}
 		}
 	}
@@ -416,12 +638,13 @@ void pNew(Population *pop, int s, const double *pos, const double *vel){
 		 			"%i. New particle ignored.",s);
 	else {
 
-		long int p = iStop[s]*nDims;
-		for(int d=0;d<nDims;d++){
-			pop->pos[p+d] = pos[d];
-			pop->vel[p+d] = vel[d];
-		}
+		long int i = iStop[s];
+		int nVelDims = pop->nVelDims;
+		for(int d=0;d<nDims;d++) pop->pos[i*nDims+d] = pos[d];
+		for(int d=0;d<nVelDims;d++) pop->vel[i*nVelDims+d] = vel[d];
+		if(pop->weight) pop->weight[i] = 0;
 		iStop[s]++;
+		pop->sorted = 0;
 
 	}
 
@@ -430,16 +653,22 @@ void pNew(Population *pop, int s, const double *pos, const double *vel){
 void pCut(Population *pop, int s, long int p, double *pos, double *vel){
 
 	int nDims = pop->nDims;
-	long int pLast = (pop->iStop[s]-1)*nDims;
+	int nVelDims = pop->nVelDims;
+	long int i = p/nDims;
+	long int iLast = pop->iStop[s]-1;
 
 	for(int d=0;d<nDims;d++){
 		pos[d] = pop->pos[p+d];
-		vel[d] = pop->vel[p+d];
-		pop->pos[p+d] = pop->pos[pLast+d];
-		pop->vel[p+d] = pop->vel[pLast+d];
+		pop->pos[p+d] = pop->pos[iLast*nDims+d];
+	}
+	for(int d=0;d<nVelDims;d++){
+		vel[d] = pop->vel[i*nVelDims+d];
+		pop->vel[i*nVelDims+d] = pop->vel[iLast*nVelDims+d];
 	}
+	if(pop->weight) pop->weight[i] = pop->weight[iLast];
 
 	pop->iStop[s]--;
+	pop->sorted = 0;
 
 }
 
@@ -486,6 +715,8 @@ void pOpenH5(	const dictionary *ini, Population *pop, const Units *units,
 
 void pWriteH5(Population *pop, const MpiInfo *mpiInfo, double posN, double velN){
 
+	cpBegin("hdf5 population");
+
 	int mpiRank = mpiInfo->mpiRank;
 	int mpiSize = mpiInfo->mpiSize;
 	int nSpecies = pop->nSpecies;
@@ -503,6 +734,12 @@ void pWriteH5(Population *pop, const MpiInfo *mpiInfo, double posN, double velN)
 	memDims[1] = pop->nDims;
 	offset[1] = 0;
 
+	// Velocities may have more components than positions (2D3V)
+	hsize_t velFileDims[arrSize];
+	hsize_t velMemDims[arrSize];
+	velFileDims[1] = pop->nVelDims;
+	velMemDims[1] = pop->nVelDims;
+
 	long int *offsetAllSubdomains = malloc((mpiSize+1)*sizeof(long int));
 	offsetAllSubdomains[0] = 0;
 
@@ -515,7 +752,7 @@ void pWriteH5(Population *pop, const MpiInfo *mpiInfo, double posN, double velN)
 						&offsetAllSubdomains[1],
 						1,
 						MPI_LONG,
-						MPI_COMM_WORLD);
+						simComm);
 
 		// Take cumulative sum to actually get offset
 		// Last element equals total number of particles on all nodes
@@ -541,6 +778,18 @@ void pWriteH5(Population *pop, const MpiInfo *mpiInfo, double posN, double velN)
 								memDims,
 								NULL);
 
+			velFileDims[0] = fileDims[0];
+			velMemDims[0] = memDims[0];
+			hid_t velMemSpace = H5Screate_simple(arrSize,velMemDims,NULL);
+			hid_t velFileSpace = H5Screate_simple(arrSize,velFileDims,NULL);
+
+			H5Sselect_hyperslab(velFileSpace,
+								H5S_SELECT_SET,
+								offset,
+								NULL,
+								velMemDims,
+								NULL);
+
 			/*
 			 * STORE DATA COLLECTIVELY
 			 */
@@ -572,23 +821,25 @@ void pWriteH5(Population *pop, const MpiInfo *mpiInfo, double posN, double velN)
 			dataset = H5Dcreate(pop->h5,
 								name,
 								H5T_IEEE_F64LE,
-								fileSpace,
+								velFileSpace,
 								H5P_DEFAULT,
 								H5P_DEFAULT,
 								H5P_DEFAULT);
 
 			H5Dwrite(	dataset,
 				 		H5T_NATIVE_DOUBLE,
-						memSpace,
-						fileSpace,
+						velMemSpace,
+						velFileSpace,
 						pList,
-						&pop->vel[pop->iStart[s]*pop->nDims]);
+						&pop->vel[pop->iStart[s]*pop->nVelDims]);
 
 			H5Dclose(dataset);
 
 			H5Pclose(pList);
 			H5Sclose(fileSpace);
 			H5Sclose(memSpace);
+			H5Sclose(velFileSpace);
+			H5Sclose(velMemSpace);
 
 		} else {
 			msg(WARNING,"No particles of specie %i to store in .h5-file",s);
@@ -597,6 +848,8 @@ void pWriteH5(Population *pop, const MpiInfo *mpiInfo, double posN, double velN)
  	free(offsetAllSubdomains);
 
 	pToLocalFrame(pop,mpiInfo);
+
+	cpEnd();
 }
 
 void pCloseH5(Population *pop){
@@ -621,6 +874,12 @@ void pCreateEnergyDatasets(hid_t xy, Population *pop){
 
 		sprintf(name,"/energy/kinetic/specie %i",s);
 		xyCreateDataset(xy,name);
+
+		sprintf(name,"/energy/absorbed/specie %i",s);
+		xyCreateDataset(xy,name);
+
+		sprintf(name,"/flux/absorbed/specie %i",s);
+		xyCreateDataset(xy,name);
 	}
 }
 
@@ -642,6 +901,14 @@ void pWriteEnergy(hid_t xy, Population *pop, double x){
 
 		sprintf(name,"/energy/kinetic/specie %i",s);
 		xyWrite(xy,name,x,pop->kinEnergy[s],MPI_SUM);
+
+		sprintf(name,"/energy/absorbed/specie %i",s);
+		xyWrite(xy,name,x,pop->absorbedEnergy[s],MPI_SUM);
+		pop->absorbedEnergy[s] = 0;
+
+		sprintf(name,"/flux/absorbed/specie %i",s);
+		xyWrite(xy,name,x,pop->absorbed[s],MPI_SUM);
+		pop->absorbed[s] = 0;
 	}
 
 }
@@ -668,6 +935,19 @@ void pSumPotEnergy(Population *pop){
 
 }
 
+unsigned long long int pHashPos(const double *pos, const int *offset, int nDims){
+
+	unsigned long long int hash = 0;
+	for(int d=0;d<nDims;d++){
+		double x = pos[d]+offset[d];
+		unsigned long long int bits;
+		memcpy(&bits,&x,sizeof(bits));
+		hash = (hash^bits)*0x9E3779B97F4A7C15ULL;
+		hash ^= hash>>32;
+	}
+	return hash;
+}
+
 /******************************************************************************
  * DEFINING LOCAL FUNCTIONS
  *****************************************************************************/
@@ -689,6 +969,8 @@ void pToLocalFrame(Population *pop, const MpiInfo *mpiInfo){
 			for(int d=0;d<nDims;d++) pos[d] -= offset[d];
 		}
 	}
+
+	pop->sorted = 0;
 }
 
 void pToGlobalFrame(Population *pop, const MpiInfo *mpiInfo){
@@ -708,4 +990,564 @@ void pToGlobalFrame(Population *pop, const MpiInfo *mpiInfo){
 			for(int d=0;d<nDims;d++) pos[d] += offset[d];
 		}
 	}
+
+	pop->sorted = 0;
+}
+
+void pSortTiles(Population *pop, const Grid *grid){
+
+	Tiles *tiles = pop->tiles;
+	if(tiles==NULL) return;
+
+	int nDims = pop->nDims;
+	int nVelDims = pop->nVelDims;
+	int nSpecies = pop->nSpecies;
+	int tileSize = tiles->tileSize;
+
+	// The tiles change with the size of the subdomain (see gRebalance())
+	int changed = 0;
+	for(int d=0;d<nDims;d++){
+		int size = (grid->size[d+1]+tileSize-1)/tileSize;
+		if(size!=tiles->size[d]){
+			tiles->size[d] = size;
+			changed = 1;
+		}
+	}
+	if(changed) pSetTiles(tiles,nSpecies);
+
+	long int nTiles = tiles->nTiles;
+	int nThreads = thrCount();
+	long int *count = tiles->count;
+	double *pos = pop->pos;
+	double *vel = pop->vel;
+
+	long int nAllocMax = 0;
+	for(int s=0;s<nSpecies;s++){
+		long int nAlloc = pop->iStart[s+1]-pop->iStart[s];
+		if(nAlloc>nAllocMax) nAllocMax = nAlloc;
+	}
+	double *posBuffer = tiles->buffer;
+	double *velBuffer = &tiles->buffer[nDims*nAllocMax];
+	double *weightBuffer = &tiles->buffer[(nDims+nVelDims)*nAllocMax];
+	double *weight = pop->weight;
+
+	for(int s=0;s<nSpecies;s++){
+
+		long int iStart = pop->iStart[s];
+		long int iStop = pop->iStop[s];
+		long int *start = &tiles->start[s*(nTiles+1)];
+
+		for(long int n=0;n<nThreads*nTiles;n++) count[n] = 0;
+
+		// Counting sort. Both loops over particles use the same static
+		// schedule, such that each thread scatters the particles it counted.
+		#pragma omp parallel
+		{
+			long int *threadCount = &count[thrNum()*nTiles];
+
+			#pragma omp for schedule(static)
+			for(long int i=iStart;i<iStop;i++)
+				threadCount[pTile(tiles,&pos[i*nDims])]++;
+
+			#pragma omp single
+			{
+				long int offset = 0;
+				for(long int n=0;n<nTiles;n++){
+					start[n] = iStart+offset;
+					for(int t=0;t<nThreads;t++){
+						long int c = count[t*nTiles+n];
+						count[t*nTiles+n] = offset;
+						offset += c;
+					}
+				}
+				start[nTiles] = iStop;
+			}
+
+			#pragma omp for schedule(static)
+			for(long int i=iStart;i<iStop;i++){
+				long int j = threadCount[pTile(tiles,&pos[i*nDims])]++;
+				for(int d=0;d<nDims;d++) posBuffer[j*nDims+d] = pos[i*nDims+d];
+				for(int d=0;d<nVelDims;d++) velBuffer[j*nVelDims+d] = vel[i*nVelDims+d];
+				if(weight) weightBuffer[j] = weight[i];
+			}
+
+			#pragma omp for schedule(static)
+			for(long int p=0;p<(iStop-iStart)*nDims;p++)
+				pos[iStart*nDims+p] = posBuffer[p];
+
+			#pragma omp for schedule(static)
+			for(long int p=0;p<(iStop-iStart)*nVelDims;p++)
+				vel[iStart*nVelDims+p] = velBuffer[p];
+
+			if(weight){
+				#pragma omp for schedule(static)
+				for(long int j=0;j<iStop-iStart;j++) weight[iStart+j] = weightBuffer[j];
+			}
+		}
+	}
+
+	pop->sorted = 1;
+}
+
+/******************************************************************************
+ * DEFINING LOCAL FUNCTIONS
+ *****************************************************************************/
+
+static Tiles *pAllocTiles(int tileSize, int nDims, long int nBuffer){
+
+	Tiles *tiles = malloc(sizeof(*tiles));
+	tiles->tileSize = tileSize;
+	tiles->nDims = nDims;
+	tiles->size = calloc(nDims,sizeof(*tiles->size));	// Set by pSortTiles()
+	tiles->sizeProd = malloc((nDims+1)*sizeof(*tiles->sizeProd));
+	tiles->nTiles = 0;
+	tiles->order = NULL;
+	tiles->nColors = 1<<nDims;
+	tiles->colorStart = malloc((tiles->nColors+1)*sizeof(*tiles->colorStart));
+	tiles->start = NULL;
+	tiles->count = NULL;
+	tiles->buffer = memAlloc(MEM_POPULATION,nBuffer*sizeof(double));
+
+	return tiles;
+}
+
+static void pFreeTiles(Tiles *tiles){
+
+	free(tiles->size);
+	free(tiles->sizeProd);
+	free(tiles->order);
+	free(tiles->colorStart);
+	free(tiles->start);
+	free(tiles->count);
+	memFree(tiles->buffer);
+	free(tiles);
+}
+
+// Numbers the tiles color by color after tiles->size is changed
+static void pSetTiles(Tiles *tiles, int nSpecies){
+
+	int nDims = tiles->nDims;
+	int *size = tiles->size;
+	long int *sizeProd = tiles->sizeProd;
+	int nColors = tiles->nColors;
+	long int *colorStart = tiles->colorStart;
+
+	ailCumProd(size,sizeProd,nDims);
+	long int nTiles = sizeProd[nDims];
+	tiles->nTiles = nTiles;
+
+	tiles->order = realloc(tiles->order,nTiles*sizeof(*tiles->order));
+	tiles->start = realloc(tiles->start,nSpecies*(nTiles+1)*sizeof(*tiles->start));
+	tiles->count = realloc(tiles->count,thrCount()*nTiles*sizeof(*tiles->count));
+
+	// Color of a tile is given by whether its index is odd in each dimension
+	long int *next = calloc(nColors,sizeof(*next));
+	for(long int n=0;n<nTiles;n++){
+		int color = 0;
+		for(int d=0;d<nDims;d++) color |= ((n/sizeProd[d])%size[d]&1)<<d;
+		tiles->order[n] = next[color]++;
+	}
+
+	colorStart[0] = 0;
+	for(int c=0;c<nColors;c++) colorStart[c+1] = colorStart[c]+next[c];
+
+	for(long int n=0;n<nTiles;n++){
+		int color = 0;
+		for(int d=0;d<nDims;d++) color |= ((n/sizeProd[d])%size[d]&1)<<d;
+		tiles->order[n] += colorStart[color];
+	}
+
+	free(next);
+}
+
+// Number of the tile a particle belongs to
+static inline long int pTile(const Tiles *tiles, const double *pos){
+
+	long int n = 0;
+	for(int d=0;d<tiles->nDims;d++){
+		int t = (int)pos[d]/tiles->tileSize;
+		if(t>=tiles->size[d]) t = tiles->size[d]-1;
+		n += t*tiles->sizeProd[d];
+	}
+	return tiles->order[n];
+}
+
+// Particles are split between the cells of the global grid by a multinomial
+// distribution with probabilities proportional to the volume (uniform) or the
+// density at the lower node (profile) of each cell. It is drawn as binomials
+// down a fixed bisection of the global grid (see PSplit), each taking its
+// random number from the index of the box it splits, and particle g of the
+// global numbering this gives draws its position from index g. Each MPI node
+// only descends into the boxes overlapping its subdomain, so the work is
+// O(N/mpiSize+cells/mpiSize), and the particles do not depend on the
+// subdomains.
+static void pPosLocal(const dictionary *ini, Population *pop,
+					  const MpiInfo *mpiInfo, const Grid *density){
+
+	// Read from ini
+	int nSpecies = pop->nSpecies;
+	int nDims = pop->nDims;
+	long int *nParticles = iniGetLongIntArr(ini,"population:nParticles",nSpecies);
+	unsigned int seed = (unsigned int)iniGetInt(ini,"population:seed");
+
+	// Read from mpiInfo
+	int *subdomain = mpiInfo->subdomain;
+	int *nSubdomains = mpiInfo->nSubdomains;
+	int **edges = mpiInfo->edges;
+	int *offset = mpiInfo->offset;
+
+	PSplit sp;
+	sp.nDims = nDims;
+	sp.nSubdomains = nSubdomains;
+	sp.edges = edges;
+	sp.size = malloc(nDims*sizeof(*sp.size));
+	sp.lo = malloc(nDims*sizeof(*sp.lo));
+	sp.hi = malloc(nDims*sizeof(*sp.hi));
+	sp.sum = NULL;
+	sp.sumProd = malloc((nDims+1)*sizeof(*sp.sumProd));
+	sp.known = NULL;
+	sp.nKnown = 0;
+
+	int depth = 0;
+	sp.sumProd[0] = 1;
+	long int nCells = 1;
+	for(int d=0;d<nDims;d++){
+		sp.size[d] = edges[d][nSubdomains[d]];
+		sp.lo[d] = edges[d][subdomain[d]];
+		sp.hi[d] = edges[d][subdomain[d]+1];
+		sp.sumProd[d+1] = sp.sumProd[d]*(sp.hi[d]-sp.lo[d]+1);
+		nCells *= sp.hi[d]-sp.lo[d];
+		while((1<<depth)<sp.size[d]) depth++;
+	}
+	if(depth*nDims>=62) msg(ERROR,"too many cells to split particles between");
+
+	if(density){
+
+		if(density->rank!=nDims+1 || density->size[0]!=1)
+			msg(ERROR,"density profile must be a scalar grid of grid:nDims dimensions");
+		for(int d=0;d<nDims;d++){
+			if(density->trueSize[d+1]!=sp.hi[d]-sp.lo[d])
+				msg(ERROR|ALL,"density profile doesn't match the subdomain");
+		}
+
+		// Density at the lower node of local cell c
+		long int *node = malloc(nCells*sizeof(*node));
+		double max = 0;
+		for(long int c=0;c<nCells;c++){
+			node[c] = 0;
+			long int cRem = c;
+			for(int d=0;d<nDims;d++){
+				int size = sp.hi[d]-sp.lo[d];
+				node[c] += (cRem%size+density->nGhostLayers[d+1])*density->sizeProd[d+1];
+				cRem /= size;
+			}
+			if(density->val[node[c]]<0) msg(ERROR|ALL,"density profile is negative");
+			if(density->val[node[c]]>max) max = density->val[node[c]];
+		}
+		MPI_Allreduce(MPI_IN_PLACE,&max,1,MPI_DOUBLE,MPI_MAX,simComm);
+		if(max<=0) msg(ERROR,"density profile is zero everywhere");
+
+		// Summed table of the weights of the local cells, with the lower
+		// corner of box [x,y) at sum[x-lo], and weights in multiples of
+		// max/P_PROFILE_RES, such that all sums are exact
+		sp.sum = calloc(sp.sumProd[nDims],sizeof(*sp.sum));
+		for(long int c=0;c<nCells;c++){
+			long int i = 0, cRem = c;
+			for(int d=0;d<nDims;d++){
+				int size = sp.hi[d]-sp.lo[d];
+				i += (cRem%size+1)*sp.sumProd[d];
+				cRem /= size;
+			}
+			sp.sum[i] = llround(density->val[node[c]]/max*P_PROFILE_RES);
+		}
+		for(int d=0;d<nDims;d++){
+			int size = sp.hi[d]-sp.lo[d]+1;
+			for(long int i=0;i<sp.sumProd[nDims];i++){
+				if((i/sp.sumProd[d])%size>0) sp.sum[i] += sp.sum[i-sp.sumProd[d]];
+			}
+		}
+		free(node);
+
+		// Boxes overlapping several subdomains are summed over all of them.
+		// All MPI nodes list the boxes in the same order.
+		int *a = calloc(nDims,sizeof(*a));
+		long int nAlloc = 0;
+		pSplitKnown(&sp,1,a,sp.size,&nAlloc);
+		free(a);
+		long long int *weights = malloc(sp.nKnown*sizeof(*weights));
+		for(long int k=0;k<sp.nKnown;k++) weights[k] = sp.known[k].weight;
+		MPI_Allreduce(MPI_IN_PLACE,weights,sp.nKnown,MPI_LONG_LONG,MPI_SUM,simComm);
+		for(long int k=0;k<sp.nKnown;k++) sp.known[k].weight = weights[k];
+		free(weights);
+		qsort(sp.known,sp.nKnown,sizeof(*sp.known),pSplitCompare);
+	}
+
+	int *root = calloc(nDims,sizeof(*root));
+	long long int weightTotal = pSplitWeight(&sp,1,root,sp.size);
+	if(weightTotal<=0) msg(ERROR,"density profile is zero everywhere");
+
+	// Each cell of this subdomain with particles is a leaf of the bisection
+	sp.leafCell = malloc(nCells*nDims*sizeof(*sp.leafCell));
+	sp.leafFirst = malloc(nCells*sizeof(*sp.leafFirst));
+	sp.leafN = malloc(nCells*sizeof(*sp.leafN));
+	long int *leafStart = malloc((nCells+1)*sizeof(*leafStart));
+
+	for(int s=0;s<nSpecies;s++){
+
+		if(pop->fluid[s]) continue;
+
+		long int iStart = pop->iStart[s];
+		Rng rng;
+		rngSet(&rng,seed,RNG_POS,s,0);
+
+		sp.nLeaves = 0;
+		pSplitDescend(&sp,&rng,1,root,sp.size,nParticles[s],0,weightTotal);
+
+		leafStart[0] = 0;
+		for(long int l=0;l<sp.nLeaves;l++) leafStart[l+1] = leafStart[l]+sp.leafN[l];
+		long int nLocal = leafStart[sp.nLeaves];
+
+		long int allocated = pop->iStart[s+1]-iStart;
+		if(nLocal>allocated)
+			msg(ERROR|ALL,	"allocated only %li particles of specie %i per node but "
+						"%li generated", allocated, s, nLocal);
+
+		#pragma omp parallel
+		{
+			unsigned long long int index[P_RNG_BATCH];
+			double *batch = malloc(P_RNG_BATCH*nDims*sizeof(*batch));
+
+			#pragma omp for schedule(static)
+			for(long int l=0;l<sp.nLeaves;l++){
+
+				const int *cell = &sp.leafCell[l*nDims];
+				for(long int k0=0;k0<sp.leafN[l];k0+=P_RNG_BATCH){
+
+					long int nBatch = sp.leafN[l]-k0;
+					if(nBatch>P_RNG_BATCH) nBatch = P_RNG_BATCH;
+					for(long int k=0;k<nBatch;k++) index[k] = sp.leafFirst[l]+k0+k;
+					rngUniform(&rng,index,nBatch,nDims,batch);
+
+					for(long int k=0;k<nBatch;k++){
+						double *u = &batch[k*nDims];
+						double *pos = &pop->pos[(iStart+leafStart[l]+k0+k)*nDims];
+
+						// On multiples of 1/P_POS_RES such that pHashPos() is exact
+						for(int d=0;d<nDims;d++){
+							double frac = floor(u[d]*P_POS_RES);
+							if(frac>=P_POS_RES) frac = P_POS_RES-1;
+							pos[d] = cell[d]-offset[d] + frac/P_POS_RES;
+						}
+					}
+				}
+			}
+
+			free(batch);
+		}
+
+		pop->iStop[s] = iStart+nLocal;
+		pop->sorted = 0;
+	}
+
+	free(leafStart);
+	free(sp.leafN);
+	free(sp.leafFirst);
+	free(sp.leafCell);
+	free(root);
+	free(sp.known);
+	free(sp.sum);
+	free(sp.sumProd);
+	free(sp.hi);
+	free(sp.lo);
+	free(sp.size);
+	free(nParticles);
+}
+
+// Splits box [a,b) in two halves along its longest dimension. Box id has the
+// halves 2*id and 2*id+1, such that the whole grid is box 1.
+static void pSplitHalf(const PSplit *sp, const int *a, const int *b, int right,
+					   int *ca, int *cb){
+
+	int dSplit = 0;
+	for(int d=0;d<sp->nDims;d++){
+		ca[d] = a[d];
+		cb[d] = b[d];
+		if(b[d]-a[d]>b[dSplit]-a[dSplit]) dSplit = d;
+	}
+	int mid = a[dSplit]+(b[dSplit]-a[dSplit])/2;
+	if(right) ca[dSplit] = mid;
+	else cb[dSplit] = mid;
+}
+
+// Sum of the weights of the local cells within box [a,b)
+static long long int pSplitLocalSum(const PSplit *sp, const int *a, const int *b){
+
+	int nDims = sp->nDims;
+	int x[2][nDims];
+	for(int d=0;d<nDims;d++){
+		x[0][d] = (a[d]>sp->lo[d] ? a[d] : sp->lo[d])-sp->lo[d];
+		x[1][d] = (b[d]<sp->hi[d] ? b[d] : sp->hi[d])-sp->lo[d];
+		if(x[1][d]<=x[0][d]) return 0;
+	}
+
+	if(!sp->sum){
+		long long int volume = 1;
+		for(int d=0;d<nDims;d++) volume *= x[1][d]-x[0][d];
+		return volume;
+	}
+
+	// Inclusion-exclusion over the corners of the box
+	long long int sum = 0;
+	for(int corner=0;corner<(1<<nDims);corner++){
+		long int i = 0;
+		int sign = 1;
+		for(int d=0;d<nDims;d++){
+			int upper = (corner>>d)&1;
+			i += x[upper][d]*sp->sumProd[d];
+			if(!upper) sign = -sign;
+		}
+		sum += sign*sp->sum[i];
+	}
+	return sum;
+}
+
+// Whether box [a,b) overlaps more than one subdomain
+static int pSplitStraddles(const PSplit *sp, const int *a, const int *b){
+
+	for(int d=0;d<sp->nDims;d++){
+		for(int J=1;J<sp->nSubdomains[d];J++){
+			if(a[d]<sp->edges[d][J] && sp->edges[d][J]<b[d]) return 1;
+		}
+	}
+	return 0;
+}
+
+// Lists box id and its descendants whose weights are needed by several MPI
+// nodes, i.e., the root and the halves of boxes straddling subdomains.
+static void pSplitKnown(PSplit *sp, unsigned long long int id,
+						const int *a, const int *b, long int *nAlloc){
+
+	if(sp->nKnown==*nAlloc){
+		*nAlloc = 2*(*nAlloc)+16;
+		sp->known = realloc(sp->known,*nAlloc*sizeof(*sp->known));
+	}
+	sp->known[sp->nKnown].id = id;
+	sp->known[sp->nKnown].weight = pSplitLocalSum(sp,a,b);
+	sp->nKnown++;
+
+	if(!pSplitStraddles(sp,a,b)) return;
+
+	int nDims = sp->nDims;
+	int ca[nDims], cb[nDims];
+	for(int right=0;right<2;right++){
+		pSplitHalf(sp,a,b,right,ca,cb);
+		pSplitKnown(sp,2*id+right,ca,cb,nAlloc);
+	}
+}
+
+static int pSplitCompare(const void *x, const void *y){
+
+	unsigned long long int idX = ((const PSplitKnown*)x)->id;
+	unsigned long long int idY = ((const PSplitKnown*)y)->id;
+	return (idX>idY)-(idX<idY);
+}
+
+// Weight of box id spanning [a,b)
+static long long int pSplitWeight(const PSplit *sp, unsigned long long int id,
+								  const int *a, const int *b){
+
+	int local = 1;
+	for(int d=0;d<sp->nDims;d++)
+		if(a[d]<sp->lo[d] || b[d]>sp->hi[d]) local = 0;
+
+	if(local) return pSplitLocalSum(sp,a,b);
+
+	if(!sp->sum){
+		long long int volume = 1;
+		for(int d=0;d<sp->nDims;d++) volume *= b[d]-a[d];
+		return volume;
+	}
+
+	PSplitKnown key = {.id = id};
+	PSplitKnown *known = bsearch(&key,sp->known,sp->nKnown,sizeof(*sp->known),
+								 pSplitCompare);
+	if(!known) msg(ERROR|ALL,"weight of box %llu not summed",id);
+	return known->weight;
+}
+
+// Splits the n particles g0, g0+1, ... of box id spanning [a,b) with weight w
+// between its halves, and records the cells of this subdomain as leaves
+static void pSplitDescend(PSplit *sp, const Rng *rng, unsigned long long int id,
+						  const int *a, const int *b, long int n, long int g0,
+						  long long int w){
+
+	int nDims = sp->nDims;
+	if(n==0) return;
+
+	int leaf = 1;
+	for(int d=0;d<nDims;d++){
+		if(b[d]<=sp->lo[d] || a[d]>=sp->hi[d]) return;
+		if(b[d]-a[d]>1) leaf = 0;
+	}
+
+	if(leaf){
+		for(int d=0;d<nDims;d++) sp->leafCell[sp->nLeaves*nDims+d] = a[d];
+		sp->leafFirst[sp->nLeaves] = g0;
+		sp->leafN[sp->nLeaves] = n;
+		sp->nLeaves++;
+		return;
+	}
+
+	int ca[nDims], cb[nDims];
+	pSplitHalf(sp,a,b,0,ca,cb);
+	long long int wLeft = pSplitWeight(sp,2*id,ca,cb);
+	long int nLeft = rngBinomial(rng,P_SPLIT_INDEX+id,n,(double)wLeft/w);
+	pSplitDescend(sp,rng,2*id,ca,cb,nLeft,g0,wLeft);
+
+	pSplitHalf(sp,a,b,1,ca,cb);
+	pSplitDescend(sp,rng,2*id+1,ca,cb,n-nLeft,g0+nLeft,w-wLeft);
+}
+
+// Digits of k in the given base mirrored around the decimal point
+static double pRadicalInverse(unsigned long long int k, int base){
+
+	double inv = 1.0/base, scale = inv, u = 0;
+	while(k>0){
+		u += (k%base)*scale;
+		k /= base;
+		scale *= inv;
+	}
+	return u;
+}
+
+// Inverse of the standard normal cumulative distribution function for p in
+// (0,1), with a relative error below 1.2e-9. From P. J. Acklam (2003).
+static double pInvNormalCdf(double p){
+
+	static const double a[] = {-3.969683028665376e+01, 2.209460984245205e+02,
+							   -2.759285104469687e+02, 1.383577518672690e+02,
+							   -3.066479806614716e+01, 2.506628277459239e+00};
+	static const double b[] = {-5.447609879822406e+01, 1.615858368580409e+02,
+							   -1.556989798598866e+02, 6.680131188771972e+01,
+							   -1.328068155288572e+01};
+	static const double c[] = {-7.784894002430293e-03,-3.223964580411365e-01,
+							   -2.400758277161838e+00,-2.549732539343734e+00,
+								4.374664141464968e+00, 2.938163982698783e+00};
+	static const double d[] = { 7.784695709041462e-03, 3.224671290700398e-01,
+								2.445134137142996e+00, 3.754408661907416e+00};
+
+	double q = p<0.5 ? p : 1-p;
+
+	if(q<0.02425){
+		// Tails
+		double r = sqrt(-2*log(q));
+		double x = (((((c[0]*r+c[1])*r+c[2])*r+c[3])*r+c[4])*r+c[5]) /
+				   ((((d[0]*r+d[1])*r+d[2])*r+d[3])*r+1);
+		return p<0.5 ? x : -x;
+	}
+
+	// Central region
+	double r = (p-0.5)*(p-0.5);
+	return (((((a[0]*r+a[1])*r+a[2])*r+a[3])*r+a[4])*r+a[5])*(p-0.5) /
+		   (((((b[0]*r+b[1])*r+b[2])*r+b[3])*r+b[4])*r+1);
 }
@@ -14,7 +14,9 @@
  *
  * Allocates memory for as many particles and species as specified in
  * populations:nSpecies and population:nAlloc in ini-file. This function only
- * allocates the memory for the particles, it does not generate them.
+ * allocates the memory for the particles, it does not generate them. The
+ * delta-f weights are allocated and zeroed if population:deltaF is set (see
+ * Population), which requires a positive population:thermalVelocity.
  *
  * Remember to call pFree() to free memory.
  */
@@ -30,27 +32,67 @@ void pFree(Population *pop);
  * @brief	Assign particles uniformly distributed positions
  * @param			ini		Dictionary to input file
  * @param[in,out]	pop		Population of particles
- * @param			grid	Grid in which the particles are to be distributed
- * @param			rngSync	Synchronized random number generator
+ * @param			mpiInfo	MpiInfo
  * @return			void
  *
  * The amount of particles specified by population:nParticles in ini will be
  * generated with uniformly distributed random positions within the simulation
- * domain (global reference frame). In case of multiple subdomains only
- * particles residing in this MPI node's subdomain will be stored, and will be
- * transformed to its local reference frame. The rng should have the same seed
- * (be synchronized) on all MPI nodes when calling this function as that will
- * ensure that all nodes generates the same particles and discards particles
- * not belonging to their subdomain. Failure to do so may lead to the number of
- * particles generated being different than specified in ini.
+ * domain, and stored in the local reference frame. Each MPI node only
+ * generates the particles in its own subdomain. How many there are in each
+ * cell is drawn from a multinomial distribution, such that the total is
+ * exactly population:nParticles. It is drawn as binomials down a fixed
+ * bisection of the global grid, and each MPI node only draws those of the
+ * boxes overlapping its subdomain. The random numbers are drawn from the
+ * RNG_POS stream (see Rng) with an index given by the box or by the particle's
+ * number in the global grid, so the particles are reproducible given
+ * population:seed, regardless of the number of MPI nodes and threads, and of
+ * the subdomains.
  *
  * Beware that this function do not assign any velocity to the particles.
- * @see pVelMaxwell()
+ * @see pVelMaxwell(), pPosProfile()
  */
-void pPosUniform(const dictionary *ini, Population *pop, const MpiInfo *mpiInfo, const gsl_rng *rngSync);
+void pPosUniform(const dictionary *ini, Population *pop, const MpiInfo *mpiInfo);
+
+/**
+ * @brief	Assign particles positions distributed as a density profile
+ * @param			ini		Dictionary to input file
+ * @param[in,out]	pop		Population of particles
+ * @param			mpiInfo	MpiInfo
+ * @param			density	Density profile
+ * @return			void
+ *
+ * Like pPosUniform(), but the number of particles in each cell is
+ * proportional to the density at its lower node, e.g. as read from the file
+ * given by population:profile using gReadH5(). The density need not be
+ * normalized, but must be non-negative, and is the same for all species. It is
+ * rounded to a multiple of 2^-20 times its maximum, such that the particles do
+ * not depend on the subdomains.
+ */
+void pPosProfile(const dictionary *ini, Population *pop, const MpiInfo *mpiInfo,
+				 const Grid *density);
 
 void pPosLattice(const dictionary *ini, Population *pop, const MpiInfo *mpiInfo);
 
+/**
+ * @brief	Assign particles low-discrepancy positions (quiet start)
+ * @param			ini		Dictionary to input file
+ * @param[in,out]	pop		Population of particles
+ * @param			mpiInfo	MpiInfo
+ * @return			void
+ *
+ * The particles specified by population:nParticles are split between the
+ * subdomains in proportion to their volume, and placed in the local reference
+ * frame as a Hammersley set: evenly spaced along the first dimension and by
+ * radical inverses (bit-reversal in base 2, then base 3) along the others.
+ * This fills the domain far more evenly than pPosUniform(), which reduces the
+ * initial noise. Species with the same number of particles get the same
+ * positions, so their charge cancels exactly at the start.
+ *
+ * Beware that the particles are ordered along the first dimension.
+ * @see pVelQuiet()
+ */
+void pPosQuiet(const dictionary *ini, Population *pop, const MpiInfo *mpiInfo);
+
 /**
  * @brief	Assign particles artificial positions suitable for debugging
  * @param			ini		Dictionary to input file
@@ -65,13 +107,24 @@ void pPosLattice(const dictionary *ini, Population *pop, const MpiInfo *mpiInfo)
  */
 void pPosDebug(const dictionary *ini, Population *pop);
 
-
+/**
+ * @brief	Displace particles by a sinusoidal perturbation
+ * @param			ini		Dictionary to input file
+ * @param[in,out]	pop		Population of particles
+ * @param			mpiInfo	MpiInfo
+ *
+ * Particle positions are displaced along each dimension d by
+ * population:perturbAmplitude times cos(2*pi*m*x/L), where m is
+ * population:perturbMode. With delta-f weights (see Population), each
+ * particle also gets the weight of the perturbed density, which is exact to
+ * all orders in the amplitude when the unperturbed positions are uniform.
+ */
 void pPosPerturb(const dictionary *ini, Population *pop, const MpiInfo *mpiInfo);
 
 /**
  * @brief Set the same velocity to all particles
  * @param[in,out]	pop		Population
- * @param			vel		Velocity to set (expected to be pop->nDims long)
+ * @param			vel		Velocity to set (expected to be pop->nVelDims long)
  */
 void pVelSet(Population *pop, const double *vel);
 
@@ -86,23 +139,38 @@ void pSumKinEnergy(Population *pop);
  * @brief	Assign particles Maxwellian distributed velocities
  * @param			ini		Dictionary to input file
  * @param[in,out]	pop		Population of particles
- * @param			rng		Random number generator
+ * @param			mpiInfo	MpiInfo
  * @return			void
  *
  * Iterates through all particles belonging to pop and assignes Maxwellian
  * distributed velocities to them, according to the temperature specified in
- * ini. Contrary to in posUniform() rng should at this point _not_ have the same
- * seed as that will lead to particles in different sub-domains having identical
- * velocities.
+ * ini. The velocity of a particle is drawn from the RNG_VEL stream with a hash
+ * of its position in the global reference frame as index (see Rng). Thus the
+ * velocities are the same regardless of the number of MPI nodes and threads,
+ * given the same positions and population:seed.
+ */
+void pVelMaxwell(const dictionary *ini, Population *pop, const MpiInfo *mpiInfo);
+
+/**
+ * @brief	Assign particles Maxwellian velocities with low noise (quiet start)
+ * @param			ini		Dictionary to input file
+ * @param[in,out]	pop		Population of particles
+ * @return			void
+ *
+ * Like pVelMaxwell(), but the velocities are loaded by the inverse of the
+ * cumulative Maxwellian applied to radical inverses in bases not used by
+ * pPosQuiet(). Every other particle gets the opposite thermal velocity of
+ * the one before it, such that the mean velocity of each specie is exactly
+ * population:drift.
  */
-void pVelMaxwell(const dictionary *ini, Population *pop, const gsl_rng *rng);
+void pVelQuiet(const dictionary *ini, Population *pop);
 
 /**
  * @brief	Add new particle to population
  * @param[in,out]	pop		Population
  * @param			s		Specie of new particle
  * @param			pos		Position of new particle (nDims elements)
- * @param			vel		Velocity of new particle (nDims elements)
+ * @param			vel		Velocity of new particle (nVelDims elements)
  * @return			void
  */
 void pNew(Population *pop, int s, const double *pos, const double *vel);
@@ -127,6 +195,28 @@ void pNew(Population *pop, int s, const double *pos, const double *vel);
  */
 void pCut(Population *pop, int s, long int p, double *pos, double *vel);
 
+/**
+ * @brief Position along the first dimension of particles to be removed
+ *
+ * Such particles are removed the next time emigrants are extracted, see
+ * puExtractEmigrantsND().
+ */
+#define P_REMOVED (-INFINITY)
+
+/**
+ * @brief	Hash of a position in the global reference frame
+ * @param	pos		Position in local reference frame (nDims elements)
+ * @param	offset	Offset of the local reference frame (see MpiInfo)
+ * @param	nDims	Number of dimensions
+ * @return	Hash
+ *
+ * Used as index of random numbers drawn for particles (see Rng), since
+ * particles carry no identity. Moving between reference frames is exact for
+ * positions drawn by pPosUniform(), such that the hash does not depend on the
+ * subdomains.
+ */
+unsigned long long int pHashPos(const double *pos, const int *offset, int nDims);
+
 /**
  * @brief	Creates .pop.h5-file to store population in
  * @param	ini				Dictionary to input file
@@ -202,6 +292,28 @@ void pToLocalFrame(Population *pop, const MpiInfo *mpiInfo);
  */
 void pToGlobalFrame(Population *pop, const MpiInfo *mpiInfo);
 
+/**
+ * @brief Sorts particles by spatial tile
+ * @param	pop		Population of particles (in local frame)
+ * @param	grid	Grid spanning the subdomain (e.g. rho)
+ * @return	void
+ * @see Tiles
+ *
+ * Does nothing unless population:tileSize is non-zero. Otherwise it sorts the
+ * particles of each specie by the tile they are in, using a counting sort
+ * parallelized among the threads, and sets pop->sorted. The particle kernels
+ * then schedule the tiles to the threads dynamically, and puDistr3D1() and
+ * the other charge assignment kernels are parallelized by coloring the tiles.
+ * Particles must be sorted again after they are moved or migrated, and the
+ * tiles are adapted to the size of the grid if it has changed since the last
+ * call (e.g. after load balancing).
+ *
+ * Each cell in the tiles should hold enough particles for the sorting to pay
+ * off, while the tiles should be small enough to balance the threads. Sorting
+ * needs a buffer for the positions and velocities of one specie.
+ */
+void pSortTiles(Population *pop, const Grid *grid);
+
 /**
  * @brief Creates datasets in .xy.h5-file for storing energy
  * @param	xy		.xy.h5-identifier
@@ -219,6 +331,10 @@ void pToGlobalFrame(Population *pop, const MpiInfo *mpiInfo);
  *	- /energy/potential/specie 1
  *	- /energy/potential/total
  *
+ * In addition, the kinetic energy and number of particles absorbed at the
+ * boundaries are stored per specie in /energy/absorbed/specie 0 and
+ * /flux/absorbed/specie 0, and so on.
+ *
  * pWriteEnergy() can be used to populate these datasets.
  */
 void pCreateEnergyDatasets(hid_t xy, Population *pop);
@@ -238,6 +354,9 @@ void pCreateEnergyDatasets(hid_t xy, Population *pop);
  * specie, or if that is unobtainable by the algorithm, the summed (total)
  * energy for all species. In the former case, the total energy can be obtained
  * simply by addition during post-processing.
+ *
+ * The absorbed energy and number of particles are those since the previous
+ * call, and are reset.
  */
 void pWriteEnergy(hid_t xy, Population *pop, double x);
 
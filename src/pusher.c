@@ -37,6 +37,9 @@
 static inline void puInterp3D1(	double *result, const double *pos,
 								const double *val, const long int *sizeProd);
 
+static inline void puInterp2D1(	double *result, const double *pos,
+								const double *val, const long int *sizeProd);
+
 static inline void puInterpND0(	double *result, const double *pos,
 								const double *val, const long int *sizeProd,
 								int nDims);
@@ -64,6 +67,59 @@ static void puDistrND1Inner(	double *val, long int p, const long int *mul,
  */
 static inline void addCross(const double *a, const double *b, double *res);
 
+/**
+ * @brief	Advances the delta-f weight of a particle by its acceleration
+ * @param[in,out]	weight	Weight of particle
+ * @param			vel		Velocity of particle before acceleration
+ * @param			dv		Increment of velocity
+ * @param			drift	Drift velocity of background
+ * @param			invVar	One over the squared thermal velocity of background
+ * @param			nDims	Number of dimensions
+ * @return	Mean of weight before and after (for the kinetic energy)
+ *
+ * Since the markers follow the orbits of the full distribution, 1-weight is
+ * proportional to the Maxwellian background along the orbit (see Population).
+ * Updating it by the ratio of the background at the new and old velocity is
+ * exact for the discrete orbit, and becomes dw/dt=(1-w)(v-u).a/vth^2 for small
+ * time steps.
+ */
+static inline double puWeight(	double *weight, const double *vel,
+								const double *dv, double drift, double invVar,
+								int nDims);
+
+/**
+ * @brief	Profile of the external fields at a particle
+ * @param	ext		External fields
+ * @param	pos		Position of particle in local frame
+ * @return	Factor f scaling the external fields (see External)
+ */
+static inline double puProfile(const External *ext, const double *pos);
+
+/**
+ * @brief	Adds the external E-field to the velocity increment of a particle
+ * @param[in,out]	dv		Increment of velocity
+ * @param			acc		Increment by unscaled EExt (External::acc of specie)
+ * @param			ext		External fields
+ * @param			pos		Position of particle in local frame
+ * @param			nVelDims	Number of velocity components
+ * @return	void
+ *
+ * EExt only has three components, which are added to the first three.
+ */
+static inline void puAddExternal(	double *dv, const double *acc,
+									const External *ext, const double *pos,
+									int nVelDims);
+
+/**
+ * @brief	Boris rotation parameters scaled by a factor
+ * @param			factor	Factor to scale t by
+ * @param			t		Rotation parameter t (3 elements)
+ * @param[out]		T		factor*t (3 elements)
+ * @param[out]		S		2*T/(1+T^2) (3 elements)
+ * @return	void
+ */
+static inline void puRotation(double factor, const double *t, double *T, double *S);
+
 /**
  * @brief	Sanity check of accelerator and distributor functions
  * @param	ini		Input file
@@ -78,6 +134,59 @@ static inline void addCross(const double *a, const double *b, double *res);
  */
 static void puSanity(dictionary *ini, const char* name, int dim, int order);
 
+/**
+ * @brief	Submits the particles of a specie to the scheduler of a population
+ * @param	pop		Population
+ * @param	s		Specie
+ * @return	void
+ *
+ * The tasks are the tiles if the particles are sorted, and otherwise equal
+ * parts of the specie.
+ */
+static void puSubmit(const Population *pop, int s);
+
+/**
+ * @brief Finds the edges of the global domain which this subdomain is part of
+ * @param		pop			Population
+ * @param		mpiInfo		MpiInfo
+ * @param[out]	type		Boundary at each edge (PBND_PERIODIC if not part)
+ * @param[out]	wall		Position of each edge in local frame
+ * @param[out]	lower		Lower threshold for migration
+ * @param[out]	upper		Upper threshold for migration
+ * @return		Number of edges with non-periodic boundaries
+ *
+ * All arrays have 2*nDims elements, except lower and upper which have nDims.
+ * The thresholds are at the edges where the boundaries are non-periodic, such
+ * that all particles beyond them are detected when extracting emigrants.
+ */
+static int puWalls(const Population *pop, const MpiInfo *mpiInfo,
+				   pBndType *type, double *wall, double *lower, double *upper);
+
+/**
+ * @brief Applies the non-periodic boundaries to a particle
+ * @return	1 if the particle is absorbed, otherwise 0
+ * @see		puWalls()
+ *
+ * 'weight' is the delta-f weight of the particle (1 without weights), by which
+ * it counts in Population::absorbed and Population::absorbedEnergy.
+ */
+static int puApplyWalls(Population *pop, int s, double *pos, double *vel,
+						double weight, const pBndType *type, const double *wall,
+						const MpiInfo *mpiInfo);
+
+/**
+ * @name Scheduling of charge assignment
+ * @brief	Submits the particles of specie s in tiles of color c
+ *
+ * Charge can only be assigned concurrently from tiles of the same color. If
+ * the particles are not sorted there is only one color, and all particles of
+ * the specie are submitted as one task.
+ */
+///@{
+static int puNColors(const Population *pop);
+static void puSubmitColor(const Population *pop, int s, int c);
+///@}
+
 /******************************************************************************
  * DEFINING GLOBAL FUNCTIONS
  *****************************************************************************/
@@ -86,18 +195,33 @@ void puMove(Population *pop){
 
 	int nSpecies = pop->nSpecies;
 	int nDims = pop->nDims;
+	int nVelDims = pop->nVelDims;
 	double *pos = pop->pos;
 	double *vel = pop->vel;
 
 	for(int s=0; s<nSpecies; s++){
 
-		long int pStart = pop->iStart[s]*nDims;
-		long int pStop = pop->iStop[s]*nDims;
-
-		for(long int p=pStart;p<pStop;p++){
-			pos[p] += vel[p];
+		puSubmit(pop,s);
+
+		#pragma omp parallel
+		{
+			long int iStart, iStop;
+			while(schNext(pop->sch,&iStart,&iStop)){
+				if(nVelDims==nDims){
+					for(long int p=iStart*nDims;p<iStop*nDims;p++){
+						pos[p] += vel[p];
+					}
+				} else {
+					// Skip velocity components normal to the grid (2D3V)
+					for(long int i=iStart;i<iStop;i++){
+						for(int d=0;d<nDims;d++) pos[i*nDims+d] += vel[i*nVelDims+d];
+					}
+				}
+			}
 		}
 	}
+
+	pop->sorted = 0;
 }
 
 void puPeriodic(Population *pop, Grid *grid){
@@ -132,6 +256,8 @@ void puAcc3D1(Population *pop, Grid *E){
 	int nDims = 3; // pop->nDims; // hard-coding allows compiler to replace by value
 	double *pos = pop->pos;
 	double *vel = pop->vel;
+	double *weight = pop->weight;
+	External *ext = pop->ext;
 
 	long int *sizeProd = E->sizeProd;
 	double *val = E->val;
@@ -140,13 +266,24 @@ void puAcc3D1(Population *pop, Grid *E){
 
 		gMul(E, pop->charge[s]/pop->mass[s]);
 
-		long int pStart = pop->iStart[s]*nDims;
-		long int pStop = pop->iStop[s]*nDims;
-
-		for(long int p=pStart;p<pStop;p+=nDims){
-			double dv[3];
-			puInterp3D1(dv,&pos[p],val,sizeProd);
-			for(int d=0;d<nDims;d++) vel[p+d] += dv[d];
+		double drift = weight ? pop->drift[s] : 0;
+		double invVar = weight ? 1.0/pow(pop->thermal[s],2) : 0;
+		const double *accExt = ext && ext->acc ? &ext->acc[3*s] : NULL;
+
+		puSubmit(pop,s);
+
+		#pragma omp parallel
+		{
+			long int iStart, iStop;
+			while(schNext(pop->sch,&iStart,&iStop)){
+				for(long int p=iStart*nDims;p<iStop*nDims;p+=nDims){
+					double dv[3];
+					puInterp3D1(dv,&pos[p],val,sizeProd);
+					if(accExt) puAddExternal(dv,accExt,ext,&pos[p],nDims);
+					if(weight) puWeight(&weight[p/nDims],&vel[p],dv,drift,invVar,nDims);
+					for(int d=0;d<nDims;d++) vel[p+d] += dv[d];
+				}
+			}
 		}
 
 		gMul(E, pop->mass[s]/pop->charge[s]);
@@ -163,6 +300,8 @@ void puAcc3D1KE(Population *pop, Grid *E){
 	int nDims = 3; // pop->nDims; // hard-coding allows compiler to replace by value
 	double *pos = pop->pos;
 	double *vel = pop->vel;
+	double *weight = pop->weight;
+	External *ext = pop->ext;
 	double *mass = pop->mass;
 	double *kinEnergy = pop->kinEnergy;
 
@@ -173,23 +312,34 @@ void puAcc3D1KE(Population *pop, Grid *E){
 
 		gMul(E, pop->charge[s]/pop->mass[s]);
 
-		long int pStart = pop->iStart[s]*nDims;
-		long int pStop = pop->iStop[s]*nDims;
-
-		kinEnergy[s]=0;
-
-		for(long int p=pStart;p<pStop;p+=nDims){
-			double dv[3];
-			puInterp3D1(dv,&pos[p],val,sizeProd);
-			double velSquared=0;
-			for(int d=0;d<nDims;d++){
-				velSquared += vel[p+d]*(vel[p+d]+dv[d]);
-				vel[p+d] += dv[d];
+		double drift = weight ? pop->drift[s] : 0;
+		double invVar = weight ? 1.0/pow(pop->thermal[s],2) : 0;
+		const double *accExt = ext && ext->acc ? &ext->acc[3*s] : NULL;
+
+		puSubmit(pop,s);
+
+		double energy=0;
+
+		#pragma omp parallel reduction(+:energy)
+		{
+			long int iStart, iStop;
+			while(schNext(pop->sch,&iStart,&iStop)){
+				for(long int p=iStart*nDims;p<iStop*nDims;p+=nDims){
+					double dv[3];
+					puInterp3D1(dv,&pos[p],val,sizeProd);
+					if(accExt) puAddExternal(dv,accExt,ext,&pos[p],nDims);
+					double w = weight ? puWeight(&weight[p/nDims],&vel[p],dv,drift,invVar,nDims) : 1;
+					double velSquared=0;
+					for(int d=0;d<nDims;d++){
+						velSquared += vel[p+d]*(vel[p+d]+dv[d]);
+						vel[p+d] += dv[d];
+					}
+					energy+=w*velSquared;
+				}
 			}
-			kinEnergy[s]+=velSquared;
 		}
 
-		kinEnergy[s]*=0.5*mass[s];
+		kinEnergy[s]=0.5*mass[s]*energy;
 
 		gMul(E, pop->mass[s]/pop->charge[s]);
 	}
@@ -202,48 +352,67 @@ void puAccND1KE(Population *pop, Grid *E){
 
 	int nSpecies = pop->nSpecies;
 	int nDims = pop->nDims;
+	int nVelDims = pop->nVelDims;
 	double *pos = pop->pos;
 	double *vel = pop->vel;
+	double *weight = pop->weight;
+	External *ext = pop->ext;
 	double *mass = pop->mass;
 	double *kinEnergy = pop->kinEnergy;
 
 	long int *sizeProd = E->sizeProd;
 	double *val = E->val;
 
-	double *dv = malloc(nDims*sizeof(*dv));
-	int *integer = malloc(nDims*sizeof(*integer));
-	double *decimal = malloc(nDims*sizeof(*decimal));
-	double *complement = malloc(nDims*sizeof(*complement));
-
 	for(int s=0;s<nSpecies;s++){
 
 		gMul(E, pop->charge[s]/pop->mass[s]);
 
-		long int pStart = pop->iStart[s]*nDims;
-		long int pStop = pop->iStop[s]*nDims;
-
-		kinEnergy[s]=0;
-
-		for(long int p=pStart;p<pStop;p+=nDims){
-
-			puInterpND1(dv,&pos[p],val,sizeProd,nDims,integer,decimal,complement);
-			double velSquared=0;
-			for(int d=0;d<nDims;d++){
-				velSquared += vel[p+d]*(vel[p+d]+dv[d]);
-				vel[p+d] += dv[d];
+		double drift = weight ? pop->drift[s] : 0;
+		double invVar = weight ? 1.0/pow(pop->thermal[s],2) : 0;
+		const double *accExt = ext && ext->acc ? &ext->acc[3*s] : NULL;
+
+		puSubmit(pop,s);
+
+		double energy=0;
+
+		// Each thread needs its own work arrays
+		#pragma omp parallel reduction(+:energy)
+		{
+			double *dv = malloc(nVelDims*sizeof(*dv));
+			int *integer = malloc(nDims*sizeof(*integer));
+			double *decimal = malloc(nDims*sizeof(*decimal));
+			double *complement = malloc(nDims*sizeof(*complement));
+
+			long int iStart, iStop;
+			while(schNext(pop->sch,&iStart,&iStop)){
+				for(long int i=iStart;i<iStop;i++){
+
+					long int p = i*nDims;
+					double *v = &vel[i*nVelDims];
+
+					puInterpND1(dv,&pos[p],val,sizeProd,nDims,integer,decimal,complement);
+					for(int d=nDims;d<nVelDims;d++) dv[d] = 0;
+					if(accExt) puAddExternal(dv,accExt,ext,&pos[p],nVelDims);
+					double w = weight ? puWeight(&weight[i],v,dv,drift,invVar,nVelDims) : 1;
+					double velSquared=0;
+					for(int d=0;d<nVelDims;d++){
+						velSquared += v[d]*(v[d]+dv[d]);
+						v[d] += dv[d];
+					}
+					energy+=w*velSquared;
+				}
 			}
-			kinEnergy[s]+=velSquared;
+
+			free(dv);
+			free(integer);
+			free(decimal);
+			free(complement);
 		}
 
-		kinEnergy[s]*=0.5*mass[s];
+		kinEnergy[s]=0.5*mass[s]*energy;
 
 		gMul(E, pop->mass[s]/pop->charge[s]);
 	}
-
-	free(dv);
-	free(integer);
-	free(decimal);
-	free(complement);
 }
 
 funPtr puAccND1_set(dictionary *ini){
@@ -254,39 +423,58 @@ void puAccND1(Population *pop, Grid *E){
 
 	int nSpecies = pop->nSpecies;
 	int nDims = pop->nDims;
+	int nVelDims = pop->nVelDims;
 	double *pos = pop->pos;
 	double *vel = pop->vel;
+	double *weight = pop->weight;
+	External *ext = pop->ext;
 
 	long int *sizeProd = E->sizeProd;
 	double *val = E->val;
 
-	double *dv = malloc(nDims*sizeof(*dv));
-	int *integer = malloc(nDims*sizeof(*integer));
-	double *decimal = malloc(nDims*sizeof(*decimal));
-	double *complement = malloc(nDims*sizeof(*complement));
-
 	for(int s=0;s<nSpecies;s++){
 
 		gMul(E, pop->charge[s]/pop->mass[s]);
 
-		long int pStart = pop->iStart[s]*nDims;
-		long int pStop = pop->iStop[s]*nDims;
-
-		for(long int p=pStart;p<pStop;p+=nDims){
-
-			puInterpND1(dv,&pos[p],val,sizeProd,nDims,integer,decimal,complement);
-			for(int d=0;d<nDims;d++){
-				vel[p+d] += dv[d];
+		double drift = weight ? pop->drift[s] : 0;
+		double invVar = weight ? 1.0/pow(pop->thermal[s],2) : 0;
+		const double *accExt = ext && ext->acc ? &ext->acc[3*s] : NULL;
+
+		puSubmit(pop,s);
+
+		// Each thread needs its own work arrays
+		#pragma omp parallel
+		{
+			double *dv = malloc(nVelDims*sizeof(*dv));
+			int *integer = malloc(nDims*sizeof(*integer));
+			double *decimal = malloc(nDims*sizeof(*decimal));
+			double *complement = malloc(nDims*sizeof(*complement));
+
+			long int iStart, iStop;
+			while(schNext(pop->sch,&iStart,&iStop)){
+				for(long int i=iStart;i<iStop;i++){
+
+					long int p = i*nDims;
+					double *v = &vel[i*nVelDims];
+
+					puInterpND1(dv,&pos[p],val,sizeProd,nDims,integer,decimal,complement);
+					for(int d=nDims;d<nVelDims;d++) dv[d] = 0;
+					if(accExt) puAddExternal(dv,accExt,ext,&pos[p],nVelDims);
+					if(weight) puWeight(&weight[i],v,dv,drift,invVar,nVelDims);
+					for(int d=0;d<nVelDims;d++){
+						v[d] += dv[d];
+					}
+				}
 			}
+
+			free(dv);
+			free(integer);
+			free(decimal);
+			free(complement);
 		}
 
 		gMul(E, pop->mass[s]/pop->charge[s]);
 	}
-
-	free(dv);
-	free(integer);
-	free(decimal);
-	free(complement);
 }
 
 funPtr puAccND0KE_set(dictionary *ini){
@@ -297,42 +485,60 @@ void puAccND0KE(Population *pop, Grid *E){
 
 	int nSpecies = pop->nSpecies;
 	int nDims = pop->nDims;
+	int nVelDims = pop->nVelDims;
 	double *pos = pop->pos;
 	double *vel = pop->vel;
+	double *weight = pop->weight;
+	External *ext = pop->ext;
 	double *mass = pop->mass;
 	double *kinEnergy = pop->kinEnergy;
 
 	long int *sizeProd = E->sizeProd;
 	double *val = E->val;
 
-	double *dv = malloc(nDims*sizeof(*dv));
-
 	for(int s=0;s<nSpecies;s++){
 
 		gMul(E, pop->charge[s]/pop->mass[s]);
 
-		long int pStart = pop->iStart[s]*nDims;
-		long int pStop = pop->iStop[s]*nDims;
+		double drift = weight ? pop->drift[s] : 0;
+		double invVar = weight ? 1.0/pow(pop->thermal[s],2) : 0;
+		const double *accExt = ext && ext->acc ? &ext->acc[3*s] : NULL;
 
-		kinEnergy[s]=0;
+		puSubmit(pop,s);
 
-		for(long int p=pStart;p<pStop;p+=nDims){
+		double energy=0;
+
+		#pragma omp parallel reduction(+:energy)
+		{
+			double *dv = malloc(nVelDims*sizeof(*dv));
+
+			long int iStart, iStop;
+			while(schNext(pop->sch,&iStart,&iStop)){
+				for(long int i=iStart;i<iStop;i++){
 
-			puInterpND0(dv,&pos[p],val,sizeProd,nDims);
-			double velSquared=0;
-			for(int d=0;d<nDims;d++){
-				velSquared += vel[p+d]*(vel[p+d]+dv[d]);
-				vel[p+d] += dv[d];
+					long int p = i*nDims;
+					double *v = &vel[i*nVelDims];
+
+					puInterpND0(dv,&pos[p],val,sizeProd,nDims);
+					for(int d=nDims;d<nVelDims;d++) dv[d] = 0;
+					if(accExt) puAddExternal(dv,accExt,ext,&pos[p],nVelDims);
+					double w = weight ? puWeight(&weight[i],v,dv,drift,invVar,nVelDims) : 1;
+					double velSquared=0;
+					for(int d=0;d<nVelDims;d++){
+						velSquared += v[d]*(v[d]+dv[d]);
+						v[d] += dv[d];
+					}
+					energy+=w*velSquared;
+				}
 			}
-			kinEnergy[s]+=velSquared;
+
+			free(dv);
 		}
 
-		kinEnergy[s]*=0.5*mass[s];
+		kinEnergy[s]=0.5*mass[s]*energy;
 
 		gMul(E, pop->mass[s]/pop->charge[s]);
 	}
-
-	free(dv);
 }
 
 funPtr puAccND0_set(dictionary *ini){
@@ -343,42 +549,67 @@ void puAccND0(Population *pop, Grid *E){
 
 	int nSpecies = pop->nSpecies;
 	int nDims = pop->nDims;
+	int nVelDims = pop->nVelDims;
 	double *pos = pop->pos;
 	double *vel = pop->vel;
+	double *weight = pop->weight;
+	External *ext = pop->ext;
 
 	long int *sizeProd = E->sizeProd;
 	double *val = E->val;
 
-	double *dv = malloc(nDims*sizeof(*dv));
-
 	for(int s=0;s<nSpecies;s++){
 
 		gMul(E, pop->charge[s]/pop->mass[s]);
 
-		long int pStart = pop->iStart[s]*nDims;
-		long int pStop = pop->iStop[s]*nDims;
+		double drift = weight ? pop->drift[s] : 0;
+		double invVar = weight ? 1.0/pow(pop->thermal[s],2) : 0;
+		const double *accExt = ext && ext->acc ? &ext->acc[3*s] : NULL;
 
-		for(long int p=pStart;p<pStop;p+=nDims){
+		puSubmit(pop,s);
 
-			puInterpND0(dv,&pos[p],val,sizeProd,nDims);
-			for(int d=0;d<nDims;d++){
-				vel[p+d] += dv[d];
+		#pragma omp parallel
+		{
+			double *dv = malloc(nVelDims*sizeof(*dv));
+
+			long int iStart, iStop;
+			while(schNext(pop->sch,&iStart,&iStop)){
+				for(long int i=iStart;i<iStop;i++){
+
+					long int p = i*nDims;
+					double *v = &vel[i*nVelDims];
+
+					puInterpND0(dv,&pos[p],val,sizeProd,nDims);
+					for(int d=nDims;d<nVelDims;d++) dv[d] = 0;
+					if(accExt) puAddExternal(dv,accExt,ext,&pos[p],nVelDims);
+					if(weight) puWeight(&weight[i],v,dv,drift,invVar,nVelDims);
+					for(int d=0;d<nVelDims;d++){
+						v[d] += dv[d];
+					}
+				}
 			}
+
+			free(dv);
 		}
 
 		gMul(E, pop->mass[s]/pop->charge[s]);
 	}
-
-	free(dv);
 }
 
 
-void puBoris3D1(Population *pop, Grid *E, const double *T, const double *S){
+funPtr puAcc2D1_set(dictionary *ini){
+	puSanity(ini,"puAcc2D1",2,1);
+	return puAcc2D1;
+}
+void puAcc2D1(Population *pop, Grid *E){
 
 	int nSpecies = pop->nSpecies;
-	int nDims = 3; // pop->nDims; // hard-coding allows compiler to replace by value
+	int nDims = 2; // pop->nDims; // hard-coding allows compiler to replace by value
+	int nVelDims = pop->nVelDims;
 	double *pos = pop->pos;
 	double *vel = pop->vel;
+	double *weight = pop->weight;
+	External *ext = pop->ext;
 
 	long int *sizeProd = E->sizeProd;
 	double *val = E->val;
@@ -387,40 +618,181 @@ void puBoris3D1(Population *pop, Grid *E, const double *T, const double *S){
 
 		gMul(E, pop->charge[s]/pop->mass[s]);
 
-		long int pStart = pop->iStart[s]*nDims;
-		long int pStop = pop->iStop[s]*nDims;
+		double drift = weight ? pop->drift[s] : 0;
+		double invVar = weight ? 1.0/pow(pop->thermal[s],2) : 0;
+		const double *accExt = ext && ext->acc ? &ext->acc[3*s] : NULL;
+
+		puSubmit(pop,s);
+
+		#pragma omp parallel
+		{
+			long int iStart, iStop;
+			while(schNext(pop->sch,&iStart,&iStop)){
+				for(long int i=iStart;i<iStop;i++){
+					double dv[3] = {0,0,0};
+					double *v = &vel[i*nVelDims];
+					puInterp2D1(dv,&pos[i*nDims],val,sizeProd);
+					if(accExt) puAddExternal(dv,accExt,ext,&pos[i*nDims],nVelDims);
+					if(weight) puWeight(&weight[i],v,dv,drift,invVar,nVelDims);
+					for(int d=0;d<nVelDims;d++) v[d] += dv[d];
+				}
+			}
+		}
 
-		for(long int p=pStart;p<pStop;p+=nDims){
-			double dv[3], vPrime[3];
-			puInterp3D1(dv,&pos[p],val,sizeProd);
+		gMul(E, pop->mass[s]/pop->charge[s]);
+	}
+}
+
+funPtr puAcc2D1KE_set(dictionary *ini){
+	puSanity(ini,"puAcc2D1KE",2,1);
+	return puAcc2D1KE;
+}
+void puAcc2D1KE(Population *pop, Grid *E){
+
+	int nSpecies = pop->nSpecies;
+	int nDims = 2; // pop->nDims; // hard-coding allows compiler to replace by value
+	int nVelDims = pop->nVelDims;
+	double *pos = pop->pos;
+	double *vel = pop->vel;
+	double *weight = pop->weight;
+	External *ext = pop->ext;
+	double *mass = pop->mass;
+	double *kinEnergy = pop->kinEnergy;
 
-			// Add half the acceleration (becomes v minus in B&L notation)
-			for(int d=0;d<nDims;d++) vel[p+d] += 0.5*dv[d];
+	long int *sizeProd = E->sizeProd;
+	double *val = E->val;
 
-			// Rotate
-			memcpy(vPrime,vel,3*sizeof(*vPrime));
-			addCross(vel,&T[3*s],vPrime); // vPrime is now v prime
-			addCross(vPrime,&S[3*s],vel); // vel is now v plus (B&L)
+	for(int s=0;s<nSpecies;s++){
 
-			// Compute energy here in KE-version
+		gMul(E, pop->charge[s]/pop->mass[s]);
 
-			// Add half the acceleration
-			for(int d=0;d<nDims;d++) vel[p+d] += 0.5*dv[d];
+		double drift = weight ? pop->drift[s] : 0;
+		double invVar = weight ? 1.0/pow(pop->thermal[s],2) : 0;
+		const double *accExt = ext && ext->acc ? &ext->acc[3*s] : NULL;
+
+		puSubmit(pop,s);
+
+		double energy=0;
+
+		#pragma omp parallel reduction(+:energy)
+		{
+			long int iStart, iStop;
+			while(schNext(pop->sch,&iStart,&iStop)){
+				for(long int i=iStart;i<iStop;i++){
+					double dv[3] = {0,0,0};
+					double *v = &vel[i*nVelDims];
+					puInterp2D1(dv,&pos[i*nDims],val,sizeProd);
+					if(accExt) puAddExternal(dv,accExt,ext,&pos[i*nDims],nVelDims);
+					double w = weight ? puWeight(&weight[i],v,dv,drift,invVar,nVelDims) : 1;
+					double velSquared=0;
+					for(int d=0;d<nVelDims;d++){
+						velSquared += v[d]*(v[d]+dv[d]);
+						v[d] += dv[d];
+					}
+					energy+=w*velSquared;
+				}
+			}
 		}
 
+		kinEnergy[s]=0.5*mass[s]*energy;
+
 		gMul(E, pop->mass[s]/pop->charge[s]);
 	}
 }
 
-void puBoris3D1KE(Population *pop, Grid *E, const double *T, const double *S){
+funPtr puBoris3D1_set(dictionary *ini){
+	puSanity(ini,"puBoris3D1",3,1);
+	return puBoris3D1;
+}
+void puBoris3D1(Population *pop, Grid *E){
 
 	int nSpecies = pop->nSpecies;
 	int nDims = 3; // pop->nDims; // hard-coding allows compiler to replace by value
 	double *pos = pop->pos;
 	double *vel = pop->vel;
+	double *weight = pop->weight;
+	External *ext = pop->ext;
 
-	double *kinEnergy = pop->kinEnergy;
+	if(!ext) msg(ERROR,"puBoris3D1 requires external fields (see puAllocExternal())");
+	int varying = ext->profile!=EXT_CONSTANT;
+
+	long int *sizeProd = E->sizeProd;
+	double *val = E->val;
+
+	for(int s=0;s<nSpecies;s++){
+
+		gMul(E, pop->charge[s]/pop->mass[s]);
+
+		double drift = weight ? pop->drift[s] : 0;
+		double invVar = weight ? 1.0/pow(pop->thermal[s],2) : 0;
+		const double *accExt = ext->acc ? &ext->acc[3*s] : NULL;
+		const double *T = &ext->T[3*s];
+		const double *S = &ext->S[3*s];
+
+		puSubmit(pop,s);
+
+		#pragma omp parallel
+		{
+			long int iStart, iStop;
+			while(schNext(pop->sch,&iStart,&iStop)){
+				for(long int p=iStart*nDims;p<iStop*nDims;p+=nDims){
+					double dv[3], vPrime[3], vOld[3], TLocal[3], SLocal[3];
+					double *v = &vel[p];
+					puInterp3D1(dv,&pos[p],val,sizeProd);
+
+					// External fields at the particle (see External)
+					double f = varying ? puProfile(ext,&pos[p]) : 1;
+					if(accExt) for(int d=0;d<3;d++) dv[d] += f*accExt[d];
+					const double *TP = T, *SP = S;
+					if(varying){
+						puRotation(f,T,TLocal,SLocal);
+						TP = TLocal;
+						SP = SLocal;
+					}
+
+					memcpy(vOld,v,3*sizeof(*vOld));
+
+					// Add half the acceleration (becomes v minus in B&L notation)
+					for(int d=0;d<3;d++) v[d] += 0.5*dv[d];
+
+					// Rotate
+					memcpy(vPrime,v,3*sizeof(*vPrime));
+					addCross(v,TP,vPrime); // vPrime is now v prime
+					addCross(vPrime,SP,v); // v is now v plus (B&L)
+
+					// Add half the acceleration
+					for(int d=0;d<3;d++) v[d] += 0.5*dv[d];
+
+					// Weight by the total velocity change, including the rotation
+					if(weight){
+						for(int d=0;d<3;d++) dv[d] = v[d]-vOld[d];
+						puWeight(&weight[p/nDims],vOld,dv,drift,invVar,3);
+					}
+				}
+			}
+		}
+
+		gMul(E, pop->mass[s]/pop->charge[s]);
+	}
+}
+
+funPtr puBoris3D1KE_set(dictionary *ini){
+	puSanity(ini,"puBoris3D1KE",3,1);
+	return puBoris3D1KE;
+}
+void puBoris3D1KE(Population *pop, Grid *E){
+
+	int nSpecies = pop->nSpecies;
+	int nDims = 3; // pop->nDims; // hard-coding allows compiler to replace by value
+	double *pos = pop->pos;
+	double *vel = pop->vel;
 	double *mass = pop->mass;
+	double *kinEnergy = pop->kinEnergy;
+	double *weight = pop->weight;
+	External *ext = pop->ext;
+
+	if(!ext) msg(ERROR,"puBoris3D1KE requires external fields (see puAllocExternal())");
+	int varying = ext->profile!=EXT_CONSTANT;
 
 	long int *sizeProd = E->sizeProd;
 	double *val = E->val;
@@ -429,60 +801,317 @@ void puBoris3D1KE(Population *pop, Grid *E, const double *T, const double *S){
 
 		gMul(E, pop->charge[s]/pop->mass[s]);
 
-		long int pStart = pop->iStart[s]*nDims;
-		long int pStop = pop->iStop[s]*nDims;
+		double drift = weight ? pop->drift[s] : 0;
+		double invVar = weight ? 1.0/pow(pop->thermal[s],2) : 0;
+		const double *accExt = ext->acc ? &ext->acc[3*s] : NULL;
+		const double *T = &ext->T[3*s];
+		const double *S = &ext->S[3*s];
+
+		puSubmit(pop,s);
+
+		double energy=0;
+
+		#pragma omp parallel reduction(+:energy)
+		{
+			long int iStart, iStop;
+			while(schNext(pop->sch,&iStart,&iStop)){
+				for(long int p=iStart*nDims;p<iStop*nDims;p+=nDims){
+					double dv[3], vPrime[3], vOld[3], TLocal[3], SLocal[3];
+					double *v = &vel[p];
+					puInterp3D1(dv,&pos[p],val,sizeProd);
+
+					// External fields at the particle (see External)
+					double f = varying ? puProfile(ext,&pos[p]) : 1;
+					if(accExt) for(int d=0;d<3;d++) dv[d] += f*accExt[d];
+					const double *TP = T, *SP = S;
+					if(varying){
+						puRotation(f,T,TLocal,SLocal);
+						TP = TLocal;
+						SP = SLocal;
+					}
+
+					memcpy(vOld,v,3*sizeof(*vOld));
+
+					// Add half the acceleration (becomes v minus in B&L notation)
+					for(int d=0;d<3;d++) v[d] += 0.5*dv[d];
+
+					// Rotate
+					memcpy(vPrime,v,3*sizeof(*vPrime));
+					addCross(v,TP,vPrime); // vPrime is now v prime
+					addCross(vPrime,SP,v); // v is now v plus (B&L)
+
+					// Compute energy
+					double velSquared = 0;
+					for(int d=0;d<3;d++) velSquared += v[d]*v[d];
+
+					// Add half the acceleration
+					for(int d=0;d<3;d++) v[d] += 0.5*dv[d];
+
+					// Weight by the total velocity change, including the rotation
+					double w = 1;
+					if(weight){
+						for(int d=0;d<3;d++) dv[d] = v[d]-vOld[d];
+						w = puWeight(&weight[p/nDims],vOld,dv,drift,invVar,3);
+					}
+					energy += w*velSquared;
+				}
+			}
+		}
 
-		kinEnergy[s]=0;
+		kinEnergy[s]=0.5*mass[s]*energy;
 
-		for(long int p=pStart;p<pStop;p+=nDims){
-			double dv[3], vPrime[3];
-			puInterp3D1(dv,&pos[p],val,sizeProd);
+		gMul(E, pop->mass[s]/pop->charge[s]);
+	}
+}
+
+funPtr puBoris2D1_set(dictionary *ini){
+	puSanity(ini,"puBoris2D1",2,1);
+	if(iniGetInt(ini,"population:nVelDims")!=3)
+		msg(ERROR,"puBoris2D1 requires population:nVelDims=3");
+	return puBoris2D1;
+}
+void puBoris2D1(Population *pop, Grid *E){
 
-			// Add half the acceleration (becomes v minus in B&L notation)
-			for(int d=0;d<nDims;d++) vel[p+d] += 0.5*dv[d];
+	int nSpecies = pop->nSpecies;
+	int nDims = 2; // pop->nDims; // hard-coding allows compiler to replace by value
+	double *pos = pop->pos;
+	double *vel = pop->vel;
+	double *weight = pop->weight;
+	External *ext = pop->ext;
 
-			// Rotate
-			memcpy(vPrime,vel,3*sizeof(*vPrime));
-			addCross(vel,&T[3*s],vPrime); // vPrime is now v prime
-			addCross(vPrime,&S[3*s],vel); // vel is now v plus (B&L)
+	if(!ext) msg(ERROR,"puBoris2D1 requires external fields (see puAllocExternal())");
+	int varying = ext->profile!=EXT_CONSTANT;
 
-			// Compute energy
-			double velSquared = 0;
-			for(int d=0;d<nDims;d++){
-				velSquared += pow(vel[p+d],2);
+	long int *sizeProd = E->sizeProd;
+	double *val = E->val;
+
+	for(int s=0;s<nSpecies;s++){
+
+		gMul(E, pop->charge[s]/pop->mass[s]);
+
+		double drift = weight ? pop->drift[s] : 0;
+		double invVar = weight ? 1.0/pow(pop->thermal[s],2) : 0;
+		const double *accExt = ext->acc ? &ext->acc[3*s] : NULL;
+		const double *T = &ext->T[3*s];
+		const double *S = &ext->S[3*s];
+
+		puSubmit(pop,s);
+
+		#pragma omp parallel
+		{
+			long int iStart, iStop;
+			while(schNext(pop->sch,&iStart,&iStop)){
+				for(long int i=iStart;i<iStop;i++){
+					double dv[3] = {0,0,0}, vPrime[3], vOld[3], TLocal[3], SLocal[3];
+					double *v = &vel[3*i];
+					puInterp2D1(dv,&pos[i*nDims],val,sizeProd);
+
+					// External fields at the particle (see External)
+					double f = varying ? puProfile(ext,&pos[i*nDims]) : 1;
+					if(accExt) for(int d=0;d<3;d++) dv[d] += f*accExt[d];
+					const double *TP = T, *SP = S;
+					if(varying){
+						puRotation(f,T,TLocal,SLocal);
+						TP = TLocal;
+						SP = SLocal;
+					}
+
+					memcpy(vOld,v,3*sizeof(*vOld));
+
+					// Add half the acceleration (becomes v minus in B&L notation)
+					for(int d=0;d<3;d++) v[d] += 0.5*dv[d];
+
+					// Rotate all three components, also the out-of-plane one
+					memcpy(vPrime,v,3*sizeof(*vPrime));
+					addCross(v,TP,vPrime); // vPrime is now v prime
+					addCross(vPrime,SP,v); // v is now v plus (B&L)
+
+					// Add half the acceleration
+					for(int d=0;d<3;d++) v[d] += 0.5*dv[d];
+
+					// Weight by the total velocity change, including the rotation
+					if(weight){
+						for(int d=0;d<3;d++) dv[d] = v[d]-vOld[d];
+						puWeight(&weight[i],vOld,dv,drift,invVar,3);
+					}
+				}
 			}
-			kinEnergy[s]+=velSquared;
+		}
+
+		gMul(E, pop->mass[s]/pop->charge[s]);
+	}
+}
 
-			// Add half the acceleration
-			for(int d=0;d<nDims;d++) vel[p+d] += 0.5*dv[d];
+funPtr puBoris2D1KE_set(dictionary *ini){
+	puSanity(ini,"puBoris2D1KE",2,1);
+	if(iniGetInt(ini,"population:nVelDims")!=3)
+		msg(ERROR,"puBoris2D1KE requires population:nVelDims=3");
+	return puBoris2D1KE;
+}
+void puBoris2D1KE(Population *pop, Grid *E){
+
+	int nSpecies = pop->nSpecies;
+	int nDims = 2; // pop->nDims; // hard-coding allows compiler to replace by value
+	double *pos = pop->pos;
+	double *vel = pop->vel;
+	double *mass = pop->mass;
+	double *kinEnergy = pop->kinEnergy;
+	double *weight = pop->weight;
+	External *ext = pop->ext;
+
+	if(!ext) msg(ERROR,"puBoris2D1KE requires external fields (see puAllocExternal())");
+	int varying = ext->profile!=EXT_CONSTANT;
+
+	long int *sizeProd = E->sizeProd;
+	double *val = E->val;
+
+	for(int s=0;s<nSpecies;s++){
+
+		gMul(E, pop->charge[s]/pop->mass[s]);
+
+		double drift = weight ? pop->drift[s] : 0;
+		double invVar = weight ? 1.0/pow(pop->thermal[s],2) : 0;
+		const double *accExt = ext->acc ? &ext->acc[3*s] : NULL;
+		const double *T = &ext->T[3*s];
+		const double *S = &ext->S[3*s];
+
+		puSubmit(pop,s);
+
+		double energy=0;
+
+		#pragma omp parallel reduction(+:energy)
+		{
+			long int iStart, iStop;
+			while(schNext(pop->sch,&iStart,&iStop)){
+				for(long int i=iStart;i<iStop;i++){
+					double dv[3] = {0,0,0}, vPrime[3], vOld[3], TLocal[3], SLocal[3];
+					double *v = &vel[3*i];
+					puInterp2D1(dv,&pos[i*nDims],val,sizeProd);
+
+					// External fields at the particle (see External)
+					double f = varying ? puProfile(ext,&pos[i*nDims]) : 1;
+					if(accExt) for(int d=0;d<3;d++) dv[d] += f*accExt[d];
+					const double *TP = T, *SP = S;
+					if(varying){
+						puRotation(f,T,TLocal,SLocal);
+						TP = TLocal;
+						SP = SLocal;
+					}
+
+					memcpy(vOld,v,3*sizeof(*vOld));
+
+					// Add half the acceleration (becomes v minus in B&L notation)
+					for(int d=0;d<3;d++) v[d] += 0.5*dv[d];
+
+					// Rotate all three components, also the out-of-plane one
+					memcpy(vPrime,v,3*sizeof(*vPrime));
+					addCross(v,TP,vPrime); // vPrime is now v prime
+					addCross(vPrime,SP,v); // v is now v plus (B&L)
+
+					// Compute energy
+					double velSquared = 0;
+					for(int d=0;d<3;d++) velSquared += v[d]*v[d];
+
+					// Add half the acceleration
+					for(int d=0;d<3;d++) v[d] += 0.5*dv[d];
+
+					// Weight by the total velocity change, including the rotation
+					double w = 1;
+					if(weight){
+						for(int d=0;d<3;d++) dv[d] = v[d]-vOld[d];
+						w = puWeight(&weight[i],vOld,dv,drift,invVar,3);
+					}
+					energy += w*velSquared;
+				}
+			}
 		}
 
-		kinEnergy[s]*=0.5*mass[s];
+		kinEnergy[s]=0.5*mass[s]*energy;
 
 		gMul(E, pop->mass[s]/pop->charge[s]);
 	}
-
 }
 
 void puGet3DRotationParameters(dictionary *ini, double *T, double *S){
 
-	int nDims = iniGetInt(ini,"grid:nDims");
-	int nSpecies = iniGetInt(ini,"grid:nSpecies");
-	double *BExt = iniGetDoubleArr(ini,"fields:BExt",nDims);
+	int nSpecies = iniGetInt(ini,"population:nSpecies");
+	double *BExt = iniGetDoubleArr(ini,"fields:BExt",3);
 	double *charge = iniGetDoubleArr(ini,"population:charge",nSpecies);
 	double *mass = iniGetDoubleArr(ini,"population:mass",nSpecies);
 
 	for(int s=0;s<nSpecies;s++){
-		double factor = 0.5*charge[s]/mass[s];
-		double denom = 1;
-		for(int p=0;p<3;p++){
-			T[3*s+p] = factor*BExt[p];
-			denom += pow(T[3*s+p],2);
-		}
-		double mul = 2.0/denom;
-		for(int p=0;p<3;p++){
-			S[3*s+p] = mul*T[3*s+p];
-		}
+		puRotation(0.5*charge[s]/mass[s],BExt,&T[3*s],&S[3*s]);
+	}
+
+	free(BExt);
+	free(charge);
+	free(mass);
+}
+
+External *puAllocExternal(const dictionary *ini, const MpiInfo *mpiInfo){
+
+	int nSpecies = iniGetInt(ini,"population:nSpecies");
+	int nDims = iniGetInt(ini,"grid:nDims");
+
+	External *ext = malloc(sizeof(*ext));
+	ext->nSpecies = nSpecies;
+	ext->nDims = nDims;
+
+	char *profile = iniGetStr(ini,"fields:extProfile");
+	if(		!strcmp(profile,"CONSTANT"))	ext->profile = EXT_CONSTANT;
+	else if(!strcmp(profile,"LINEAR"))		ext->profile = EXT_LINEAR;
+	else if(!strcmp(profile,"COSINE"))		ext->profile = EXT_COSINE;
+	else msg(ERROR,"%s invalid value for fields:extProfile",profile);
+	free(profile);
+
+	ext->k = iniGetDoubleArr(ini,"fields:extWaveVector",nDims);
+	ext->offset = mpiInfo->offset;
+	ext->EExt = iniGetDoubleArr(ini,"fields:EExt",3);
+	ext->BExt = iniGetDoubleArr(ini,"fields:BExt",3);
+
+	double *charge = iniGetDoubleArr(ini,"population:charge",nSpecies);
+	double *mass = iniGetDoubleArr(ini,"population:mass",nSpecies);
+	ext->chargeOverMass = malloc(nSpecies*sizeof(*ext->chargeOverMass));
+	for(int s=0;s<nSpecies;s++) ext->chargeOverMass[s] = charge[s]/mass[s];
+	free(charge);
+	free(mass);
+
+	// Accelerators skip EExt altogether if it is zero
+	int electric = 0;
+	for(int p=0;p<3;p++) if(ext->EExt[p]!=0) electric = 1;
+
+	ext->acc = electric ? malloc(3*nSpecies*sizeof(*ext->acc)) : NULL;
+	ext->T = malloc(3*nSpecies*sizeof(*ext->T));
+	ext->S = malloc(3*nSpecies*sizeof(*ext->S));
+	puExternalStep(ext,1);
+
+	return ext;
+}
+
+void puFreeExternal(External *ext){
+
+	if(!ext) return;
+
+	free(ext->k);
+	free(ext->EExt);
+	free(ext->BExt);
+	free(ext->chargeOverMass);
+	free(ext->acc);
+	free(ext->T);
+	free(ext->S);
+	free(ext);
+}
+
+void puExternalStep(External *ext, double dtFactor){
+
+	if(!ext) return;
+
+	ext->dtFactor = dtFactor;
+	for(int s=0;s<ext->nSpecies;s++){
+		double factor = dtFactor*ext->chargeOverMass[s];
+		if(ext->acc)
+			for(int p=0;p<3;p++) ext->acc[3*s+p] = factor*ext->EExt[p];
+		puRotation(0.5*factor,ext->BExt,&ext->T[3*s],&ext->S[3*s]);
 	}
 }
 
@@ -498,53 +1127,137 @@ void puDistr3D1(const Population *pop, Grid *rho){
 	long int *sizeProd = rho->sizeProd;
 
 	int nSpecies = pop->nSpecies;
+	const double *weight = pop->weight;
+
+	for(int s=0;s<nSpecies;s++){
+
+		gMul(rho, 1.0/pop->charge[s]);
+
+		// Tiles of the same color never weigh to the same node
+		for(int c=0;c<puNColors(pop);c++){
+
+			puSubmitColor(pop,s,c);
+
+			#pragma omp parallel
+			{
+				long int iStart, iStop;
+				while(schNext(pop->sch,&iStart,&iStop)){
+					for(long int i=iStart;i<iStop;i++){
+
+						double *pos = &pop->pos[3*i];
+
+						// Integer parts of position
+						int j = (int) pos[0];
+						int k = (int) pos[1];
+						int l = (int) pos[2];
+
+						// Decimal (cell-referenced) parts of position and their complement
+						double x = pos[0]-j;
+						double y = pos[1]-k;
+						double z = pos[2]-l;
+						double xcomp = 1-x;
+						double ycomp = 1-y;
+						double zcomp = 1-z;
+
+						// Delta-f weight (see Population)
+						if(weight){
+							x *= weight[i];
+							xcomp *= weight[i];
+						}
+
+						// Index of neighbouring nodes
+						long int p 		= j + k*sizeProd[2] + l*sizeProd[3];
+						long int pj 	= p + 1; //sizeProd[1];
+						long int pk 	= p + sizeProd[2];
+						long int pjk 	= pk + 1; //sizeProd[1];
+						long int pl 	= p + sizeProd[3];
+						long int pjl 	= pl + 1; //sizeProd[1];
+						long int pkl 	= pl + sizeProd[2];
+						long int pjkl 	= pkl + 1; //sizeProd[1];
+
+						// if(pjkl>=sizeProd[4])
+						// 	msg(STATUS,"Particle %i at (%f,%f,%f) out-of-bounds, tried to access node %li",i,pos[0],pos[1],pos[2],pjkl);
+
+						val[p] 		+= xcomp*ycomp*zcomp;
+						val[pj]		+= x    *ycomp*zcomp;
+						val[pk]		+= xcomp*y    *zcomp;
+						val[pjk]	+= x    *y    *zcomp;
+						val[pl]     += xcomp*ycomp*z    ;
+						val[pjl]	+= x    *ycomp*z    ;
+						val[pkl]	+= xcomp*y    *z    ;
+						val[pjkl]	+= x    *y    *z    ;
+
+					}
+				}
+			}
+		}
+
+		gMul(rho, pop->charge[s]);
+
+	}
+
+}
+
+funPtr puDistr2D1_set(dictionary *ini){
+	puSanity(ini,"puDistr2D1",2,1);
+	return puDistr2D1;
+}
+void puDistr2D1(const Population *pop, Grid *rho){
+
+	gZero(rho);
+	double *val = rho->val;
+	long int *sizeProd = rho->sizeProd;
+
+	int nSpecies = pop->nSpecies;
+	const double *weight = pop->weight;
 
 	for(int s=0;s<nSpecies;s++){
 
 		gMul(rho, 1.0/pop->charge[s]);
 
-		long int iStart = pop->iStart[s];
-		long int iStop = pop->iStop[s];
-
-		for(int i=iStart;i<iStop;i++){
-
-			double *pos = &pop->pos[3*i];
-
-			// Integer parts of position
-			int j = (int) pos[0];
-			int k = (int) pos[1];
-			int l = (int) pos[2];
-
-			// Decimal (cell-referenced) parts of position and their complement
-			double x = pos[0]-j;
-			double y = pos[1]-k;
-			double z = pos[2]-l;
-			double xcomp = 1-x;
-			double ycomp = 1-y;
-			double zcomp = 1-z;
-
-			// Index of neighbouring nodes
-			long int p 		= j + k*sizeProd[2] + l*sizeProd[3];
-			long int pj 	= p + 1; //sizeProd[1];
-			long int pk 	= p + sizeProd[2];
-			long int pjk 	= pk + 1; //sizeProd[1];
-			long int pl 	= p + sizeProd[3];
-			long int pjl 	= pl + 1; //sizeProd[1];
-			long int pkl 	= pl + sizeProd[2];
-			long int pjkl 	= pkl + 1; //sizeProd[1];
-
-			// if(pjkl>=sizeProd[4])
-			// 	msg(STATUS,"Particle %i at (%f,%f,%f) out-of-bounds, tried to access node %li",i,pos[0],pos[1],pos[2],pjkl);
-
-			val[p] 		+= xcomp*ycomp*zcomp;
-			val[pj]		+= x    *ycomp*zcomp;
-			val[pk]		+= xcomp*y    *zcomp;
-			val[pjk]	+= x    *y    *zcomp;
-			val[pl]     += xcomp*ycomp*z    ;
-			val[pjl]	+= x    *ycomp*z    ;
-			val[pkl]	+= xcomp*y    *z    ;
-			val[pjkl]	+= x    *y    *z    ;
+		// Tiles of the same color never weigh to the same node
+		for(int c=0;c<puNColors(pop);c++){
+
+			puSubmitColor(pop,s,c);
+
+			#pragma omp parallel
+			{
+				long int iStart, iStop;
+				while(schNext(pop->sch,&iStart,&iStop)){
+					for(long int i=iStart;i<iStop;i++){
+
+						double *pos = &pop->pos[2*i];
+
+						// Integer parts of position
+						int j = (int) pos[0];
+						int k = (int) pos[1];
+
+						// Decimal (cell-referenced) parts of position and their complement
+						double x = pos[0]-j;
+						double y = pos[1]-k;
+						double xcomp = 1-x;
+						double ycomp = 1-y;
+
+						// Delta-f weight (see Population)
+						if(weight){
+							x *= weight[i];
+							xcomp *= weight[i];
+						}
+
+						// Index of neighbouring nodes
+						long int p 		= j + k*sizeProd[2];
+						long int pj 	= p + 1; //sizeProd[1];
+						long int pk 	= p + sizeProd[2];
+						long int pjk 	= pk + 1; //sizeProd[1];
+
+						val[p] 		+= xcomp*ycomp;
+						val[pj]		+= x    *ycomp;
+						val[pk]		+= xcomp*y    ;
+						val[pjk]	+= x    *y    ;
 
+					}
+				}
+			}
 		}
 
 		gMul(rho, pop->charge[s]);
@@ -566,43 +1279,53 @@ void puDistrND1(const Population *pop, Grid *rho){
 	long int *sizeProd = rho->sizeProd;
 
 	int nSpecies = pop->nSpecies;
-
-	int *integer = malloc(nDims*sizeof(*integer));
-	double *decimal = malloc(nDims*sizeof(*decimal));
-	double *complement = malloc(nDims*sizeof(*complement));
+	const double *weight = pop->weight;
 
 	for(int s=0;s<nSpecies;s++){
 
 		gMul(rho, 1.0/pop->charge[s]);
 
-		long int iStart = pop->iStart[s];
-		long int iStop = pop->iStop[s];
+		// Tiles of the same color never weigh to the same node
+		for(int c=0;c<puNColors(pop);c++){
 
-		for(int i=iStart;i<iStop;i++){
+			puSubmitColor(pop,s,c);
 
-			double *pos = &pop->pos[nDims*i];
+			#pragma omp parallel
+			{
+				int *integer = malloc(nDims*sizeof(*integer));
+				double *decimal = malloc(nDims*sizeof(*decimal));
+				double *complement = malloc(nDims*sizeof(*complement));
 
-			long int p = 0;
+				long int iStart, iStop;
+				while(schNext(pop->sch,&iStart,&iStop)){
+					for(long int i=iStart;i<iStop;i++){
 
-			for(int d=0;d<nDims;d++){
-				integer[d] = (int) pos[d];
-				decimal[d] = pos[d] - integer[d];
-				complement[d] = 1 - decimal[d];
+						double *pos = &pop->pos[nDims*i];
 
-				p += integer[d]*sizeProd[d+1];
-			}
+						long int p = 0;
+
+						for(int d=0;d<nDims;d++){
+							integer[d] = (int) pos[d];
+							decimal[d] = pos[d] - integer[d];
+							complement[d] = 1 - decimal[d];
 
-			puDistrND1Inner(val,p,&sizeProd[nDims],sizeProd[1],&decimal[nDims-1],&complement[nDims-1],1);
+							p += integer[d]*sizeProd[d+1];
+						}
 
+						puDistrND1Inner(val,p,&sizeProd[nDims],sizeProd[1],&decimal[nDims-1],&complement[nDims-1],weight ? weight[i] : 1);
+
+					}
+				}
+
+				free(integer);
+				free(decimal);
+				free(complement);
+			}
 		}
 
 		gMul(rho, pop->charge[s]);
 
 	}
-
-	free(integer);
-	free(decimal);
-	free(complement);
 }
 
 static void puDistrND1Inner(	double *val, long int p, const long int *mul,
@@ -632,26 +1355,36 @@ void puDistrND0(const Population *pop, Grid *rho){
 	long int *sizeProd = rho->sizeProd;
 
 	int nSpecies = pop->nSpecies;
+	const double *weight = pop->weight;
 
 	for(int s=0;s<nSpecies;s++){
 
 		gMul(rho, 1.0/pop->charge[s]);
 
-		long int iStart = pop->iStart[s];
-		long int iStop = pop->iStop[s];
+		// Tiles of the same color never weigh to the same node
+		for(int c=0;c<puNColors(pop);c++){
 
-		for(int i=iStart;i<iStop;i++){
+			puSubmitColor(pop,s,c);
 
-			double *pos = &pop->pos[nDims*i];
+			#pragma omp parallel
+			{
+				long int iStart, iStop;
+				while(schNext(pop->sch,&iStart,&iStop)){
+					for(long int i=iStart;i<iStop;i++){
 
-			long int p = 0;
+						double *pos = &pop->pos[nDims*i];
 
-			for(int d=0;d<nDims;d++){
-				int integer = (int)(pos[d]+0.5);
-				p += integer*sizeProd[d+1];
-			}
-			val[p]++;
+						long int p = 0;
 
+						for(int d=0;d<nDims;d++){
+							int integer = (int)(pos[d]+0.5);
+							p += integer*sizeProd[d+1];
+						}
+						val[p] += weight ? weight[i] : 1;
+
+					}
+				}
+			}
 		}
 
 		gMul(rho, pop->charge[s]);
@@ -766,7 +1499,7 @@ void puExtractEmigrants3D(Population *pop, MpiInfo *mpiInfo){
 	int nSpecies = pop->nSpecies;
 	double *pos = pop->pos;
 	double *vel = pop->vel;
-	double *thresholds = mpiInfo->thresholds;
+	double *weight = pop->weight;
 	const int neighborhoodCenter = 13;
 	long int *nEmigrants = mpiInfo->nEmigrants;
 	int nNeighbors = mpiInfo->nNeighbors;
@@ -779,12 +1512,17 @@ void puExtractEmigrants3D(Population *pop, MpiInfo *mpiInfo){
 	}
 	alSetAll(nEmigrants,nSpecies*nNeighbors,0);
 
-	double lx = thresholds[0];
-	double ly = thresholds[1];
-	double lz = thresholds[2];
-	double ux = thresholds[3];
-	double uy = thresholds[4];
-	double uz = thresholds[5];
+	pBndType type[6];
+	double wall[6], lower[3], upper[3];
+	int nWalls = puWalls(pop,mpiInfo,type,wall,lower,upper);
+	pop->bndStep++;
+
+	double lx = lower[0];
+	double ly = lower[1];
+	double lz = lower[2];
+	double ux = upper[0];
+	double uy = upper[1];
+	double uz = upper[2];
 
 	// adPrint(thresholds,6);
 
@@ -806,6 +1544,26 @@ void puExtractEmigrants3D(Population *pop, MpiInfo *mpiInfo){
 			// if(p==371*3)
 			// 	msg(STATUS,"x1: %f",x);
 
+			if(ne!=neighborhoodCenter && (nWalls || x==P_REMOVED)){
+				double w = weight ? weight[p/3] : 1;
+				if(x==P_REMOVED || puApplyWalls(pop,s,&pos[p],&vel[p],w,type,wall,mpiInfo)){
+					for(int d=0;d<3;d++) pos[p+d] = pos[pStop-3+d];
+					for(int d=0;d<3;d++) vel[p+d] = vel[pStop-3+d];
+					if(weight) weight[p/3] = weight[pStop/3-1];
+					pStop -= 3;
+					p -= 3;
+					pop->iStop[s]--;
+					continue;
+				}
+				x = pos[p];
+				y = pos[p+1];
+				z = pos[p+2];
+				nx = - (x<lx) + (x>=ux);
+				ny = - (y<ly) + (y>=uy);
+				nz = - (z<lz) + (z>=uz);
+				ne = neighborhoodCenter + nx + 3*ny + 9*nz;
+			}
+
 			if(ne!=neighborhoodCenter){
 				*(emigrants[ne]++) = x;
 				*(emigrants[ne]++) = y;
@@ -813,6 +1571,7 @@ void puExtractEmigrants3D(Population *pop, MpiInfo *mpiInfo){
 				*(emigrants[ne]++) = vel[p];
 				*(emigrants[ne]++) = vel[p+1];
 				*(emigrants[ne]++) = vel[p+2];
+				if(weight) *(emigrants[ne]++) = weight[p/3];
 				nEmigrants[ne*nSpecies+s]++;
 
 				pos[p]   = pos[pStop-3];
@@ -821,6 +1580,7 @@ void puExtractEmigrants3D(Population *pop, MpiInfo *mpiInfo){
 				vel[p]   = vel[pStop-3];
 				vel[p+1] = vel[pStop-2];
 				vel[p+2] = vel[pStop-1];
+				if(weight) weight[p/3] = weight[pStop/3-1];
 
 				// if(p==371*3)
 				// 	msg(STATUS,"x2: %f",pos[p]);
@@ -834,6 +1594,8 @@ void puExtractEmigrants3D(Population *pop, MpiInfo *mpiInfo){
 		}
 		// msg(STATUS,"pRange: %li-%li, iStop: %li",pStart,pStop,pop->iStop[s]);
 	}
+
+	pop->sorted = 0;
 }
 
 // Works
@@ -845,9 +1607,10 @@ void puExtractEmigrantsND(Population *pop, MpiInfo *mpiInfo){
 
 	int nSpecies = pop->nSpecies;
 	int nDims = pop->nDims;
+	int nVelDims = pop->nVelDims;
 	double *pos = pop->pos;
 	double *vel = pop->vel;
-	double *thresholds = mpiInfo->thresholds;
+	double *weight = pop->weight;
 	int neighborhoodCenter = mpiInfo->neighborhoodCenter;
 	long int *nEmigrants = mpiInfo->nEmigrants;
 	int nNeighbors = mpiInfo->nNeighbors;
@@ -860,35 +1623,75 @@ void puExtractEmigrantsND(Population *pop, MpiInfo *mpiInfo){
 	}
 	alSetAll(nEmigrants,nSpecies*nNeighbors,0);
 
+	pBndType *type = malloc(2*nDims*sizeof(*type));
+	double *wall = malloc(2*nDims*sizeof(*wall));
+	double *lower = malloc(nDims*sizeof(*lower));
+	double *upper = malloc(nDims*sizeof(*upper));
+	int nWalls = puWalls(pop,mpiInfo,type,wall,lower,upper);
+	pop->bndStep++;
+
 	for(int s=0;s<nSpecies;s++){
 
 		long int pStart = pop->iStart[s]*nDims;
 		long int pStop = pop->iStop[s]*nDims;
 
 		for(long int p=pStart;p<pStop;p+=nDims){
+			long int i = p/nDims;
+			long int iLast = pStop/nDims-1;
 			int ne = 0;
 			for(int d=nDims-1;d>=0;d--){
 				ne *= 3;
-				ne += 1 - (pos[p+d]<thresholds[d]) + (pos[p+d]>=thresholds[nDims+d]);
+				ne += 1 - (pos[p+d]<lower[d]) + (pos[p+d]>=upper[d]);
 				// A particle at position x will use j=(int)x and j+1 for
 				// interpolation. When x is integer and equal to a threshold, it
 				// should migrate if on the upper threshold since it may run out
 				// of ghost nodes otherwise (unless the user has specified more
 				// ghost layers than necessary)
 			}
+
+			// Boundaries are only applied to the few particles leaving, and
+			// absorbed particles are removed like emigrants. Particles marked
+			// as P_REMOVED (e.g. by oMove()) are always leaving.
+			if(ne!=neighborhoodCenter && (nWalls || pos[p]==P_REMOVED)){
+				double w = weight ? weight[i] : 1;
+				if(pos[p]==P_REMOVED || puApplyWalls(pop,s,&pos[p],&vel[i*nVelDims],w,type,wall,mpiInfo)){
+					for(int d=0;d<nDims;d++) pos[p+d] = pos[pStop-nDims+d];
+					for(int d=0;d<nVelDims;d++) vel[i*nVelDims+d] = vel[iLast*nVelDims+d];
+					if(weight) weight[i] = weight[iLast];
+					pStop -= nDims;
+					p -= nDims;
+					pop->iStop[s]--;
+					continue;
+				}
+				ne = 0;
+				for(int d=nDims-1;d>=0;d--){
+					ne *= 3;
+					ne += 1 - (pos[p+d]<lower[d]) + (pos[p+d]>=upper[d]);
+				}
+			}
+
 			if(ne!=neighborhoodCenter){
 				for(int d=0;d<nDims;d++) *(emigrants[ne]++) = pos[p+d];
-				for(int d=0;d<nDims;d++) *(emigrants[ne]++) = vel[p+d];
+				for(int d=0;d<nVelDims;d++) *(emigrants[ne]++) = vel[i*nVelDims+d];
+				if(weight) *(emigrants[ne]++) = weight[i];
 				nEmigrants[ne*nSpecies+s]++;
 
 				for(int d=0;d<nDims;d++) pos[p+d] = pos[pStop-nDims+d];
-				for(int d=0;d<nDims;d++) vel[p+d] = vel[pStop-nDims+d];
+				for(int d=0;d<nVelDims;d++) vel[i*nVelDims+d] = vel[iLast*nVelDims+d];
+				if(weight) weight[i] = weight[iLast];
 				pStop -= nDims;
 				p -= nDims;
 				pop->iStop[s]--;
 			}
 		}
 	}
+
+	free(type);
+	free(wall);
+	free(lower);
+	free(upper);
+
+	pop->sorted = 0;
 }
 
 // Works
@@ -909,8 +1712,8 @@ static inline void exchangeNMigrants(MpiInfo *mpiInfo){
 			int reciprocal = puNeighborToReciprocal(ne,mpiInfo->nDims);
 			long int *nEmigrants  = &mpiInfo->nEmigrants[nSpecies*ne];
 			long int *nImmigrants = &mpiInfo->nImmigrants[nSpecies*ne];
-			MPI_Isend(nEmigrants ,nSpecies,MPI_LONG,rank,reciprocal,MPI_COMM_WORLD,&send[ne]);
-			MPI_Irecv(nImmigrants,nSpecies,MPI_LONG,rank,ne        ,MPI_COMM_WORLD,&recv[ne]);
+			MPI_Isend(nEmigrants ,nSpecies,MPI_LONG,rank,reciprocal,simComm,&send[ne]);
+			MPI_Irecv(nImmigrants,nSpecies,MPI_LONG,rank,ne        ,simComm,&recv[ne]);
 		}
 	}
 
@@ -926,16 +1729,23 @@ static inline void shiftImmigrants(MpiInfo *mpiInfo, Grid *grid, int ne){
 	int nSpecies = mpiInfo->nSpecies;
 	long int nImmigrantsTotal = alSum(&mpiInfo->nImmigrants[ne*nSpecies],nSpecies);
 	int nDims = mpiInfo->nDims;
+	int migrantSize = mpiInfo->migrantSize;
 
 	for(int d=0;d<nDims;d++){
 		int n = ne%3-1;
 		ne /=3;
 
-		double shift = n*grid->trueSize[d+1];
+		// Subdomains may have different sizes (see gRebalance())
+		int *edges = mpiInfo->edges[d];
+		int J = mpiInfo->subdomain[d];
+		int nJ = mpiInfo->nSubdomains[d];
+		double shift = 0;
+		if(n==-1) shift = -(edges[(J+nJ-1)%nJ+1]-edges[(J+nJ-1)%nJ]);
+		if(n==+1) shift = edges[J+1]-edges[J];
 		for(int i=0;i<nImmigrantsTotal;i++){
-			immigrants[d+2*nDims*i] += shift;
+			immigrants[d+migrantSize*i] += shift;
 
-			// double pos = immigrants[d+2*nDims*i];
+			// double pos = immigrants[d+migrantSize*i];
 			// if(pos>grid->trueSize[d+1])
 			// 	msg(ERROR,"particle %i skipped two domains");
 
@@ -949,21 +1759,28 @@ static inline void shiftImmigrants(MpiInfo *mpiInfo, Grid *grid, int ne){
 static inline void importParticles(Population *pop, double *particles, long int *nParticles, int nSpecies){
 
 	int nDims = pop->nDims;
+	int nVelDims = pop->nVelDims;
 	long int *iStop = pop->iStop;
 
 	for(int s=0;s<nSpecies;s++){
 
+		if(iStop[s]+nParticles[s]>pop->iStart[s+1])
+			msg(ERROR|ALL,"Too many particles of specie %i for population:nAlloc",s);
+
 		double *pos = &pop->pos[nDims*iStop[s]];
-		double *vel = &pop->vel[nDims*iStop[s]];
+		double *vel = &pop->vel[nVelDims*iStop[s]];
+		double *weight = pop->weight ? &pop->weight[iStop[s]] : NULL;
 
 		for(int i=0;i<nParticles[s];i++){
 			for(int d=0;d<nDims;d++) *(pos++) = *(particles++);
-			for(int d=0;d<nDims;d++) *(vel++) = *(particles++);
+			for(int d=0;d<nVelDims;d++) *(vel++) = *(particles++);
+			if(weight) *(weight++) = *(particles++);
 		}
 
 		iStop[s] += nParticles[s];
 	}
 
+	pop->sorted = 0;
 }
 
 // Works
@@ -983,8 +1800,8 @@ static inline void exchangeMigrants(Population *pop, MpiInfo *mpiInfo, Grid *gri
 			int rank = puNeighborToRank(mpiInfo,ne);
 			int reciprocal = puNeighborToReciprocal(ne,nDims);
 			long int *nEmigrants  = &mpiInfo->nEmigrants[nSpecies*ne];
-			long int length = alSum(nEmigrants,nSpecies)*2*nDims;
-			MPI_Isend(emigrants[ne],length,MPI_DOUBLE,rank,reciprocal,MPI_COMM_WORLD,&send[ne]);
+			long int length = alSum(nEmigrants,nSpecies)*mpiInfo->migrantSize;
+			MPI_Isend(emigrants[ne],length,MPI_DOUBLE,rank,reciprocal,simComm,&send[ne]);
 		}
 	}
 
@@ -994,7 +1811,7 @@ static inline void exchangeMigrants(Population *pop, MpiInfo *mpiInfo, Grid *gri
 	for(int a=0;a<nNeighbors-1;a++){
 
 		MPI_Status status;
-		MPI_Recv(immigrants,nImmigrantsAlloc,MPI_DOUBLE,MPI_ANY_SOURCE,MPI_ANY_TAG,MPI_COMM_WORLD,&status);
+		MPI_Recv(immigrants,nImmigrantsAlloc,MPI_DOUBLE,MPI_ANY_SOURCE,MPI_ANY_TAG,simComm,&status);
 		int ne = status.MPI_TAG;	// Which neighbor it is from equals the tag
 
 		// adPrint(mpiInfo->immigrants,6);
@@ -1008,18 +1825,279 @@ static inline void exchangeMigrants(Population *pop, MpiInfo *mpiInfo, Grid *gri
 
 }
 
+// Updates high-water marks of migrant buffers. Used by puMemMsg().
+static inline void updateMigrantsPeak(MpiInfo *mpiInfo){
+
+	int nSpecies = mpiInfo->nSpecies;
+	int nNeighbors = mpiInfo->nNeighbors;
+	int migrantSize = mpiInfo->migrantSize;
+	long int *nEmigrantsPeak = mpiInfo->nEmigrantsPeak;
+
+	for(int ne=0;ne<nNeighbors;ne++){
+		long int nEmigrants = alSum(&mpiInfo->nEmigrants[ne*nSpecies],nSpecies);
+		long int nImmigrants = alSum(&mpiInfo->nImmigrants[ne*nSpecies],nSpecies);
+		if(nEmigrants>nEmigrantsPeak[ne]) nEmigrantsPeak[ne] = nEmigrants;
+		if(migrantSize*nImmigrants>mpiInfo->nImmigrantsPeak)
+			mpiInfo->nImmigrantsPeak = migrantSize*nImmigrants;
+	}
+}
+
+// Updates high-water marks of particle buffers. Used by puMemMsg().
+static inline void updatePopulationPeak(Population *pop){
+
+	for(int s=0;s<pop->nSpecies;s++){
+		long int n = pop->iStop[s]-pop->iStart[s];
+		if(n>pop->nPeak[s]) pop->nPeak[s] = n;
+	}
+}
+
 // Works
 void puMigrate(Population *pop, MpiInfo *mpiInfo, Grid *grid){
 
+	cpBegin("migrant counts");
 	exchangeNMigrants(mpiInfo);
+	cpEnd();
+	updateMigrantsPeak(mpiInfo);
+	cpBegin("migrant payloads");
 	exchangeMigrants(pop,mpiInfo,grid);
+	cpEnd();
+	updatePopulationPeak(pop);
+
+}
+
+void puReserveEmigrants(const Population *pop, MpiInfo *mpiInfo){
+
+	int nSpecies = pop->nSpecies;
+	int nDims = pop->nDims;
+	double *pos = pop->pos;
+	double *thresholds = mpiInfo->thresholds;
+	int nNeighbors = mpiInfo->nNeighbors;
+	int neighborhoodCenter = mpiInfo->neighborhoodCenter;
+	int migrantSize = mpiInfo->migrantSize;
+
+	// Count emigrants the same way as puExtractEmigrantsND()
+	long int *nEmigrants = calloc(nNeighbors,sizeof(*nEmigrants));
+	for(int s=0;s<nSpecies;s++){
+		for(long int p=pop->iStart[s]*nDims;p<pop->iStop[s]*nDims;p+=nDims){
+			int ne = 0;
+			for(int d=nDims-1;d>=0;d--){
+				ne *= 3;
+				ne += 1 - (pos[p+d]<thresholds[d]) + (pos[p+d]>=thresholds[nDims+d]);
+			}
+			nEmigrants[ne]++;
+		}
+	}
+	nEmigrants[neighborhoodCenter] = 0;
+
+	// The immigrant buffer must hold the largest message from any neighbor
+	long int nMax = alMax(nEmigrants,nNeighbors);
+	long int nMaxGlobal;
+	MPI_Allreduce(&nMax,&nMaxGlobal,1,MPI_LONG,MPI_MAX,simComm);
+
+	for(int ne=0;ne<nNeighbors;ne++){
+		if(ne==neighborhoodCenter || nEmigrants[ne]<=mpiInfo->nEmigrantsAlloc[ne])
+			continue;
+
+		memFree(mpiInfo->emigrants[ne]);
+		memFree(mpiInfo->migrants[ne]);
+		mpiInfo->emigrants[ne] = memAlloc(MEM_MIGRANTS,
+			migrantSize*nEmigrants[ne]*sizeof(**mpiInfo->emigrants));
+		mpiInfo->migrants[ne] = memAlloc(MEM_MIGRANTS,
+			nEmigrants[ne]*sizeof(**mpiInfo->migrants));
+		mpiInfo->nEmigrantsAlloc[ne] = nEmigrants[ne];
+	}
+
+	if(migrantSize*nMaxGlobal>mpiInfo->nImmigrantsAlloc){
+		memFree(mpiInfo->immigrants);
+		mpiInfo->nImmigrantsAlloc = migrantSize*nMaxGlobal;
+		mpiInfo->immigrants = memAlloc(MEM_MIGRANTS,
+			mpiInfo->nImmigrantsAlloc*sizeof(*mpiInfo->immigrants));
+	}
+
+	free(nEmigrants);
+}
 
+void puMemMsg(const Population *pop, const MpiInfo *mpiInfo){
+
+	int nSpecies = pop->nSpecies;
+	int nNeighbors = mpiInfo->nNeighbors;
+	int nElements = nSpecies+2;
+
+	// Utilization (fraction of capacity) along with rank for MPI_MAXLOC.
+	// Elements: one per specie, then emigrant buffers, then immigrant buffer.
+	struct { double val; int rank; } *local, *global;
+	local = malloc(nElements*sizeof(*local));
+	global = malloc(nElements*sizeof(*global));
+
+	for(int s=0;s<nSpecies;s++){
+		long int capacity = pop->iStart[s+1]-pop->iStart[s];
+		local[s].val = capacity ? (double)pop->nPeak[s]/capacity : 0;
+	}
+
+	local[nSpecies].val = 0;
+	for(int ne=0;ne<nNeighbors;ne++){
+		long int capacity = mpiInfo->nEmigrantsAlloc[ne];
+		if(ne==mpiInfo->neighborhoodCenter || capacity==0) continue;
+		double utilization = (double)mpiInfo->nEmigrantsPeak[ne]/capacity;
+		if(utilization>local[nSpecies].val) local[nSpecies].val = utilization;
+	}
+
+	local[nSpecies+1].val = (double)mpiInfo->nImmigrantsPeak/mpiInfo->nImmigrantsAlloc;
+
+	for(int i=0;i<nElements;i++) local[i].rank = mpiInfo->mpiRank;
+
+	MPI_Reduce(local,global,nElements,MPI_DOUBLE_INT,MPI_MAXLOC,0,simComm);
+
+	long int *nPeakMax = malloc(nSpecies*sizeof(*nPeakMax));
+	MPI_Reduce(pop->nPeak,nPeakMax,nSpecies,MPI_LONG,MPI_MAX,0,simComm);
+
+	msg(STATUS, "Peak buffer utilization (worst node):");
+	for(int s=0;s<nSpecies;s++){
+		msg(STATUS, "  specie %i particles %5.1f%% on node %i (max %li per node, "
+			"%li allocated)", s, 100*global[s].val, global[s].rank, nPeakMax[s],
+			pop->iStart[s+1]-pop->iStart[s]);
+	}
+	msg(STATUS, "  emigrants         %5.1f%% on node %i",
+		100*global[nSpecies].val, global[nSpecies].rank);
+	msg(STATUS, "  immigrants        %5.1f%% on node %i",
+		100*global[nSpecies+1].val, global[nSpecies+1].rank);
+
+	free(nPeakMax);
+	free(local);
+	free(global);
 }
 
-void puReflect(){
+/*
+ * Nominal work per particle. Grid values accessed by a particle are counted as
+ * moved to/from memory (scattered access), whereas grid-wide operations like
+ * gMul() count each node once.
+ */
+
+static long int puNParticles(const Population *pop){
+
+	long int n = 0;
+	for(int s=0;s<pop->nSpecies;s++) n += pop->iStop[s]-pop->iStart[s];
+	return n;
+}
 
+void puMoveCost(Cost *cost, const Population *pop){
 
+	int nDims = pop->nDims;
+	long int n = puNParticles(pop);
 
+	cost->bytes += n*3*nDims*sizeof(double);	// Read pos and vel, write pos
+	cost->flops += n*nDims;
+}
+
+static void puAccCost(Cost *cost, const Population *pop, const Grid *E,
+					  int order, int kinEnergy){
+
+	int nDims = pop->nDims;
+	long int nCorners = order ? 1<<nDims : 1;
+	long int n = puNParticles(pop);
+
+	// Read pos, read and write vel, gather E from corners
+	cost->bytes += n*(3+nCorners)*nDims*sizeof(double);
+
+	// Weights, interpolation of each component, velocity update
+	double flops = order ? 2*nDims+3*nDims*(nCorners-1)+nDims : 2*nDims;
+	if(kinEnergy) flops += 3*nDims;
+	cost->flops += n*flops;
+
+	// Rescaling E back and forth for each specie
+	long int nNodes = E->sizeProd[E->rank];
+	cost->bytes += pop->nSpecies*4*nNodes*sizeof(double);
+	cost->flops += pop->nSpecies*2*nNodes;
+}
+
+void puAccND1Cost(Cost *cost, const Population *pop, const Grid *E){
+	puAccCost(cost,pop,E,1,0);
+}
+
+void puAccND1KECost(Cost *cost, const Population *pop, const Grid *E){
+	puAccCost(cost,pop,E,1,1);
+}
+
+void puAccND0Cost(Cost *cost, const Population *pop, const Grid *E){
+	puAccCost(cost,pop,E,0,0);
+}
+
+void puAccND0KECost(Cost *cost, const Population *pop, const Grid *E){
+	puAccCost(cost,pop,E,0,1);
+}
+
+funPtr puAcc3D1_cost(dictionary *ini){ return puAccND1Cost; }
+funPtr puAcc3D1KE_cost(dictionary *ini){ return puAccND1KECost; }
+funPtr puAcc2D1_cost(dictionary *ini){ return puAccND1Cost; }
+funPtr puAcc2D1KE_cost(dictionary *ini){ return puAccND1KECost; }
+funPtr puAccND1_cost(dictionary *ini){ return puAccND1Cost; }
+funPtr puAccND1KE_cost(dictionary *ini){ return puAccND1KECost; }
+funPtr puAccND0_cost(dictionary *ini){ return puAccND0Cost; }
+funPtr puAccND0KE_cost(dictionary *ini){ return puAccND0KECost; }
+
+void puBorisCost(Cost *cost, const Population *pop, const Grid *E){
+	puAccCost(cost,pop,E,1,0);
+	cost->flops += puNParticles(pop)*(3+2*9+6);	// Half kicks and rotation
+}
+
+void puBorisKECost(Cost *cost, const Population *pop, const Grid *E){
+	puAccCost(cost,pop,E,1,1);
+	cost->flops += puNParticles(pop)*(3+2*9+6);
+}
+
+funPtr puBoris3D1_cost(dictionary *ini){ return puBorisCost; }
+funPtr puBoris3D1KE_cost(dictionary *ini){ return puBorisKECost; }
+funPtr puBoris2D1_cost(dictionary *ini){ return puBorisCost; }
+funPtr puBoris2D1KE_cost(dictionary *ini){ return puBorisKECost; }
+
+static void puDistrCost(Cost *cost, const Population *pop, const Grid *rho,
+						int order){
+
+	int nDims = pop->nDims;
+	long int nCorners = order ? 1<<nDims : 1;
+	long int n = puNParticles(pop);
+
+	// Read pos, read and write rho in corners
+	cost->bytes += n*(nDims+2*nCorners)*sizeof(double);
+
+	// Weights and accumulation
+	double flops = order ? 2*nDims+nCorners*nDims : nDims+1;
+	cost->flops += n*flops;
+
+	// Zeroing rho and rescaling it back and forth for each specie
+	long int nNodes = rho->sizeProd[rho->rank];
+	cost->bytes += (1+pop->nSpecies*4)*nNodes*sizeof(double);
+	cost->flops += pop->nSpecies*2*nNodes;
+}
+
+void puDistrND1Cost(Cost *cost, const Population *pop, const Grid *rho){
+	puDistrCost(cost,pop,rho,1);
+}
+
+void puDistrND0Cost(Cost *cost, const Population *pop, const Grid *rho){
+	puDistrCost(cost,pop,rho,0);
+}
+
+funPtr puDistr3D1_cost(dictionary *ini){ return puDistrND1Cost; }
+funPtr puDistr2D1_cost(dictionary *ini){ return puDistrND1Cost; }
+funPtr puDistrND1_cost(dictionary *ini){ return puDistrND1Cost; }
+funPtr puDistrND0_cost(dictionary *ini){ return puDistrND0Cost; }
+
+void puExtractEmigrantsNDCost(Cost *cost, const Population *pop){
+
+	int nDims = pop->nDims;
+	long int n = puNParticles(pop);
+
+	// Read pos and compare to lower and upper thresholds. Emigrants neglected.
+	cost->bytes += n*nDims*sizeof(double);
+	cost->flops += n*2*nDims;
+}
+
+funPtr puExtractEmigrants3D_cost(const dictionary *ini){
+	return puExtractEmigrantsNDCost;
+}
+funPtr puExtractEmigrantsND_cost(const dictionary *ini){
+	return puExtractEmigrantsNDCost;
 }
 
 /******************************************************************************
@@ -1068,6 +2146,112 @@ static void puSanity(dictionary *ini, const char* name, int dim, int order){
 	free(thresholds);
 }
 
+static void puSubmit(const Population *pop, int s){
+
+	if(pop->sorted){
+		Tiles *tiles = pop->tiles;
+		schSubmit(pop->sch,&tiles->start[s*(tiles->nTiles+1)],tiles->nTiles);
+	} else {
+		schSubmitRange(pop->sch,pop->iStart[s],pop->iStop[s]);
+	}
+}
+
+static int puNColors(const Population *pop){
+	return pop->sorted ? pop->tiles->nColors : 1;
+}
+
+static void puSubmitColor(const Population *pop, int s, int c){
+
+	if(pop->sorted){
+		Tiles *tiles = pop->tiles;
+		long int *start = &tiles->start[s*(tiles->nTiles+1)];
+		long int *colorStart = tiles->colorStart;
+		schSubmit(pop->sch,&start[colorStart[c]],colorStart[c+1]-colorStart[c]);
+	} else {
+		long int range[2] = {pop->iStart[s],pop->iStop[s]};
+		schSubmit(pop->sch,range,1);
+	}
+}
+
+static int puWalls(const Population *pop, const MpiInfo *mpiInfo,
+				   pBndType *type, double *wall, double *lower, double *upper){
+
+	int nDims = pop->nDims;
+	int nWalls = 0;
+
+	for(int b=0;b<2*nDims;b++){
+
+		int d = b%nDims;
+		int isUpper = b>=nDims;
+		int J = mpiInfo->subdomain[d];
+		int *edges = mpiInfo->edges[d];
+		int atEdge = isUpper ? J==mpiInfo->nSubdomains[d]-1 : J==0;
+
+		type[b] = atEdge ? pop->bnd[b] : PBND_PERIODIC;
+		wall[b] = edges[isUpper ? J+1 : J]-mpiInfo->offset[d];
+
+		double threshold = mpiInfo->thresholds[b];
+		if(type[b]!=PBND_PERIODIC){
+			threshold = wall[b];
+			nWalls++;
+		}
+		if(isUpper) upper[d] = threshold;
+		else lower[d] = threshold;
+	}
+
+	return nWalls;
+}
+
+static int puApplyWalls(Population *pop, int s, double *pos, double *vel,
+						double weight, const pBndType *type, const double *wall,
+						const MpiInfo *mpiInfo){
+
+	int nDims = pop->nDims;
+	int nVelDims = pop->nVelDims;
+
+	for(int b=0;b<2*nDims;b++){
+
+		int d = b%nDims;
+		double sign = b<nDims ? 1 : -1;
+
+		if(type[b]==PBND_PERIODIC) continue;
+		if(sign>0 ? pos[d]>=wall[b] : pos[d]<wall[b]) continue;
+
+		if(type[b]==PBND_ABSORBING){
+			double velSquared = 0;
+			for(int dd=0;dd<nVelDims;dd++) velSquared += vel[dd]*vel[dd];
+			pop->absorbed[s] += weight;
+			pop->absorbedEnergy[s] += 0.5*pop->mass[s]*velSquared*weight;
+			return 1;
+		}
+
+		if(type[b]==PBND_DIFFUSE){
+
+			// Half-Maxwellian flux leaving the wall, drawn for the position
+			// where the particle crossed it
+			Rng rng;
+			rngSet(&rng,pop->seed,RNG_BOUNDARY,s,pop->bndStep);
+			unsigned long long int index = pHashPos(pos,mpiInfo->offset,nDims);
+			double u;
+			rngUniform(&rng,&index,1,1,&u);
+			index ^= 1ULL<<63;
+			rngGaussian(&rng,&index,1,nVelDims,vel);
+			for(int dd=0;dd<nVelDims;dd++) vel[dd] *= pop->thermal[s];
+			vel[d] = sign*pop->thermal[s]*sqrt(-2*log(u));
+
+		} else {
+
+			vel[d] = -vel[d];
+		}
+
+		// Mirror the position, keeping it inside the upper edge
+		pos[d] = 2*wall[b]-pos[d];
+		if(sign<0 && pos[d]>=wall[b]) pos[d] = nextafter(wall[b],0);
+	}
+
+	return 0;
+}
+
 static inline void puInterp3D1(	double *result, const double *pos,
 								const double *val, const long int *sizeProd){
 
@@ -1103,6 +2287,32 @@ static inline void puInterp3D1(	double *result, const double *pos,
 
 }
 
+static inline void puInterp2D1(	double *result, const double *pos,
+								const double *val, const long int *sizeProd){
+
+	// Integer parts of position
+	int j = (int) pos[0];
+	int k = (int) pos[1];
+
+	// Decimal (cell-referenced) parts of position and their complement
+	double x = pos[0]-j;
+	double y = pos[1]-k;
+	double xcomp = 1-x;
+	double ycomp = 1-y;
+
+	// Index of neighbouring nodes
+	long int p 		= j*2 + k*sizeProd[2];
+	long int pj 	= p + 2; //sizeProd[1];
+	long int pk 	= p + sizeProd[2];
+	long int pjk 	= pk + 2; //sizeProd[1];
+
+	// Linear interpolation
+	for(int v=0;v<2;v++)
+		result[v] =	 ycomp*(xcomp*val[p   +v]+x*val[pj  +v])
+					+y    *(xcomp*val[pk  +v]+x*val[pjk +v]);
+
+}
+
 static inline void puInterpND1(	double *result, const double *pos,
 								const double *val, const long int *sizeProd,
 								int nDims, int *integer, double *decimal,
@@ -1218,3 +2428,43 @@ static inline void addCross(const double *a, const double *b, double *res){
 	res[1] += -(a[0]*b[2]-a[2]*b[0]);
 	res[2] +=  (a[0]*b[1]-a[1]*b[0]);
 }
+
+static inline double puWeight(	double *weight, const double *vel,
+								const double *dv, double drift, double invVar,
+								int nDims){
+
+	double exponent = 0;
+	for(int d=0;d<nDims;d++) exponent += (vel[d]+0.5*dv[d]-drift)*dv[d];
+
+	double old = *weight;
+	*weight = 1-(1-old)*exp(-exponent*invVar);
+	return 0.5*(old+*weight);
+}
+
+static inline double puProfile(const External *ext, const double *pos){
+
+	if(ext->profile==EXT_CONSTANT) return 1;
+
+	double phase = 0;
+	for(int d=0;d<ext->nDims;d++) phase += ext->k[d]*(pos[d]+ext->offset[d]);
+
+	return ext->profile==EXT_LINEAR ? 1+phase : cos(phase);
+}
+
+static inline void puAddExternal(	double *dv, const double *acc,
+									const External *ext, const double *pos,
+									int nVelDims){
+
+	double f = puProfile(ext,pos);
+	for(int d=0;d<nVelDims && d<3;d++) dv[d] += f*acc[d];
+}
+
+static inline void puRotation(double factor, const double *t, double *T, double *S){
+
+	double denom = 1;
+	for(int p=0;p<3;p++){
+		T[p] = factor*t[p];
+		denom += T[p]*T[p];
+	}
+	for(int p=0;p<3;p++) S[p] = 2*T[p]/denom;
+}
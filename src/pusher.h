@@ -65,16 +65,18 @@ void puPeriodic(Population *pop, Grid *grid);
  *
  * Remember that Boris and leapfrog methods require the velocities to be
  * located at half-integer steps. This initialization of the velocities can be
- * performed by multiplying E (and S and T in case of Boris) by 0.5,
- * accelerating once, and restoring E (and S and T) by multiplying them by 2.
- * For instance to get a leapfrog iteration:
+ * performed by multiplying E by 0.5 and computing the external fields for half
+ * a time step, accelerating once, and restoring both. For instance to get a
+ * leapfrog iteration:
  *
  * @code
  *	// Assume position and velocity initialized at timestep 0 here
  *
  *	gMul(E,0.5);
+ *	puExternalStep(pop->ext,0.5);
  *	puAcc3D1KE(pop,E); // Increment velocity to timestep 0.5
  *	gMul(E,2);
+ *	puExternalStep(pop->ext,1);
  *
  *	for(int n=1; n<=nTimeSteps; n++){ // Mind the range of n
  *
@@ -97,8 +99,6 @@ void puPeriodic(Population *pop, Grid *grid);
  *
  * @param[in,out]	pop		Population
  * @param			E		Electric field
- * @param			S		Rotation parameter (Boris only)
- * @param			T		Rotation parameter (Boris only)
  * @return					void
  *
  * The E input is usually not constified since it is rescaled several times
@@ -106,31 +106,52 @@ void puPeriodic(Population *pop, Grid *grid);
  * function call, however, it should be restored to its initial value (to within
  * machine precision).
  *
- * The rotation parameters S and T for the homogeneous Boris methods are
- * generated from the external B-field before the loop by
- * puGet3DRotationParameters(). For inhomogeneous fields S and T are Grid
- * quantities (no function to create them yet). For slowly time-varying
- * magnetic fields S and T can be regenerated each iteration. However, using a
- * Poisson solver does not properly deal with electromagnetic effects, so if
- * considering this the magnetic field must be kept quasi-static (and
- * quasi-homogeneous?).
+ * The external fields pop->ext (see External) are added to E particle by
+ * particle, such that no extra pass over the grid is needed. The Boris methods
+ * take the rotation parameters S and T of each specie from pop->ext, where
+ * they are precomputed once by puAllocExternal(), and require pop->ext to be
+ * set. Only if the external fields vary in space (fields:extProfile) are they
+ * scaled for each particle. Since a Poisson solver does not properly deal with
+ * electromagnetic effects, the magnetic field must be static.
+ *
+ * With delta-f weights (see Population), the puAcc*() functions also advance
+ * the weights by the same acceleration, and the KE-functions compute the
+ * kinetic energy of the deviation from the background. The Boris methods
+ * advance the weights by the total velocity change of the step, such that the
+ * magnetic rotation also changes them if the drift is not along B.
+ *
+ * The 2D-functions also accept three velocity components
+ * (population:nVelDims=3, see Population), of which only the in-plane ones are
+ * accelerated by E on the grid. The out-of-plane component is still accelerated
+ * by the external E-field, rotated by the Boris methods, which require three
+ * components, and included in the kinetic energy.
  */
 ///@{
 void puAcc3D1(Population *pop, Grid *E);
 void puAcc3D1KE(Population *pop, Grid *E);
+void puAcc2D1(Population *pop, Grid *E);
+void puAcc2D1KE(Population *pop, Grid *E);
 void puAccND1(Population *pop, Grid *E);
 void puAccND1KE(Population *pop, Grid *E);
 void puAccND0(Population *pop, Grid *E);
 void puAccND0KE(Population *pop, Grid *E);
-void puBoris3D1(Population *pop, Grid *E, const double *T, const double *S);
-void puBoris3D1KE(Population *pop, Grid *E, const double *T, const double *S);
+void puBoris3D1(Population *pop, Grid *E);
+void puBoris3D1KE(Population *pop, Grid *E);
+void puBoris2D1(Population *pop, Grid *E);
+void puBoris2D1KE(Population *pop, Grid *E);
 
 funPtr puAcc3D1_set(dictionary *ini);
 funPtr puAcc3D1KE_set(dictionary *ini);
+funPtr puAcc2D1_set(dictionary *ini);
+funPtr puAcc2D1KE_set(dictionary *ini);
 funPtr puAccND1_set(dictionary *ini);
 funPtr puAccND1KE_set(dictionary *ini);
 funPtr puAccND0_set(dictionary *ini);
 funPtr puAccND0KE_set(dictionary *ini);
+funPtr puBoris3D1_set(dictionary *ini);
+funPtr puBoris3D1KE_set(dictionary *ini);
+funPtr puBoris2D1_set(dictionary *ini);
+funPtr puBoris2D1KE_set(dictionary *ini);
 ///@}
 
 /**
@@ -139,11 +160,41 @@ funPtr puAccND0KE_set(dictionary *ini);
  * @param[out]		T		Rotation parameter named t in B&L
  * @param[out]		S		Rotation parameter named s in B&L
  *
- * S and T must be pre-allocated to hold 3*nSpecies doubles each.
- * This functions needs some cleanup.
+ * S and T must be pre-allocated to hold 3*nSpecies doubles each. fields:BExt
+ * always has three components, also in 2D. The kernels themselves use the
+ * parameters precomputed by puAllocExternal().
  */
 void puGet3DRotationParameters(dictionary *ini, double *T, double *S);
 
+/**
+ * @brief	Allocates the external fields acting on the particles
+ * @param	ini		Input file
+ * @param	mpiInfo	MpiInfo
+ * @return	Pointer to External
+ *
+ * Reads fields:EExt, fields:BExt, fields:extProfile and fields:extWaveVector,
+ * and precomputes the velocity increment and rotation parameters of each
+ * specie for a whole time step. Must be called after uNormalize(). Store the
+ * result in Population::ext, and free it using puFreeExternal().
+ */
+External *puAllocExternal(const dictionary *ini, const MpiInfo *mpiInfo);
+
+/**
+ * @brief	Frees the external fields
+ * @param	ext		External fields (may be NULL)
+ */
+void puFreeExternal(External *ext);
+
+/**
+ * @brief	Recomputes the external fields for a time step of different length
+ * @param[in,out]	ext			External fields (may be NULL)
+ * @param			dtFactor	Length of time step relative to time:timeStep
+ *
+ * E.g. use 0.5 when advancing the velocities half a time step at startup, and
+ * 1 afterwards.
+ */
+void puExternalStep(External *ext, double dtFactor);
+
 
 /** @name Distributors
  * These functions distributes or deposits charges onto the charge densty grid
@@ -155,16 +206,25 @@ void puGet3DRotationParameters(dictionary *ini, double *T, double *S);
  * out-of-bounds or out-of-threshold area. Make sure to migrate particles to
  * other subdomains before calling.
  *
+ * Charge is only assigned by several threads if the particles are sorted by
+ * tile (see pSortTiles()), in which case the threads work on tiles of one
+ * color at a time. Otherwise the charge is assigned by a single thread.
+ *
+ * With delta-f weights (see Population), each particle deposits its weight
+ * times its charge, which gives the perturbed charge density only.
+ *
  * @param			pop		Population
  * @param[in,out]	rho		Charge density
  * @return					void
  */
 ///@{
 void puDistr3D1(const Population *pop, Grid *rho);
+void puDistr2D1(const Population *pop, Grid *rho);
 void puDistrND1(const Population *pop, Grid *rho);
 void puDistrND0(const Population *pop, Grid *rho);
 
 funPtr puDistr3D1_set(dictionary *ini);
+funPtr puDistr2D1_set(dictionary *ini);
 funPtr puDistrND1_set(dictionary *ini);
 funPtr puDistrND0_set(dictionary *ini);
 ///@}
@@ -183,6 +243,85 @@ funPtr puExtractEmigrants3D_set(const dictionary *ini);
 
 void puMigrate(Population *pop, MpiInfo *mpiInfo, Grid *grid);
 
+/**
+ * @brief	Grows migrant buffers to fit the next migration if necessary
+ * @param			pop			Population
+ * @param[in,out]	mpiInfo		MpiInfo
+ *
+ * The extractors and puMigrate() do not check the size of the migrant buffers,
+ * which are sized by grid:nEmigrantsAlloc for the migration taking place every
+ * time step. This collective function counts the particles about to emigrate
+ * and enlarges the buffers if they do not fit. Use it prior to extraordinary
+ * migrations, e.g. after moving the subdomain boundaries (see gRebalance()).
+ * Buffers are never shrunk.
+ */
+void puReserveEmigrants(const Population *pop, MpiInfo *mpiInfo);
+
+/**
+ * @brief	Prints peak utilization of particle and migrant buffers
+ * @param	pop			Population
+ * @param	mpiInfo		MpiInfo
+ *
+ * puMigrate() keeps track of the high-water marks Population::nPeak,
+ * MpiInfo::nEmigrantsPeak and MpiInfo::nImmigrantsPeak. This collective
+ * function prints them relative to the allocated capacity for the worst MPI
+ * node, such that population:nAlloc and grid:nEmigrantsAlloc can be sized
+ * accordingly.
+ */
+void puMemMsg(const Population *pop, const MpiInfo *mpiInfo);
+
+/** @name Cost functions
+ * These functions add the nominal work of one call to puMove(), the
+ * accelerators, the distributors and the emigrant extractors to 'cost', for
+ * use in roofline reports (see telRooflineMsg()). They take the same arguments
+ * as the function they describe, preceded by 'cost'. The cost of accelerators,
+ * distributors and extractors depends on the method selected and is obtained
+ * using the same key as for the method itself:
+ *
+ * @code
+ *	void (*distr)()     = select(ini,"methods:distr",puDistr3D1_set ,puDistrND1_set );
+ *	void (*distrCost)() = select(ini,"methods:distr",puDistr3D1_cost,puDistrND1_cost);
+ *	distr(pop, rho);
+ *	distrCost(&cost, pop, rho);
+ * @endcode
+ *
+ * @param[in,out]	cost	Nominal work is added to this
+ * @param			pop		Population
+ * @param			E		Electric field (accelerators only)
+ * @param			rho		Charge density (distributors only)
+ */
+///@{
+void puMoveCost(Cost *cost, const Population *pop);
+void puAccND1Cost(Cost *cost, const Population *pop, const Grid *E);
+void puAccND1KECost(Cost *cost, const Population *pop, const Grid *E);
+void puAccND0Cost(Cost *cost, const Population *pop, const Grid *E);
+void puAccND0KECost(Cost *cost, const Population *pop, const Grid *E);
+void puBorisCost(Cost *cost, const Population *pop, const Grid *E);
+void puBorisKECost(Cost *cost, const Population *pop, const Grid *E);
+void puDistrND1Cost(Cost *cost, const Population *pop, const Grid *rho);
+void puDistrND0Cost(Cost *cost, const Population *pop, const Grid *rho);
+void puExtractEmigrantsNDCost(Cost *cost, const Population *pop);
+
+funPtr puAcc3D1_cost(dictionary *ini);
+funPtr puAcc3D1KE_cost(dictionary *ini);
+funPtr puAcc2D1_cost(dictionary *ini);
+funPtr puAcc2D1KE_cost(dictionary *ini);
+funPtr puAccND1_cost(dictionary *ini);
+funPtr puAccND1KE_cost(dictionary *ini);
+funPtr puAccND0_cost(dictionary *ini);
+funPtr puAccND0KE_cost(dictionary *ini);
+funPtr puBoris3D1_cost(dictionary *ini);
+funPtr puBoris3D1KE_cost(dictionary *ini);
+funPtr puBoris2D1_cost(dictionary *ini);
+funPtr puBoris2D1KE_cost(dictionary *ini);
+funPtr puDistr3D1_cost(dictionary *ini);
+funPtr puDistr2D1_cost(dictionary *ini);
+funPtr puDistrND1_cost(dictionary *ini);
+funPtr puDistrND0_cost(dictionary *ini);
+funPtr puExtractEmigrants3D_cost(const dictionary *ini);
+funPtr puExtractEmigrantsND_cost(const dictionary *ini);
+///@}
+
 int puRankToNeighbor(MpiInfo *mpiInfo, int rank);
 int puNeighborToRank(MpiInfo *mpiInfo, int neighbor);
 int puNeighborToReciprocal(int neighbor, int nDims);
@@ -22,8 +22,7 @@ SpectralSolver* sAlloc(const dictionary *ini, const Grid *rho, Grid *phi){
 	solver->spectralSize = spectralSize;
 	free(trueSize);
 
-	fftw_complex *spectrum = (fftw_complex *)malloc(size*sizeof(*spectrum));
-	double *spectralFactor = (double *)malloc(spectralSize*sizeof(*spectralFactor));
+	double *spectralFactor = memAlloc(MEM_SPECTRAL,spectralSize*sizeof(*spectralFactor));
 
 	spectralFactor[0] = 0; // Actually infinity
 	for(int n=1; n<spectralSize; n++){
@@ -37,7 +36,9 @@ SpectralSolver* sAlloc(const dictionary *ini, const Grid *rho, Grid *phi){
 	}
 
 
-	spectrum = (fftw_complex *)fftw_malloc(spectralSize*sizeof(fftw_complex));
+	// FFTW's own allocator ensures alignment suitable for SIMD
+	fftw_complex *spectrum = (fftw_complex *)fftw_malloc(spectralSize*sizeof(fftw_complex));
+	memAdd(MEM_SPECTRAL,spectralSize*sizeof(fftw_complex));
 
 	// Replacing FFTW_ESTIMATE with FFTW_MEASURE may be beneficial for very
 	// large systems. More efficient algorithm by omitting FFTW_PRESERVE_INPUT
@@ -57,8 +58,9 @@ void sFree(SpectralSolver *solver){
 	fftw_destroy_plan(solver->fftInverse);
 	fftw_cleanup();
 
-	free(solver->spectralFactor);
-	free(solver->spectrum);
+	memFree(solver->spectralFactor);
+	fftw_free(solver->spectrum);
+	memAdd(MEM_SPECTRAL,-solver->spectralSize*(long int)sizeof(fftw_complex));
 	free(solver);
 }
 
@@ -114,6 +116,30 @@ void sSolve(const SpectralSolver *solver,
 	gInsertHalo(phi, nGhostLayers);
 }
 
+void sSolveCost(Cost *cost, const SpectralSolver *solver,
+	const Grid *rho, const Grid *phi, const MpiInfo *mpiInfo){
+
+	// Real transform of n points counted as 2.5*n*log2(n) flops, each way
+	long int n = rho->sizeProd[rho->rank];
+	long int nSpectrum = solver->spectralSize;
+	double fftFlops = 2.5*n*log2(n);
+
+	// Removing and inserting halos on rho and phi (copying in place)
+	cost->bytes += 4*2*n*sizeof(double);
+
+	// Forward and inverse FFT (real array and spectrum read and written once)
+	cost->bytes += 2*(n*sizeof(double)+nSpectrum*sizeof(fftw_complex));
+	cost->flops += 2*fftFlops;
+
+	// Multiplication by spectral factor
+	cost->bytes += nSpectrum*(2*sizeof(fftw_complex)+sizeof(double));
+	cost->flops += 2*nSpectrum;
+}
+
+funPtr sSolver_cost(dictionary *ini){
+	return sSolveCost;
+}
+
 funPtr sMode_set(dictionary *ini){
 	int nDims = iniGetInt(ini,"grid:nDims");
 	if(nDims!=1) msg(ERROR,"sMode only works with grid:nDims=1");
@@ -52,4 +52,18 @@ void sSolve(const SpectralSolver *solver, Grid *rho, Grid *phi, const MpiInfo *m
 
 funPtr sSolver_set(dictionary *ini);
 
+/**
+ * @brief Adds the nominal work of sSolve() to cost
+ * @param cost    Cost
+ * @param solver  SpectralSolver
+ * @param rho     Charge density (source)
+ * @param phi     Electric potential (unknown)
+ * @param mpiInfo MpiInfo
+ * @see Cost, mgSolveCost()
+ */
+void sSolveCost(Cost *cost, const SpectralSolver *solver,
+	const Grid *rho, const Grid *phi, const MpiInfo *mpiInfo);
+
+funPtr sSolver_cost(dictionary *ini);
+
 #endif // SPECTRAL_H
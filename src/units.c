@@ -116,6 +116,10 @@ void uNormalize(dictionary *ini, const Units *units){
 	iniScaleDouble(ini, "population:perturbAmplitude", 1.0/units->length);
 	iniScaleDouble(ini, "fields:BExt", 1.0/units->bField);
 	iniScaleDouble(ini, "fields:EExt", 1.0/units->eField);
+	iniScaleDouble(ini, "fields:extWaveVector", units->length);
+	iniScaleDouble(ini, "collisions:neutralDensity", 1.0/units->density);
+	iniScaleDouble(ini, "collisions:neutralMass", 1.0/units->mass);
+	iniScaleDouble(ini, "collisions:neutralThermalVelocity", 1.0/units->velocity);
 
 }
 /*
@@ -146,8 +150,9 @@ static void parseIndirectInput(dictionary *ini){
 	double V = (double)gGetGlobalVolume(ini);
 
 	int *L = gGetGlobalSize(ini);
-	double *mul = malloc(nDims*sizeof(nDims));
+	double *mul = malloc(nDims*sizeof(*mul));
 	for(int i=0;i<nDims;i++) mul[i] = 1.0/L[i];
+	free(L);
 
 	iniApplySuffix(ini, "population:nParticles", "pc", &V, 1);
 	iniApplySuffix(ini, "population:nAlloc", "pc", &V, 1);
@@ -172,6 +177,7 @@ static Units *uSemiSI(dictionary *ini){
 
 	adScale(charge, nSpecies, elementaryCharge);
 	adScale(mass, nSpecies, electronMass);
+	iniScaleDouble(ini, "collisions:neutralMass", electronMass);
 
 	double wpe = sqrt(pow(elementaryCharge,2)*density[0]/
 			(vacuumPermittivity*electronMass));
@@ -9,6 +9,10 @@
 #ifndef UNITS_H
 #define UNITS_H
 
+extern const double elementaryCharge;	///< Elementary charge [C]
+extern const double electronMass;		///< Electron mass [kg]
+extern const double vacuumPermittivity;	///< Vacuum permittivity [F/m]
+
 /**
  * @brief	Allocates and populates Unit according to ini-file
  * @param	ini		Dictionary to input file
@@ -32,8 +32,159 @@ static int testAEq(){
 	return 0;
 }
 
+static int testMemAlloc(){
+
+	size_t current = memGetCurrent(MEM_GRID);
+	size_t total = memGetCurrent(MEM_NTAGS);
+
+	double *a = memAlloc(MEM_GRID,100*sizeof(*a));
+	double *b = memAlloc(MEM_GRID,50*sizeof(*b));
+	utAssert(memGetCurrent(MEM_GRID)==current+150*sizeof(double),
+		"memAlloc doesn't account for allocated memory");
+	utAssert(memGetCurrent(MEM_NTAGS)==total+150*sizeof(double),
+		"memAlloc doesn't account for total memory");
+
+	memFree(a);
+	utAssert(memGetCurrent(MEM_GRID)==current+50*sizeof(double),
+		"memFree doesn't account for freed memory");
+	utAssert(memGetPeak(MEM_GRID)>=current+150*sizeof(double),
+		"memGetPeak is broken");
+
+	memFree(b);
+	memFree(NULL);
+	utAssert(memGetCurrent(MEM_GRID)==current,"memFree is broken");
+
+	return 0;
+}
+
+/*
+ * Each task must be taken by exactly one thread, also when the weights are
+ * uneven and some tasks are empty.
+ */
+static int testScheduler(){
+
+	long int nTasks = 1000;
+	long int *cumWeight = malloc((nTasks+1)*sizeof(*cumWeight));
+	cumWeight[0] = 7;
+	for(long int t=0;t<nTasks;t++) cumWeight[t+1] = cumWeight[t]+(t%10)*(t%7);
+
+	long int nItems = cumWeight[nTasks];
+	int *taken = calloc(nItems,sizeof(*taken));
+
+	Scheduler *sch = schAlloc();
+	schSubmit(sch,cumWeight,nTasks);
+
+	#pragma omp parallel
+	{
+		long int start, stop;
+		while(schNext(sch,&start,&stop)){
+			for(long int i=start;i<stop;i++){
+				#pragma omp atomic
+				taken[i]++;
+			}
+		}
+	}
+
+	int bad = 0;
+	for(long int i=0;i<nItems;i++)
+		if(taken[i]!=(i>=cumWeight[0])) bad = 1;
+	utAssert(!bad,"schNext doesn't take each task exactly once");
+
+	long int start, stop;
+	utAssert(!schNext(sch,&start,&stop),"schNext takes tasks when empty");
+
+	schFree(sch);
+	free(taken);
+	free(cumWeight);
+
+	return 0;
+}
+
+/*
+ * Philox4x32-10 must reproduce the known answer of Random123, and a value must
+ * not depend on which other items it is drawn together with.
+ */
+static int testRng(){
+
+	unsigned int counter[4] = {0,0,0,0};
+	unsigned int key[2] = {0,0};
+	unsigned int result[4];
+	rngPhilox(counter,key,result);
+	utAssert(result[0]==0x6627e8d5 && result[1]==0xe169c58d &&
+			 result[2]==0xbc57ac4c && result[3]==0x9b00dbd8,
+			 "rngPhilox doesn't match known answer");
+
+	long int n = 1000;
+	int nValues = 3;
+	unsigned long long int *index = malloc(n*sizeof(*index));
+	double *all = malloc(n*nValues*sizeof(*all));
+	for(long int i=0;i<n;i++) index[i] = 7*i+(1ULL<<40);
+
+	Rng rng;
+	rngSet(&rng,1,RNG_VEL,0,0);
+	rngGaussian(&rng,index,n,nValues,all);
+
+	double one[3];
+	rngGaussian(&rng,&index[n/2],1,nValues,one);
+	utAssert(!memcmp(one,&all[(n/2)*nValues],sizeof(one)),
+			 "rngGaussian depends on the other items drawn");
+
+	double mean = 0, var = 0;
+	for(long int j=0;j<n*nValues;j++){
+		mean += all[j];
+		var += all[j]*all[j];
+	}
+	mean /= n*nValues;
+	var = var/(n*nValues)-mean*mean;
+	utAssert(fabs(mean)<0.1 && fabs(var-1)<0.1,
+			 "rngGaussian doesn't give a standard normal distribution");
+
+	free(index);
+	free(all);
+
+	return 0;
+}
+
+/*
+ * rngBinomial() must have the mean and variance of the binomial distribution,
+ * both by inversion (small mean) and by the normal approximation (large mean).
+ */
+static int testRngBinomial(){
+
+	Rng rng;
+	rngSet(&rng,1,RNG_POS,0,0);
+
+	long int nTrials[] = {40, 100000};
+	double p[] = {0.1, 0.7};
+	long int nDraws = 20000;
+
+	for(int t=0;t<2;t++){
+		double mean = 0, var = 0;
+		for(long int i=0;i<nDraws;i++){
+			double k = rngBinomial(&rng,i,nTrials[t],p[t]);
+			mean += k;
+			var += k*k;
+		}
+		mean /= nDraws;
+		var = var/nDraws-mean*mean;
+
+		double expMean = nTrials[t]*p[t];
+		double expVar = expMean*(1-p[t]);
+		utAssert(fabs(mean-expMean)<4*sqrt(expVar/nDraws),
+				 "rngBinomial has mean %g but expected %g", mean, expMean);
+		utAssert(fabs(var-expVar)<0.05*expVar,
+				 "rngBinomial has variance %g but expected %g", var, expVar);
+	}
+
+	return 0;
+}
+
 // All tests for aux.c is contained in this function
 void testAux(){
 	utRun(&testAiProd);
 	utRun(&testAEq);
+	utRun(&testMemAlloc);
+	utRun(&testScheduler);
+	utRun(&testRng);
+	utRun(&testRngBinomial);
 }
@@ -0,0 +1,204 @@
+/**
+ * @file		collision.test.c
+ * @brief		Unit tests for collision.c
+ */
+
+#include "test.h"
+#include "pinc.h"
+#include "collision.h"
+#include <math.h>
+
+/*
+ * Collides particles of equal speed with cold and heavy neutrals of constant
+ * cross section for one time step, and checks the number of collisions against
+ * the collision frequency. Specie 0 scatters elastically and must keep its
+ * speed, whereas specie 1 exchanges charge and must come to rest.
+ */
+static int testColCollide(){
+
+	const char *fName = "collision.test.txt";
+	FILE *file = fopen(fName,"w");
+	fprintf(file,"# Energy [eV]  Cross section [m^2]\n0 1\n0.01 1\n");
+	fclose(file);
+
+	dictionary *ini = iniGetDummyPop();
+	iniparser_set(ini,"population:nSpecies","2");
+	iniparser_set(ini,"population:nAlloc","20000");
+	iniparser_set(ini,"population:nParticles","20000");
+	iniparser_set(ini,"population:charge","-1,1");
+	iniparser_set(ini,"population:mass","1,1");
+	iniparser_set(ini,"grid:trueSize","10,10,10");
+	iniparser_set(ini,"collisions:neutralDensity","0.5");
+	iniparser_set(ini,"collisions:neutralMass","1e9");
+	iniparser_set(ini,"collisions:neutralThermalVelocity","0");
+	iniparser_set(ini,"collisions:processes","ELASTIC,EXCHANGE");
+	iniparser_set(ini,"collisions:crossSections",fName);
+	iniparser_set(ini,"collisions:tableSize","64");
+	iniparser_set(ini,"collisions:coulombInterval","0");
+	iniparser_set(ini,"collisions:coulombLog","10");
+
+	// Energies in eV are then the same as normalized energies
+	double weights[2] = {1,1};
+	Units units;
+	units.weights = weights;
+	units.length = 1;
+	units.energy = elementaryCharge;
+
+	MpiInfo *mpiInfo = gAllocMpi(ini);
+	Population *pop = pAlloc(ini);
+	Collider *col = colAlloc(ini,&units,mpiInfo);
+	remove(fName);
+
+	long int nParticles = 20000;
+	double speed = 0.1;
+	for(int s=0;s<2;s++){
+		pop->iStop[s] = pop->iStart[s]+nParticles;
+		for(long int i=pop->iStart[s];i<pop->iStop[s];i++){
+			pop->vel[3*i] = speed;
+			pop->vel[3*i+1] = 0;
+			pop->vel[3*i+2] = 0;
+		}
+	}
+
+	colCollide(col,pop,1);
+
+	double expected = nParticles*(1-exp(-0.5*speed));
+	long int nCollided[2] = {0,0};
+	int bad = 0;
+	for(int s=0;s<2;s++){
+		for(long int i=pop->iStart[s];i<pop->iStop[s];i++){
+			double *v = &pop->vel[3*i];
+			if(v[0]==speed && v[1]==0 && v[2]==0) continue;
+			nCollided[s]++;
+			double vv = sqrt(v[0]*v[0]+v[1]*v[1]+v[2]*v[2]);
+			if(s==0 && fabs(vv-speed)>1e-6*speed) bad = 1;
+			if(s==1 && vv!=0) bad = 1;
+		}
+		utAssert(fabs(nCollided[s]-expected)<4*sqrt(expected),
+				 "colCollide collides %li particles of specie %i but expected %.0f",
+				 nCollided[s], s, expected);
+	}
+	utAssert(!bad,"colCollide gives wrong velocities after collisions");
+
+	colFree(col);
+	pFree(pop);
+	gFreeMpi(mpiInfo);
+	iniparser_freedict(ini);
+
+	return 0;
+}
+
+/*
+ * Scatters two species by Coulomb collisions, and checks that momentum and
+ * energy are conserved. The result must be the same whether the particles are
+ * found through the index or through the tiles.
+ */
+static int testColCoulomb(){
+
+	dictionary *ini = iniGetDummyPop();
+	iniparser_set(ini,"population:nSpecies","2");
+	iniparser_set(ini,"population:nAlloc","4000");
+	iniparser_set(ini,"population:nParticles","4000");
+	iniparser_set(ini,"population:tileSize","1");
+	iniparser_set(ini,"population:charge","-1,1");
+	iniparser_set(ini,"population:mass","1,4");
+	iniparser_set(ini,"grid:trueSize","4,4,4");
+	iniparser_set(ini,"collisions:neutralDensity","0");
+	iniparser_set(ini,"collisions:neutralMass","1");
+	iniparser_set(ini,"collisions:neutralThermalVelocity","0");
+	iniparser_set(ini,"collisions:processes","NONE");
+	iniparser_set(ini,"collisions:crossSections","NONE");
+	iniparser_set(ini,"collisions:tableSize","2");
+	iniparser_set(ini,"collisions:coulombInterval","2");
+	iniparser_set(ini,"collisions:coulombLog","10");
+
+	double weights[2] = {1,1};
+	Units units;
+	units.weights = weights;
+
+	MpiInfo *mpiInfo = gAllocMpi(ini);
+	Population *pop = pAlloc(ini);
+	Grid *rho = gAlloc(ini,SCALAR);
+	Collider *col = colAlloc(ini,&units,mpiInfo);
+
+	Rng rng;
+	rngSet(&rng,1,RNG_POS,0,0);
+	long int nParticles = 1800;
+	for(int s=0;s<2;s++){
+		pop->iStop[s] = pop->iStart[s]+nParticles;
+		for(long int i=pop->iStart[s];i<pop->iStop[s];i++){
+			unsigned long long int index = i;
+			double u[6];
+			rngUniform(&rng,&index,1,6,u);
+			for(int d=0;d<3;d++){
+				pop->pos[3*i+d] = 1+4*u[d];
+				pop->vel[3*i+d] = u[3+d]-0.5;
+			}
+		}
+	}
+	pSortTiles(pop,rho);
+
+	long int nAlloc = pop->iStart[2];
+	double *vel = malloc(3*nAlloc*sizeof(*vel));
+	for(long int i=0;i<3*nAlloc;i++) vel[i] = pop->vel[i];
+
+	double before[4] = {0,0,0,0}, after[4] = {0,0,0,0};
+	for(int s=0;s<2;s++){
+		for(long int i=pop->iStart[s];i<pop->iStop[s];i++){
+			for(int d=0;d<3;d++){
+				before[d] += pop->mass[s]*pop->vel[3*i+d];
+				before[3] += pop->mass[s]*pop->vel[3*i+d]*pop->vel[3*i+d];
+			}
+		}
+	}
+
+	// Nothing happens at odd time steps
+	colCoulomb(col,pop,rho,1);
+	utAssert(col->nPairs==0,"colCoulomb collides at time step not a multiple of interval");
+
+	colCoulomb(col,pop,rho,2);
+	utAssert(col->index==NULL,"colCoulomb does not use the tiles of sorted particles");
+
+	int changed = 0;
+	for(int s=0;s<2;s++){
+		for(long int i=pop->iStart[s];i<pop->iStop[s];i++){
+			for(int d=0;d<3;d++){
+				after[d] += pop->mass[s]*pop->vel[3*i+d];
+				after[3] += pop->mass[s]*pop->vel[3*i+d]*pop->vel[3*i+d];
+				if(pop->vel[3*i+d]!=vel[3*i+d]) changed = 1;
+			}
+		}
+	}
+	utAssert(changed,"colCoulomb does not change velocities");
+	for(int k=0;k<4;k++){
+		utAssert(fabs(after[k]-before[k])<1e-10*before[3],
+				 "colCoulomb does not conserve momentum and energy");
+	}
+
+	// Same collisions through the index
+	double *velTiles = pop->vel;
+	pop->vel = vel;
+	pop->sorted = 0;
+	colCoulomb(col,pop,rho,2);
+	utAssert(col->index!=NULL,"colCoulomb does not index unsorted particles");
+
+	int differ = 0;
+	for(long int i=0;i<3*nAlloc;i++) if(vel[i]!=velTiles[i]) differ = 1;
+	utAssert(!differ,"colCoulomb gives different results with and without tiles");
+	pop->vel = velTiles;
+
+	free(vel);
+	colFree(col);
+	gFree(rho);
+	pFree(pop);
+	gFreeMpi(mpiInfo);
+	iniparser_freedict(ini);
+
+	return 0;
+}
+
+// All tests for collision.c is contained in this function
+void testCollision(){
+	utRun(&testColCollide);
+	utRun(&testColCoulomb);
+}
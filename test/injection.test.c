@@ -0,0 +1,217 @@
+/**
+ * @file		injection.test.c
+ * @brief		Unit tests for injection.c
+ */
+
+#include "test.h"
+#include "pinc.h"
+#include "injection.h"
+#include <math.h>
+
+/*
+ * Injects particles through the lower x-face for many time steps, and checks
+ * the number of particles and their mean velocity normal to the face against
+ * the flux-Maxwellian. Particles must start between the face and the position
+ * reached after one time step.
+ */
+static int testInjMaxwell(){
+
+	dictionary *ini = iniGetDummyPop();
+	iniparser_set(ini,"population:nAlloc","200000");
+	iniparser_set(ini,"population:nParticles","6000");
+	iniparser_set(ini,"population:drift","0.05");
+	iniparser_set(ini,"population:thermalVelocity","0.1");
+	iniparser_set(ini,"population:boundaries","ABSORBING,PERIODIC,PERIODIC,ABSORBING,PERIODIC,PERIODIC");
+	iniparser_set(ini,"grid:trueSize","10,10,10");
+	iniparser_set(ini,"grid:boundaries","DIRICHLET,PERIODIC,PERIODIC,DIRICHLET,PERIODIC,PERIODIC");
+	iniparser_set(ini,"injection:faces","MAXWELL,NONE,NONE,NONE,NONE,NONE");
+	iniparser_set(ini,"injection:tableSize","1024");
+	iniparser_set(ini,"methods:poisson","mgSolver");
+
+	MpiInfo *mpiInfo = gAllocMpi(ini);
+	Population *pop = pAlloc(ini);
+	Injector *inj = injAlloc(ini,pop,mpiInfo);
+	pop->iStop[0] = pop->iStart[0];
+
+	int nSteps = 200;
+	for(int n=0;n<nSteps;n++) injInject(inj,pop,n);
+
+	// Density 6 per cell, area 100 cells, u=0.5 thermal velocities
+	double u = 0.5, vth = 0.1;
+	double e = exp(-0.5*u*u), w = sqrt(PI/2)*(1+erf(u/sqrt(2)));
+	double rate = 600*vth*(e/sqrt(2*PI)+0.5*u*(1+erf(u/sqrt(2))));
+	double meanVel = vth*((1+u*u)*w+u*e)/(e+u*w);
+
+	long int nNew = pop->iStop[0]-pop->iStart[0];
+	utAssert(fabs(nNew-nSteps*rate)<4*sqrt(nSteps*rate),
+			 "injInject injects %li particles but expected %.0f", nNew, nSteps*rate);
+
+	double sum = 0;
+	int bad = 0;
+	for(long int i=pop->iStart[0];i<pop->iStop[0];i++){
+		double x = pop->pos[3*i]-inj->facePos[0];
+		double v = pop->vel[3*i];
+		sum += v;
+		if(v<=0 || x<0 || x>v) bad = 1;
+	}
+	utAssert(!bad,"injInject places particles wrongly");
+	utAssert(fabs(sum/nNew-meanVel)<0.01*meanVel,
+			 "injInject gives mean velocity %g but expected %g", sum/nNew, meanVel);
+
+	injFree(inj);
+	pFree(pop);
+	gFreeMpi(mpiInfo);
+	iniparser_freedict(ini);
+
+	return 0;
+}
+
+static int compareVel(const void *a, const void *b){
+	const double *x = a, *y = b;
+	for(int d=0;d<3;d++) if(x[d]!=y[d]) return (x[d]>y[d])-(x[d]<y[d]);
+	return 0;
+}
+
+// Appends the velocities and global positions of the particles to all
+static void injGlobal(const Population *pop, const MpiInfo *mpiInfo,
+					  double *all, long int *nAll){
+
+	for(long int i=pop->iStart[0];i<pop->iStop[0];i++){
+		double *p = &all[6*(*nAll)++];
+		for(int d=0;d<3;d++){
+			p[d] = pop->vel[3*i+d];
+			p[3+d] = pop->pos[3*i+d]+mpiInfo->offset[d];
+		}
+	}
+}
+
+/*
+ * The injected particles must be the same when the face is split between
+ * subdomains of different sizes as when it is not.
+ */
+static int testInjSubdomains(){
+
+	dictionary *ini = iniGetDummyPop();
+	iniparser_set(ini,"population:nAlloc","20000");
+	iniparser_set(ini,"population:nParticles","6000");
+	iniparser_set(ini,"population:drift","0.05");
+	iniparser_set(ini,"population:thermalVelocity","0.1");
+	iniparser_set(ini,"population:boundaries","ABSORBING,PERIODIC,PERIODIC,ABSORBING,PERIODIC,PERIODIC");
+	iniparser_set(ini,"grid:trueSize","10,10,10");
+	iniparser_set(ini,"grid:boundaries","DIRICHLET,PERIODIC,PERIODIC,DIRICHLET,PERIODIC,PERIODIC");
+	iniparser_set(ini,"injection:faces","MAXWELL,NONE,NONE,NONE,NONE,NONE");
+	iniparser_set(ini,"injection:tableSize","1024");
+	iniparser_set(ini,"methods:poisson","mgSolver");
+
+	MpiInfo *mpiInfo = gAllocMpi(ini);
+	Population *pop = pAlloc(ini);
+	pop->iStop[0] = pop->iStart[0];
+	int nSteps = 5;
+
+	Injector *inj = injAlloc(ini,pop,mpiInfo);
+	for(int step=0;step<nSteps;step++) injInject(inj,pop,step);
+	injFree(inj);
+
+	long int n = pop->iStop[0]-pop->iStart[0], nWhole = 0;
+	double *whole = malloc(6*n*sizeof(*whole));
+	injGlobal(pop,mpiInfo,whole,&nWhole);
+	qsort(whole,nWhole,6*sizeof(*whole),compareVel);
+
+	// Pretend the y-axis is split in two subdomains, and inject into both
+	int *edges = mpiInfo->edges[1];
+	int nSubdomains = mpiInfo->nSubdomains[1];
+	int subdomain = mpiInfo->subdomain[1];
+	int offset = mpiInfo->offset[1];
+	int split[] = {0,3,10};
+	mpiInfo->edges[1] = split;
+	mpiInfo->nSubdomains[1] = 2;
+
+	double *parts = malloc(6*n*sizeof(*parts));
+	long int nParts = 0;
+	int bad = 0;
+	for(int J=0;J<2;J++){
+		mpiInfo->subdomain[1] = J;
+		mpiInfo->offset[1] = split[J]-1;
+		inj = injAlloc(ini,pop,mpiInfo);
+		pop->iStop[0] = pop->iStart[0];
+		for(int step=0;step<nSteps;step++) injInject(inj,pop,step);
+		injFree(inj);
+		if(nParts+pop->iStop[0]-pop->iStart[0]>n) bad = 1;
+		else injGlobal(pop,mpiInfo,parts,&nParts);
+	}
+	qsort(parts,nParts,6*sizeof(*parts),compareVel);
+
+	mpiInfo->edges[1] = edges;
+	mpiInfo->nSubdomains[1] = nSubdomains;
+	mpiInfo->subdomain[1] = subdomain;
+	mpiInfo->offset[1] = offset;
+
+	for(long int i=0;i<nParts && !bad && nParts==nWhole;i++)
+		for(int d=0;d<6;d++)
+			if(fabs(parts[6*i+d]-whole[6*i+d])>1e-12) bad = 1;
+	utAssert(!bad && nParts==nWhole, "injInject depends on the subdomains");
+
+	free(parts);
+	free(whole);
+	pFree(pop);
+	gFreeMpi(mpiInfo);
+	iniparser_freedict(ini);
+
+	return 0;
+}
+
+/*
+ * With methods:poisson=mgBoltzSolver, the electrons (specie 0) are a fluid, and
+ * are neither allocated, loaded nor injected, whereas the ions are.
+ */
+static int testInjFluid(){
+
+	dictionary *ini = iniGetDummyPop();
+	iniparser_set(ini,"population:nSpecies","2");
+	iniparser_set(ini,"population:nAlloc","20000,20000");
+	iniparser_set(ini,"population:nParticles","6000,6000");
+	iniparser_set(ini,"population:charge","-1,1");
+	iniparser_set(ini,"population:mass","1,100");
+	iniparser_set(ini,"population:drift","0.05,0.05");
+	iniparser_set(ini,"population:thermalVelocity","0.1,0.1");
+	iniparser_set(ini,"population:boundaries","ABSORBING,PERIODIC,PERIODIC,ABSORBING,PERIODIC,PERIODIC");
+	iniparser_set(ini,"grid:trueSize","10,10,10");
+	iniparser_set(ini,"grid:boundaries","DIRICHLET,PERIODIC,PERIODIC,DIRICHLET,PERIODIC,PERIODIC");
+	iniparser_set(ini,"injection:faces","MAXWELL,NONE,NONE,NONE,NONE,NONE");
+	iniparser_set(ini,"injection:tableSize","1024");
+	iniparser_set(ini,"methods:poisson","mgBoltzSolver");
+
+	MpiInfo *mpiInfo = gAllocMpi(ini);
+	Population *pop = pAlloc(ini);
+	utAssert(pop->fluid[0] && !pop->fluid[1],
+			 "pAlloc does not make the electrons a fluid with mgBoltzSolver");
+	utAssert(pop->iStart[1]==pop->iStart[0],
+			 "pAlloc allocates %li electrons for a fluid",
+			 pop->iStart[1]-pop->iStart[0]);
+
+	pPosUniform(ini,pop,mpiInfo);
+	pVelMaxwell(ini,pop,mpiInfo);
+	utAssert(pop->iStop[0]==pop->iStart[0] && pop->iStop[1]==pop->iStart[1]+6000,
+			 "pPosUniform loads %li electrons and %li ions but expected 0 and 6000",
+			 pop->iStop[0]-pop->iStart[0], pop->iStop[1]-pop->iStart[1]);
+
+	Injector *inj = injAlloc(ini,pop,mpiInfo);
+	for(int step=0;step<5;step++) injInject(inj,pop,step);
+	utAssert(pop->iStop[0]==pop->iStart[0] && pop->iStop[1]>pop->iStart[1]+6000,
+			 "injInject injects %li electrons and %li ions but expected 0 and more",
+			 pop->iStop[0]-pop->iStart[0], pop->iStop[1]-pop->iStart[1]-6000);
+
+	injFree(inj);
+	pFree(pop);
+	gFreeMpi(mpiInfo);
+	iniparser_freedict(ini);
+
+	return 0;
+}
+
+// All tests for injection.c is contained in this function
+void testInjection(){
+	utRun(&testInjMaxwell);
+	utRun(&testInjSubdomains);
+	utRun(&testInjFluid);
+}
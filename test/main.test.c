@@ -19,6 +19,9 @@ int main(int argc, char *argv[]){
 	testPopulation();
 	testPusher();
 	testMultigrid();
+	testInjection();
+	testObject();
+	testCollision();
 	utSummary();
 
 	MPI_Finalize();
@@ -107,9 +107,113 @@ static int testmgGS(){
 // 	return 0;
 // }
 
+/*
+ * Solves for the potential of a sinusoidal ion density with Boltzmann
+ * electrons of unit density and temperature, and checks the residual of the
+ * nonlinear equation at each node. Solving again must not need any cycles.
+ */
+static int testMgBoltzSolve(){
+
+	dictionary *ini = iniGetDummyPop();
+	iniparser_set(ini,"population:nSpecies","2");
+	iniparser_set(ini,"population:nParticles","4096,4096");
+	iniparser_set(ini,"population:charge","-1,1");
+	iniparser_set(ini,"population:mass","1,1836");
+	iniparser_set(ini,"population:thermalVelocity","1,0.02");
+	iniparser_set(ini,"grid:trueSize","16,16,16");
+	iniparser_set(ini,"multigrid:cycle","mgVRecursive");
+	iniparser_set(ini,"multigrid:preSmooth","gaussSeidelRB");
+	iniparser_set(ini,"multigrid:postSmooth","gaussSeidelRB");
+	iniparser_set(ini,"multigrid:coarseSolver","gaussSeidelRB");
+	iniparser_set(ini,"multigrid:nCoarseSolve","10");
+
+	MpiInfo *mpiInfo = gAllocMpi(ini);
+	Grid *rho = gAlloc(ini,SCALAR);
+	Grid *phi = gAlloc(ini,SCALAR);
+	gCreateNeighborhood(ini,mpiInfo,rho);
+	gSetBndSlices(phi,mpiInfo);
+	MultigridSolver *solver = mgAllocBoltzSolver(ini,rho,phi);
+
+	long int *sizeProd = rho->sizeProd;
+	for(long int g=0;g<sizeProd[4];g++){
+		int j = g%sizeProd[2]-1;
+		rho->val[g] = 1+0.5*sin(2*PI*j/16);
+	}
+	gZero(phi);
+	mgBoltzSolve(solver,rho,phi,mpiInfo);
+
+	double maxRes = 0, maxPhi = 0;
+	for(int l=1;l<=16;l++) for(int k=1;k<=16;k++) for(int j=1;j<=16;j++){
+		long int g = j+k*sizeProd[2]+l*sizeProd[3];
+		double *p = &phi->val[g];
+		double lap = p[1]+p[-1]+p[sizeProd[2]]+p[-sizeProd[2]]
+				   + p[sizeProd[3]]+p[-sizeProd[3]]-6*p[0];
+		double res = fabs(lap+rho->val[g]-exp(p[0]));
+		if(res>maxRes) maxRes = res;
+		if(fabs(p[0])>maxPhi) maxPhi = fabs(p[0]);
+	}
+	utAssert(maxRes<1e-8,"mgBoltzSolve leaves a residual of %g",maxRes);
+	utAssert(maxPhi>0.1,"mgBoltzSolve gives a potential of at most %g",maxPhi);
+
+	mgBoltzSolve(solver,rho,phi,mpiInfo);
+	utAssert(solver->mgRho->nCyclesLast==0,
+			 "mgBoltzSolve runs %i cycles from a converged potential",
+			 solver->mgRho->nCyclesLast);
+
+	mgFreeSolver(solver);
+	gFree(rho);
+	gFree(phi);
+	gDestroyNeighborhood(mpiInfo);
+	gFreeMpi(mpiInfo);
+	iniparser_freedict(ini);
+
+	return 0;
+}
+
+/*
+ * Performance regression test of the Gauss-Seidel smoother on a periodic
+ * 64x64x64 grid. The work is counted as grid points per cycle.
+ */
+typedef struct{
+	Grid *phi;
+	Grid *rho;
+	MpiInfo *mpiInfo;
+	int nCycles;
+} BenchData;
+
+static void benchMgGS3D(void *data){
+	BenchData *d = (BenchData *)data;
+	mgGS3D(d->phi,d->rho,NULL,NULL,d->nCycles,d->mpiInfo);
+}
+
+static int testBenchMgGS3D(){
+
+	dictionary *ini = iniGetDummyPop();
+	iniparser_set(ini,"grid:trueSize","64,64,64");
+
+	MpiInfo *mpiInfo = gAllocMpi(ini);
+	Grid *phi = gAlloc(ini,SCALAR);
+	Grid *rho = gAlloc(ini,SCALAR);
+	gSetBndSlices(phi,mpiInfo);
+	gZero(phi);
+	gZero(rho);
+
+	BenchData data = {phi,rho,mpiInfo,10};
+	utBench("mgGS3D",benchMgGS3D,&data,64*64*64*data.nCycles);
+
+	gFree(phi);
+	gFree(rho);
+	gFreeMpi(mpiInfo);
+	iniparser_freedict(ini);
+
+	return 0;
+}
+
 // All tests for grid.c is contained in this function
 void testMultigrid(){
 	utRun(&testStructs);
 	utRun(&testmgGS);
+	utRun(&testMgBoltzSolve);
+	utRun(&testBenchMgGS3D);
 	// utRun(&testRestrictor);
 }
@@ -0,0 +1,358 @@
+/**
+ * @file		object.test.c
+ * @brief		Unit tests for object.c
+ */
+
+#include "test.h"
+#include "pinc.h"
+#include "object.h"
+#include "multigrid.h"
+#include <math.h>
+
+/*
+ * Moves one particle into a cubic object and one outside of it, and checks
+ * that only the first is marked for removal and has its charge collected.
+ * Also checks that extracting emigrants removes it without migrating it.
+ */
+static int testOMove(){
+
+	dictionary *ini = iniGetDummyPop();
+	iniparser_set(ini,"population:nAlloc","100");
+
+	MpiInfo *mpiInfo = gAllocMpi(ini);
+	Population *pop = pAlloc(ini);
+	Grid *rho = gAlloc(ini,SCALAR);
+	gCreateNeighborhood(ini,mpiInfo,rho);
+
+	// Object 1 covers the nodes 3 to 5 along each dimension
+	Object *obj = oAlloc(ini);
+	Grid *domain = obj->domain;
+	long int *sizeProd = domain->sizeProd;
+	for(int k=3;k<=5;k++) for(int j=3;j<=5;j++) for(int i=3;i<=5;i++)
+		domain->val[i*sizeProd[1]+j*sizeProd[2]+k*sizeProd[3]] = 1;
+	oMakeMask(obj,mpiInfo);
+
+	double pos[] = {2.5,3,3}, vel[] = {0.25,0,0};
+	pNew(pop,0,pos,vel);
+	adSet(pos,3,2.,3.,3.);
+	pNew(pop,0,pos,vel);
+
+	oMove(pop,obj);
+
+	utAssert(obj->nObjects==1,"oMakeMask finds %i objects but expected 1",obj->nObjects);
+	utAssert(pop->pos[0]==P_REMOVED,"oMove does not absorb particle inside object");
+	utAssert(pop->pos[3]==2.25,"oMove absorbs particle outside object");
+	utAssert(obj->charge[0]==-1,"oMove collects charge %g but expected -1",obj->charge[0]);
+
+	puExtractEmigrantsND(pop,mpiInfo);
+	long int nParticles = pop->iStop[0]-pop->iStart[0];
+	long int nEmigrants = alSum(mpiInfo->nEmigrants,mpiInfo->nNeighbors);
+	utAssert(nParticles==1 && nEmigrants==0,
+			 "puExtractEmigrantsND leaves %li particles and %li emigrants but expected 1 and 0",
+			 nParticles, nEmigrants);
+
+	oFree(obj);
+	gFree(rho);
+	pFree(pop);
+	gFreeMpi(mpiInfo);
+	iniparser_freedict(ini);
+
+	return 0;
+}
+
+/*
+ * Puts an object in the half-space x>4.5, with the signed distance field of
+ * the plane x=4.3, and checks the crossing of a particle moving from x=3.9
+ * to x=4.9 with and without the distance field. Also checks the surface.
+ */
+static int testOCrossing(){
+
+	dictionary *ini = iniGetDummyPop();
+
+	MpiInfo *mpiInfo = gAllocMpi(ini);
+	Grid *rho = gAlloc(ini,SCALAR);
+	gCreateNeighborhood(ini,mpiInfo,rho);
+
+	Object *obj = oAlloc(ini);
+	Grid *domain = obj->domain;
+	long int *sizeProd = domain->sizeProd;
+	int *size = domain->size;
+	for(long int g=0;g<sizeProd[4];g++)
+		domain->val[g] = (g/sizeProd[1])%size[1]>=5 && (g/sizeProd[1])%size[1]<=8;
+	oMakeMask(obj,mpiInfo);
+
+	long int nSurface = obj->lookupSurfaceOffset[1];
+	utAssert(nSurface==128,"oMakeMask finds %li surface nodes but expected 128",nSurface);
+
+	double pos[] = {4.9,3.2,3.7}, vel[] = {1,0,0};
+	double crossing = oCrossing(obj,pos,vel);
+	utAssert(fabs(crossing-0.6)<1e-3,
+			 "oCrossing gives %g without distance field but expected 0.6", crossing);
+
+	for(long int g=0;g<sizeProd[4];g++)
+		domain->val[g] = 4.3-(g/sizeProd[1])%size[1];
+	oMakeDistance(obj,mpiInfo);
+
+	crossing = oCrossing(obj,pos,vel);
+	utAssert(fabs(crossing-0.4)<1e-6,
+			 "oCrossing gives %g with distance field but expected 0.4", crossing);
+
+	oFree(obj);
+	gFree(rho);
+	gFreeMpi(mpiInfo);
+	iniparser_freedict(ini);
+
+	return 0;
+}
+
+/*
+ * Writes a cube from 2.3 to 5.7 as an ASCII STL-file and a cube from 8.3 to
+ * 11.7 as an ASCII VTK-file (with quadrilaterals), in units of the step size
+ * 0.5, and checks the number of nodes of each voxelized object. Two
+ * subdomains along x are used if there are two MPI nodes.
+ */
+static void writeCube(FILE *file, double lo, double hi, int stl){
+
+	// Corner c has coordinate hi along dimension d if bit d of c is set
+	static const int faces[6][4] = {{0,2,3,1},{4,5,7,6},{0,1,5,4},
+									{2,6,7,3},{0,4,6,2},{1,3,7,5}};
+
+	if(stl){
+		fprintf(file,"solid cube\n");
+		for(int f=0;f<6;f++){
+			for(int t=0;t<2;t++){
+				int corner[3] = {faces[f][0],faces[f][t+1],faces[f][t+2]};
+				fprintf(file,"facet normal 0 0 0\nouter loop\n");
+				for(int v=0;v<3;v++){
+					int c = corner[v];
+					fprintf(file,"vertex %g %g %g\n",
+							c&1 ? hi : lo, c&2 ? hi : lo, c&4 ? hi : lo);
+				}
+				fprintf(file,"endloop\nendfacet\n");
+			}
+		}
+		fprintf(file,"endsolid cube\n");
+	} else {
+		fprintf(file,"# vtk DataFile Version 3.0\ncube\nASCII\nDATASET POLYDATA\n");
+		fprintf(file,"POINTS 8 float\n");
+		for(int c=0;c<8;c++)
+			fprintf(file,"%g %g %g\n",c&1 ? hi : lo, c&2 ? hi : lo, c&4 ? hi : lo);
+		fprintf(file,"POLYGONS 6 30\n");
+		for(int f=0;f<6;f++)
+			fprintf(file,"4 %i %i %i %i\n",faces[f][0],faces[f][1],faces[f][2],faces[f][3]);
+	}
+}
+
+static int testOVoxelize(){
+
+	int mpiSize;
+	MPI_Comm_size(MPI_COMM_WORLD,&mpiSize);
+	if(mpiSize>2) return 0;
+
+	dictionary *ini = iniGetDummyPop();
+	iniparser_set(ini,"grid:nSubdomains",mpiSize==2 ? "2,1,1" : "1,1,1");
+	iniparser_set(ini,"grid:trueSize",mpiSize==2 ? "8,16,16" : "16,16,16");
+	iniparser_set(ini,"grid:stepSize","0.5,0.5,0.5");
+	iniparser_set(ini,"objects:meshes","testCube.stl,testCube.vtk");
+
+	int rank;
+	MPI_Comm_rank(MPI_COMM_WORLD,&rank);
+	if(rank==0){
+		FILE *file = fopen("testCube.stl","w");
+		writeCube(file,1.15,2.85,1);
+		fclose(file);
+		file = fopen("testCube.vtk","w");
+		writeCube(file,4.15,5.85,0);
+		fclose(file);
+	}
+	MPI_Barrier(MPI_COMM_WORLD);
+
+	MpiInfo *mpiInfo = gAllocMpi(ini);
+	Grid *rho = gAlloc(ini,SCALAR);
+	gCreateNeighborhood(ini,mpiInfo,rho);
+
+	Object *obj = oAlloc(ini);
+	oVoxelize(ini,obj,mpiInfo);
+
+	// Count the true nodes of each object
+	long int count[2] = {0,0};
+	long int *mul = obj->maskSizeProd;
+	for(int k=1;k<=16;k++) for(int j=1;j<=16;j++) for(int i=1;i<=rho->trueSize[1];i++){
+		int id = obj->mask[i*mul[1]+j*mul[2]+k*mul[3]];
+		if(id) count[id-1]++;
+	}
+	MPI_Allreduce(MPI_IN_PLACE,count,2,MPI_LONG,MPI_SUM,MPI_COMM_WORLD);
+
+	utAssert(obj->nObjects==2,"oVoxelize finds %i objects but expected 2",obj->nObjects);
+	utAssert(count[0]==27 && count[1]==27,
+			 "oVoxelize gives objects of %li and %li nodes but expected 27",
+			 count[0], count[1]);
+
+	MPI_Barrier(MPI_COMM_WORLD);
+	if(rank==0){
+		remove("testCube.stl");
+		remove("testCube.vtk");
+	}
+
+	oFree(obj);
+	gFree(rho);
+	gFreeMpi(mpiInfo);
+	iniparser_freedict(ini);
+
+	return 0;
+}
+
+/*
+ * Puts a biased and a floating cubic object in an empty, periodic domain, and
+ * checks that the potential is constant on the surface of each after
+ * oApplyCapacitance(), that it equals the bias for the first, and that the
+ * surface charge of the second equals its collected charge. This also holds
+ * after oRedistributeCapacitance().
+ */
+static int testOCapacitance(){
+
+	dictionary *ini = iniGetDummyPop();
+	iniparser_set(ini,"grid:trueSize","16,16,16");
+	iniparser_set(ini,"multigrid:cycle","mgVRecursive");
+	iniparser_set(ini,"multigrid:preSmooth","gaussSeidelRB");
+	iniparser_set(ini,"multigrid:postSmooth","gaussSeidelRB");
+	iniparser_set(ini,"multigrid:coarseSolver","gaussSeidelRB");
+	iniparser_set(ini,"multigrid:mgCycles","20");
+	iniparser_set(ini,"multigrid:nCoarseSolve","10");
+	iniparser_set(ini,"objects:bias","1,FLOAT");
+
+	MpiInfo *mpiInfo = gAllocMpi(ini);
+	Grid *rho = gAlloc(ini,SCALAR);
+	Grid *phi = gAlloc(ini,SCALAR);
+	gCreateNeighborhood(ini,mpiInfo,rho);
+	gSetBndSlices(phi,mpiInfo);
+	MultigridSolver *solver = mgAllocSolver(ini,rho,phi);
+
+	Units units;
+	units.potential = 1;
+
+	// Object 1 covers the nodes 3 to 6 and object 2 the nodes 10 to 13
+	Object *obj = oAlloc(ini);
+	Grid *domain = obj->domain;
+	long int *sizeProd = domain->sizeProd;
+	for(int o=0;o<2;o++)
+		for(int k=3;k<=6;k++) for(int j=3;j<=6;j++) for(int i=3;i<=6;i++)
+			domain->val[(i+7*o)*sizeProd[1]+j*sizeProd[2]+k*sizeProd[3]] = o+1;
+	oMakeMask(obj,mpiInfo);
+	obj->charge[1] = 2;
+
+	oComputeCapacitance(obj,ini,&units,mgSolve,solver,rho,phi,mpiInfo);
+	utAssert(obj->nCap==112,"oComputeCapacitance finds %i surface nodes but expected 112",obj->nCap);
+
+	// The second time, the surface nodes on this MPI node are in a different
+	// order, as if the subdomain had changed, and the rows must follow them
+	for(int pass=0;pass<2;pass++){
+
+		if(pass){
+			long int *first = &obj->lookupSurface[obj->lookupSurfaceOffset[0]];
+			long int *last = &obj->lookupSurface[obj->lookupSurfaceOffset[2]-1];
+			for(;first<last;first++,last--){
+				long int temp = *first;
+				*first = *last;
+				*last = temp;
+			}
+			oRedistributeCapacitance(obj,mpiInfo);
+		}
+
+		gZero(rho);
+		gZero(phi);
+		mgSolve(solver,rho,phi,mpiInfo);
+		oApplyCapacitance(obj,mgSolve,solver,rho,phi,mpiInfo);
+
+		// Charge of other nodes is the neutralizing background
+		double background = rho->val[sizeProd[1]+sizeProd[2]+sizeProd[3]];
+		double min[2] = {INFINITY,INFINITY}, max[2] = {-INFINITY,-INFINITY};
+		double surfaceCharge = 0;
+		for(int i=0;i<obj->nCapLocal;i++){
+			int o = obj->capObject[obj->capIndex[i]];
+			double value = phi->val[obj->capNode[i]];
+			if(value<min[o]) min[o] = value;
+			if(value>max[o]) max[o] = value;
+			if(o==1) surfaceCharge += rho->val[obj->capNode[i]]-background;
+		}
+		utAssert(fabs(min[0]-1)<1e-6 && fabs(max[0]-1)<1e-6,
+				 "oApplyCapacitance gives potential %g to %g on biased object but expected 1",
+				 min[0], max[0]);
+		utAssert(max[1]-min[1]<1e-6,
+				 "oApplyCapacitance gives potential %g to %g on floating object",
+				 min[1], max[1]);
+		utAssert(fabs(surfaceCharge-2)<1e-6,
+				 "oApplyCapacitance gives charge %g on floating object but expected 2",
+				 surfaceCharge);
+	}
+
+	oFree(obj);
+	mgFreeSolver(solver);
+	gFree(rho);
+	gFree(phi);
+	gFreeMpi(mpiInfo);
+	iniparser_freedict(ini);
+
+	return 0;
+}
+
+/*
+ * Performance regression test of oMove(), set up like testBenchPusher() but
+ * with a spherical object of radius 8 in the middle. Particles are placed
+ * outside of it, and their velocities are zero, such that none are absorbed and
+ * the kernel can be repeated indefinitely. Compare to puMove.
+ */
+static void benchOMove(void *data){
+	oMove(((Population **)data)[0],((Object **)data)[1]);
+}
+
+static int testBenchOMove(){
+
+	long int nParticles = 1000000;
+
+	dictionary *ini = iniGetDummyPop();
+	iniparser_set(ini,"population:nAlloc","1000000");
+	iniparser_set(ini,"grid:trueSize","32,32,32");
+
+	MpiInfo *mpiInfo = gAllocMpi(ini);
+	Population *pop = pAlloc(ini);
+	Object *obj = oAlloc(ini);
+
+	Grid *domain = obj->domain;
+	long int *sizeProd = domain->sizeProd;
+	for(int k=0;k<domain->size[3];k++)
+		for(int j=0;j<domain->size[2];j++)
+			for(int i=0;i<domain->size[1];i++){
+				double r2 = pow(i-17,2)+pow(j-17,2)+pow(k-17,2);
+				if(r2<64) domain->val[i*sizeProd[1]+j*sizeProd[2]+k*sizeProd[3]] = 1;
+			}
+	oMakeMask(obj,mpiInfo);
+
+	double posV[3], velV[] = {0,0,0};
+	for(long int i=0;pop->iStop[0]<nParticles;i++){
+		posV[0] = 1+32*fmod(i*0.6180339887498949,1);
+		posV[1] = 1+32*fmod(i*0.4142135623730950,1);
+		posV[2] = 1+32*fmod(i*0.7320508075688772,1);
+		double r2 = pow(posV[0]-17,2)+pow(posV[1]-17,2)+pow(posV[2]-17,2);
+		if(r2>=100) pNew(pop,0,posV,velV);
+	}
+
+	void *data[] = {pop,obj};
+	utBench("oMove",benchOMove,data,nParticles);
+
+	oFree(obj);
+	pFree(pop);
+	gFreeMpi(mpiInfo);
+	iniparser_freedict(ini);
+
+	return 0;
+}
+
+// All tests for object.c is contained in this function
+void testObject(){
+	utRun(&testOMove);
+	utRun(&testOCrossing);
+	utRun(&testOVoxelize);
+	utRun(&testOCapacitance);
+	utRun(&testBenchOMove);
+}
@@ -7,6 +7,7 @@
 #include "pinc.h"
 #include "test.h"
 #include <math.h>
+#include <string.h>
 
 static int testPCut(){
 
@@ -56,7 +57,230 @@ static int testPCut(){
 
 }
 
+// Dictionary of a 2D population in an 8x6 grid with one specie
+static dictionary *pPosIni(){
+
+	dictionary *ini = iniGetDummyPop();
+	iniparser_set(ini,"population:nVelDims","2");
+	iniparser_set(ini,"population:nAlloc","30000");
+	iniparser_set(ini,"population:nParticles","20000");
+	iniparser_set(ini,"population:seed","3");
+	iniparser_set(ini,"grid:nDims","2");
+	iniparser_set(ini,"grid:nSubdomains","1,1");
+	iniparser_set(ini,"grid:trueSize","8,6");
+	iniparser_set(ini,"grid:stepSize","1,1");
+	iniparser_set(ini,"grid:nGhostLayers","1,1,1,1");
+	iniparser_set(ini,"grid:thresholds","0.5,0.5,0.5,0.5");
+	return ini;
+}
+
+static int compareDouble2(const void *a, const void *b){
+	const double *x = a, *y = b;
+	if(x[0]!=y[0]) return (x[0]>y[0])-(x[0]<y[0]);
+	return (x[1]>y[1])-(x[1]<y[1]);
+}
+
+/*
+ * pPosUniform() must give exactly the same particles when the domain is split
+ * into subdomains of different sizes as when it is not.
+ */
+static int testPPosUniform(){
+
+	dictionary *ini = pPosIni();
+	MpiInfo *mpiInfo = gAllocMpi(ini);
+	Population *pop = pAlloc(ini);
+	long int n = 20000;
+
+	pPosUniform(ini,pop,mpiInfo);
+	utAssert(pop->iStop[0]-pop->iStart[0]==n,"pPosUniform generates %li "
+			 "particles but expected %li", pop->iStop[0]-pop->iStart[0], n);
+
+	double *whole = malloc(2*n*sizeof(*whole));
+	for(long int i=0;i<2*n;i++) whole[i] = pop->pos[i]+mpiInfo->offset[i%2];
+	qsort(whole,n,2*sizeof(*whole),compareDouble2);
+
+	// Pretend the x-axis is split in three subdomains, and draw each of them
+	int *edges = mpiInfo->edges[0];
+	int nSubdomains = mpiInfo->nSubdomains[0];
+	int subdomain = mpiInfo->subdomain[0];
+	int offset = mpiInfo->offset[0];
+	int split[] = {0,3,5,8};
+	mpiInfo->edges[0] = split;
+	mpiInfo->nSubdomains[0] = 3;
+
+	double *parts = malloc(2*n*sizeof(*parts));
+	long int nParts = 0;
+	int bad = 0;
+	for(int J=0;J<3;J++){
+		mpiInfo->subdomain[0] = J;
+		mpiInfo->offset[0] = split[J]-1;
+		pPosUniform(ini,pop,mpiInfo);
+		for(long int i=pop->iStart[0];i<pop->iStop[0] && nParts<n;i++){
+			double x = pop->pos[2*i]+mpiInfo->offset[0];
+			double y = pop->pos[2*i+1]+mpiInfo->offset[1];
+			if(x<split[J] || x>=split[J+1]) bad = 1;
+			parts[2*nParts] = x;
+			parts[2*nParts+1] = y;
+			nParts++;
+		}
+	}
+	qsort(parts,nParts,2*sizeof(*parts),compareDouble2);
+
+	mpiInfo->edges[0] = edges;
+	mpiInfo->nSubdomains[0] = nSubdomains;
+	mpiInfo->subdomain[0] = subdomain;
+	mpiInfo->offset[0] = offset;
+
+	utAssert(!bad,"pPosUniform generates particles outside the subdomain");
+	utAssert(nParts==n && !memcmp(parts,whole,2*n*sizeof(*parts)),
+			 "pPosUniform depends on the subdomains");
+
+	free(parts);
+	free(whole);
+	pFree(pop);
+	gFreeMpi(mpiInfo);
+	iniparser_freedict(ini);
+
+	return 0;
+}
+
+/*
+ * With a density proportional to x, the number of particles in each column of
+ * cells must be proportional to its lower x.
+ */
+static int testPPosProfile(){
+
+	dictionary *ini = pPosIni();
+	MpiInfo *mpiInfo = gAllocMpi(ini);
+	Population *pop = pAlloc(ini);
+	Grid *density = gAlloc(ini,SCALAR);
+	long int n = 20000;
+
+	for(long int p=0;p<density->sizeProd[3];p++){
+		int x = (int)((p/density->sizeProd[1])%density->size[1])-1;
+		density->val[p] = x>0 ? x : 0;
+	}
+
+	pPosProfile(ini,pop,mpiInfo,density);
+	utAssert(pop->iStop[0]-pop->iStart[0]==n,"pPosProfile generates %li "
+			 "particles but expected %li", pop->iStop[0]-pop->iStart[0], n);
+
+	long int count[8] = {0};
+	for(long int i=pop->iStart[0];i<pop->iStop[0];i++)
+		count[(int)(pop->pos[2*i]+mpiInfo->offset[0])]++;
+
+	for(int x=0;x<8;x++){
+		double expected = n*x/28.0;
+		utAssert(fabs(count[x]-expected)<=4*sqrt(expected),
+				 "pPosProfile puts %li particles at x=%i but expected %.0f",
+				 count[x], x, expected);
+	}
+
+	gFree(density);
+	pFree(pop);
+	gFreeMpi(mpiInfo);
+	iniparser_freedict(ini);
+
+	return 0;
+}
+
+/*
+ * pPosQuiet() is a low-discrepancy set, so the first and second moments of the
+ * positions and the number of particles per cell must be far closer to their
+ * expected values than the statistical errors of random particles.
+ */
+static int testPPosQuiet(){
+
+	dictionary *ini = pPosIni();
+	MpiInfo *mpiInfo = gAllocMpi(ini);
+	Population *pop = pAlloc(ini);
+	long int n = 20000;
+	int L[2] = {8,6};
+
+	pPosQuiet(ini,pop,mpiInfo);
+	utAssert(pop->iStop[0]-pop->iStart[0]==n,"pPosQuiet generates %li "
+			 "particles but expected %li", pop->iStop[0]-pop->iStart[0], n);
+
+	long int count[8][6] = {{0}};
+	double mean[2] = {0}, meanSq[2] = {0};
+	for(long int i=pop->iStart[0];i<pop->iStop[0];i++){
+		double x = pop->pos[2*i]+mpiInfo->offset[0];
+		double y = pop->pos[2*i+1]+mpiInfo->offset[1];
+		count[(int)x][(int)y]++;
+		mean[0] += x/n;
+		mean[1] += y/n;
+		meanSq[0] += x*x/n;
+		meanSq[1] += y*y/n;
+	}
+
+	// Random particles would miss by about L/sqrt(12n) and L^2/sqrt(45n)
+	for(int d=0;d<2;d++){
+		utAssert(fabs(mean[d]-L[d]/2.)<1e-3*L[d], "pPosQuiet has mean "
+				 "%f along dimension %i but expected %f", mean[d], d, L[d]/2.);
+		utAssert(fabs(meanSq[d]-L[d]*L[d]/3.)<1e-3*L[d]*L[d], "pPosQuiet has "
+				 "second moment %f along dimension %i but expected %f",
+				 meanSq[d], d, L[d]*L[d]/3.);
+	}
+
+	// Random particles would give about 20 particles more or less
+	double expected = n/48.;
+	for(int x=0;x<8;x++) for(int y=0;y<6;y++)
+		utAssert(fabs(count[x][y]-expected)<=0.02*expected, "pPosQuiet puts "
+				 "%li particles in cell (%i,%i) but expected %.0f",
+				 count[x][y], x, y, expected);
+
+	pFree(pop);
+	gFreeMpi(mpiInfo);
+	iniparser_freedict(ini);
+
+	return 0;
+}
+
+/*
+ * pVelQuiet() must give exactly the drift as the mean velocity, and a variance
+ * closer to the Maxwellian one than random velocities would.
+ */
+static int testPVelQuiet(){
+
+	dictionary *ini = pPosIni();
+	iniparser_set(ini,"population:drift","0.5");
+	iniparser_set(ini,"population:thermalVelocity","2");
+	MpiInfo *mpiInfo = gAllocMpi(ini);
+	Population *pop = pAlloc(ini);
+	long int n = 20000;
+	double drift = 0.5, velTh = 2;
+
+	pPosQuiet(ini,pop,mpiInfo);
+	pVelQuiet(ini,pop);
+
+	for(int d=0;d<2;d++){
+
+		double mean = 0, var = 0;
+		for(long int i=pop->iStart[0];i<pop->iStop[0];i++){
+			double v = pop->vel[2*i+d]-drift;
+			mean += v/n;
+			var += v*v/n;
+		}
+
+		// Random velocities would miss the variance by about 1%
+		utAssert(fabs(mean)<1e-12, "pVelQuiet has mean velocity %f along "
+				 "dimension %i but expected %f", mean+drift, d, drift);
+		utAssert(fabs(var/(velTh*velTh)-1)<3e-3, "pVelQuiet has variance %f "
+				 "along dimension %i but expected %f", var, d, velTh*velTh);
+	}
+
+	pFree(pop);
+	gFreeMpi(mpiInfo);
+	iniparser_freedict(ini);
+
+	return 0;
+}
+
 // All tests for io.c is contained in this function
 void testPopulation(){
 	utRun(&testPCut);
+	utRun(&testPPosUniform);
+	utRun(&testPPosProfile);
+	utRun(&testPPosQuiet);
+	utRun(&testPVelQuiet);
 }
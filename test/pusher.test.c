@@ -572,6 +572,502 @@ static int testPuRankNeighbor(){
 
 }
 
+/*
+ * Sorting particles by tile must keep the particles, put them in the tiles
+ * they belong to, and give the same charge density as when not sorted (then
+ * assigned by several threads). The grid is changed to test that the tiles
+ * are adapted.
+ */
+static int testPSortTiles(){
+
+	dictionary *ini = iniGetDummyPop();
+	iniparser_set(ini,"population:nSpecies","2");
+	iniparser_set(ini,"population:nAlloc","20000,20000");
+	iniparser_set(ini,"population:tileSize","2");
+	iniparser_set(ini,"population:charge","-1,1");
+	iniparser_set(ini,"population:mass","1,1");
+	iniparser_set(ini,"population:thermalVelocity","0,0");
+
+	Population *pop = pAlloc(ini);
+
+	int bad = 0;
+	const char *trueSize[] = {"9,6,4","4,7,5"};
+	for(int g=0;g<2;g++){
+
+		iniparser_set(ini,"grid:trueSize",trueSize[g]);
+		Grid *rho = gAlloc(ini,SCALAR);
+		Grid *rhoSorted = gAlloc(ini,SCALAR);
+		int *size = rho->size;
+
+		double pos[3], vel[] = {0,0,0}, posSum = 0;
+		for(int s=0;s<2;s++){
+			pop->iStop[s] = pop->iStart[s];
+			for(long int i=0;i<10000+3000*s;i++){
+				pos[0] = (size[1]-1)*fmod(i*0.6180339887498949,1);
+				pos[1] = (size[2]-1)*fmod(i*0.4142135623730950,1);
+				pos[2] = (size[3]-1)*fmod(i*0.7320508075688772,1);
+				pNew(pop,s,pos,vel);
+				posSum += pos[0]+pos[1]+pos[2];
+			}
+		}
+
+		puDistr3D1(pop,rho);
+		pSortTiles(pop,rho);
+		puDistr3D1(pop,rhoSorted);
+
+		Tiles *tiles = pop->tiles;
+		long int nTiles = tiles->nTiles;
+		utAssert(pop->sorted,"pSortTiles doesn't mark particles as sorted");
+		utAssert(nTiles==aiProd(tiles->size,3),"pSortTiles has wrong tiles");
+
+		for(int s=0;s<2;s++){
+			long int *start = &tiles->start[s*(nTiles+1)];
+			if(start[0]!=pop->iStart[s] || start[nTiles]!=pop->iStop[s]) bad = 1;
+			for(long int n=0;n<nTiles;n++){
+				for(long int i=start[n];i<start[n+1];i++){
+					long int rowMajor = 0;
+					for(int d=0;d<3;d++){
+						posSum -= pop->pos[3*i+d];
+						rowMajor += (long int)pop->pos[3*i+d]/2*tiles->sizeProd[d];
+					}
+					if(tiles->order[rowMajor]!=n) bad = 1;
+				}
+			}
+		}
+		utAssert(!bad,"pSortTiles doesn't put particles in their tiles");
+		utAssert(fabs(posSum)<1e-3,"pSortTiles doesn't keep the particles");
+
+		for(long int p=0;p<rho->sizeProd[4];p++)
+			if(fabs(rho->val[p]-rhoSorted->val[p])>1e-10) bad = 1;
+		utAssert(!bad,"puDistr3D1 is wrong for sorted particles");
+
+		gFree(rho);
+		gFree(rhoSorted);
+	}
+
+	pFree(pop);
+	iniparser_freedict(ini);
+
+	return 0;
+}
+
+/*
+ * Delta-f particles must deposit their weight times their charge, keep their
+ * weights when sorted, and in a constant field get weights such that 1-weight
+ * changes as the Maxwellian background along the orbit.
+ */
+static int testPuDeltaF(){
+
+	dictionary *ini = iniGetDummyPop();
+	iniparser_set(ini,"population:deltaF","1");
+	iniparser_set(ini,"population:tileSize","2");
+	iniparser_set(ini,"population:charge","-2");
+	iniparser_set(ini,"population:thermalVelocity","0.1");
+	iniparser_set(ini,"population:drift","0.05");
+	iniparser_set(ini,"grid:trueSize","4,4,4");
+	iniparser_set(ini,"fields:EExt","0,0,0");
+	iniparser_set(ini,"fields:BExt","0.1,-0.2,0.3");
+	iniparser_set(ini,"fields:extProfile","CONSTANT");
+	iniparser_set(ini,"fields:extWaveVector","0,0,0");
+
+	Population *pop = pAlloc(ini);
+	Grid *rho = gAlloc(ini,SCALAR);
+	Grid *E = gAlloc(ini,VECTOR);
+
+	long int n = 1000;
+	double pos[3], vel[3], weightSum = 0, momentSum = 0;
+	for(long int i=0;i<n;i++){
+		pos[0] = 1+4*fmod(i*0.6180339887498949,1);
+		pos[1] = 1+4*fmod(i*0.4142135623730950,1);
+		pos[2] = 1+4*fmod(i*0.7320508075688772,1);
+		for(int d=0;d<3;d++) vel[d] = 0.1*sin(3*i+d);
+		pNew(pop,0,pos,vel);
+		pop->weight[i] = 0.1*cos(i);
+		weightSum += pop->weight[i];
+		momentSum += pop->weight[i]*(pos[0]+2*pos[1]+3*vel[2]);
+	}
+
+	pSortTiles(pop,rho);
+	for(long int i=0;i<n;i++)
+		momentSum -= pop->weight[i]*(pop->pos[3*i]+2*pop->pos[3*i+1]+3*pop->vel[3*i+2]);
+	utAssert(fabs(momentSum)<1e-10,"pSortTiles doesn't keep the delta-f weights");
+
+	puDistr3D1(pop,rho);
+	double rhoSum = 0;
+	for(long int p=0;p<rho->sizeProd[4];p++) rhoSum += rho->val[p];
+	utAssert(fabs(rhoSum+2*weightSum)<1e-10,"puDistr3D1 doesn't deposit delta-f weights");
+
+	double dv[] = {0.01,-0.02,0.005};
+	for(long int p=0;p<E->sizeProd[4];p++) E->val[p] = -0.5*dv[p%3];
+
+	double *velOld = malloc(3*n*sizeof(*velOld));
+	double *weightOld = malloc(n*sizeof(*weightOld));
+	for(long int i=0;i<n;i++){
+		for(int d=0;d<3;d++) velOld[3*i+d] = pop->vel[3*i+d];
+		weightOld[i] = pop->weight[i];
+	}
+
+	puAcc3D1KE(pop,E);
+
+	int bad = 0;
+	double energy = 0;
+	for(long int i=0;i<n;i++){
+		double exponent = 0, velSquared = 0;
+		for(int d=0;d<3;d++){
+			double u = velOld[3*i+d]-0.05, v = pop->vel[3*i+d]-0.05;
+			exponent += (v*v-u*u)/(2*0.01);
+			velSquared += velOld[3*i+d]*pop->vel[3*i+d];
+		}
+		double expected = 1-(1-weightOld[i])*exp(-exponent);
+		if(fabs(pop->weight[i]-expected)>1e-12) bad = 1;
+		energy += 0.5*(weightOld[i]+pop->weight[i])*velSquared;
+	}
+	utAssert(!bad,"puAcc3D1KE evolves delta-f weights wrongly");
+	utAssert(fabs(pop->kinEnergy[0]-0.5*energy)<1e-12,
+			 "puAcc3D1KE gives wrong delta-f kinetic energy");
+
+	// The Boris rotation also changes the weights, since the drift is not along B
+	MpiInfo *mpiInfo = gAllocMpi(ini);
+	pop->ext = puAllocExternal(ini,mpiInfo);
+
+	for(long int i=0;i<n;i++){
+		for(int d=0;d<3;d++) velOld[3*i+d] = pop->vel[3*i+d];
+		weightOld[i] = pop->weight[i];
+	}
+
+	puBoris3D1KE(pop,E);
+
+	bad = 0;
+	energy = 0;
+	for(long int i=0;i<n;i++){
+		double exponent = 0, velSquared = 0;
+		for(int d=0;d<3;d++){
+			double u = velOld[3*i+d]-0.05, v = pop->vel[3*i+d]-0.05;
+			double vPlus = pop->vel[3*i+d]-0.5*dv[d];
+			exponent += (v*v-u*u)/(2*0.01);
+			velSquared += vPlus*vPlus;
+		}
+		double expected = 1-(1-weightOld[i])*exp(-exponent);
+		if(fabs(pop->weight[i]-expected)>1e-12) bad = 1;
+		energy += 0.5*(weightOld[i]+pop->weight[i])*velSquared;
+	}
+	utAssert(!bad,"puBoris3D1KE evolves delta-f weights wrongly");
+	utAssert(fabs(pop->kinEnergy[0]-0.5*energy)<1e-12,
+			 "puBoris3D1KE gives wrong delta-f kinetic energy");
+
+	puFreeExternal(pop->ext);
+	free(velOld);
+	free(weightOld);
+	gFree(E);
+	gFree(rho);
+	pFree(pop);
+	gFreeMpi(mpiInfo);
+	iniparser_freedict(ini);
+
+	return 0;
+}
+
+/*
+ * Delta-f particles absorbed at the walls must count by their weights in the
+ * absorbed number of particles and kinetic energy.
+ */
+static int testPuAbsorbDeltaF(){
+
+	dictionary *ini = iniGetDummyPop();
+	iniparser_set(ini,"population:deltaF","1");
+	iniparser_set(ini,"population:mass","2");
+	iniparser_set(ini,"population:thermalVelocity","0.1");
+	iniparser_set(ini,"population:boundaries","ABSORBING,PERIODIC,PERIODIC,ABSORBING,PERIODIC,PERIODIC");
+	iniparser_set(ini,"grid:boundaries","DIRICHLET,PERIODIC,PERIODIC,DIRICHLET,PERIODIC,PERIODIC");
+
+	Population *pop = pAlloc(ini);
+	Grid *grid = gAlloc(ini,SCALAR);
+	MpiInfo *mpiInfo = gAllocMpi(ini);
+	gCreateNeighborhood(ini,mpiInfo,grid);
+
+	// One particle beyond each wall along x, and one inside
+	double pos[3][3] = {{0.5,5,5},{9.5,5,5},{5,5,5}};
+	double vel[3][3] = {{-0.1,0.2,0},{0.3,0,0},{0.1,0,0}};
+	double weight[3] = {0.25,-0.5,0.75};
+	for(int i=0;i<3;i++){
+		pNew(pop,0,pos[i],vel[i]);
+		pop->weight[i] = weight[i];
+	}
+
+	puExtractEmigrantsND(pop,mpiInfo);
+
+	double absorbed = 0.25-0.5;
+	double energy = 0.25*(0.01+0.04)-0.5*0.09;
+	utAssert(pop->iStop[0]-pop->iStart[0]==1,"puExtractEmigrantsND doesn't absorb");
+	utAssert(fabs(pop->absorbed[0]-absorbed)<1e-12,"puExtractEmigrantsND counts "
+			 "%g absorbed particles but expected %g", pop->absorbed[0], absorbed);
+	utAssert(fabs(pop->absorbedEnergy[0]-energy)<1e-12,"puExtractEmigrantsND "
+			 "counts %g absorbed energy but expected %g", pop->absorbedEnergy[0], energy);
+
+	gFree(grid);
+	pFree(pop);
+	gDestroyNeighborhood(mpiInfo);
+	gFreeMpi(mpiInfo);
+	iniparser_freedict(ini);
+
+	return 0;
+}
+
+/*
+ * A 2D3V particle in a constant E along x and B along x must accelerate
+ * uniformly along x, while its velocity in the y-z plane gyrates by the Boris
+ * angle 2*atan(|T|) per time step out of the plane of the grid. Half of E is
+ * on the grid and half of it is external.
+ */
+static int testPuBoris2D1(){
+
+	dictionary *ini = iniGetDummyPop();
+	iniparser_set(ini,"population:nAlloc","10");
+	iniparser_set(ini,"population:charge","-2");
+	iniparser_set(ini,"grid:nDims","2");
+	iniparser_set(ini,"grid:nSubdomains","1,1");
+	iniparser_set(ini,"grid:trueSize","4,4");
+	iniparser_set(ini,"grid:nGhostLayers","1,1,1,1");
+	iniparser_set(ini,"fields:EExt","0.0005,0,0");
+	iniparser_set(ini,"fields:BExt","0.2,0,0");
+	iniparser_set(ini,"fields:extProfile","CONSTANT");
+	iniparser_set(ini,"fields:extWaveVector","0,0");
+
+	MpiInfo *mpiInfo = gAllocMpi(ini);
+	Population *pop = pAlloc(ini);
+	Grid *E = gAlloc(ini,VECTOR);
+	pop->ext = puAllocExternal(ini,mpiInfo);
+
+	double pos[] = {2.3,1.6}, vel[] = {0,0.1,0};
+	pNew(pop,0,pos,vel);
+	for(long int p=0;p<E->sizeProd[3];p++) E->val[p] = p%2 ? 0 : 0.0005;
+
+	int nSteps = 10;
+	for(int n=0;n<nSteps;n++) puBoris2D1(pop,E);
+
+	double angle = nSteps*2*atan(0.2);
+	double *v = pop->vel;
+	utAssert(fabs(v[0]+nSteps*0.002)<1e-12 &&
+			 fabs(v[1]-0.1*cos(angle))<1e-12 &&
+			 fabs(v[2]-0.1*sin(angle))<1e-12,
+			 "puBoris2D1 gives velocity (%g,%g,%g)", v[0], v[1], v[2]);
+
+	puFreeExternal(pop->ext);
+	gFree(E);
+	pFree(pop);
+	gFreeMpi(mpiInfo);
+	iniparser_freedict(ini);
+
+	return 0;
+}
+
+/*
+ * Particles at rest in a cosine-shaped external E must be accelerated by the
+ * field at their global position, and by half of it when the external fields
+ * are computed for half a time step.
+ */
+static int testPuExternal(){
+
+	dictionary *ini = iniGetDummyPop();
+	iniparser_set(ini,"population:nAlloc","100");
+	iniparser_set(ini,"population:charge","-2");
+	iniparser_set(ini,"grid:trueSize","4,4,4");
+	iniparser_set(ini,"fields:EExt","0.01,0,-0.02");
+	iniparser_set(ini,"fields:BExt","0,0,0");
+	iniparser_set(ini,"fields:extProfile","COSINE");
+	iniparser_set(ini,"fields:extWaveVector","0.5,0,0.25");
+
+	MpiInfo *mpiInfo = gAllocMpi(ini);
+	Population *pop = pAlloc(ini);
+	Grid *E = gAlloc(ini,VECTOR);
+	gZero(E);
+	pop->ext = puAllocExternal(ini,mpiInfo);
+
+	long int n = 100;
+	double pos[3], vel[] = {0,0,0};
+	for(long int i=0;i<n;i++){
+		for(int d=0;d<3;d++) pos[d] = 1+4*fmod(i*(0.618+0.1*d),1);
+		pNew(pop,0,pos,vel);
+	}
+
+	puExternalStep(pop->ext,0.5);
+	puAcc3D1(pop,E);
+	puExternalStep(pop->ext,1);
+
+	int bad = 0;
+	const int *offset = mpiInfo->offset;
+	for(long int i=0;i<n;i++){
+		double *x = &pop->pos[3*i];
+		double f = cos(0.5*(x[0]+offset[0])+0.25*(x[2]+offset[2]));
+		double expected[] = {-0.01*f,0,0.02*f};
+		for(int d=0;d<3;d++)
+			if(fabs(pop->vel[3*i+d]-expected[d])>1e-14) bad = 1;
+	}
+	utAssert(!bad,"puAcc3D1 applies the external E-field wrongly");
+
+	puFreeExternal(pop->ext);
+	gFree(E);
+	pFree(pop);
+	gFreeMpi(mpiInfo);
+	iniparser_freedict(ini);
+
+	return 0;
+}
+
+/*
+ * With a linear profile the external fields scale with 1+k*x at the global
+ * position of each particle. puBoris3D1 must then rotate a particle in a B
+ * along z by the angle 2*atan(|T|) of its own position, and puAcc2D1 must also
+ * accelerate the out-of-plane velocity of 2D3V particles by EExt.
+ */
+static int testPuExternalLinear(){
+
+	dictionary *ini = iniGetDummyPop();
+	iniparser_set(ini,"population:nAlloc","100");
+	iniparser_set(ini,"population:charge","-2");
+	iniparser_set(ini,"grid:trueSize","4,4,4");
+	iniparser_set(ini,"fields:EExt","0,0,0");
+	iniparser_set(ini,"fields:BExt","0,0,0.2");
+	iniparser_set(ini,"fields:extProfile","LINEAR");
+	iniparser_set(ini,"fields:extWaveVector","0.05,0.02,0");
+
+	MpiInfo *mpiInfo = gAllocMpi(ini);
+	Population *pop = pAlloc(ini);
+	Grid *E = gAlloc(ini,VECTOR);
+	gZero(E);
+	pop->ext = puAllocExternal(ini,mpiInfo);
+
+	long int n = 100;
+	double pos[3], vel[] = {0.1,0,0};
+	for(long int i=0;i<n;i++){
+		for(int d=0;d<3;d++) pos[d] = 1+4*fmod(i*(0.618+0.1*d),1);
+		pNew(pop,0,pos,vel);
+	}
+
+	puBoris3D1(pop,E);
+
+	int bad = 0;
+	const int *offset = mpiInfo->offset;
+	for(long int i=0;i<n;i++){
+		double *x = &pop->pos[3*i];
+		double f = 1+0.05*(x[0]+offset[0])+0.02*(x[1]+offset[1]);
+		double angle = 2*atan(0.2*f);
+		double expected[] = {0.1*cos(angle),0.1*sin(angle),0};
+		for(int d=0;d<3;d++)
+			if(fabs(pop->vel[3*i+d]-expected[d])>1e-14) bad = 1;
+	}
+	utAssert(!bad,"puBoris3D1 rotates by the external B-field wrongly");
+
+	puFreeExternal(pop->ext);
+	gFree(E);
+	pFree(pop);
+	gFreeMpi(mpiInfo);
+
+	iniparser_set(ini,"population:nVelDims","3");
+	iniparser_set(ini,"grid:nDims","2");
+	iniparser_set(ini,"grid:nSubdomains","1,1");
+	iniparser_set(ini,"grid:trueSize","4,4");
+	iniparser_set(ini,"grid:nGhostLayers","1,1,1,1");
+	iniparser_set(ini,"fields:EExt","0.01,0,-0.02");
+	iniparser_set(ini,"fields:BExt","0,0,0");
+	iniparser_set(ini,"fields:extWaveVector","0.05,0.02");
+
+	mpiInfo = gAllocMpi(ini);
+	pop = pAlloc(ini);
+	E = gAlloc(ini,VECTOR);
+	gZero(E);
+	pop->ext = puAllocExternal(ini,mpiInfo);
+
+	vel[0] = 0;
+	for(long int i=0;i<n;i++){
+		for(int d=0;d<2;d++) pos[d] = 1+4*fmod(i*(0.618+0.1*d),1);
+		pNew(pop,0,pos,vel);
+	}
+
+	puAcc2D1(pop,E);
+
+	bad = 0;
+	offset = mpiInfo->offset;
+	for(long int i=0;i<n;i++){
+		double *x = &pop->pos[2*i];
+		double f = 1+0.05*(x[0]+offset[0])+0.02*(x[1]+offset[1]);
+		double expected[] = {-0.02*f,0,0.04*f};
+		for(int d=0;d<3;d++)
+			if(fabs(pop->vel[3*i+d]-expected[d])>1e-14) bad = 1;
+	}
+	utAssert(!bad,"puAcc2D1 applies the external E-field wrongly in 2D3V");
+
+	puFreeExternal(pop->ext);
+	gFree(E);
+	pFree(pop);
+	gFreeMpi(mpiInfo);
+	iniparser_freedict(ini);
+
+	return 0;
+}
+
+/*
+ * Performance regression tests of the particle kernels. A single specie is
+ * scattered quasi-randomly on a periodic 32x32x32 grid. puMove is benchmarked
+ * while velocities are still zero, and E is weak, such that the particles stay
+ * in place and the kernels can be repeated indefinitely.
+ */
+typedef struct{
+	Population *pop;
+	Grid *E;
+	Grid *rho;
+} BenchData;
+
+static void benchPuMove(void *data){
+	puMove(((BenchData *)data)->pop);
+}
+
+static void benchPuAcc3D1(void *data){
+	puAcc3D1(((BenchData *)data)->pop,((BenchData *)data)->E);
+}
+
+static void benchPuDistr3D1(void *data){
+	puDistr3D1(((BenchData *)data)->pop,((BenchData *)data)->rho);
+}
+
+static int testBenchPusher(){
+
+	long int nParticles = 1000000;
+
+	dictionary *ini = iniGetDummyPop();
+	iniparser_set(ini,"population:nAlloc","1000000");
+	iniparser_set(ini,"grid:trueSize","32,32,32");
+
+	Population *pop = pAlloc(ini);
+	Grid *E = gAlloc(ini,VECTOR);
+	Grid *rho = gAlloc(ini,SCALAR);
+
+	double val[] = {1e-3,0,0};
+	gSet(E,val);
+
+	// Low-discrepancy positions in [1,33) avoid a too cache-friendly order
+	double posV[3], velV[] = {0,0,0};
+	for(long int i=0;i<nParticles;i++){
+		posV[0] = 1+32*fmod(i*0.6180339887498949,1);
+		posV[1] = 1+32*fmod(i*0.4142135623730950,1);
+		posV[2] = 1+32*fmod(i*0.7320508075688772,1);
+		pNew(pop,0,posV,velV);
+	}
+
+	BenchData data = {pop,E,rho};
+
+	utBench("puMove",benchPuMove,&data,nParticles);
+	utBench("puAcc3D1",benchPuAcc3D1,&data,nParticles);
+	utBench("puDistr3D1",benchPuDistr3D1,&data,nParticles);
+
+	pFree(pop);
+	gFree(E);
+	gFree(rho);
+	iniparser_freedict(ini);
+
+	return 0;
+}
+
 // All tests for pusher.c is contained in this function
 void testPusher(){
 	utRun(&testPuAcc3D1);
@@ -581,4 +1077,11 @@ void testPusher(){
 	utRun(&testPuBndIdMigrantsXD);
 	utRun(&testExtractEmigrantsXD);
 	utRun(&testPuRankNeighbor);
+	utRun(&testPSortTiles);
+	utRun(&testPuDeltaF);
+	utRun(&testPuAbsorbDeltaF);
+	utRun(&testPuBoris2D1);
+	utRun(&testPuExternal);
+	utRun(&testPuExternalLinear);
+	utRun(&testBenchPusher);
 }
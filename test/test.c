@@ -29,6 +29,92 @@ int utAssertInner(const char *file, const char *func, int line, int test, const
 	}
 }
 
+static int compareDouble(const void *a, const void *b){
+	double diff = *(const double *)a - *(const double *)b;
+	return (diff>0) - (diff<0);
+}
+
+int utBenchInner(const char *file, const char *func, int line, const char *name,
+	void (*kernel)(void *), void *data, double work){
+
+	// Load settings
+	dictionary *ini = iniGetDummy();
+	int nWarmUp = iniparser_getint(ini,"bench:nWarmUp",3);
+	int nRepetitions = iniparser_getint(ini,"bench:nRepetitions",11);
+	double tolerance = iniparser_getdouble(ini,"bench:tolerance",0.25);
+	int refresh = iniparser_getint(ini,"bench:refresh",0);
+	char *fName = iniparser_getstring(ini,"bench:baselines","test/benchmarks.ini");
+
+	// Run benchmark
+	for(int i=0;i<nWarmUp;i++) kernel(data);
+
+	double *time = malloc(nRepetitions*sizeof(*time));
+	for(int i=0;i<nRepetitions;i++){
+		unsigned long long int start = getNanoSec();
+		kernel(data);
+		time[i] = (double)(getNanoSec()-start)/1e9;
+	}
+
+	qsort(time,nRepetitions,sizeof(*time),compareDouble);
+	double median = time[nRepetitions/2];
+	double throughput = work/median;
+	free(time);
+
+	// Compare to baseline
+	char key[BUFFSIZE];
+	snprintf(key,BUFFSIZE,"baselines:%s",name);
+
+	dictionary *baselines = NULL;
+	FILE *f = fopen(fName,"r");
+	if(f!=NULL){
+		fclose(f);
+		baselines = iniparser_load(fName);
+	}
+	if(baselines==NULL){
+		baselines = dictionary_new(0);
+		iniparser_set(baselines,"baselines",NULL);
+	}
+	double baseline = iniparser_getdouble(baselines,key,0);
+
+	int fail = 0;
+	if(refresh){
+
+		char value[BUFFSIZE];
+		snprintf(value,BUFFSIZE,"%.4e",throughput);
+		iniparser_set(baselines,key,value);
+
+		f = fopen(fName,"w");
+		if(f==NULL){
+			fprintf(stderr,"%s:%i %s: could not write %s\n",file,line,func,fName);
+			fail = 1;
+		} else {
+			fprintf(f,";\n; Baselines for performance regression tests (work per second).\n");
+			fprintf(f,"; Machine-specific. Generated by utBench() with bench:refresh=1.\n;\n");
+			iniparser_dump_ini(baselines,f);
+			fclose(f);
+		}
+		printf("BENCH: %-20s %10.4e /s (new baseline)\n",name,throughput);
+
+	} else if(baseline==0){
+
+		printf("BENCH: %-20s %10.4e /s (no baseline)\n",name,throughput);
+
+	} else {
+
+		printf("BENCH: %-20s %10.4e /s (%+5.1f%% of baseline)\n",
+			name,throughput,100*(throughput/baseline-1));
+
+		fail = utAssertInner(file,func,line,throughput>=(1-tolerance)*baseline,
+			"%s regressed: %.4e/s is below baseline %.4e/s by more than %g%%",
+			name,throughput,baseline,100*tolerance);
+	}
+
+	iniparser_freedict(baselines);
+	iniparser_freedict(ini);
+
+	return fail;
+}
+
 void utRun(int (*fun)()){
 
 	static int nTrials = 0;
@@ -67,3 +153,30 @@ dictionary *iniSetDummy(int argc, char **argv){
 dictionary *iniGetDummy(){
 	return iniSetDummy(0,0);
 }
+
+dictionary *iniGetDummyPop(){
+
+	dictionary *ini = iniGetDummy();
+	iniparser_set(ini,"population:nSpecies","1");
+	iniparser_set(ini,"population:deltaF","0");
+	iniparser_set(ini,"population:nVelDims","3");
+	iniparser_set(ini,"population:nAlloc","1000");
+	iniparser_set(ini,"population:nParticles","1000");
+	iniparser_set(ini,"population:tileSize","0");
+	iniparser_set(ini,"population:charge","-1");
+	iniparser_set(ini,"population:mass","1");
+	iniparser_set(ini,"population:drift","0");
+	iniparser_set(ini,"population:thermalVelocity","0");
+	iniparser_set(ini,"population:seed","1");
+	iniparser_set(ini,"population:boundaries","PERIODIC");
+	iniparser_set(ini,"grid:nDims","3");
+	iniparser_set(ini,"grid:nSubdomains","1,1,1");
+	iniparser_set(ini,"grid:trueSize","8,8,8");
+	iniparser_set(ini,"grid:stepSize","1,1,1");
+	iniparser_set(ini,"grid:nGhostLayers","1,1,1,1,1,1");
+	iniparser_set(ini,"grid:thresholds","0.5,0.5,0.5,0.5,0.5,0.5");
+	iniparser_set(ini,"grid:boundaries","PERIODIC");
+	iniparser_set(ini,"grid:nEmigrantsAlloc","10");
+	iniparser_set(ini,"methods:poisson","mgSolver");
+	return ini;
+}
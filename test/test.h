@@ -85,9 +85,72 @@ int utAssertInner(const char *file, const char *func, int line, int test, const
  */
 void utRun(int (*fun)());
 
+/**
+ * @brief Tests that a kernel is not slower than its recorded baseline.
+ * @param	name		Name of benchmark (key in baseline file)
+ * @param	kernel		Function to benchmark. Called as kernel(data).
+ * @param	data		Pointer passed on to kernel
+ * @param	work		Amount of work per call (e.g. number of particles)
+ *
+ * Performance regression test. The kernel is first called bench:nWarmUp times
+ * to warm up caches and page in memory, and then timed bench:nRepetitions
+ * times. The throughput (work per second) of the median run is compared to the
+ * baseline stored in the [baselines] section of the file bench:baselines, and
+ * the test fails if it is more than bench:tolerance (relative) below it. All
+ * bench:* keys are read from the unit test input file.
+ *
+ * Baselines are machine-specific, and the baseline file is therefore not part
+ * of the repository. To record them, set bench:refresh=1 and run the unit
+ * tests once on the host. The measured throughputs then overwrites those in
+ * the baseline file. A benchmark without a baseline only prints its
+ * throughput, such that the tests pass on hosts which have not recorded any.
+ *
+ * Like utAssert() this macro makes the test function return 1 on failure. The
+ * kernel must leave data in a state where it can be called again. Example:
+ *
+ * @code
+ *	static void benchMove(void *pop){
+ *		puMove((Population *)pop);
+ *	}
+ *
+ *	static int testBenchMove(){
+ *		...
+ *		utBench("puMove", benchMove, pop, nParticles);
+ *		return 0;
+ *	}
+ * @endcode
+ */
+#define utBench(...) do { int fail = utBenchInner(__FILE__,__func__,__LINE__,__VA_ARGS__); if(fail) return 1; } while (0)
+
+/**
+ * @brief Performance regression test. Call indirectly using utBench() macro.
+ * @param	file	Name of file where benchmark is (passed by macro)
+ * @param	func	Name of function where benchmark is (passed by macro)
+ * @param	line	Line number where benchmark is (passed by macro)
+ * @param	name	See utBench()
+ * @param	kernel	See utBench()
+ * @param	data	See utBench()
+ * @param	work	See utBench()
+ * @return			0 if successful, 1 if failure
+ * @see utBench()
+ */
+int utBenchInner(const char *file, const char *func, int line, const char *name,
+	void (*kernel)(void *), void *data, double work);
+
 dictionary *iniGetDummy();
 dictionary *iniSetDummy(int argc,char **argv);
 
+/**
+ * @brief	Dummy input file with a population and a grid
+ * @return	Dictionary
+ *
+ * Like iniGetDummy(), but with the population:* and grid:* keys needed by
+ * pAlloc(), gAllocMpi() and gAlloc() set to one specie at rest in a periodic
+ * 8x8x8 grid with one ghost layer. Tests override the keys they depend on
+ * using iniparser_set(), and free it using iniparser_freedict().
+ */
+dictionary *iniGetDummyPop();
+
 /**
  * @brief	Prints a summary of the tests
  * @return	void
@@ -143,4 +206,28 @@ void testPusher();
  */
 void testMultigrid();
 
+/**
+ * @brief	Performs all tests in injection.test.c
+ * @return	void
+ *
+ * This prevents many small global test functions.
+ */
+void testInjection();
+
+/**
+ * @brief	Performs all tests in object.test.c
+ * @return	void
+ *
+ * This prevents many small global test functions.
+ */
+void testObject();
+
+/**
+ * @brief	Performs all tests in collision.test.c
+ * @return	void
+ *
+ * This prevents many small global test functions.
+ */
+void testCollision();
+
 #endif // TEST_H